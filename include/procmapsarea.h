@@ -55,7 +55,6 @@
 typedef char *VA;  /* VA = virtual address */
 
 typedef enum ProcMapsAreaProperties {
-  DMTCP_ZERO_PAGE = 0x0001,
   DMTCP_SKIP_WRITING_TEXT_SEGMENTS = 0x0002
 } ProcMapsAreaProperties;
 
@@ -106,4 +105,96 @@ typedef union ProcMapsArea {
 } ProcMapsArea;
 
 typedef ProcMapsArea Area;
+
+/* Bits of the entries of /proc/self/pagemap.  See Documentation/vm/pagemap.txt
+ * in the Linux sources.
+ */
+#define PM_SOFT_DIRTY      (1ULL << 55)
+#define PM_FILE            (1ULL << 61)
+#define PM_SWAP            (1ULL << 62)
+#define PM_PRESENT         (1ULL << 63)
+
+/* On-disk record of a memory area in the checkpoint image.
+ *
+ * The fixed MtcpAreaRecord is followed by the name of the area (NUL
+ * terminated, padded to 8 bytes) and by the list of its runs.  Each run
+ * covers a page-aligned range of the area, in order, and has its type in
+ * the low bits.  The data of the DATA and DEDUP runs follows the record, in
+ * the order of the runs.  A record with size (uint64_t)-1 ends the list of
+ * memory areas.
+ */
+#define MTCP_AREA_MAGIC    0x41455241  /* "AREA" */
+#define MTCP_AREA_VERSION  3
+#define MTCP_AREA_MAX_RUNS 512
+
+typedef enum MtcpAreaRunType {
+  MTCP_AREA_RUN_DATA = 0,    // The contents follow in the image.
+  MTCP_AREA_RUN_ZERO = 1,    // All zeroes; nothing in the image.
+
+  // Incremental image: the contents are in the parent image.
+  MTCP_AREA_RUN_PARENT = 2,
+
+  // A CkptDedupRef per chunk follows in the image; see src/ckptdedup.h.
+  MTCP_AREA_RUN_DEDUP = 3,
+
+  // Pages of a private file mapping that were never written to; they are
+  // mapped from the file again (DMTCP_SKIP_UNMODIFIED_FILE_PAGES), if it is
+  // still the file described by the file* fields of the record.
+  MTCP_AREA_RUN_FILE = 4
+} MtcpAreaRunType;
+
+typedef uint64_t MtcpAreaRun;
+
+#define MTCP_AREA_RUN(type, len) ((MtcpAreaRun)(len) | (type))
+#define MTCP_AREA_RUN_TYPE(run)  ((int)((run) & MTCP_PAGE_OFFSET_MASK))
+#define MTCP_AREA_RUN_LEN(run)   ((size_t)((run) & MTCP_PAGE_MASK))
+
+typedef struct MtcpAreaRecord {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t nameLen;     // Without the terminating NUL.
+  uint32_t numRuns;
+  uint32_t recordLen;   // Including the name, the runs, and any padding.
+  uint64_t addr;
+  uint64_t size;
+  uint64_t offset;
+  int32_t prot;
+  int32_t flags;
+  uint64_t devmajor;
+  uint64_t devminor;
+  uint64_t inodenum;
+  uint64_t properties;
+
+  // The stat() of the file that was mapped, if the record has FILE runs.
+  uint64_t fileDev;
+  uint64_t fileInode;
+  uint64_t fileSize;
+  uint64_t fileMtimeSec;
+  uint64_t fileMtimeNsec;
+} MtcpAreaRecord;
+
+#define MTCP_AREA_NAME_SPACE(nameLen) (((nameLen) + 8) & ~7)
+
+/* A record may be padded with up to a page of zeroes, so that the data that
+ * follows it starts at a page-aligned offset in the image (see
+ * MTCP_IMAGE_PAGE_ALIGNED); recordLen includes the padding.
+ */
+typedef union MtcpAreaRecordBuf {
+  MtcpAreaRecord rec;
+  char _buf[sizeof(MtcpAreaRecord) + FILENAMESIZE +
+            MTCP_AREA_MAX_RUNS * sizeof(MtcpAreaRun) + MTCP_PAGE_SIZE];
+} MtcpAreaRecordBuf;
+
+static inline char *
+mtcp_area_name(MtcpAreaRecord *rec)
+{
+  return (char *)(rec + 1);
+}
+
+static inline MtcpAreaRun *
+mtcp_area_runs(MtcpAreaRecord *rec)
+{
+  return (MtcpAreaRun *)(mtcp_area_name(rec) +
+                         MTCP_AREA_NAME_SPACE(rec->nameLen));
+}
 #endif // ifndef PROCMAPSAREA_H
@@ -44,6 +44,8 @@ enum ProtectedFds {
   PROTECTED_ENVIRON_FD,
   PROTECTED_NS_FD,
   PROTECTED_DEBUG_SOCKET_FD,
+  PROTECTED_LAZY_RESTART_FD,
+  PROTECTED_BARRIER_RELAY_FD,
   PROTECTED_FD_END
 };
 
@@ -39,6 +39,7 @@
 #define MAX_PTRACE_ID_MAPS       256
 #define MAX_INCOMING_CONNECTIONS 10240
 #define MAX_INODE_PID_MAPS       10240
+#define MAX_NODE_BARRIER_PEERS   1024
 #define CON_ID_LEN \
   (sizeof(DmtcpUniqueProcessId) + sizeof(int64_t))
 
@@ -104,6 +105,11 @@ struct BarrierInfo {
 
   // Posix Barrier
   pthread_barrier_t barrier;
+
+  // Global barriers met per node (see CoordinatorAPI::waitForBarrier).
+  uint32_t nodeNumIn;
+  uint32_t nodeRound;
+  uint32_t nodeKilled;
 };
 
 typedef enum {
@@ -151,6 +157,7 @@ struct Header {
   struct PtyNameMap ptyNameMap[MAX_PTY_NAME_MAPS];
   struct IncomingConMap incomingConMap[MAX_INCOMING_CONNECTIONS];
   InodeConnIdMap inodeConnIdMap[MAX_INODE_PID_MAPS];
+  DmtcpUniqueProcessId nodeBarrierPeers[MAX_NODE_BARRIER_PEERS];
 
   char versionStr[32];
   DmtcpUniqueProcessId compId;
@@ -183,6 +190,12 @@ void prepareForCkpt();
 void postRestart();
 void waitForBarrier(const string &barrierId);
 
+int nodeBarrierSlot();
+size_t numNodeBarrierPeers();
+bool waitForNodeLeader();
+void waitForNodePeers(vector<DmtcpUniqueProcessId> *ids);
+void releaseNodePeers(bool kill);
+
 string coordHost();
 uint32_t coordPort();
 void getCoordAddr(struct sockaddr *addr, uint32_t *len);
@@ -173,15 +173,23 @@ char readDec(int fd, VA *value);
 char readHex(int fd, VA *value);
 char readChar(int fd);
 int readProcMapsLine(int mapsfd, ProcMapsArea *area);
+void readAreaRecord(int fd, MtcpAreaRecordBuf *buf);
 int memProtToOpenFlags(int prot);
 pid_t getTracerPid(pid_t tid = -1);
 bool isPtraced();
 bool isValidFd(int fd);
+void waitForLazyRestart();
 bool isPseudoTty(const string &path);
 size_t pageSize();
 size_t pageMask();
 bool areZeroPages(void *addr, size_t numPages);
 
+// Name of the kernel used by areZeroPages() ("avx512", "avx2", "neon" or
+// "scalar").  setZeroPagesKernel() selects one by name, or the best one
+// for this CPU if name is NULL; it returns false if the CPU lacks it.
+const char *zeroPagesKernel();
+bool setZeroPagesKernel(const char *name);
+
 char *findExecutable(char *executable, const char *path_env, char *exec_path);
 string getPath(string cmd, bool is32bit = false);
 void getDmtcpArgs(vector<string> &dmtcp_args);
@@ -0,0 +1,292 @@
+/****************************************************************************
+ *   Copyright (C) 2006-2013 by Jason Ansel, Kapil Arya, and Gene Cooperman *
+ *   jansel@csail.mit.edu, kapil@ccs.neu.edu, gene@ccs.neu.edu              *
+ *                                                                          *
+ *  This file is part of DMTCP.                                             *
+ *                                                                          *
+ *  DMTCP is free software: you can redistribute it and/or                  *
+ *  modify it under the terms of the GNU Lesser General Public License as   *
+ *  published by the Free Software Foundation, either version 3 of the      *
+ *  License, or (at your option) any later version.                         *
+ *                                                                          *
+ *  DMTCP is distributed in the hope that it will be useful,                *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU Lesser General Public License for more details.                     *
+ *                                                                          *
+ *  You should have received a copy of the GNU Lesser General Public        *
+ *  License along with DMTCP:dmtcp/src.  If not, see                        *
+ *  <http://www.gnu.org/licenses/>.                                         *
+ ****************************************************************************/
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <algorithm>
+#include "../jalib/jassert.h"
+#include "barrierrelay.h"
+#include "dmtcpmessagetypes.h"
+
+using namespace dmtcp;
+
+#define MAX_EVENTS 10000
+
+namespace
+{
+struct Member {
+  Member(const jalib::JSocket &s, uint32_t n)
+    : sock(s), numMembers(n), reported(false) {}
+
+  jalib::JSocket sock;
+
+  // The processes behind it: 1 for a process, any number for a relay,
+  // which is not waited for while it has none.
+  uint32_t numMembers;
+
+  // Its DMT_OK for the current barrier arrived.
+  bool reported;
+};
+}
+
+static jalib::JSocket *listenSock = NULL;
+static jalib::JSocket upstreamSock(-1);
+static int epollFd = -1;
+static vector<Member *>members;
+static uint32_t totalMembers = 0;
+
+// The processes of the current barrier not reported upstream yet.  A relay
+// may report a barrier in several parts, when members join or leave during
+// it; the coordinator releases it once it heard from every process.
+static vector<DmtcpUniqueProcessId>pendingIds;
+static WorkerState::eWorkerState pendingState = WorkerState::UNKNOWN;
+
+static void
+addToEpoll(int fd, void *ptr)
+{
+  struct epoll_event ev;
+
+#ifdef EPOLLRDHUP
+  ev.events = EPOLLIN | EPOLLRDHUP;
+#else // ifdef EPOLLRDHUP
+  ev.events = EPOLLIN;
+#endif // ifdef EPOLLRDHUP
+  ev.data.ptr = ptr;
+  JASSERT(epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) != -1) (JASSERT_ERRNO);
+}
+
+// One write per message, so that Nagle's algorithm does not hold back the
+// extra data until the header is acknowledged.
+static void
+sendMessage(jalib::JSocket &sock, const DmtcpMessage &msg,
+            const void *extraData)
+{
+  vector<char>buf(sizeof(msg) + msg.extraBytes);
+
+  memcpy(&buf[0], &msg, sizeof(msg));
+  if (msg.extraBytes > 0) {
+    memcpy(&buf[sizeof(msg)], extraData, msg.extraBytes);
+  }
+  sock.writeAll(&buf[0], buf.size());
+}
+
+static void
+sendPending()
+{
+  DmtcpMessage msg(DMT_OK);
+
+  msg.state = pendingState;
+  msg.numPeers = pendingIds.size();
+  msg.extraBytes = pendingIds.size() * sizeof(pendingIds[0]);
+  sendMessage(upstreamSock, msg, &pendingIds[0]);
+  JTRACE("barrier reported upstream") (msg.numPeers) (msg.state);
+  pendingIds.clear();
+}
+
+static void
+sendPendingIfComplete()
+{
+  if (pendingIds.empty()) {
+    return;
+  }
+  for (size_t i = 0; i < members.size(); i++) {
+    if (members[i]->numMembers > 0 && !members[i]->reported) {
+      return;
+    }
+  }
+  sendPending();
+}
+
+// The coordinator only needs to know whether there is anybody to wait for.
+static void
+updateTotalMembers(int64_t delta)
+{
+  uint32_t oldTotal = totalMembers;
+
+  totalMembers += delta;
+  if ((oldTotal == 0) != (totalMembers == 0)) {
+    DmtcpMessage msg(DMT_BARRIER_RELAY);
+    msg.numPeers = totalMembers;
+    upstreamSock << msg;
+  }
+}
+
+static void
+onConnect()
+{
+  jalib::JSocket remote = listenSock->accept();
+
+  if (!remote.isValid()) {
+    remote.close();
+    return;
+  }
+
+  DmtcpMessage hello;
+  hello.poison();
+  remote >> hello;
+  if (!remote.isValid() || !hello.isValid() ||
+      hello.type != DMT_BARRIER_RELAY) {
+    JWARNING(false) (hello.type) .Text("Unexpected connection; closing it");
+    remote.close();
+    return;
+  }
+
+  Member *m = new Member(remote, hello.numPeers);
+  members.push_back(m);
+  updateTotalMembers(m->numMembers);
+  addToEpoll(remote.sockfd(), m);
+  JTRACE("member joined") (hello.from) (hello.numPeers) (members.size());
+}
+
+static void
+onDisconnect(Member *m)
+{
+  members.erase(std::find(members.begin(), members.end(), m));
+  updateTotalMembers(-(int64_t)m->numMembers);
+  m->sock.close();
+  delete m;
+  sendPendingIfComplete();
+}
+
+static void
+onData(Member *m)
+{
+  DmtcpMessage msg;
+
+  if (m->sock.readAll((char *)&msg, sizeof(msg)) != sizeof(msg)) {
+    onDisconnect(m);
+    return;
+  }
+  msg.assertValid();
+  char *extraData = NULL;
+  if (msg.extraBytes > 0) {
+    extraData = new char[msg.extraBytes];
+    m->sock.readAll(extraData, msg.extraBytes);
+  }
+
+  switch (msg.type) {
+  case DMT_OK:
+  {
+    if (!pendingIds.empty() && msg.state != pendingState) {
+      sendPending();
+    }
+    pendingState = msg.state;
+    if (extraData == NULL) {
+      pendingIds.push_back(msg.from.upid());
+    } else {
+      const DmtcpUniqueProcessId *ids = (const DmtcpUniqueProcessId *)extraData;
+      pendingIds.insert(pendingIds.end(), ids,
+                        ids + msg.extraBytes / sizeof(*ids));
+    }
+    m->reported = true;
+    sendPendingIfComplete();
+    break;
+  }
+
+  case DMT_BARRIER_RELAY:
+    updateTotalMembers((int64_t)msg.numPeers - m->numMembers);
+    m->numMembers = msg.numPeers;
+    sendPendingIfComplete();
+    break;
+
+  default:
+    JWARNING(false) (msg.from) (msg.type)
+    .Text("Unexpected message from a member; closing its connection");
+    onDisconnect(m);
+  }
+
+  delete[] extraData;
+}
+
+static void
+onUpstreamData()
+{
+  DmtcpMessage msg;
+
+  if (upstreamSock.readAll((char *)&msg, sizeof(msg)) != sizeof(msg) ||
+      !msg.isValid()) {
+    JNOTE("Lost the connection to the coordinator; exiting");
+    exit(0);
+  }
+  char *extraData = NULL;
+  if (msg.extraBytes > 0) {
+    extraData = new char[msg.extraBytes];
+    upstreamSock.readAll(extraData, msg.extraBytes);
+  }
+
+  JASSERT(msg.type == DMT_BARRIER_RELEASED || msg.type == DMT_KILL_PEER)
+    (msg.type);
+  for (size_t i = 0; i < members.size(); i++) {
+    sendMessage(members[i]->sock, msg, extraData);
+    members[i]->reported = false;
+  }
+
+  delete[] extraData;
+}
+
+void
+BarrierRelay::eventLoop(jalib::JSocket *sock, const string &upstream)
+{
+  size_t sep = upstream.rfind(':');
+
+  JASSERT(sep != string::npos && sep > 0 && isdigit(upstream[sep + 1]))
+    (upstream) .Text("The relay target must be given as HOST:PORT");
+  string host = upstream.substr(0, sep);
+  upstreamSock = jalib::JClientSocket(host.c_str(),
+                                      atoi(upstream.c_str() + sep + 1));
+  JASSERT(upstreamSock.isValid()) (upstream) (JASSERT_ERRNO)
+  .Text("Cannot connect to the coordinator");
+  DmtcpMessage hello(DMT_BARRIER_RELAY);
+  upstreamSock << hello;
+
+  listenSock = sock;
+  epollFd = epoll_create(MAX_EVENTS);
+  JASSERT(epollFd != -1) (JASSERT_ERRNO);
+  addToEpoll(listenSock->sockfd(), listenSock);
+  addToEpoll(upstreamSock.sockfd(), &upstreamSock);
+  JNOTE("barrier relay running") (listenSock->port()) (upstream);
+
+  struct epoll_event events[MAX_EVENTS];
+  while (true) {
+    int nfds = epoll_wait(epollFd, events, MAX_EVENTS, -1);
+    JASSERT(nfds != -1 || errno == EINTR) (JASSERT_ERRNO);
+
+    for (int n = 0; n < nfds; ++n) {
+      void *ptr = events[n].data.ptr;
+      if (ptr == listenSock) {
+        onConnect();
+      } else if (ptr == &upstreamSock) {
+        onUpstreamData();
+      } else if ((events[n].events & EPOLLHUP) ||
+#ifdef EPOLLRDHUP
+                 (events[n].events & EPOLLRDHUP) ||
+#endif // ifdef EPOLLRDHUP
+                 (events[n].events & EPOLLERR)) {
+        onDisconnect((Member *)ptr);
+      } else if (events[n].events & EPOLLIN) {
+        onData((Member *)ptr);
+      }
+    }
+  }
+}
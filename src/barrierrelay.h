@@ -0,0 +1,45 @@
+/****************************************************************************
+ *   Copyright (C) 2006-2013 by Jason Ansel, Kapil Arya, and Gene Cooperman *
+ *   jansel@csail.mit.edu, kapil@ccs.neu.edu, gene@ccs.neu.edu              *
+ *                                                                          *
+ *  This file is part of DMTCP.                                             *
+ *                                                                          *
+ *  DMTCP is free software: you can redistribute it and/or                  *
+ *  modify it under the terms of the GNU Lesser General Public License as   *
+ *  published by the Free Software Foundation, either version 3 of the      *
+ *  License, or (at your option) any later version.                         *
+ *                                                                          *
+ *  DMTCP is distributed in the hope that it will be useful,                *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU Lesser General Public License for more details.                     *
+ *                                                                          *
+ *  You should have received a copy of the GNU Lesser General Public        *
+ *  License along with DMTCP:dmtcp/src.  If not, see                        *
+ *  <http://www.gnu.org/licenses/>.                                         *
+ ****************************************************************************/
+
+#ifndef BARRIERRELAY_H
+#define BARRIERRELAY_H
+
+#include "../jalib/jsocket.h"
+#include "dmtcpalloc.h"
+
+/* A barrier relay (dmtcp_coordinator --relay-to HOST:PORT) stands between
+ * the processes of a node and the coordinator, for the global barriers of
+ * checkpoint and restart.  Its members are the processes started with
+ * --barrier-relay, or other relays: relays of relays make a tree.  It sends
+ * a single DMT_OK upstream once every member reached the barrier, listing
+ * the processes behind it, and forwards DMT_BARRIER_RELEASED and
+ * DMT_KILL_PEER to its members.  Everything else still goes from each
+ * process straight to the coordinator.
+ */
+namespace dmtcp
+{
+namespace BarrierRelay
+{
+// Never returns; the relay exits when it loses its upstream connection.
+void eventLoop(jalib::JSocket *listenSock, const string &upstream);
+}
+}
+#endif // ifndef BARRIERRELAY_H
@@ -0,0 +1,447 @@
+/****************************************************************************
+ *   Copyright (C) 2006-2013 by Jason Ansel, Kapil Arya, and Gene Cooperman *
+ *   jansel@csail.mit.edu, kapil@ccs.neu.edu, gene@ccs.neu.edu              *
+ *                                                                          *
+ *  This file is part of DMTCP.                                             *
+ *                                                                          *
+ *  DMTCP is free software: you can redistribute it and/or                  *
+ *  modify it under the terms of the GNU Lesser General Public License as   *
+ *  published by the Free Software Foundation, either version 3 of the      *
+ *  License, or (at your option) any later version.                         *
+ *                                                                          *
+ *  DMTCP is distributed in the hope that it will be useful,                *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU Lesser General Public License for more details.                     *
+ *                                                                          *
+ *  You should have received a copy of the GNU Lesser General Public        *
+ *  License along with DMTCP:dmtcp/src.  If not, see                        *
+ *  <http://www.gnu.org/licenses/>.                                         *
+ ****************************************************************************/
+
+/* Benchmark of the global barriers of the coordinator, with and without
+ * barrier relays.
+ *
+ * Usage: barriers [-c COORDINATOR] [-n MAX_PROCS] [-k PROCS_PER_NODE]
+ *                 [-f FANOUT] [-b BARRIERS] [-r ROUNDS]
+ *
+ * Starts dmtcp_coordinator (default: bin/dmtcp_coordinator of this build)
+ * and simulates up to MAX_PROCS processes (default: 1024), in nodes of
+ * PROCS_PER_NODE (default: 16) that each are a process of the benchmark.
+ * The simulated processes take ROUNDS (default: 3) checkpoints with
+ * BARRIERS (default: 20) global barriers each, and the best time per
+ * barrier is printed for 1, 2, 4, ... nodes:
+ *   flat: every process talks to the coordinator;
+ *   node: one process per node reports the whole node, as with
+ *         dmtcp_launch --node-barriers;
+ *   tree: the processes of a node go through a relay of their own, and the
+ *         relays through a tree of relays of FANOUT (default: 8) members.
+ */
+
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#include "../jalib/jconvert.h"
+#include "../jalib/jfilesystem.h"
+#include "../jalib/jsocket.h"
+#include "../dmtcpmessagetypes.h"
+#include "util.h"
+
+using namespace dmtcp;
+
+enum Mode { FLAT, NODE, TREE };
+
+static string coordinator;
+static char tmpDir[] = "/tmp/dmtcp-barriers-XXXXXX";
+static std::vector<pid_t>coordinators;
+
+static double
+now()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+die(const char *what)
+{
+  perror(what);
+  exit(1);
+}
+
+// Starts the coordinator, or a relay reporting to UPSTREAM; returns its port.
+static int
+startCoordinator(const char *upstream)
+{
+  static int n = 0;
+  char portFile[PATH_MAX];
+
+  char dir[PATH_MAX];
+
+  // Each coordinator has a directory of its own for its restart script.
+  snprintf(dir, sizeof dir, "%s/%d", tmpDir, n++);
+  snprintf(portFile, sizeof portFile, "%s/port", dir);
+  if (mkdir(dir, 0700) == -1) {
+    die("mkdir");
+  }
+  pid_t pid = fork();
+  if (pid == 0) {
+    int fd = open("/dev/null", O_RDWR);
+    dup2(fd, STDIN_FILENO);
+    dup2(fd, STDOUT_FILENO);
+    dup2(fd, STDERR_FILENO);
+    if (chdir(dir) == -1) {
+      _exit(1);
+    }
+    const char *args[] = {
+      coordinator.c_str(), "--quiet", "--coord-port", "0",
+      "--port-file", portFile, "--ckptdir", dir, "--tmpdir", dir,
+      upstream != NULL ? "--relay-to" : NULL, upstream, NULL
+    };
+    execv(args[0], (char **)args);
+    _exit(1);
+  }
+  coordinators.push_back(pid);
+
+  for (int i = 0; i < 1000; i++) {
+    FILE *f = fopen(portFile, "r");
+    int port = 0;
+    if (f != NULL) {
+      int ret = fscanf(f, "%d", &port);
+      fclose(f);
+      if (ret == 1 && port > 0) {
+        return port;
+      }
+    }
+    usleep(10000);
+  }
+  fprintf(stderr, "%s did not start\n", coordinator.c_str());
+  exit(1);
+}
+
+static void
+stopCoordinators()
+{
+  for (size_t i = 0; i < coordinators.size(); i++) {
+    kill(coordinators[i], SIGKILL);
+    waitpid(coordinators[i], NULL, 0);
+  }
+  coordinators.clear();
+}
+
+static int
+connectTo(int port)
+{
+  int fd = jalib::JClientSocket("127.0.0.1", port).sockfd();
+
+  if (fd == -1) {
+    die("connect");
+  }
+  return fd;
+}
+
+static void
+sendMsg(int fd, DmtcpMessage &msg, const char *extraData = NULL,
+        size_t len = 0)
+{
+  std::vector<char>buf(sizeof(msg) + len);
+
+  // One write, as the processes do.
+  msg.extraBytes = len;
+  memcpy(&buf[0], &msg, sizeof(msg));
+  if (len > 0) {
+    memcpy(&buf[sizeof(msg)], extraData, len);
+  }
+  if (Util::writeAll(fd, &buf[0], buf.size()) != (ssize_t)buf.size()) {
+    die("write");
+  }
+}
+
+static void
+recvMsg(int fd, DmtcpMessageType type, DmtcpMessage *msg)
+{
+  char buf[4096];
+
+  if (Util::readAll(fd, msg, sizeof(*msg)) != sizeof(*msg) ||
+      !msg->isValid() || msg->type != type) {
+    fprintf(stderr, "expected message %d, got %d\n", type, msg->type);
+    exit(1);
+  }
+  for (size_t left = msg->extraBytes; left > 0;) {
+    size_t len = left < sizeof(buf) ? left : sizeof(buf);
+    if (Util::readAll(fd, buf, len) != (ssize_t)len) {
+      die("read");
+    }
+    left -= len;
+  }
+}
+
+struct SimProcess {
+  UniquePid id;
+  int coordFd;
+  int barrierFd;
+};
+
+// One node: connects its processes, then goes through the checkpoints the
+// parent requests, and reports the time spent in the barriers of each.
+static void
+runNode(int node, int procsPerNode, int coordPort, int relayPort,
+        bool nodeBarrier, int numBarriers, int rounds, int readyFd,
+        int resultFd)
+{
+  std::vector<SimProcess>procs(procsPerNode);
+  char hostAndProg[64];
+  size_t len = snprintf(hostAndProg, sizeof hostAndProg, "node%d", node) + 1;
+
+  strcpy(hostAndProg + len, "barriers");
+  len += strlen("barriers") + 1;
+  for (int i = 0; i < procsPerNode; i++) {
+    SimProcess &p = procs[i];
+    DmtcpMessage msg(DMT_NEW_WORKER);
+
+    p.id = UniquePid(gethostid(), 1 + node * procsPerNode + i, time(NULL));
+    msg.from = p.id;
+    msg.state = WorkerState::RUNNING;
+    msg.virtualPid = -1;
+    p.coordFd = connectTo(coordPort);
+    sendMsg(p.coordFd, msg, hostAndProg, len);
+    recvMsg(p.coordFd, DMT_ACCEPT, &msg);
+
+    p.barrierFd = p.coordFd;
+    if (relayPort != 0) {
+      DmtcpMessage join(DMT_BARRIER_RELAY);
+      join.from = p.id;
+      join.numPeers = 1;
+      p.barrierFd = connectTo(relayPort);
+      sendMsg(p.barrierFd, join);
+    }
+  }
+
+  if (node == 0) {
+    string barriers;
+    for (int b = 0; b < numBarriers; b++) {
+      barriers += (b > 0 ? ",bench::barrier" : "bench::barrier") +
+                  jalib::XToString(b);
+    }
+    barriers += ";";
+    DmtcpMessage msg(DMT_BARRIER_LIST);
+    sendMsg(procs[0].coordFd, msg, barriers.c_str(), barriers.length() + 1);
+  }
+  std::vector<DmtcpUniqueProcessId>ids;
+  for (int i = 0; i < procsPerNode; i++) {
+    ids.push_back(procs[i].id.upid());
+  }
+  if (write(readyFd, "", 1) != 1) {
+    die("write");
+  }
+
+  for (int r = 0; r < rounds; r++) {
+    DmtcpMessage msg;
+    for (int i = 0; i < procsPerNode; i++) {
+      recvMsg(procs[i].coordFd, DMT_DO_SUSPEND, &msg);
+    }
+    for (int i = 0; i < procsPerNode; i++) {
+      DmtcpMessage ok(DMT_OK);
+      ok.from = procs[i].id;
+      ok.state = WorkerState::SUSPENDED;
+      sendMsg(procs[i].coordFd, ok);
+    }
+    for (int i = 0; i < procsPerNode; i++) {
+      recvMsg(procs[i].coordFd, DMT_COMPUTATION_INFO, &msg);
+    }
+
+    double start = now();
+    for (int b = 0; b < numBarriers; b++) {
+      if (nodeBarrier) {
+        DmtcpMessage ok(DMT_OK);
+        ok.from = procs[0].id;
+        ok.state = WorkerState::CHECKPOINTING;
+        sendMsg(procs[0].coordFd, ok, (const char *)&ids[0],
+                ids.size() * sizeof(ids[0]));
+        recvMsg(procs[0].coordFd, DMT_BARRIER_RELEASED, &msg);
+        continue;
+      }
+      for (int i = 0; i < procsPerNode; i++) {
+        DmtcpMessage ok(DMT_OK);
+        ok.from = procs[i].id;
+        ok.state = WorkerState::CHECKPOINTING;
+        sendMsg(procs[i].barrierFd, ok);
+      }
+      for (int i = 0; i < procsPerNode; i++) {
+        recvMsg(procs[i].barrierFd, DMT_BARRIER_RELEASED, &msg);
+      }
+    }
+    double elapsed = now() - start;
+
+    for (int i = 0; i < procsPerNode; i++) {
+      // Image name, shell type, hostname.
+      char info[] = "ckpt.dmtcp\0\0node";
+      DmtcpMessage done(DMT_CKPT_FILENAME);
+      done.from = procs[i].id;
+      done.state = WorkerState::CHECKPOINTED;
+      sendMsg(procs[i].coordFd, done, info, sizeof(info));
+
+      DmtcpMessage ok(DMT_OK);
+      ok.from = procs[i].id;
+      ok.state = WorkerState::RUNNING;
+      sendMsg(procs[i].coordFd, ok);
+    }
+    if (write(resultFd, &elapsed, sizeof(elapsed)) != sizeof(elapsed)) {
+      die("write");
+    }
+  }
+  exit(0);
+}
+
+static bool
+requestCheckpoint(int coordPort)
+{
+  int fd = connectTo(coordPort);
+  DmtcpMessage msg(DMT_USER_CMD);
+
+  msg.coordCmd = 'c';
+  sendMsg(fd, msg);
+  recvMsg(fd, DMT_USER_CMD_RESULT, &msg);
+  close(fd);
+  return msg.coordCmdStatus == CoordCmdStatus::NOERROR;
+}
+
+// Returns the best time per barrier, in milliseconds.
+static double
+run(int numNodes, int procsPerNode, int fanout, Mode mode, int numBarriers,
+    int rounds)
+{
+  int coordPort = startCoordinator(NULL);
+  std::vector<int>relayPorts;
+
+  if (mode == TREE) {
+    // Levels of relays, from the relays of the nodes up.
+    std::vector<int>levels(1, numNodes);
+    while (levels.back() > fanout) {
+      levels.push_back((levels.back() + fanout - 1) / fanout);
+    }
+    std::vector<int>upstream(1, coordPort);
+    for (int l = levels.size() - 1; l >= 0; l--) {
+      relayPorts.clear();
+      for (int i = 0; i < levels[l]; i++) {
+        string target = "127.0.0.1:" + jalib::XToString(upstream[i / fanout]);
+        relayPorts.push_back(startCoordinator(target.c_str()));
+      }
+      upstream = relayPorts;
+    }
+  }
+
+  int readyPipe[2], resultPipe[2];
+  if (pipe(readyPipe) == -1 || pipe(resultPipe) == -1) {
+    die("pipe");
+  }
+  std::vector<pid_t>nodes;
+  for (int n = 0; n < numNodes; n++) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      runNode(n, procsPerNode, coordPort, mode == TREE ? relayPorts[n] : 0,
+              mode == NODE,
+              numBarriers, rounds, readyPipe[1], resultPipe[1]);
+    }
+    nodes.push_back(pid);
+  }
+  for (int n = 0; n < numNodes; n++) {
+    char c;
+    if (read(readyPipe[0], &c, 1) != 1) {
+      die("read");
+    }
+  }
+
+  double best = 0;
+  for (int r = 0; r < rounds; r++) {
+    while (!requestCheckpoint(coordPort)) {
+      usleep(1000);
+    }
+    double slowest = 0;
+    for (int n = 0; n < numNodes; n++) {
+      double elapsed;
+      if (read(resultPipe[0], &elapsed, sizeof(elapsed)) != sizeof(elapsed)) {
+        die("read");
+      }
+      slowest = elapsed > slowest ? elapsed : slowest;
+    }
+    best = (best == 0 || slowest < best) ? slowest : best;
+  }
+
+  for (size_t n = 0; n < nodes.size(); n++) {
+    waitpid(nodes[n], NULL, 0);
+  }
+  close(readyPipe[0]);
+  close(readyPipe[1]);
+  close(resultPipe[0]);
+  close(resultPipe[1]);
+  stopCoordinators();
+  return best / numBarriers * 1000;
+}
+
+int
+main(int argc, char **argv)
+{
+  int maxProcs = 1024;
+  int procsPerNode = 16;
+  int fanout = 8;
+  int numBarriers = 20;
+  int rounds = 3;
+  int opt;
+
+  coordinator = jalib::Filesystem::GetProgramDir() +
+                "/../../bin/dmtcp_coordinator";
+  while ((opt = getopt(argc, argv, "c:n:k:f:b:r:")) != -1) {
+    switch (opt) {
+    case 'c': coordinator = optarg; break;
+    case 'n': maxProcs = atoi(optarg); break;
+    case 'k': procsPerNode = atoi(optarg); break;
+    case 'f': fanout = atoi(optarg); break;
+    case 'b': numBarriers = atoi(optarg); break;
+    case 'r': rounds = atoi(optarg); break;
+    default:
+      fprintf(stderr, "Usage: %s [-c COORDINATOR] [-n MAX_PROCS] "
+                      "[-k PROCS_PER_NODE] [-f FANOUT] [-b BARRIERS] "
+                      "[-r ROUNDS]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (maxProcs < procsPerNode || procsPerNode <= 0 || fanout < 2 ||
+      numBarriers <= 0 || rounds <= 0) {
+    fprintf(stderr, "%s: invalid arguments\n", argv[0]);
+    return 1;
+  }
+  if (mkdtemp(tmpDir) == NULL) {
+    die("mkdtemp");
+  }
+
+  printf("%d processes per node, relay fanout %d, %d barriers, %d rounds\n",
+         procsPerNode, fanout, numBarriers, rounds);
+  printf("%8s %6s %14s %14s %14s\n", "procs", "nodes", "flat ms/bar",
+         "node ms/bar", "tree ms/bar");
+  fflush(stdout);
+  for (int nodes = 1; nodes * procsPerNode <= maxProcs; nodes *= 2) {
+    double flat = run(nodes, procsPerNode, fanout, FLAT, numBarriers, rounds);
+    double node = run(nodes, procsPerNode, fanout, NODE, numBarriers, rounds);
+    double tree = run(nodes, procsPerNode, fanout, TREE, numBarriers, rounds);
+    printf("%8d %6d %14.3f %14.3f %14.3f\n", nodes * procsPerNode, nodes, flat,
+           node, tree);
+    fflush(stdout);
+  }
+
+  string cmd = string("rm -rf ") + tmpDir;
+  if (system(cmd.c_str()) != 0) {
+    perror("rm");
+  }
+  return 0;
+}
@@ -0,0 +1,289 @@
+/****************************************************************************
+ *   Copyright (C) 2006-2013 by Jason Ansel, Kapil Arya, and Gene Cooperman *
+ *   jansel@csail.mit.edu, kapil@ccs.neu.edu, gene@ccs.neu.edu              *
+ *                                                                          *
+ *  This file is part of DMTCP.                                             *
+ *                                                                          *
+ *  DMTCP is free software: you can redistribute it and/or                  *
+ *  modify it under the terms of the GNU Lesser General Public License as   *
+ *  published by the Free Software Foundation, either version 3 of the      *
+ *  License, or (at your option) any later version.                         *
+ *                                                                          *
+ *  DMTCP is distributed in the hope that it will be useful,                *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU Lesser General Public License for more details.                     *
+ *                                                                          *
+ *  You should have received a copy of the GNU Lesser General Public        *
+ *  License along with DMTCP:dmtcp/src.  If not, see                        *
+ *  <http://www.gnu.org/licenses/>.                                         *
+ ****************************************************************************/
+
+/* Benchmark of the coordinator accepting a storm of new processes.
+ *
+ * Usage: connects [-c COORDINATOR] [-n MAX_PROCS] [-k PROCS_PER_NODE]
+ *                 [-t IO_THREADS] [-w TIMEOUT]
+ *
+ * Starts dmtcp_coordinator (default: bin/dmtcp_coordinator of this build,
+ * with --io-threads IO_THREADS if given) and lets up to MAX_PROCS (default:
+ * 1024) simulated processes, in nodes of PROCS_PER_NODE (default: 32) that
+ * each are a process of the benchmark, connect at once.  The time until all
+ * of them are accepted is printed for 1, 2, 4, ... nodes:
+ *   idle:  nothing else is connected;
+ *   slow:  a client that connected first has not sent its hello yet.
+ * A run that takes longer than TIMEOUT (default: 10) seconds is printed as
+ * "stalled".
+ */
+
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#include "../jalib/jconvert.h"
+#include "../jalib/jfilesystem.h"
+#include "../jalib/jsocket.h"
+#include "../dmtcpmessagetypes.h"
+#include "util.h"
+
+using namespace dmtcp;
+
+static string coordinator;
+static string ioThreads;
+static char tmpDir[] = "/tmp/dmtcp-connects-XXXXXX";
+static pid_t coordinatorPid = -1;
+
+static double
+now()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+die(const char *what)
+{
+  perror(what);
+  exit(1);
+}
+
+// Starts the coordinator; returns its port.
+static int
+startCoordinator()
+{
+  static int n = 0;
+  char portFile[PATH_MAX];
+  char dir[PATH_MAX];
+
+  // Each coordinator has a directory of its own for its restart script.
+  snprintf(dir, sizeof dir, "%s/%d", tmpDir, n++);
+  snprintf(portFile, sizeof portFile, "%s/port", dir);
+  if (mkdir(dir, 0700) == -1) {
+    die("mkdir");
+  }
+  coordinatorPid = fork();
+  if (coordinatorPid == 0) {
+    int fd = open("/dev/null", O_RDWR);
+    dup2(fd, STDIN_FILENO);
+    dup2(fd, STDOUT_FILENO);
+    dup2(fd, STDERR_FILENO);
+    if (chdir(dir) == -1) {
+      _exit(1);
+    }
+    const char *args[] = {
+      coordinator.c_str(), "--quiet", "--coord-port", "0",
+      "--port-file", portFile, "--ckptdir", dir, "--tmpdir", dir,
+      ioThreads.empty() ? NULL : "--io-threads", ioThreads.c_str(), NULL
+    };
+    execv(args[0], (char **)args);
+    _exit(1);
+  }
+
+  for (int i = 0; i < 1000; i++) {
+    FILE *f = fopen(portFile, "r");
+    int port = 0;
+    if (f != NULL) {
+      int ret = fscanf(f, "%d", &port);
+      fclose(f);
+      if (ret == 1 && port > 0) {
+        return port;
+      }
+    }
+    usleep(10000);
+  }
+  fprintf(stderr, "%s did not start\n", coordinator.c_str());
+  exit(1);
+}
+
+static int
+connectTo(int port)
+{
+  int fd = jalib::JClientSocket("127.0.0.1", port).sockfd();
+
+  if (fd == -1) {
+    die("connect");
+  }
+  return fd;
+}
+
+// One node: connects its processes, each as soon as the previous one has
+// been accepted, reports that they are all in, and waits to be killed.
+static void
+runNode(int node, int procsPerNode, int coordPort, int doneFd)
+{
+  std::vector<char>buf(sizeof(DmtcpMessage) + 64);
+  size_t len = snprintf(&buf[sizeof(DmtcpMessage)], 32, "node%d", node) + 1;
+
+  strcpy(&buf[sizeof(DmtcpMessage) + len], "connects");
+  len += strlen("connects") + 1;
+  for (int i = 0; i < procsPerNode; i++) {
+    DmtcpMessage msg(DMT_NEW_WORKER);
+
+    msg.from = UniquePid(gethostid(), 1 + node * procsPerNode + i, time(NULL));
+    msg.state = WorkerState::RUNNING;
+    msg.virtualPid = -1;
+    msg.extraBytes = len;
+    memcpy(&buf[0], &msg, sizeof(msg));
+
+    // Left open until the node is killed.
+    int fd = connectTo(coordPort);
+    if (Util::writeAll(fd, &buf[0], sizeof(msg) + len) !=
+        (ssize_t)(sizeof(msg) + len)) {
+      die("write");
+    }
+    if (Util::readAll(fd, &msg, sizeof(msg)) != sizeof(msg) ||
+        !msg.isValid() || msg.type != DMT_ACCEPT) {
+      fprintf(stderr, "node %d: not accepted\n", node);
+      exit(1);
+    }
+  }
+  if (write(doneFd, "", 1) != 1) {
+    die("write");
+  }
+  pause();
+  exit(0);
+}
+
+// Returns the time until all processes are accepted, in milliseconds, or -1
+// if that took longer than TIMEOUT seconds.
+static double
+run(int numNodes, int procsPerNode, bool slowClient, int timeout)
+{
+  int coordPort = startCoordinator();
+  int slowFd = slowClient ? connectTo(coordPort) : -1;
+
+  int donePipe[2];
+  if (pipe(donePipe) == -1) {
+    die("pipe");
+  }
+
+  double start = now();
+  std::vector<pid_t>nodes;
+  for (int n = 0; n < numNodes; n++) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      runNode(n, procsPerNode, coordPort, donePipe[1]);
+    }
+    nodes.push_back(pid);
+  }
+
+  double elapsed = -1;
+  int numDone = 0;
+  while (numDone < numNodes) {
+    struct pollfd pfd = { donePipe[0], POLLIN, 0 };
+    int left = (int)((start + timeout - now()) * 1000);
+    if (left <= 0 || poll(&pfd, 1, left) <= 0) {
+      break;
+    }
+    char c;
+    if (read(donePipe[0], &c, 1) != 1) {
+      die("read");
+    }
+    numDone++;
+  }
+  if (numDone == numNodes) {
+    elapsed = (now() - start) * 1000;
+  }
+
+  for (size_t n = 0; n < nodes.size(); n++) {
+    kill(nodes[n], SIGKILL);
+    waitpid(nodes[n], NULL, 0);
+  }
+  if (slowFd != -1) {
+    close(slowFd);
+  }
+  close(donePipe[0]);
+  close(donePipe[1]);
+  kill(coordinatorPid, SIGKILL);
+  waitpid(coordinatorPid, NULL, 0);
+  return elapsed;
+}
+
+static void
+printTime(double ms)
+{
+  if (ms < 0) {
+    printf(" %14s", "stalled");
+  } else {
+    printf(" %14.1f", ms);
+  }
+}
+
+int
+main(int argc, char **argv)
+{
+  int maxProcs = 1024;
+  int procsPerNode = 32;
+  int timeout = 10;
+  int opt;
+
+  coordinator = jalib::Filesystem::GetProgramDir() +
+                "/../../bin/dmtcp_coordinator";
+  while ((opt = getopt(argc, argv, "c:n:k:t:w:")) != -1) {
+    switch (opt) {
+    case 'c': coordinator = optarg; break;
+    case 'n': maxProcs = atoi(optarg); break;
+    case 'k': procsPerNode = atoi(optarg); break;
+    case 't': ioThreads = optarg; break;
+    case 'w': timeout = atoi(optarg); break;
+    default:
+      fprintf(stderr, "Usage: %s [-c COORDINATOR] [-n MAX_PROCS] "
+                      "[-k PROCS_PER_NODE] [-t IO_THREADS] [-w TIMEOUT]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+  if (maxProcs < procsPerNode || procsPerNode <= 0 || timeout <= 0) {
+    fprintf(stderr, "%s: invalid arguments\n", argv[0]);
+    return 1;
+  }
+  if (mkdtemp(tmpDir) == NULL) {
+    die("mkdtemp");
+  }
+
+  printf("%d processes per node\n", procsPerNode);
+  printf("%8s %6s %14s %14s\n", "procs", "nodes", "idle ms", "slow ms");
+  fflush(stdout);
+  for (int nodes = 1; nodes * procsPerNode <= maxProcs; nodes *= 2) {
+    printf("%8d %6d", nodes * procsPerNode, nodes);
+    printTime(run(nodes, procsPerNode, false, timeout));
+    printTime(run(nodes, procsPerNode, true, timeout));
+    printf("\n");
+    fflush(stdout);
+  }
+
+  string cmd = string("rm -rf ") + tmpDir;
+  if (system(cmd.c_str()) != 0) {
+    perror("rm");
+  }
+  return 0;
+}
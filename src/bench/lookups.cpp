@@ -0,0 +1,186 @@
+/****************************************************************************
+ *   Copyright (C) 2006-2013 by Jason Ansel, Kapil Arya, and Gene Cooperman *
+ *   jansel@csail.mit.edu, kapil@ccs.neu.edu, gene@ccs.neu.edu              *
+ *                                                                          *
+ *  This file is part of DMTCP.                                             *
+ *                                                                          *
+ *  DMTCP is free software: you can redistribute it and/or                  *
+ *  modify it under the terms of the GNU Lesser General Public License as   *
+ *  published by the Free Software Foundation, either version 3 of the      *
+ *  License, or (at your option) any later version.                         *
+ *                                                                          *
+ *  DMTCP is distributed in the hope that it will be useful,                *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU Lesser General Public License for more details.                     *
+ *                                                                          *
+ *  You should have received a copy of the GNU Lesser General Public        *
+ *  License along with DMTCP:dmtcp/src.  If not, see                        *
+ *  <http://www.gnu.org/licenses/>.                                         *
+ ****************************************************************************/
+
+/* Benchmark of the name service of the coordinator.
+ *
+ * Usage: lookups [-n MAX_KEYS] [-r ROUNDS]
+ *
+ * Fills one namespace of a LookupService with 1k, 4k, 16k, ... up to
+ * MAX_KEYS (default: 1M) keys, the way the socket and InfiniBand plugins
+ * publish their connections on restart, and prints the best of ROUNDS
+ * (default: 3) rounds, in millions of operations per second:
+ *   insert: addKeyValue() of a 16-byte key and a 24-byte value;
+ *   query:  query() of every key, in random order;
+ *   uniqid: getUniqueId() of every key in another namespace;
+ * and the time reset() takes to drop them all, in milliseconds.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+#include "../lookup_service.h"
+
+using namespace dmtcp;
+
+namespace dmtcp
+{
+// addKeyValue() and query() are private to the coordinator.
+class LookupServiceBench
+{
+  public:
+    static void addKeyValue(LookupService *service,
+                            const void *key,
+                            size_t keyLen,
+                            const void *val,
+                            size_t valLen)
+    {
+      service->addKeyValue("sock", key, keyLen, val, valLen);
+    }
+
+    static void query(LookupService *service,
+                      const void *key,
+                      size_t keyLen,
+                      void **val,
+                      size_t *valLen)
+    {
+      service->query("sock", key, keyLen, val, valLen);
+    }
+};
+}
+
+struct Key {
+  uint64_t hostid;
+  uint32_t pid;
+  uint32_t fd;
+};
+
+struct Value {
+  uint64_t lid;
+  uint64_t qpn;
+  uint64_t psn;
+};
+
+static double
+now()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double
+best(double t, double best)
+{
+  return (best == 0 || t < best) ? t : best;
+}
+
+int
+main(int argc, char **argv)
+{
+  size_t maxKeys = 1024 * 1024;
+  int rounds = 3;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:r:")) != -1) {
+    switch (opt) {
+    case 'n': maxKeys = atol(optarg); break;
+    case 'r': rounds = atoi(optarg); break;
+    default:
+      fprintf(stderr, "Usage: %s [-n MAX_KEYS] [-r ROUNDS]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (maxKeys == 0 || rounds <= 0) {
+    fprintf(stderr, "%s: invalid arguments\n", argv[0]);
+    return 1;
+  }
+
+  printf("%10s %12s %12s %12s %12s\n", "keys", "insert Mop/s",
+         "query Mop/s", "uniqid Mop/s", "reset ms");
+  fflush(stdout);
+  for (size_t numKeys = 1024; numKeys <= maxKeys; numKeys *= 4) {
+    std::vector<Key>keys(numKeys);
+    for (size_t i = 0; i < numKeys; i++) {
+      keys[i].hostid = 0x7f000001 + i / 64;
+      keys[i].pid = 1000 + i / 16;
+      keys[i].fd = i % 16;
+    }
+    std::vector<size_t>order(numKeys);
+    for (size_t i = 0; i < numKeys; i++) {
+      order[i] = i;
+    }
+    srand(numKeys);
+    std::random_shuffle(order.begin(), order.end());
+
+    double insertTime = 0, queryTime = 0, uniqidTime = 0, resetTime = 0;
+    size_t found = 0;
+    for (int r = 0; r < rounds; r++) {
+      LookupService *service = new LookupService();
+
+      double start = now();
+      for (size_t i = 0; i < numKeys; i++) {
+        Value val = { i, i * 3, i * 7 };
+        LookupServiceBench::addKeyValue(service, &keys[i], sizeof(Key), &val,
+                                        sizeof(val));
+      }
+      insertTime = best(now() - start, insertTime);
+
+      start = now();
+      for (size_t i = 0; i < numKeys; i++) {
+        void *val;
+        size_t valLen;
+        LookupServiceBench::query(service, &keys[order[i]], sizeof(Key), &val,
+                                  &valLen);
+        found += (val != NULL && ((Value *)val)->lid == order[i]);
+      }
+      queryTime = best(now() - start, queryTime);
+
+      start = now();
+      for (size_t i = 0; i < numKeys; i++) {
+        void *val;
+        service->getUniqueId("pid", &keys[i], sizeof(Key), &val, 1,
+                             sizeof(uint32_t));
+      }
+      uniqidTime = best(now() - start, uniqidTime);
+
+      start = now();
+      service->reset();
+      resetTime = best(now() - start, resetTime);
+      delete service;
+    }
+    if (found != numKeys * rounds) {
+      fprintf(stderr, "%zu of %zu queries failed\n", numKeys * rounds - found,
+              numKeys * rounds);
+      return 1;
+    }
+
+    printf("%10zu %12.2f %12.2f %12.2f %12.3f\n", numKeys,
+           numKeys / insertTime / 1e6, numKeys / queryTime / 1e6,
+           numKeys / uniqidTime / 1e6, resetTime * 1000);
+    fflush(stdout);
+  }
+  return 0;
+}
@@ -0,0 +1,135 @@
+/****************************************************************************
+ *   Copyright (C) 2006-2013 by Jason Ansel, Kapil Arya, and Gene Cooperman *
+ *   jansel@csail.mit.edu, kapil@ccs.neu.edu, gene@ccs.neu.edu              *
+ *                                                                          *
+ *  This file is part of DMTCP.                                             *
+ *                                                                          *
+ *  DMTCP is free software: you can redistribute it and/or                  *
+ *  modify it under the terms of the GNU Lesser General Public License as   *
+ *  published by the Free Software Foundation, either version 3 of the      *
+ *  License, or (at your option) any later version.                         *
+ *                                                                          *
+ *  DMTCP is distributed in the hope that it will be useful,                *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU Lesser General Public License for more details.                     *
+ *                                                                          *
+ *  You should have received a copy of the GNU Lesser General Public        *
+ *  License along with DMTCP:dmtcp/src.  If not, see                        *
+ *  <http://www.gnu.org/licenses/>.                                         *
+ ****************************************************************************/
+
+/* Microbenchmark for Util::areZeroPages().
+ *
+ * Usage: zeropages [MB [ROUNDS]]
+ *
+ * Scans a buffer of MB megabytes (default: 512) in 64 KB units, the way
+ * mtcp_get_next_page_range() does, with every kernel this CPU supports, and
+ * prints the best throughput out of ROUNDS (default: 5) for three patterns:
+ *   zero:  all pages are zero (but backed by real pages, not the zero page);
+ *   dirty: every page has a non-zero byte in its last word;
+ *   mixed: half of the 64 KB units are zero, the others have a non-zero byte
+ *          at a pseudo-random offset.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include "util.h"
+
+using namespace dmtcp;
+
+#define SCAN_SIZE (64 * 1024)
+
+static const char *kernels[] = { "avx512", "avx2", "neon", "scalar" };
+
+static double
+now()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+fillPattern(char *buf, size_t len, const char *pattern)
+{
+  size_t pageSize = Util::pageSize();
+  unsigned int seed = 1;
+
+  memset(buf, 0, len);
+  if (strcmp(pattern, "dirty") == 0) {
+    for (size_t i = 0; i < len; i += pageSize) {
+      buf[i + pageSize - 1] = 1;
+    }
+  } else if (strcmp(pattern, "mixed") == 0) {
+    for (size_t i = 0; i < len; i += SCAN_SIZE) {
+      if (rand_r(&seed) % 2) {
+        buf[i + rand_r(&seed) % SCAN_SIZE] = 1;
+      }
+    }
+  }
+}
+
+static double
+scan(char *buf, size_t len, int rounds, size_t *numZero)
+{
+  size_t pagesPerScan = SCAN_SIZE / Util::pageSize();
+  double best = 0;
+
+  for (int r = 0; r < rounds; r++) {
+    size_t n = 0;
+    double start = now();
+    for (size_t i = 0; i < len; i += SCAN_SIZE) {
+      n += Util::areZeroPages(buf + i, pagesPerScan);
+    }
+    double elapsed = now() - start;
+    if (best == 0 || elapsed < best) {
+      best = elapsed;
+    }
+    *numZero = n;
+  }
+  return len / best / 1e9;
+}
+
+int
+main(int argc, char **argv)
+{
+  size_t len = (argc > 1 ? atol(argv[1]) : 512) * 1024 * 1024;
+  int rounds = argc > 2 ? atoi(argv[2]) : 5;
+  const char *patterns[] = { "zero", "dirty", "mixed" };
+
+  if (len == 0 || rounds <= 0) {
+    fprintf(stderr, "Usage: %s [MB [ROUNDS]]\n", argv[0]);
+    return 1;
+  }
+
+  char *buf = (char *)mmap(NULL, len, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buf == MAP_FAILED) {
+    perror("mmap");
+    return 1;
+  }
+
+  printf("%zu MB, %d rounds, default kernel: %s\n",
+         len / (1024 * 1024), rounds, Util::zeroPagesKernel());
+  printf("%-8s %-8s %10s %12s\n", "pattern", "kernel", "GB/s", "zero units");
+  for (size_t p = 0; p < sizeof(patterns) / sizeof(patterns[0]); p++) {
+    fillPattern(buf, len, patterns[p]);
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+      if (!Util::setZeroPagesKernel(kernels[k])) {
+        continue;
+      }
+      size_t numZero = 0;
+      double gbps = scan(buf, len, rounds, &numZero);
+      printf("%-8s %-8s %10.2f %12zu\n", patterns[p], kernels[k], gbps,
+             numZero);
+    }
+  }
+
+  munmap(buf, len);
+  return 0;
+}
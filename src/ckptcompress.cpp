@@ -0,0 +1,697 @@
+/****************************************************************************
+ *   Copyright (C) 2006-2013 by Jason Ansel, Kapil Arya, and Gene Cooperman *
+ *   jansel@csail.mit.edu, kapil@ccs.neu.edu, gene@ccs.neu.edu              *
+ *                                                                          *
+ *  This file is part of DMTCP.                                             *
+ *                                                                          *
+ *  DMTCP is free software: you can redistribute it and/or                  *
+ *  modify it under the terms of the GNU Lesser General Public License as   *
+ *  published by the Free Software Foundation, either version 3 of the      *
+ *  License, or (at your option) any later version.                         *
+ *                                                                          *
+ *  DMTCP is distributed in the hope that it will be useful,                *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU Lesser General Public License for more details.                     *
+ *                                                                          *
+ *  You should have received a copy of the GNU Lesser General Public        *
+ *  License along with DMTCP:dmtcp/src.  If not, see                        *
+ *  <http://www.gnu.org/licenses/>.                                         *
+ ****************************************************************************/
+
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "../jalib/jassert.h"
+#include "ckptcompress.h"
+#include "constants.h"
+#include "rawsyscall.h"
+#include "syscallwrappers.h"
+#include "util.h"
+
+using namespace dmtcp;
+
+/* The compressor threads are created with a raw clone() rather than
+ * pthread_create().  They must not show up in the ThreadList, must not be
+ * known to libpthread (whose bookkeeping is part of the checkpoint image),
+ * and their stacks must not be saved.  They only touch memory inside the
+ * arena and issue futex system calls.  Having no TLS of their own, they
+ * would share errno with the checkpoint thread, which keeps writing the
+ * image meanwhile, and acts on errno (Util::writeAll() retries on EAGAIN):
+ * their futex calls go through raw_syscall(), which leaves errno alone.
+ */
+#define WORKER_STACK_SIZE (256 * 1024)
+#define WORKER_CLONE_FLAGS                                    \
+  (CLONE_VM | CLONE_FS | CLONE_FILES | CLONE_SIGHAND | CLONE_THREAD | \
+  CLONE_SYSVSEM | CLONE_PARENT_SETTID | CLONE_CHILD_CLEARTID)
+
+/* LZ4 block format parameters. */
+#define LZ4_MINMATCH       4
+#define LZ4_LASTLITERALS   5
+#define LZ4_MFLIMIT        12
+#define LZ4_MAX_DISTANCE   65535
+#define LZ4_HASH_LOG       14
+#define LZ4_HASH_BYTES     (sizeof(uint32_t) << LZ4_HASH_LOG)
+#define LZ4_SKIP_TRIGGER   6
+#define LZ4_RUN_MASK       15
+
+#define SLOT_FREE          0
+#define SLOT_FULL          1
+#define SLOT_BUSY          2
+#define SLOT_DONE          3
+
+#define MAX_SLOTS          (2 * CKPT_COMPRESS_MAX_THREADS)
+
+typedef struct Slot {
+  volatile int state;
+  int error;
+  uint32_t flags;
+  uint32_t rawLen;
+  uint32_t compLen;
+  uint64_t seq;
+  uint64_t rawOffset;
+  char *in;
+  char *out;
+} Slot;
+
+typedef struct Pool {
+  char *arena;
+  size_t arenaSize;
+  size_t blockSize;
+  bool decompress;
+  int fd;
+  int nthreads;
+  int nslots;
+  uint64_t numSubmitted;
+  uint64_t numFlushed;
+  uint64_t totalRaw;
+  Slot *cur;
+  volatile int event;
+  volatile int shutdown;
+  volatile pid_t tids[CKPT_COMPRESS_MAX_THREADS];
+  Slot slots[MAX_SLOTS];
+} Pool;
+
+static Pool pool;
+static bool streamActive = false;
+
+static inline uint32_t
+read32(const uint8_t *p)
+{
+  uint32_t v;
+
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint32_t
+hash32(uint32_t v)
+{
+  return (v * 2654435761U) >> (32 - LZ4_HASH_LOG);
+}
+
+static inline uint8_t *
+writeLength(uint8_t *op, size_t len)
+{
+  for (; len >= 255; len -= 255) {
+    *op++ = 255;
+  }
+  *op++ = (uint8_t)len;
+  return op;
+}
+
+/* Returns the compressed size, or 0 if the output would not fit in dstCap. */
+static size_t
+lz4Compress(const uint8_t *src, size_t srcLen,
+            uint8_t *dst, size_t dstCap, uint32_t *table)
+{
+  const uint8_t *ip = src;
+  const uint8_t *anchor = src;
+  const uint8_t *const iend = src + srcLen;
+  uint8_t *op = dst;
+  uint8_t *const oend = dst + dstCap;
+  size_t litLen;
+
+  if (srcLen > LZ4_MFLIMIT) {
+    const uint8_t *const mflimit = iend - LZ4_MFLIMIT;
+    const uint8_t *const matchlimit = iend - LZ4_LASTLITERALS;
+    unsigned step = 1 << LZ4_SKIP_TRIGGER;
+
+    memset(table, 0, LZ4_HASH_BYTES);
+    ip++;
+    while (ip < mflimit) {
+      uint32_t seq = read32(ip);
+      uint32_t h = hash32(seq);
+      const uint8_t *ref = src + table[h];
+      table[h] = (uint32_t)(ip - src);
+
+      if (ref >= ip || ip - ref > LZ4_MAX_DISTANCE || read32(ref) != seq) {
+        // Skip faster over incompressible data.
+        ip += step++ >> LZ4_SKIP_TRIGGER;
+        continue;
+      }
+
+      while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+        ip--;
+        ref--;
+      }
+
+      const uint8_t *mp = ip + LZ4_MINMATCH;
+      const uint8_t *rp = ref + LZ4_MINMATCH;
+      while (mp < matchlimit && *mp == *rp) {
+        mp++;
+        rp++;
+      }
+
+      litLen = ip - anchor;
+      size_t matchLen = mp - ip - LZ4_MINMATCH;
+      if ((size_t)(oend - op) < litLen + litLen / 255 + matchLen / 255 + 6) {
+        return 0;
+      }
+
+      uint8_t *token = op++;
+      if (litLen >= LZ4_RUN_MASK) {
+        *token = LZ4_RUN_MASK << 4;
+        op = writeLength(op, litLen - LZ4_RUN_MASK);
+      } else {
+        *token = (uint8_t)(litLen << 4);
+      }
+      memcpy(op, anchor, litLen);
+      op += litLen;
+
+      size_t offset = ip - ref;
+      *op++ = (uint8_t)(offset & 0xff);
+      *op++ = (uint8_t)(offset >> 8);
+
+      if (matchLen >= LZ4_RUN_MASK) {
+        *token |= LZ4_RUN_MASK;
+        op = writeLength(op, matchLen - LZ4_RUN_MASK);
+      } else {
+        *token |= (uint8_t)matchLen;
+      }
+
+      ip = anchor = mp;
+      step = 1 << LZ4_SKIP_TRIGGER;
+      if (ip < mflimit) {
+        table[hash32(read32(ip - 2))] = (uint32_t)(ip - 2 - src);
+      }
+    }
+  }
+
+  // The last sequence holds only literals.
+  litLen = iend - anchor;
+  if ((size_t)(oend - op) < litLen + litLen / 255 + 2) {
+    return 0;
+  }
+  if (litLen >= LZ4_RUN_MASK) {
+    *op++ = LZ4_RUN_MASK << 4;
+    op = writeLength(op, litLen - LZ4_RUN_MASK);
+  } else {
+    *op++ = (uint8_t)(litLen << 4);
+  }
+  memcpy(op, anchor, litLen);
+  op += litLen;
+  return op - dst;
+}
+
+static inline bool
+readLength(const uint8_t **ip, const uint8_t *iend, size_t *len)
+{
+  unsigned s;
+
+  do {
+    if (*ip >= iend) {
+      return false;
+    }
+    s = *(*ip)++;
+    *len += s;
+  } while (s == 255);
+  return true;
+}
+
+/* Returns the decompressed size, or -1 on a malformed block. */
+static ssize_t
+lz4Decompress(const uint8_t *src, size_t srcLen, uint8_t *dst, size_t dstCap)
+{
+  const uint8_t *ip = src;
+  const uint8_t *const iend = src + srcLen;
+  uint8_t *op = dst;
+  uint8_t *const oend = dst + dstCap;
+
+  while (ip < iend) {
+    unsigned token = *ip++;
+    size_t len = token >> 4;
+    if (len == LZ4_RUN_MASK && !readLength(&ip, iend, &len)) {
+      return -1;
+    }
+    if (len > (size_t)(iend - ip) || len > (size_t)(oend - op)) {
+      return -1;
+    }
+    memcpy(op, ip, len);
+    op += len;
+    ip += len;
+    if (ip == iend) {
+      break;
+    }
+
+    if (iend - ip < 2) {
+      return -1;
+    }
+    size_t offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if (offset == 0 || offset > (size_t)(op - dst)) {
+      return -1;
+    }
+
+    len = token & LZ4_RUN_MASK;
+    if (len == LZ4_RUN_MASK && !readLength(&ip, iend, &len)) {
+      return -1;
+    }
+    len += LZ4_MINMATCH;
+    if (len > (size_t)(oend - op)) {
+      return -1;
+    }
+
+    const uint8_t *ref = op - offset;
+    if (offset >= len) {
+      memcpy(op, ref, len);
+      op += len;
+    } else {
+      while (len-- > 0) {
+        *op++ = *ref++;
+      }
+    }
+  }
+  return op - dst;
+}
+
+static void
+futexWait(volatile int *addr, int val)
+{
+  raw_futex_wait(addr, val);
+}
+
+static void
+futexWake(volatile int *addr)
+{
+  raw_futex_wake(addr);
+}
+
+/* Every slot state change bumps pool.event.  Waiters sample the counter
+ * before testing their condition, so a change in between makes FUTEX_WAIT
+ * return at once instead of losing the wakeup.
+ */
+static void
+notifyAll()
+{
+  __sync_fetch_and_add(&pool.event, 1);
+  futexWake(&pool.event);
+}
+
+static void
+processSlot(Slot *s, uint32_t *table)
+{
+  if (!pool.decompress) {
+    size_t n = 0;
+    if (s->rawLen > 0) {
+      n = lz4Compress((uint8_t *)s->in, s->rawLen,
+                      (uint8_t *)s->out, s->rawLen - 1, table);
+    }
+    if (n == 0) {
+      s->flags = CKPT_COMPRESS_BLOCK_STORED;
+      s->compLen = s->rawLen;
+    } else {
+      s->flags = CKPT_COMPRESS_BLOCK_LZ4;
+      s->compLen = n;
+    }
+  } else if (s->flags & CKPT_COMPRESS_BLOCK_LZ4) {
+    ssize_t n = lz4Decompress((uint8_t *)s->in, s->compLen,
+                              (uint8_t *)s->out, pool.blockSize);
+    s->error = (n != (ssize_t)s->rawLen);
+  }
+}
+
+static Slot *
+claimSlot()
+{
+  int first = pool.numFlushed % pool.nslots;
+
+  for (int i = 0; i < pool.nslots; i++) {
+    Slot *s = &pool.slots[(first + i) % pool.nslots];
+    if (s->state == SLOT_FULL &&
+        __sync_bool_compare_and_swap(&s->state, SLOT_FULL, SLOT_BUSY)) {
+      return s;
+    }
+  }
+  return NULL;
+}
+
+static int
+workerMain(void *arg)
+{
+  uint32_t *table = (uint32_t *)arg;
+
+  while (1) {
+    int event = pool.event;
+    __sync_synchronize();
+    Slot *s = claimSlot();
+    if (s != NULL) {
+      processSlot(s, table);
+      __sync_synchronize();
+      s->state = SLOT_DONE;
+      notifyAll();
+    } else if (pool.shutdown) {
+      break;
+    } else {
+      futexWait(&pool.event, event);
+    }
+  }
+  return 0;
+}
+
+static void
+waitForSlot(Slot *s, int state)
+{
+  while (s->state != state) {
+    int event = pool.event;
+    __sync_synchronize();
+    if (s->state == state) {
+      break;
+    }
+    futexWait(&pool.event, event);
+  }
+  __sync_synchronize();
+}
+
+static void
+startPool(int fd, int nthreads, size_t blockSize, bool decompress)
+{
+  if (nthreads < 1) {
+    nthreads = 1;
+  } else if (nthreads > CKPT_COMPRESS_MAX_THREADS) {
+    nthreads = CKPT_COMPRESS_MAX_THREADS;
+  }
+
+  memset(&pool, 0, sizeof(pool));
+  pool.fd = fd;
+  pool.blockSize = blockSize;
+  pool.decompress = decompress;
+  pool.nthreads = nthreads;
+  pool.nslots = 2 * nthreads;
+
+  /* A shared anonymous mapping is never merged with its neighbors by the
+   * kernel, so it always shows up as a separate area in /proc/self/maps and
+   * can be reliably skipped while writing the memory areas.
+   */
+  size_t perThread = WORKER_STACK_SIZE + LZ4_HASH_BYTES;
+  pool.arenaSize = nthreads * perThread + pool.nslots * 2 * blockSize;
+  pool.arena = (char *)_real_mmap(NULL, pool.arenaSize,
+                                  PROT_READ | PROT_WRITE,
+                                  MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE,
+                                  -1, 0);
+  JASSERT(pool.arena != MAP_FAILED) (pool.arenaSize) (JASSERT_ERRNO)
+  .Text("Failed to allocate compression buffers");
+
+  char *buffers = pool.arena + nthreads * perThread;
+  for (int i = 0; i < pool.nslots; i++) {
+    pool.slots[i].in = buffers + (2 * i) * blockSize;
+    pool.slots[i].out = buffers + (2 * i + 1) * blockSize;
+  }
+
+  // Workers inherit a fully blocked signal mask.
+  sigset_t allSignals, oldMask;
+  sigfillset(&allSignals);
+  _real_syscall(SYS_rt_sigprocmask, SIG_SETMASK, &allSignals, &oldMask,
+                _NSIG / 8);
+  for (int i = 0; i < nthreads; i++) {
+    char *stack = pool.arena + i * perThread;
+    uint32_t *table = (uint32_t *)(stack + WORKER_STACK_SIZE);
+    pid_t tid = clone(workerMain, stack + WORKER_STACK_SIZE,
+                      WORKER_CLONE_FLAGS, table,
+                      &pool.tids[i], NULL, &pool.tids[i]);
+    JASSERT(tid > 0) (JASSERT_ERRNO).Text("Failed to create worker thread");
+  }
+  _real_syscall(SYS_rt_sigprocmask, SIG_SETMASK, &oldMask, NULL, _NSIG / 8);
+}
+
+static void
+stopPool()
+{
+  pool.shutdown = 1;
+  notifyAll();
+
+  // The kernel clears each tid and does a FUTEX_WAKE when the thread exits.
+  for (int i = 0; i < pool.nthreads; i++) {
+    pid_t tid;
+    while ((tid = pool.tids[i]) != 0) {
+      futexWait(&pool.tids[i], tid);
+    }
+  }
+
+  JASSERT(_real_munmap(pool.arena, pool.arenaSize) == 0) (JASSERT_ERRNO);
+  pool.arena = NULL;
+  pool.arenaSize = 0;
+}
+
+static void
+flushOldest()
+{
+  Slot *s = &pool.slots[pool.numFlushed % pool.nslots];
+  waitForSlot(s, SLOT_DONE);
+
+  const char *data = (s->flags & CKPT_COMPRESS_BLOCK_LZ4) ? s->out : s->in;
+  if (!pool.decompress) {
+    CkptCompressBlockHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.flags = s->flags;
+    hdr.compLen = s->compLen;
+    hdr.seq = s->seq;
+    hdr.rawOffset = s->rawOffset;
+    hdr.rawLen = s->rawLen;
+    JASSERT(Util::writeAll(pool.fd, &hdr, sizeof(hdr)) == (ssize_t)sizeof(hdr))
+      (JASSERT_ERRNO);
+    JASSERT(Util::writeAll(pool.fd, data, s->compLen) == s->compLen)
+      (JASSERT_ERRNO);
+  } else {
+    JASSERT(!s->error) (s->seq) (s->rawOffset) (s->compLen)
+    .Text("Corrupted block in compressed checkpoint image");
+    JASSERT(Util::writeAll(pool.fd, data, s->rawLen) == s->rawLen)
+      (JASSERT_ERRNO);
+  }
+
+  s->state = SLOT_FREE;
+  pool.numFlushed++;
+}
+
+static Slot *
+acquireSlot()
+{
+  if (pool.numSubmitted - pool.numFlushed == (uint64_t)pool.nslots) {
+    flushOldest();
+  }
+  Slot *s = &pool.slots[pool.numSubmitted % pool.nslots];
+  JASSERT(s->state == SLOT_FREE) (s->state);
+  s->error = 0;
+  s->rawLen = 0;
+  s->compLen = 0;
+  return s;
+}
+
+static void
+submitSlot(Slot *s)
+{
+  s->seq = pool.numSubmitted++;
+  __sync_synchronize();
+  s->state = SLOT_FULL;
+  notifyAll();
+}
+
+static void
+flushAll()
+{
+  while (pool.numFlushed < pool.numSubmitted) {
+    flushOldest();
+  }
+}
+
+int
+CkptCompress::numThreads()
+{
+  const char *str = getenv(ENV_VAR_PARALLEL_COMPRESSION);
+
+  if (str == NULL || *str == '\0') {
+    return 0;
+  }
+
+  char *endptr;
+  long n = strtol(str, &endptr, 10);
+  if (*endptr != '\0' || n < 0) {
+    JWARNING(false) (ENV_VAR_PARALLEL_COMPRESSION) (str)
+    .Text("Env var not defined as a non-negative number."
+          "  Parallel compression will not be used.");
+    return 0;
+  }
+  return n > CKPT_COMPRESS_MAX_THREADS ? CKPT_COMPRESS_MAX_THREADS : n;
+}
+
+void
+CkptCompress::beginStream(int fd, int nthreads)
+{
+  JASSERT(!streamActive);
+
+  // mtcp_writememoryareas() closes its fd when done; keep our own.
+  int outFd = _real_dup(fd);
+  JASSERT(outFd != -1) (fd) (JASSERT_ERRNO);
+  startPool(outFd, nthreads, CKPT_COMPRESS_BLOCK_SIZE, false);
+
+  CkptCompressStreamHeader hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, CKPT_COMPRESS_MAGIC, CKPT_COMPRESS_MAGIC_LEN);
+  hdr.version = CKPT_COMPRESS_VERSION;
+  hdr.blockSize = CKPT_COMPRESS_BLOCK_SIZE;
+  JASSERT(Util::writeAll(outFd, &hdr, sizeof(hdr)) == (ssize_t)sizeof(hdr))
+    (JASSERT_ERRNO);
+
+  streamActive = true;
+  JTRACE("Parallel compression of checkpoint image") (nthreads);
+}
+
+bool
+CkptCompress::isActive()
+{
+  return streamActive;
+}
+
+void
+CkptCompress::write(const void *buf, size_t len)
+{
+  const char *ptr = (const char *)buf;
+
+  JASSERT(streamActive);
+  while (len > 0) {
+    if (pool.cur == NULL) {
+      pool.cur = acquireSlot();
+      pool.cur->rawOffset = pool.totalRaw;
+    }
+
+    Slot *s = pool.cur;
+    size_t n = pool.blockSize - s->rawLen;
+    if (n > len) {
+      n = len;
+    }
+    memcpy(s->in + s->rawLen, ptr, n);
+    s->rawLen += n;
+    pool.totalRaw += n;
+    ptr += n;
+    len -= n;
+
+    if (s->rawLen == pool.blockSize) {
+      submitSlot(s);
+      pool.cur = NULL;
+    }
+  }
+}
+
+void
+CkptCompress::endStream()
+{
+  JASSERT(streamActive);
+
+  if (pool.cur != NULL && pool.cur->rawLen > 0) {
+    submitSlot(pool.cur);
+  }
+  pool.cur = NULL;
+  flushAll();
+
+  CkptCompressBlockHeader hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.flags = CKPT_COMPRESS_BLOCK_END;
+  hdr.seq = pool.numSubmitted;
+  hdr.rawOffset = pool.totalRaw;
+  JASSERT(Util::writeAll(pool.fd, &hdr, sizeof(hdr)) == (ssize_t)sizeof(hdr))
+    (JASSERT_ERRNO);
+
+  stopPool();
+  JASSERT(_real_close(pool.fd) == 0) (JASSERT_ERRNO);
+  streamActive = false;
+  JTRACE("Compressed checkpoint stream complete")
+    (pool.numSubmitted) (pool.totalRaw);
+}
+
+bool
+CkptCompress::isArenaArea(const ProcMapsArea &area)
+{
+  return streamActive &&
+         area.addr >= pool.arena &&
+         area.addr < pool.arena + pool.arenaSize;
+}
+
+bool
+CkptCompress::isCompressedStream(int fd)
+{
+  char magic[CKPT_COMPRESS_MAGIC_LEN];
+  off_t offset = lseek(fd, 0, SEEK_CUR);
+
+  if (offset == -1) {
+    // A pipe from an external decompressor.
+    return false;
+  }
+  return pread(fd, magic, sizeof(magic), offset) == sizeof(magic) &&
+         memcmp(magic, CKPT_COMPRESS_MAGIC, CKPT_COMPRESS_MAGIC_LEN) == 0;
+}
+
+void
+CkptCompress::decompressStream(int infd, int outfd, int nthreads)
+{
+  CkptCompressStreamHeader shdr;
+
+  JASSERT(Util::readAll(infd, &shdr, sizeof(shdr)) == (ssize_t)sizeof(shdr))
+    (JASSERT_ERRNO);
+  JASSERT(memcmp(shdr.magic, CKPT_COMPRESS_MAGIC,
+                 CKPT_COMPRESS_MAGIC_LEN) == 0);
+  JASSERT(shdr.version == CKPT_COMPRESS_VERSION) (shdr.version);
+  JASSERT(shdr.blockSize > 0 && shdr.blockSize <= 64 * 1024 * 1024)
+    (shdr.blockSize);
+
+  startPool(outfd, nthreads, shdr.blockSize, true);
+
+  while (1) {
+    CkptCompressBlockHeader hdr;
+    JASSERT(Util::readAll(infd, &hdr, sizeof(hdr)) == (ssize_t)sizeof(hdr))
+      (JASSERT_ERRNO).Text("Truncated compressed checkpoint image");
+
+    if (hdr.flags == CKPT_COMPRESS_BLOCK_END) {
+      JASSERT(hdr.rawOffset == pool.totalRaw) (hdr.rawOffset) (pool.totalRaw);
+      break;
+    }
+
+    JASSERT(hdr.seq == pool.numSubmitted) (hdr.seq) (pool.numSubmitted);
+    JASSERT(hdr.rawOffset == pool.totalRaw) (hdr.rawOffset) (pool.totalRaw);
+    JASSERT(hdr.flags == CKPT_COMPRESS_BLOCK_LZ4 ||
+            hdr.flags == CKPT_COMPRESS_BLOCK_STORED) (hdr.flags);
+    JASSERT(hdr.rawLen <= pool.blockSize && hdr.compLen <= pool.blockSize)
+      (hdr.rawLen) (hdr.compLen);
+    JASSERT(hdr.flags != CKPT_COMPRESS_BLOCK_STORED ||
+            hdr.rawLen == hdr.compLen) (hdr.rawLen) (hdr.compLen);
+
+    Slot *s = acquireSlot();
+    JASSERT(Util::readAll(infd, s->in, hdr.compLen) == hdr.compLen)
+      (JASSERT_ERRNO).Text("Truncated compressed checkpoint image");
+    s->flags = hdr.flags;
+    s->compLen = hdr.compLen;
+    s->rawLen = hdr.rawLen;
+    s->rawOffset = hdr.rawOffset;
+    pool.totalRaw += hdr.rawLen;
+    submitSlot(s);
+  }
+
+  flushAll();
+  stopPool();
+}
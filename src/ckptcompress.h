@@ -0,0 +1,91 @@
+/****************************************************************************
+ *   Copyright (C) 2006-2013 by Jason Ansel, Kapil Arya, and Gene Cooperman *
+ *   jansel@csail.mit.edu, kapil@ccs.neu.edu, gene@ccs.neu.edu              *
+ *                                                                          *
+ *  This file is part of DMTCP.                                             *
+ *                                                                          *
+ *  DMTCP is free software: you can redistribute it and/or                  *
+ *  modify it under the terms of the GNU Lesser General Public License as   *
+ *  published by the Free Software Foundation, either version 3 of the      *
+ *  License, or (at your option) any later version.                         *
+ *                                                                          *
+ *  DMTCP is distributed in the hope that it will be useful,                *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU Lesser General Public License for more details.                     *
+ *                                                                          *
+ *  You should have received a copy of the GNU Lesser General Public        *
+ *  License along with DMTCP:dmtcp/src.  If not, see                        *
+ *  <http://www.gnu.org/licenses/>.                                         *
+ ****************************************************************************/
+
+#ifndef CKPT_COMPRESS_H
+#define CKPT_COMPRESS_H
+
+#include <stdint.h>
+#include "procmapsarea.h"
+
+/* Built-in parallel block compression of checkpoint images.
+ *
+ * The image stream that follows the DMTCP header is cut into independent
+ * blocks of CKPT_COMPRESS_BLOCK_SIZE bytes.  Each block is compressed by a
+ * pool of worker threads with an LZ4-compatible block codec and written out
+ * in order, preceded by a CkptCompressBlockHeader.  Since every block header
+ * records its sequence number, its offset in the uncompressed stream and its
+ * compressed length, the reader can hand blocks to its own thread pool and
+ * decompress them in parallel.
+ *
+ * Layout:  [DMTCP header (uncompressed)] [stream header] {block header, data}*
+ *          [end block header]
+ */
+
+#define CKPT_COMPRESS_MAGIC        "\211DMTCPZ\n"
+#define CKPT_COMPRESS_MAGIC_LEN    8
+#define CKPT_COMPRESS_VERSION      1
+#define CKPT_COMPRESS_BLOCK_SIZE   (1024 * 1024)
+#define CKPT_COMPRESS_MAX_THREADS  64
+
+#define CKPT_COMPRESS_BLOCK_LZ4    0x1
+#define CKPT_COMPRESS_BLOCK_STORED 0x2
+#define CKPT_COMPRESS_BLOCK_END    0x4
+
+typedef struct CkptCompressStreamHeader {
+  char magic[CKPT_COMPRESS_MAGIC_LEN];
+  uint32_t version;
+  uint32_t blockSize;
+  uint64_t reserved[2];
+} CkptCompressStreamHeader;
+
+typedef struct CkptCompressBlockHeader {
+  uint32_t flags;
+  uint32_t compLen;
+  uint64_t seq;
+  uint64_t rawOffset;   // For the end block: total uncompressed bytes.
+  uint64_t rawLen;
+} CkptCompressBlockHeader;
+
+#ifdef __cplusplus
+namespace dmtcp
+{
+namespace CkptCompress
+{
+// Number of compression threads requested through
+// DMTCP_PARALLEL_COMPRESSION, or 0 if built-in compression is disabled.
+int numThreads();
+
+// Writer side.  Called by the checkpoint thread with all user threads
+// suspended.  No malloc is done; all buffers and worker stacks live in a
+// single mmap'ed arena that mtcp_writememoryareas() must not save.
+void beginStream(int fd, int nthreads);
+bool isActive();
+void write(const void *buf, size_t len);
+void endStream();
+bool isArenaArea(const ProcMapsArea &area);
+
+// Reader side, used by dmtcp_restart.
+bool isCompressedStream(int fd);
+void decompressStream(int infd, int outfd, int nthreads);
+}
+}
+#endif // ifdef __cplusplus
+#endif // ifndef CKPT_COMPRESS_H
@@ -0,0 +1,351 @@
+/****************************************************************************
+ *   Copyright (C) 2006-2013 by Jason Ansel, Kapil Arya, and Gene Cooperman *
+ *   jansel@csail.mit.edu, kapil@ccs.neu.edu, gene@ccs.neu.edu              *
+ *                                                                          *
+ *  This file is part of DMTCP.                                             *
+ *                                                                          *
+ *  DMTCP is free software: you can redistribute it and/or                  *
+ *  modify it under the terms of the GNU Lesser General Public License as   *
+ *  published by the Free Software Foundation, either version 3 of the      *
+ *  License, or (at your option) any later version.                         *
+ *                                                                          *
+ *  DMTCP is distributed in the hope that it will be useful,                *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU Lesser General Public License for more details.                     *
+ *                                                                          *
+ *  You should have received a copy of the GNU Lesser General Public        *
+ *  License along with DMTCP:dmtcp/src.  If not, see                        *
+ *  <http://www.gnu.org/licenses/>.                                         *
+ ****************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "../jalib/jassert.h"
+#include "../jalib/jfilesystem.h"
+#include "ckptdedup.h"
+#include "constants.h"
+#include "mtcp/mtcp_header.h"
+#include "processinfo.h"
+#include "syscallwrappers.h"
+#include "util.h"
+
+using namespace dmtcp;
+
+static bool storeUsable = false;
+static char storePath[PATH_MAX] = { 0 };
+
+// No memory may be allocated while the memory areas are being written.
+static CkptDedupRef refs[CKPT_DEDUP_REFS_PER_RUN];
+static char chunkPath[PATH_MAX];
+static char tmpPath[PATH_MAX];
+static char chunkBuf[CKPT_DEDUP_CHUNK_SIZE];
+
+enum ChunkStatus {
+  CHUNK_STORED,
+  CHUNK_TAKEN,    // The name of the chunk holds other contents.
+  CHUNK_FAILED
+};
+
+/* MurmurHash3_x64_128, by Austin Appleby (public domain). */
+static inline uint64_t
+rotl64(uint64_t x, int8_t r)
+{
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t
+fmix64(uint64_t k)
+{
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdULL;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ULL;
+  k ^= k >> 33;
+  return k;
+}
+
+static void
+hashChunk(const void *data, size_t len, CkptDedupRef *ref)
+{
+  const uint8_t *p = (const uint8_t *)data;
+  const size_t nblocks = len / 16;
+  const uint64_t c1 = 0x87c37b91114253d5ULL;
+  const uint64_t c2 = 0x4cf5ad432745937fULL;
+
+  // The length is the seed: chunks of different sizes never collide.
+  uint64_t h1 = len;
+  uint64_t h2 = len;
+
+  for (size_t i = 0; i < nblocks; i++) {
+    uint64_t k1, k2;
+    memcpy(&k1, p + i * 16, sizeof(k1));
+    memcpy(&k2, p + i * 16 + 8, sizeof(k2));
+
+    k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+    h1 = rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+    k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+    h2 = rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+  }
+
+  // Chunks are made of whole pages; there is no tail.
+  JASSERT(len % 16 == 0) (len);
+
+  h1 ^= len; h2 ^= len;
+  h1 += h2; h2 += h1;
+  h1 = fmix64(h1); h2 = fmix64(h2);
+  h1 += h2; h2 += h1;
+
+  ref->hash[0] = h1;
+  ref->hash[1] = h2;
+  if (h1 == 0 && h2 == 0) {
+    // Reserved for zero chunks.
+    ref->hash[1] = 1;
+  }
+}
+
+static const char *
+chunkPathName(const char *dir, const CkptDedupRef &ref)
+{
+  // Spread the chunks over 256 subdirectories.
+  int n = snprintf(chunkPath, sizeof(chunkPath), "%s/%02x/%016llx%016llx",
+                   dir, (unsigned)(ref.hash[0] >> 56),
+                   (unsigned long long)ref.hash[0],
+                   (unsigned long long)ref.hash[1]);
+  JASSERT(n > 0 && (size_t)n < sizeof(chunkPath)) (dir);
+  return chunkPath;
+}
+
+/* Returns true if fd is a regular file that holds exactly the len bytes at
+ * data.  MurmurHash3 is not collision-resistant, and the store may be
+ * shared by all the processes of a node: a chunk of the same name is not
+ * proof of the same contents.
+ */
+static bool
+chunkHolds(int fd, const void *data, size_t len)
+{
+  struct stat st;
+
+  return fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+         (uint64_t)st.st_size == len &&
+         Util::readAll(fd, chunkBuf, len) == (ssize_t)len &&
+         memcmp(chunkBuf, data, len) == 0;
+}
+
+static ChunkStatus
+storeChunk(VA addr, size_t len, CkptDedupRef *ref)
+{
+  if (Util::areZeroPages(addr, len / MTCP_PAGE_SIZE)) {
+    ref->hash[0] = ref->hash[1] = 0;
+    return CHUNK_STORED;
+  }
+
+  hashChunk(addr, len, ref);
+  const char *path = chunkPathName(storePath, *ref);
+  int fd = _real_open(path, O_RDONLY | O_NOFOLLOW | O_NONBLOCK, 0);
+  if (fd != -1) {
+    bool same = chunkHolds(fd, addr, len);
+    _real_close(fd);
+    return same ? CHUNK_STORED : CHUNK_TAKEN;
+  } else if (errno != ENOENT) {
+    return CHUNK_FAILED;
+  }
+
+  // Publish the chunk atomically; another process may be storing it, too.
+  const UniquePid &upid = ProcessInfo::instance().upid();
+  snprintf(tmpPath, sizeof(tmpPath), "%s.%llx-%d-%llx.tmp", path,
+           (unsigned long long)upid.hostid(), (int)upid.pid(),
+           (unsigned long long)upid.time());
+  fd = _real_open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    return CHUNK_FAILED;
+  }
+  bool ok = Util::writeAll(fd, addr, len) == (ssize_t)len;
+  ok = _real_close(fd) == 0 && ok;
+  bool taken = false;
+  if (ok && _real_syscall(SYS_linkat, AT_FDCWD, tmpPath,
+                          AT_FDCWD, path, 0) != 0) {
+    // Stored by another process meanwhile.
+    ok = errno == EEXIST;
+    fd = ok ? _real_open(path, O_RDONLY | O_NOFOLLOW | O_NONBLOCK, 0) : -1;
+    taken = fd == -1 || !chunkHolds(fd, addr, len);
+    if (fd != -1) {
+      _real_close(fd);
+    }
+  }
+  _real_syscall(SYS_unlinkat, AT_FDCWD, tmpPath, 0);
+  return !ok ? CHUNK_FAILED : taken ? CHUNK_TAKEN : CHUNK_STORED;
+}
+
+string
+CkptDedup::storeDir()
+{
+  const char *dir = getenv(ENV_VAR_DEDUP_DIR);
+
+  return dir == NULL ? "" : dir;
+}
+
+void
+CkptDedup::prepareImage(bool useStore)
+{
+  string dir = useStore ? storeDir() : "";
+
+  storeUsable = false;
+  if (!dir.empty()) {
+    if (dir[0] != '/') {
+      dir = jalib::Filesystem::GetCWD() + "/" + dir;
+    }
+    storeUsable = dir.length() + 64 < sizeof(storePath) &&
+                  (jalib::Filesystem::mkdir_r(dir, 0755) == 0 ||
+                   errno == EEXIST);
+    for (int i = 0; storeUsable && i < 256; i++) {
+      char sub[8];
+      snprintf(sub, sizeof(sub), "/%02x", i);
+      string subdir = dir + sub;
+      storeUsable = mkdir(subdir.c_str(), 0755) == 0 || errno == EEXIST;
+    }
+    JWARNING(storeUsable) (dir) (JASSERT_ERRNO)
+    .Text("Cannot use the page deduplication store; writing full images.");
+  }
+
+  if (storeUsable) {
+    strcpy(storePath, dir.c_str());
+    ProcessInfo::instance().setDedupStoreDir(dir);
+  } else {
+    ProcessInfo::instance().setDedupStoreDir("");
+  }
+}
+
+size_t
+CkptDedup::storeChunks(VA addr, size_t len, const CkptDedupRef **chunkRefs)
+{
+  size_t n = 0;
+  VA start = addr;
+  VA endAddr = addr + MIN(len, (size_t)CKPT_DEDUP_REFS_PER_RUN *
+                                 CKPT_DEDUP_CHUNK_SIZE);
+
+  if (!storeUsable) {
+    return 0;
+  }
+
+  while (addr < endAddr) {
+    size_t chunkLen = MIN(CKPT_DEDUP_CHUNK_SIZE, (size_t)(endAddr - addr));
+    ChunkStatus status = storeChunk(addr, chunkLen, &refs[n]);
+    if (status == CHUNK_FAILED) {
+      JWARNING(false) (storePath) (chunkPath) (JASSERT_ERRNO)
+      .Text("Failed to write to the page deduplication store; the rest of\n"
+            "  this image is written without it.");
+      storeUsable = false;
+      return 0;
+    } else if (status == CHUNK_TAKEN) {
+      JWARNING(false) (chunkPath)
+      .Text("A chunk of the page deduplication store has other contents\n"
+            "  under the same name; the pages are written to the image.");
+      break;
+    }
+    n++;
+    addr += chunkLen;
+  }
+  *chunkRefs = refs;
+  return addr - start;
+}
+
+// ************************ For restarting *****************
+
+static void
+copyChunk(const char *dir, const CkptDedupRef &ref, size_t len, int outFd)
+{
+  if (ref.hash[0] == 0 && ref.hash[1] == 0) {
+    memset(chunkBuf, 0, len);
+  } else {
+    const char *path = chunkPathName(dir, ref);
+    struct stat st;
+    CkptDedupRef got;
+    int fd = open(path, O_RDONLY | O_NOFOLLOW | O_NONBLOCK);
+    JASSERT(fd != -1) (path) (JASSERT_ERRNO)
+    .Text("Missing chunk in the page deduplication store");
+    JASSERT(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+            (uint64_t)st.st_size == len) (path) (len) (st.st_size)
+    .Text("Chunk of the wrong size in the page deduplication store");
+    JASSERT(Util::readAll(fd, chunkBuf, len) == (ssize_t)len) (path) (len)
+    .Text("Truncated chunk in the page deduplication store");
+    close(fd);
+
+    // Catches chunks modified since they were stored.
+    hashChunk(chunkBuf, len, &got);
+    JASSERT(got.hash[0] == ref.hash[0] && got.hash[1] == ref.hash[1]) (path)
+    .Text("Corrupt chunk in the page deduplication store");
+  }
+  JASSERT(Util::writeAll(outFd, chunkBuf, len) == (ssize_t)len)
+    (JASSERT_ERRNO);
+}
+
+static void
+copyBytes(int fd, int outFd, size_t len)
+{
+  while (len > 0) {
+    size_t n = MIN(len, sizeof(chunkBuf));
+    JASSERT(Util::readAll(fd, chunkBuf, n) == (ssize_t)n)
+      (JASSERT_ERRNO).Text("Truncated checkpoint image");
+    JASSERT(Util::writeAll(outFd, chunkBuf, n) == (ssize_t)n) (JASSERT_ERRNO);
+    len -= n;
+  }
+}
+
+static MtcpAreaRecordBuf record;
+static MtcpAreaRun origRuns[MTCP_AREA_MAX_RUNS];
+
+void
+CkptDedup::resolveStream(int fd, int outFd, const string &storeDir)
+{
+  copyBytes(fd, outFd, sizeof(MtcpHeader));
+
+  while (1) {
+    MtcpAreaRecord *rec = &record.rec;
+    Util::readAreaRecord(fd, &record);
+
+    // The references become the data itself; the record keeps its size.
+    MtcpAreaRun *runs = mtcp_area_runs(rec);
+    memcpy(origRuns, runs, rec->numRuns * sizeof(*runs));
+    for (size_t i = 0; i < rec->numRuns; i++) {
+      if (MTCP_AREA_RUN_TYPE(runs[i]) == MTCP_AREA_RUN_DEDUP) {
+        runs[i] = MTCP_AREA_RUN(MTCP_AREA_RUN_DATA, MTCP_AREA_RUN_LEN(runs[i]));
+      }
+    }
+    JASSERT(Util::writeAll(outFd, rec, rec->recordLen) ==
+            (ssize_t)rec->recordLen) (JASSERT_ERRNO);
+    if (rec->size == (uint64_t)-1) {
+      break;
+    }
+
+    for (size_t i = 0; i < rec->numRuns; i++) {
+      size_t len = MTCP_AREA_RUN_LEN(origRuns[i]);
+      switch (MTCP_AREA_RUN_TYPE(origRuns[i])) {
+      case MTCP_AREA_RUN_DATA:
+        copyBytes(fd, outFd, len);
+        break;
+
+      case MTCP_AREA_RUN_DEDUP:
+        while (len > 0) {
+          size_t n = MIN(CKPT_DEDUP_REFS_SIZE(len) / sizeof(refs[0]),
+                         (size_t)CKPT_DEDUP_REFS_PER_RUN);
+          JASSERT(Util::readAll(fd, refs, n * sizeof(refs[0])) ==
+                  (ssize_t)(n * sizeof(refs[0]))) (JASSERT_ERRNO)
+          .Text("Truncated checkpoint image");
+          for (size_t j = 0; j < n; j++) {
+            size_t chunkLen = MIN(len, CKPT_DEDUP_CHUNK_SIZE);
+            copyChunk(storeDir.c_str(), refs[j], chunkLen, outFd);
+            len -= chunkLen;
+          }
+        }
+        break;
+      }
+    }
+  }
+}
@@ -0,0 +1,88 @@
+/****************************************************************************
+ *   Copyright (C) 2006-2013 by Jason Ansel, Kapil Arya, and Gene Cooperman *
+ *   jansel@csail.mit.edu, kapil@ccs.neu.edu, gene@ccs.neu.edu              *
+ *                                                                          *
+ *  This file is part of DMTCP.                                             *
+ *                                                                          *
+ *  DMTCP is free software: you can redistribute it and/or                  *
+ *  modify it under the terms of the GNU Lesser General Public License as   *
+ *  published by the Free Software Foundation, either version 3 of the      *
+ *  License, or (at your option) any later version.                         *
+ *                                                                          *
+ *  DMTCP is distributed in the hope that it will be useful,                *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU Lesser General Public License for more details.                     *
+ *                                                                          *
+ *  You should have received a copy of the GNU Lesser General Public        *
+ *  License along with DMTCP:dmtcp/src.  If not, see                        *
+ *  <http://www.gnu.org/licenses/>.                                         *
+ ****************************************************************************/
+
+#ifndef CKPT_DEDUP_H
+#define CKPT_DEDUP_H
+
+#include <stdint.h>
+#include "procmapsarea.h"
+
+/* Content-addressed deduplication of memory pages across the processes of a
+ * computation.
+ *
+ * With DMTCP_DEDUP_DIR set, the contents of file-backed and read-only memory
+ * areas (library data segments, lookup tables, shared memory segments) are
+ * cut into chunks of CKPT_DEDUP_CHUNK_SIZE bytes and stored once in that
+ * directory, named by a 128-bit hash of their contents.  The image records
+ * a run of type MTCP_AREA_RUN_DEDUP, whose data is one CkptDedupRef per
+ * chunk (at most CKPT_DEDUP_REFS_PER_RUN) instead of the pages.  When
+ * many processes on a node checkpoint into the same directory, each
+ * distinct chunk is written only once.  The hash (MurmurHash3) is not
+ * collision-resistant: a chunk already in the store is compared with the
+ * memory before it is referred to.
+ *
+ * The store is never pruned by DMTCP: it must be kept as long as any image
+ * that refers to it.  dmtcp_restart resolves the references, checking the
+ * size and the hash of each chunk, and hands a complete image to
+ * mtcp_restart.
+ */
+
+#define CKPT_DEDUP_CHUNK_SIZE    (64 * 1024)
+#define CKPT_DEDUP_REFS_PER_RUN  256
+
+typedef struct CkptDedupRef {
+  uint64_t hash[2];   // { 0, 0 } for a chunk of zeroes.
+} CkptDedupRef;
+
+// Size of the references to the chunks of len bytes of memory.
+#define CKPT_DEDUP_REFS_SIZE(len)                                \
+  (((len) + CKPT_DEDUP_CHUNK_SIZE - 1) / CKPT_DEDUP_CHUNK_SIZE * \
+    sizeof(CkptDedupRef))
+
+#ifdef __cplusplus
+# include "dmtcpalloc.h"
+
+namespace dmtcp
+{
+namespace CkptDedup
+{
+// Store directory requested through DMTCP_DEDUP_DIR, or "" if disabled.
+string storeDir();
+
+// Called by the checkpoint thread before the DMTCP header is written.  An
+// image that leaves the node (live migration) does not use the store.
+void prepareImage(bool useStore = true);
+
+// Store the chunks of the first bytes at addr, at most len, and return the
+// number of bytes stored, with the references of the chunks in *chunkRefs.
+// A chunk is only referred to if the store holds the same bytes under its
+// name; storing stops before a chunk whose name holds other contents.
+// Returns 0 if the store cannot be used, or if the first chunk is such;
+// the caller then writes the data itself.  The memory must be readable.
+size_t storeChunks(VA addr, size_t len, const CkptDedupRef **chunkRefs);
+
+// Used by dmtcp_restart: replace the references of the stream fd by the
+// contents of the chunks in storeDir.
+void resolveStream(int fd, int outFd, const string &storeDir);
+}
+}
+#endif // ifdef __cplusplus
+#endif // ifndef CKPT_DEDUP_H
@@ -0,0 +1,563 @@
+/****************************************************************************
+ *   Copyright (C) 2006-2013 by Jason Ansel, Kapil Arya, and Gene Cooperman *
+ *   jansel@csail.mit.edu, kapil@ccs.neu.edu, gene@ccs.neu.edu              *
+ *                                                                          *
+ *  This file is part of DMTCP.                                             *
+ *                                                                          *
+ *  DMTCP is free software: you can redistribute it and/or                  *
+ *  modify it under the terms of the GNU Lesser General Public License as   *
+ *  published by the Free Software Foundation, either version 3 of the      *
+ *  License, or (at your option) any later version.                         *
+ *                                                                          *
+ *  DMTCP is distributed in the hope that it will be useful,                *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU Lesser General Public License for more details.                     *
+ *                                                                          *
+ *  You should have received a copy of the GNU Lesser General Public        *
+ *  License along with DMTCP:dmtcp/src.  If not, see                        *
+ *  <http://www.gnu.org/licenses/>.                                         *
+ ****************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "../jalib/jassert.h"
+#include "../jalib/jconvert.h"
+#include "../jalib/jfilesystem.h"
+#include "ckptincremental.h"
+#include "constants.h"
+#include "mtcp/mtcp_header.h"
+#include "processinfo.h"
+#include "procselfmaps.h"
+#include "syscallwrappers.h"
+#include "util.h"
+
+#define PM_ENTRIES_PER_IO 512
+
+#define CLEAR_REFS_SOFT_DIRTY "4"
+
+using namespace dmtcp;
+
+typedef struct PageRange {
+  VA start;
+  VA end;
+  size_t bitOffset;
+} PageRange;
+
+// State of the current incremental chain.
+static uint32_t chainLength = 0;
+static bool primed = false;
+static uint32_t primedNumRestarts = 0;
+static bool softDirtyWorks = true;
+static char lastImage[PATH_MAX] = { 0 };
+static bool migrationPrimed = false;
+
+// State of the image being written.
+static bool trackThisImage = false;
+static bool imageIsIncremental = false;
+static int pagemapFd = -1;
+static PageRange *ranges = NULL;
+static size_t numRanges = 0;
+static size_t rangesSize = 0;
+static uint64_t *cleanBits = NULL;
+static size_t cleanBitsSize = 0;
+
+// Touched after clearing the soft-dirty bits to verify that the kernel
+// supports them (CONFIG_MEM_SOFT_DIRTY).
+static volatile char softDirtyProbe;
+
+static bool
+isTrackedArea(const ProcMapsArea &area)
+{
+  // Same selection as mtcp_write_non_rwx_and_anonymous_pages(), restricted to
+  // private, accessible areas.  Huge PROT_NONE reservations are left out.
+  if ((area.flags & MAP_PRIVATE) == 0 ||
+      (area.prot & (PROT_READ | PROT_WRITE)) == 0) {
+    return false;
+  }
+  return area.name[0] == '\0' ||
+         strcmp(area.name, "[heap]") == 0 ||
+         strcmp(area.name, "[stack]") == 0 ||
+         Util::strStartsWith(area.name, "[stack:");
+}
+
+static ssize_t
+readPagemap(VA addr, uint64_t *entries, size_t count)
+{
+  off_t offset = ((uintptr_t)addr / Util::pageSize()) * sizeof(uint64_t);
+  size_t numBytes = count * sizeof(uint64_t);
+
+  return _real_syscall(SYS_pread64, pagemapFd, entries, numBytes, offset);
+}
+
+static string
+chainImageName(const string &ckptFilename, uint32_t idx)
+{
+  return ckptFilename + "." + jalib::XToString(idx);
+}
+
+static bool
+clearSoftDirtyBits()
+{
+  int fd = _real_open("/proc/self/clear_refs", O_WRONLY, 0);
+
+  if (fd == -1) {
+    return false;
+  }
+  ssize_t rc = _real_write(fd, CLEAR_REFS_SOFT_DIRTY, 1);
+  _real_close(fd);
+  if (rc != 1) {
+    return false;
+  }
+
+  // Verify on a page that we know was just written.
+  softDirtyProbe = 1;
+  uint64_t entry = 0;
+  if (readPagemap((VA)&softDirtyProbe, &entry, 1) != sizeof(entry)) {
+    return false;
+  }
+  return (entry & PM_SOFT_DIRTY) != 0;
+}
+
+static bool
+isClean(size_t bitIdx)
+{
+  return (cleanBits[bitIdx / 64] & (1ULL << (bitIdx % 64))) != 0;
+}
+
+int
+CkptIncremental::maxChainLength()
+{
+  const char *str = getenv(ENV_VAR_INCREMENTAL_CKPT);
+
+  if (str == NULL || *str == '\0') {
+    return 0;
+  }
+
+  char *endptr;
+  long n = strtol(str, &endptr, 10);
+  if (*endptr != '\0' || n < 0) {
+    JWARNING(false) (ENV_VAR_INCREMENTAL_CKPT) (str)
+    .Text("Env var not defined as a non-negative number."
+          "  Incremental checkpointing will not be used.");
+    return 0;
+  }
+  return n;
+}
+
+void
+CkptIncremental::prepareImage(const string &ckptFilename, bool untracked)
+{
+  int maxChain = maxChainLength();
+  string parent;
+
+  trackThisImage = maxChain > 0 && softDirtyWorks;
+  if (trackThisImage && untracked) {
+    // The soft-dirty bits of a forked child are not those of the parent.
+    JTRACE("Incremental checkpoint disabled for this image");
+    trackThisImage = false;
+  }
+
+  imageIsIncremental = false;
+  if (trackThisImage && primed &&
+      primedNumRestarts == ProcessInfo::instance().numRestarts() &&
+      chainLength > 0 && chainLength <= (uint32_t)maxChain &&
+      ckptFilename == lastImage) {
+    // Keep the current image under a name of its own; the new image will
+    // replace ckptFilename.
+    string parentPath = chainImageName(ckptFilename, chainLength - 1);
+    unlink(parentPath.c_str());
+    if (link(ckptFilename.c_str(), parentPath.c_str()) == 0) {
+      imageIsIncremental = true;
+      parent = jalib::Filesystem::BaseName(parentPath);
+    } else {
+      JWARNING(false) (ckptFilename) (parentPath) (JASSERT_ERRNO)
+      .Text("Failed to preserve parent image; writing a full image.");
+    }
+  }
+
+  ProcessInfo::instance().setParentCkptFilename(parent);
+  JTRACE("Preparing checkpoint image")
+    (trackThisImage) (imageIsIncremental) (chainLength) (parent);
+}
+
+void
+CkptIncremental::finishImage(const string &ckptFilename)
+{
+  if (!imageIsIncremental && ckptFilename == lastImage) {
+    // A full image replaced the previous chain; its ancestors can go.
+    for (uint32_t i = 0; i < chainLength; i++) {
+      unlink(chainImageName(ckptFilename, i).c_str());
+    }
+  }
+
+  if (!trackThisImage) {
+    primed = false;
+    chainLength = 0;
+    lastImage[0] = '\0';
+    return;
+  }
+
+  chainLength = imageIsIncremental ? chainLength + 1 : 1;
+  JASSERT(ckptFilename.length() < sizeof(lastImage)) (ckptFilename);
+  strcpy(lastImage, ckptFilename.c_str());
+}
+
+void
+CkptIncremental::primeMigration()
+{
+  // Cleared before the fork: pages written by this process in between are
+  // then in both images, and none is missed.  The regular chain loses its
+  // tracking, so that the next regular image is complete.
+  migrationPrimed = false;
+  primed = false;
+  if (softDirtyWorks) {
+    pagemapFd = _real_open("/proc/self/pagemap", O_RDONLY, 0);
+    if (pagemapFd != -1) {
+      migrationPrimed = clearSoftDirtyBits();
+      _real_close(pagemapFd);
+      pagemapFd = -1;
+    }
+  }
+  primedNumRestarts = ProcessInfo::instance().numRestarts();
+  JWARNING(migrationPrimed)
+  .Text("Cannot track the pages modified during the pre-copy round;"
+        " the final migration image will be complete.");
+}
+
+void
+CkptIncremental::prepareMigrationImage(const string &parent)
+{
+  trackThisImage = !parent.empty() && migrationPrimed;
+  imageIsIncremental = trackThisImage &&
+    primedNumRestarts == ProcessInfo::instance().numRestarts();
+  migrationPrimed = false;
+
+  // The regular chain, if any, does not survive the migration.
+  primed = false;
+  chainLength = 0;
+  lastImage[0] = '\0';
+
+  ProcessInfo::instance().setParentCkptFilename(imageIsIncremental ? parent
+                                                                   : "");
+  JTRACE("Preparing migration image") (imageIsIncremental) (parent);
+}
+
+void
+CkptIncremental::snapshotDirtyPages()
+{
+  if (!trackThisImage) {
+    return;
+  }
+
+  // On failure, this image is still written completely and the next one
+  // starts a new chain.
+  pagemapFd = _real_open("/proc/self/pagemap", O_RDONLY, 0);
+  if (pagemapFd == -1) {
+    JWARNING(false) (JASSERT_ERRNO)
+    .Text("Cannot open /proc/self/pagemap; writing a full image.");
+    primed = false;
+    return;
+  }
+
+  if (imageIsIncremental) {
+    ProcSelfMaps procSelfMaps;
+    ProcMapsArea area;
+    size_t numPages = 0;
+
+    rangesSize = Util::pageSize() +
+      procSelfMaps.getNumAreas() * sizeof(PageRange);
+    ranges = (PageRange *)_real_mmap(NULL, rangesSize, PROT_READ | PROT_WRITE,
+                                     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    JASSERT(ranges != MAP_FAILED) (JASSERT_ERRNO);
+    numRanges = 0;
+    while (procSelfMaps.getNextArea(&area)) {
+      if (isTrackedArea(area) && numRanges < procSelfMaps.getNumAreas()) {
+        ranges[numRanges].start = area.addr;
+        ranges[numRanges].end = area.endAddr;
+        ranges[numRanges].bitOffset = numPages;
+        numPages += area.size / Util::pageSize();
+        numRanges++;
+      }
+    }
+
+    cleanBitsSize = Util::pageSize() + (numPages + 63) / 64 * sizeof(uint64_t);
+    cleanBits = (uint64_t *)_real_mmap(NULL, cleanBitsSize,
+                                       PROT_READ | PROT_WRITE,
+                                       MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    JASSERT(cleanBits != MAP_FAILED) (JASSERT_ERRNO);
+
+    // A page is unchanged since the parent image if it is mapped and its
+    // soft-dirty bit is still clear.
+    uint64_t entries[PM_ENTRIES_PER_IO];
+    for (size_t r = 0; r < numRanges; r++) {
+      size_t n = (ranges[r].end - ranges[r].start) / Util::pageSize();
+      for (size_t i = 0; i < n; i += PM_ENTRIES_PER_IO) {
+        size_t count = n - i < PM_ENTRIES_PER_IO ? n - i : PM_ENTRIES_PER_IO;
+        VA addr = ranges[r].start + i * Util::pageSize();
+        ssize_t rc = readPagemap(addr, entries, count);
+        if (rc != (ssize_t)(count * sizeof(uint64_t))) {
+          continue;   // Treat as dirty.
+        }
+        for (size_t j = 0; j < count; j++) {
+          if ((entries[j] & (PM_PRESENT | PM_SWAP)) != 0 &&
+              (entries[j] & PM_SOFT_DIRTY) == 0) {
+            size_t bitIdx = ranges[r].bitOffset + i + j;
+            cleanBits[bitIdx / 64] |= 1ULL << (bitIdx % 64);
+          }
+        }
+      }
+    }
+  }
+
+  // Any page modified from now on, including by the checkpoint thread while
+  // it writes this image, will be written again in the next image.
+  if (clearSoftDirtyBits()) {
+    primed = true;
+    primedNumRestarts = ProcessInfo::instance().numRestarts();
+  } else {
+    JWARNING(false)
+    .Text("Kernel does not support soft-dirty page tracking."
+          "  Incremental checkpointing disabled.");
+    softDirtyWorks = false;
+    primed = false;
+  }
+}
+
+void
+CkptIncremental::releaseDirtyPages()
+{
+  if (ranges != NULL) {
+    JASSERT(_real_munmap(ranges, rangesSize) == 0) (JASSERT_ERRNO);
+    ranges = NULL;
+    numRanges = 0;
+  }
+  if (cleanBits != NULL) {
+    JASSERT(_real_munmap(cleanBits, cleanBitsSize) == 0) (JASSERT_ERRNO);
+    cleanBits = NULL;
+  }
+  if (pagemapFd != -1) {
+    _real_close(pagemapFd);
+    pagemapFd = -1;
+  }
+}
+
+bool
+CkptIncremental::isSnapshotArea(const ProcMapsArea &area)
+{
+  return (ranges != NULL &&
+          area.addr >= (VA)ranges && area.addr < (VA)ranges + rangesSize) ||
+         (cleanBits != NULL &&
+          area.addr >= (VA)cleanBits &&
+          area.addr < (VA)cleanBits + cleanBitsSize);
+}
+
+size_t
+CkptIncremental::pageRun(VA addr, size_t len, bool *inParent)
+{
+  *inParent = false;
+  if (!imageIsIncremental || cleanBits == NULL) {
+    return len;
+  }
+
+  // Binary search for the first range ending after addr.
+  size_t lo = 0, hi = numRanges;
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if (ranges[mid].end <= addr) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo == numRanges) {
+    return len;
+  }
+
+  const PageRange &r = ranges[lo];
+  if (r.start > addr) {
+    return MIN(len, (size_t)(r.start - addr));
+  }
+  len = MIN(len, (size_t)(r.end - addr));
+
+  // A page is taken from the parent only if it was unchanged when the
+  // snapshot was taken and has not been modified since.
+  const size_t pageSize = Util::pageSize();
+  const size_t numPages = len / pageSize;
+  const size_t firstBit = r.bitOffset + (addr - r.start) / pageSize;
+  uint64_t entries[PM_ENTRIES_PER_IO];
+  bool state = false;
+  for (size_t i = 0; i < numPages; i += PM_ENTRIES_PER_IO) {
+    size_t count = numPages - i;
+    if (count > PM_ENTRIES_PER_IO) {
+      count = PM_ENTRIES_PER_IO;
+    }
+    ssize_t rc = readPagemap(addr + i * pageSize, entries, count);
+    bool ok = rc == (ssize_t)(count * sizeof(uint64_t));
+    for (size_t j = 0; j < count; j++) {
+      bool clean = ok && isClean(firstBit + i + j) &&
+                   (entries[j] & PM_SOFT_DIRTY) == 0;
+      if (i + j == 0) {
+        state = clean;
+      } else if (clean != state) {
+        *inParent = state;
+        return (i + j) * pageSize;
+      }
+    }
+  }
+  *inParent = state;
+  return len;
+}
+
+// ************************ For restarting from a chain *****************
+
+// Position in the stream of the parent image.  The parent has been merged
+// with its own parent already, so it only has DATA and ZERO runs.
+typedef struct ParentCursor {
+  MtcpAreaRecordBuf record;
+  size_t run;       // Current run of the record.
+  VA runAddr;       // Start of the current run.
+  VA pos;           // Data of the current run consumed up to pos.
+  bool eof;
+} ParentCursor;
+
+static char mergeBuf[64 * 1024];
+static MtcpAreaRecordBuf childRecord;
+static MtcpAreaRun childRuns[MTCP_AREA_MAX_RUNS];
+
+static void
+copyBytes(int infd, int outfd, size_t len)
+{
+  while (len > 0) {
+    size_t n = MIN(len, sizeof(mergeBuf));
+    JASSERT(Util::readAll(infd, mergeBuf, n) == (ssize_t)n) (JASSERT_ERRNO)
+    .Text("Truncated checkpoint image");
+    if (outfd != -1) {
+      JASSERT(Util::writeAll(outfd, mergeBuf, n) == (ssize_t)n)
+        (JASSERT_ERRNO);
+    }
+    len -= n;
+  }
+}
+
+static void
+writeZeroes(int outfd, size_t len)
+{
+  memset(mergeBuf, 0, sizeof(mergeBuf));
+  while (len > 0) {
+    size_t n = MIN(len, sizeof(mergeBuf));
+    JASSERT(Util::writeAll(outfd, mergeBuf, n) == (ssize_t)n) (JASSERT_ERRNO);
+    len -= n;
+  }
+}
+
+static void
+nextParentRecord(int parentFd, ParentCursor *pc)
+{
+  Util::readAreaRecord(parentFd, &pc->record);
+  pc->eof = (pc->record.rec.size == (uint64_t)-1);
+  pc->run = 0;
+  pc->runAddr = pc->pos = (VA)pc->record.rec.addr;
+}
+
+static void
+copyFromParent(int parentFd, ParentCursor *pc, VA addr, size_t len, int outfd)
+{
+  while (len > 0) {
+    // Both streams are ordered by address; skip what is not needed.
+    MtcpAreaRun run = 0;
+    VA runEnd = NULL;
+    while (!pc->eof) {
+      MtcpAreaRecord *rec = &pc->record.rec;
+      if (pc->run == rec->numRuns) {
+        nextParentRecord(parentFd, pc);
+        continue;
+      }
+      run = mtcp_area_runs(rec)[pc->run];
+      runEnd = pc->runAddr + MTCP_AREA_RUN_LEN(run);
+      if (runEnd > addr) {
+        break;
+      }
+      if (MTCP_AREA_RUN_TYPE(run) == MTCP_AREA_RUN_DATA) {
+        copyBytes(parentFd, -1, runEnd - pc->pos);
+      }
+      pc->run++;
+      pc->runAddr = pc->pos = runEnd;
+    }
+    JASSERT(!pc->eof && pc->runAddr <= addr && pc->pos <= addr)
+      ((void *)addr) (len)
+    .Text("Parent checkpoint image does not contain the referenced pages");
+
+    size_t n = MIN(len, (size_t)(runEnd - addr));
+    switch (MTCP_AREA_RUN_TYPE(run)) {
+    case MTCP_AREA_RUN_DATA:
+      copyBytes(parentFd, -1, addr - pc->pos);
+      copyBytes(parentFd, outfd, n);
+      break;
+
+    case MTCP_AREA_RUN_ZERO:
+      writeZeroes(outfd, n);
+      break;
+
+    default:
+      JASSERT(false) ((void *)addr) (MTCP_AREA_RUN_TYPE(run))
+      .Text("Unexpected run in the parent checkpoint image");
+    }
+    pc->pos = addr + n;
+    addr += n;
+    len -= n;
+  }
+}
+
+void
+CkptIncremental::mergeStream(int fd, int parentFd, int outFd)
+{
+  static ParentCursor pc;
+
+  copyBytes(fd, outFd, sizeof(MtcpHeader));
+  copyBytes(parentFd, -1, sizeof(MtcpHeader));
+  nextParentRecord(parentFd, &pc);
+
+  while (1) {
+    MtcpAreaRecord *rec = &childRecord.rec;
+    Util::readAreaRecord(fd, &childRecord);
+
+    // The pages taken from the parent become data; the record keeps its size.
+    MtcpAreaRun *runs = mtcp_area_runs(rec);
+    memcpy(childRuns, runs, rec->numRuns * sizeof(*runs));
+    for (size_t i = 0; i < rec->numRuns; i++) {
+      if (MTCP_AREA_RUN_TYPE(runs[i]) == MTCP_AREA_RUN_PARENT) {
+        runs[i] = MTCP_AREA_RUN(MTCP_AREA_RUN_DATA, MTCP_AREA_RUN_LEN(runs[i]));
+      }
+    }
+    JASSERT(Util::writeAll(outFd, rec, rec->recordLen) ==
+            (ssize_t)rec->recordLen) (JASSERT_ERRNO);
+    if (rec->size == (uint64_t)-1) {
+      break;
+    }
+
+    VA addr = (VA)rec->addr;
+    for (size_t i = 0; i < rec->numRuns; i++) {
+      size_t len = MTCP_AREA_RUN_LEN(childRuns[i]);
+      switch (MTCP_AREA_RUN_TYPE(childRuns[i])) {
+      case MTCP_AREA_RUN_DATA:
+        copyBytes(fd, outFd, len);
+        break;
+
+      case MTCP_AREA_RUN_PARENT:
+        copyFromParent(parentFd, &pc, addr, len, outFd);
+        break;
+
+      case MTCP_AREA_RUN_DEDUP:
+        // The references were resolved before; see dmtcp_restart.cpp.
+        JASSERT(false).Text("Unresolved page deduplication references");
+      }
+      addr += len;
+    }
+  }
+}
@@ -0,0 +1,81 @@
+/****************************************************************************
+ *   Copyright (C) 2006-2013 by Jason Ansel, Kapil Arya, and Gene Cooperman *
+ *   jansel@csail.mit.edu, kapil@ccs.neu.edu, gene@ccs.neu.edu              *
+ *                                                                          *
+ *  This file is part of DMTCP.                                             *
+ *                                                                          *
+ *  DMTCP is free software: you can redistribute it and/or                  *
+ *  modify it under the terms of the GNU Lesser General Public License as   *
+ *  published by the Free Software Foundation, either version 3 of the      *
+ *  License, or (at your option) any later version.                         *
+ *                                                                          *
+ *  DMTCP is distributed in the hope that it will be useful,                *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU Lesser General Public License for more details.                     *
+ *                                                                          *
+ *  You should have received a copy of the GNU Lesser General Public        *
+ *  License along with DMTCP:dmtcp/src.  If not, see                        *
+ *  <http://www.gnu.org/licenses/>.                                         *
+ ****************************************************************************/
+
+#ifndef CKPT_INCREMENTAL_H
+#define CKPT_INCREMENTAL_H
+
+#include "dmtcpalloc.h"
+#include "procmapsarea.h"
+
+/* Incremental checkpoints based on the kernel's soft-dirty page tracking.
+ *
+ * After every checkpoint image is written, the soft-dirty bits of the
+ * process are cleared through /proc/self/clear_refs.  The next image writes
+ * only the pages of private anonymous areas whose soft-dirty bit got set in
+ * the meantime; unchanged pages are recorded as runs of type
+ * MTCP_AREA_RUN_PARENT, with no data.  The image names its parent in
+ * the ProcessInfo header, and dmtcp_restart merges the chain of images back
+ * into a complete stream for mtcp_restart.
+ *
+ * The newest image always has the usual name, ckpt_*.dmtcp.  Its ancestors
+ * are kept as ckpt_*.dmtcp.<N>, N = 0 being the full image.  After
+ * DMTCP_INCREMENTAL_CKPT incremental images, a full image is written again
+ * and the old chain is removed.
+ */
+
+namespace dmtcp
+{
+namespace CkptIncremental
+{
+// Maximum number of incremental images between two full images, as set
+// through DMTCP_INCREMENTAL_CKPT; 0 disables incremental checkpointing.
+int maxChainLength();
+
+// Called by the checkpoint thread around the writing of each image.
+// With untracked set, the image is full and the next one is not based on
+// it (forked and staged checkpoints).
+void prepareImage(const string &ckptFilename, bool untracked);
+void finishImage(const string &ckptFilename);
+
+// Live migration.  primeMigration() is called right before the writer of the
+// pre-copy image is forked, and re-arms the tracking of this process.
+// prepareMigrationImage() takes the place of prepareImage(): with an empty
+// parent, the image is complete; otherwise, if the tracking was primed, it
+// holds only the pages modified since the pre-copy image, named parent.
+void primeMigration();
+void prepareMigrationImage(const string &parent);
+
+// Called by mtcp_writememoryareas().  snapshotDirtyPages() records which
+// pages are unchanged since the last image and then re-arms the tracking.
+void snapshotDirtyPages();
+void releaseDirtyPages();
+bool isSnapshotArea(const ProcMapsArea &area);
+
+// Returns the length of the run of pages at addr (at most len bytes) that
+// are all either unchanged since the parent image (*inParent = true) or not.
+size_t pageRun(VA addr, size_t len, bool *inParent);
+
+// Used by dmtcp_restart: rebuild a complete memory stream from the
+// incremental stream fd and the (already complete) stream of its parent.
+void mergeStream(int fd, int parentFd, int outFd);
+}
+}
+#endif // ifndef CKPT_INCREMENTAL_H
@@ -0,0 +1,688 @@
+/****************************************************************************
+ *   Copyright (C) 2006-2013 by Jason Ansel, Kapil Arya, and Gene Cooperman *
+ *   jansel@csail.mit.edu, kapil@ccs.neu.edu, gene@ccs.neu.edu              *
+ *                                                                          *
+ *  This file is part of DMTCP.                                             *
+ *                                                                          *
+ *  DMTCP is free software: you can redistribute it and/or                  *
+ *  modify it under the terms of the GNU Lesser General Public License as   *
+ *  published by the Free Software Foundation, either version 3 of the      *
+ *  License, or (at your option) any later version.                         *
+ *                                                                          *
+ *  DMTCP is distributed in the hope that it will be useful,                *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU Lesser General Public License for more details.                     *
+ *                                                                          *
+ *  You should have received a copy of the GNU Lesser General Public        *
+ *  License along with DMTCP:dmtcp/src.  If not, see                        *
+ *  <http://www.gnu.org/licenses/>.                                         *
+ ****************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include "../jalib/jassert.h"
+#include "ckptdedup.h"
+#include "ckptindex.h"
+#include "syscallwrappers.h"
+#include "util.h"
+
+using namespace dmtcp;
+
+// Capacity of the writer arena.  It is mapped with MAP_NORESERVE, so only
+// the pages that are used cost memory.  An image with more areas than this
+// is written without an index.
+#define MAX_ENTRIES      (1 << 20)
+#define MAX_NAMES_LENGTH (16 * 1024 * 1024)
+
+typedef struct Writer {
+  char *arena;
+  size_t arenaSize;
+  CkptIndexEntry *entries;
+  uint64_t numEntries;
+  char *names;
+  uint64_t namesLength;
+  uint64_t lastNameOffset;
+  uint64_t offset;
+  bool inEntry;
+  bool overflow;
+} Writer;
+
+static Writer writer;
+static bool indexActive = false;
+
+/* Software CRC32C, eight bytes at a time ("slicing-by-8"). */
+static uint32_t crcTable[8][256];
+static bool crcTableReady = false;
+
+static void
+initCrcTable()
+{
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t crc = i;
+    for (int j = 0; j < 8; j++) {
+      crc = (crc >> 1) ^ (0x82f63b78 & (0 - (crc & 1)));
+    }
+    crcTable[0][i] = crc;
+  }
+  for (uint32_t i = 0; i < 256; i++) {
+    for (int t = 1; t < 8; t++) {
+      crcTable[t][i] = (crcTable[t - 1][i] >> 8) ^
+                       crcTable[0][crcTable[t - 1][i] & 0xff];
+    }
+  }
+  __sync_synchronize();
+  crcTableReady = true;
+}
+
+static uint32_t
+crc32cSoftware(uint32_t crc, const unsigned char *p, size_t len)
+{
+  if (!crcTableReady) {
+    initCrcTable();
+  }
+  for (; len > 0 && ((uintptr_t)p & 7) != 0; len--) {
+    crc = crcTable[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+  }
+  for (; len >= 8; len -= 8, p += 8) {
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+    word ^= crc;
+    crc = crcTable[7][word & 0xff] ^
+          crcTable[6][(word >> 8) & 0xff] ^
+          crcTable[5][(word >> 16) & 0xff] ^
+          crcTable[4][(word >> 24) & 0xff] ^
+          crcTable[3][(word >> 32) & 0xff] ^
+          crcTable[2][(word >> 40) & 0xff] ^
+          crcTable[1][(word >> 48) & 0xff] ^
+          crcTable[0][word >> 56];
+  }
+  for (; len > 0; len--) {
+    crc = crcTable[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t
+crc32cHardware(uint32_t crc, const unsigned char *p, size_t len)
+{
+  uint64_t crc64 = crc;
+
+  for (; len > 0 && ((uintptr_t)p & 7) != 0; len--) {
+    crc64 = __builtin_ia32_crc32qi((uint32_t)crc64, *p++);
+  }
+  for (; len >= 8; len -= 8, p += 8) {
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+    crc64 = __builtin_ia32_crc32di(crc64, word);
+  }
+  for (; len > 0; len--) {
+    crc64 = __builtin_ia32_crc32qi((uint32_t)crc64, *p++);
+  }
+  return (uint32_t)crc64;
+}
+
+static bool
+hasHardwareCrc32c()
+{
+  static int supported = -1;
+
+  if (supported == -1) {
+    __builtin_cpu_init();
+    supported = __builtin_cpu_supports("sse4.2") ? 1 : 0;
+  }
+  return supported == 1;
+}
+#endif // if defined(__x86_64__)
+
+uint32_t
+CkptIndex::crc32c(uint32_t crc, const void *buf, size_t len)
+{
+  const unsigned char *p = (const unsigned char *)buf;
+
+  crc = ~crc;
+#if defined(__x86_64__)
+  if (hasHardwareCrc32c()) {
+    return ~crc32cHardware(crc, p, len);
+  }
+#endif // if defined(__x86_64__)
+  return ~crc32cSoftware(crc, p, len);
+}
+
+/* Combining two CRCs, as crc32_combine() of zlib does: the CRC of len2 zero
+ * bytes appended to a is computed by applying the linear operator "append
+ * one zero bit" to crc1, len2 * 8 times, by repeated squaring of its 32x32
+ * matrix over GF(2).
+ */
+static uint32_t
+gf2MatrixTimes(const uint32_t *mat, uint32_t vec)
+{
+  uint32_t sum = 0;
+
+  for (; vec != 0; vec >>= 1, mat++) {
+    if (vec & 1) {
+      sum ^= *mat;
+    }
+  }
+  return sum;
+}
+
+static void
+gf2MatrixSquare(uint32_t *square, const uint32_t *mat)
+{
+  for (int n = 0; n < 32; n++) {
+    square[n] = gf2MatrixTimes(mat, mat[n]);
+  }
+}
+
+uint32_t
+CkptIndex::crc32cCombine(uint32_t crc1, uint32_t crc2, uint64_t len2)
+{
+  uint32_t even[32];
+  uint32_t odd[32];
+
+  if (len2 == 0) {
+    return crc1;
+  }
+
+  // The operator for one zero bit, then for two and four.
+  odd[0] = 0x82f63b78;
+  for (int n = 1; n < 32; n++) {
+    odd[n] = 1U << (n - 1);
+  }
+  gf2MatrixSquare(even, odd);
+  gf2MatrixSquare(odd, even);
+
+  // Apply the operators for one, two, four, ... zero bytes, as given by the
+  // bits of len2.
+  do {
+    gf2MatrixSquare(even, odd);
+    if (len2 & 1) {
+      crc1 = gf2MatrixTimes(even, crc1);
+    }
+    len2 >>= 1;
+    if (len2 == 0) {
+      break;
+    }
+    gf2MatrixSquare(odd, even);
+    if (len2 & 1) {
+      crc1 = gf2MatrixTimes(odd, crc1);
+    }
+    len2 >>= 1;
+  } while (len2 != 0);
+
+  return crc1 ^ crc2;
+}
+
+void
+CkptIndex::begin(uint64_t startOffset)
+{
+  JASSERT(!indexActive);
+
+  memset(&writer, 0, sizeof(writer));
+  writer.arenaSize = MAX_ENTRIES * sizeof(CkptIndexEntry) + MAX_NAMES_LENGTH;
+
+  // A shared anonymous mapping shows up as an area of its own in
+  // /proc/self/maps; see startPool() in ckptcompress.cpp.
+  writer.arena = (char *)_real_mmap(NULL, writer.arenaSize,
+                                    PROT_READ | PROT_WRITE,
+                                    MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE,
+                                    -1, 0);
+  if (writer.arena == MAP_FAILED) {
+    JNOTE("Cannot allocate the index of the checkpoint image; "
+          "writing the image without it") (writer.arenaSize) (JASSERT_ERRNO);
+    writer.arena = NULL;
+    return;
+  }
+  writer.entries = (CkptIndexEntry *)writer.arena;
+  writer.names = writer.arena + MAX_ENTRIES * sizeof(CkptIndexEntry);
+
+  // Offset 0 of the names is the empty name of anonymous areas.
+  writer.names[0] = '\0';
+  writer.namesLength = 1;
+  writer.offset = startOffset;
+  indexActive = true;
+}
+
+bool
+CkptIndex::isActive()
+{
+  return indexActive;
+}
+
+bool
+CkptIndex::isArenaArea(const ProcMapsArea &area)
+{
+  return indexActive &&
+         area.addr >= writer.arena &&
+         area.addr < writer.arena + writer.arenaSize;
+}
+
+static uint32_t
+addName(const char *name, size_t nameLen)
+{
+  if (nameLen == 0) {
+    return 0;
+  }
+
+  // Consecutive records are often parts of the same mapping.
+  const char *last = writer.names + writer.lastNameOffset;
+  if (strcmp(last, name) == 0) {
+    return writer.lastNameOffset;
+  }
+  if (writer.namesLength + nameLen + 1 > MAX_NAMES_LENGTH) {
+    writer.overflow = true;
+    return 0;
+  }
+  writer.lastNameOffset = writer.namesLength;
+  memcpy(writer.names + writer.namesLength, name, nameLen + 1);
+  writer.namesLength += nameLen + 1;
+  return writer.lastNameOffset;
+}
+
+void
+CkptIndex::addRecord(const MtcpAreaRecord *rec)
+{
+  if (!indexActive) {
+    return;
+  }
+
+  // The record that ends the memory areas is not indexed.
+  writer.inEntry = false;
+  if (rec->size != (uint64_t)-1 && !writer.overflow) {
+    if (writer.numEntries == MAX_ENTRIES) {
+      writer.overflow = true;
+    } else {
+      MtcpAreaRecord *r = const_cast<MtcpAreaRecord *>(rec);
+      const MtcpAreaRun *runs = mtcp_area_runs(r);
+      CkptIndexEntry *e = &writer.entries[writer.numEntries++];
+      memset(e, 0, sizeof(*e));
+      e->addr = rec->addr;
+      e->size = rec->size;
+      e->offset = writer.offset;
+      e->prot = rec->prot;
+      e->flags = rec->flags;
+      e->nameOffset = addName(mtcp_area_name(r), rec->nameLen);
+      for (size_t i = 0; i < rec->numRuns; i++) {
+        e->runTypes |= 1U << MTCP_AREA_RUN_TYPE(runs[i]);
+      }
+      writer.inEntry = true;
+    }
+  }
+}
+
+void
+CkptIndex::addData(const void *buf, size_t len)
+{
+  if (!indexActive) {
+    return;
+  }
+
+  if (writer.inEntry && !writer.overflow) {
+    CkptIndexEntry *e = &writer.entries[writer.numEntries - 1];
+    e->checksum = crc32c(e->checksum, buf, len);
+    e->length += len;
+  }
+  writer.offset += len;
+}
+
+void
+CkptIndex::end(int fd, void (*writeToImage)(int, const void *, size_t))
+{
+  if (!indexActive) {
+    return;
+  }
+
+  // The index itself is not part of the last entry.
+  writer.inEntry = false;
+  if (writer.overflow) {
+    JNOTE("Too many memory areas; writing the checkpoint image without "
+          "its index") (writer.numEntries) (writer.namesLength);
+  } else {
+    size_t entriesLen = writer.numEntries * sizeof(CkptIndexEntry);
+    CkptIndexFooter footer;
+    memset(&footer, 0, sizeof(footer));
+    memcpy(footer.magic, CKPT_INDEX_MAGIC, sizeof(CKPT_INDEX_MAGIC));
+    footer.version = CKPT_INDEX_VERSION;
+    footer.indexOffset = writer.offset;
+    footer.numEntries = writer.numEntries;
+    footer.namesLength = writer.namesLength;
+    footer.checksum = crc32c(0, writer.entries, entriesLen);
+    footer.checksum = crc32c(footer.checksum, writer.names,
+                             writer.namesLength);
+
+    writeToImage(fd, writer.entries, entriesLen);
+    writeToImage(fd, writer.names, writer.namesLength);
+    writeToImage(fd, &footer, sizeof(footer));
+  }
+
+  _real_munmap(writer.arena, writer.arenaSize);
+  indexActive = false;
+}
+
+static ssize_t
+preadAll(int fd, void *buf, size_t len, off_t offset)
+{
+  size_t done = 0;
+
+  while (done < len) {
+    ssize_t n = pread(fd, (char *)buf + done, len - done, offset + done);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return done > 0 ? (ssize_t)done : n;
+    }
+    done += n;
+  }
+  return done;
+}
+
+// Reads the footer of an image; false if it has no valid one.
+static bool
+readFooter(int fd, off_t fileSize, CkptIndexFooter *footer)
+{
+  if (fileSize < (off_t)sizeof(*footer) ||
+      preadAll(fd, footer, sizeof(*footer), fileSize - sizeof(*footer)) !=
+      (ssize_t)sizeof(*footer)) {
+    return false;
+  }
+  if (memcmp(footer->magic, CKPT_INDEX_MAGIC, sizeof(CKPT_INDEX_MAGIC)) != 0 ||
+      footer->version != CKPT_INDEX_VERSION) {
+    return false;
+  }
+
+  // The index must exactly fill the end of the file.
+  uint64_t indexLen = footer->numEntries * sizeof(CkptIndexEntry) +
+                      footer->namesLength + sizeof(*footer);
+  return footer->numEntries <= MAX_ENTRIES &&
+         footer->namesLength <= MAX_NAMES_LENGTH &&
+         footer->indexOffset + indexLen == (uint64_t)fileSize;
+}
+
+off_t
+CkptIndex::dataEnd(int fd)
+{
+  struct stat st;
+  CkptIndexFooter footer;
+
+  JASSERT(fstat(fd, &st) == 0) (JASSERT_ERRNO);
+  if (S_ISREG(st.st_mode) && readFooter(fd, st.st_size, &footer)) {
+    return footer.indexOffset;
+  }
+  return st.st_size;
+}
+
+CkptIndex::Reader::~Reader()
+{
+  if (_fd != -1) {
+    close(_fd);
+  }
+}
+
+static bool
+entryLess(const CkptIndexEntry &a, const CkptIndexEntry &b)
+{
+  return a.addr < b.addr;
+}
+
+bool
+CkptIndex::Reader::open(const string &path)
+{
+  struct stat st;
+  CkptIndexFooter footer;
+
+  JASSERT(_fd == -1);
+  _fd = ::open(path.c_str(), O_RDONLY);
+  if (_fd == -1) {
+    return false;
+  }
+  if (fstat(_fd, &st) == -1 || !readFooter(_fd, st.st_size, &footer)) {
+    return false;
+  }
+
+  size_t entriesLen = footer.numEntries * sizeof(CkptIndexEntry);
+  _entries.resize(footer.numEntries);
+  _names.resize(footer.namesLength + 1);
+  if ((entriesLen > 0 &&
+       preadAll(_fd, &_entries[0], entriesLen, footer.indexOffset) !=
+       (ssize_t)entriesLen) ||
+      preadAll(_fd, &_names[0], footer.namesLength,
+                     footer.indexOffset + entriesLen) !=
+      (ssize_t)footer.namesLength) {
+    return false;
+  }
+  uint32_t checksum = crc32c(0, entriesLen > 0 ? &_entries[0] : NULL,
+                             entriesLen);
+  checksum = crc32c(checksum, &_names[0], footer.namesLength);
+  if (checksum != footer.checksum) {
+    return false;
+  }
+
+  // Guards areaName() against a name that is not terminated.
+  _names[footer.namesLength] = '\0';
+  for (size_t i = 0; i < _entries.size(); i++) {
+    if (_entries[i].nameOffset >= footer.namesLength ||
+        _entries[i].offset + _entries[i].length > footer.indexOffset) {
+      return false;
+    }
+  }
+
+  // Areas are written in the order of /proc/self/maps, which is by
+  // address; sort them anyway, for findArea().
+  std::stable_sort(_entries.begin(), _entries.end(), entryLess);
+  return true;
+}
+
+const char *
+CkptIndex::Reader::areaName(size_t i) const
+{
+  return &_names[_entries[i].nameOffset];
+}
+
+ssize_t
+CkptIndex::Reader::findArea(uint64_t addr) const
+{
+  size_t lo = 0;
+  size_t hi = _entries.size();
+
+  // The first entry that starts after addr.
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (_entries[mid].addr <= addr) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo > 0 && addr - _entries[lo - 1].addr < _entries[lo - 1].size) {
+    return lo - 1;
+  }
+  return -1;
+}
+
+bool
+CkptIndex::Reader::readMemory(uint64_t addr, void *buf, size_t len)
+{
+  MtcpAreaRecordBuf record;
+  char *out = (char *)buf;
+
+  while (len > 0) {
+    ssize_t i = findArea(addr);
+    if (i == -1) {
+      return false;
+    }
+    const CkptIndexEntry &e = _entries[i];
+    size_t recLen = MIN(e.length, sizeof(record));
+    MtcpAreaRecord *rec = &record.rec;
+    if (preadAll(_fd, &record, recLen, e.offset) != (ssize_t)recLen ||
+        rec->magic != MTCP_AREA_MAGIC || rec->recordLen > recLen ||
+        rec->numRuns > MTCP_AREA_MAX_RUNS) {
+      return false;
+    }
+
+    // Find the run that holds addr, and where its data is in the image.
+    const MtcpAreaRun *runs = mtcp_area_runs(rec);
+    uint64_t runAddr = rec->addr;
+    uint64_t dataOffset = e.offset + rec->recordLen;
+    size_t r;
+    for (r = 0; r < rec->numRuns; r++) {
+      size_t runLen = MTCP_AREA_RUN_LEN(runs[r]);
+      if (addr < runAddr + runLen) {
+        break;
+      }
+      runAddr += runLen;
+      if (MTCP_AREA_RUN_TYPE(runs[r]) == MTCP_AREA_RUN_DATA) {
+        dataOffset += runLen;
+      } else if (MTCP_AREA_RUN_TYPE(runs[r]) == MTCP_AREA_RUN_DEDUP) {
+        dataOffset += CKPT_DEDUP_REFS_SIZE(runLen);
+      }
+    }
+    if (r == rec->numRuns || addr < runAddr) {
+      return false;
+    }
+
+    size_t n = MIN(len, runAddr + MTCP_AREA_RUN_LEN(runs[r]) - addr);
+    switch (MTCP_AREA_RUN_TYPE(runs[r])) {
+    case MTCP_AREA_RUN_DATA:
+      if (preadAll(_fd, out, n, dataOffset + (addr - runAddr)) !=
+          (ssize_t)n) {
+        return false;
+      }
+      break;
+
+    case MTCP_AREA_RUN_ZERO:
+      memset(out, 0, n);
+      break;
+
+    default:
+      return false;
+    }
+    addr += n;
+    out += n;
+    len -= n;
+  }
+  return true;
+}
+
+bool
+CkptIndex::Reader::verifyArea(size_t i)
+{
+  const CkptIndexEntry &e = _entries[i];
+  vector<char> buf(MIN(e.length, CKPT_INDEX_VERIFY_CHUNK));
+  uint32_t checksum = 0;
+
+  for (uint64_t done = 0; done < e.length;) {
+    size_t n = MIN(e.length - done, buf.size());
+    if (preadAll(_fd, &buf[0], n, e.offset + done) != (ssize_t)n) {
+      return false;
+    }
+    checksum = crc32c(checksum, &buf[0], n);
+    done += n;
+  }
+  return checksum == e.checksum;
+}
+
+typedef struct VerifyChunk {
+  size_t entry;
+  uint64_t offset;
+  size_t len;
+  uint32_t checksum;
+  bool readError;
+} VerifyChunk;
+
+typedef struct VerifyJob {
+  int fd;
+  VerifyChunk *chunks;
+  size_t numChunks;
+  size_t next;
+} VerifyJob;
+
+static void *
+verifyThread(void *arg)
+{
+  VerifyJob *job = (VerifyJob *)arg;
+  char *buf = new char[CKPT_INDEX_VERIFY_CHUNK];
+
+  while (1) {
+    size_t i = __sync_fetch_and_add(&job->next, 1);
+    if (i >= job->numChunks) {
+      break;
+    }
+    VerifyChunk *c = &job->chunks[i];
+    if (preadAll(job->fd, buf, c->len, c->offset) != (ssize_t)c->len) {
+      c->readError = true;
+    } else {
+      c->checksum = CkptIndex::crc32c(0, buf, c->len);
+    }
+  }
+  delete[] buf;
+  return NULL;
+}
+
+uint64_t
+CkptIndex::Reader::verifyAll(int nthreads, vector<size_t> *corrupt)
+{
+  vector<VerifyChunk> chunks;
+  uint64_t total = 0;
+
+  for (size_t i = 0; i < _entries.size(); i++) {
+    const CkptIndexEntry &e = _entries[i];
+    for (uint64_t done = 0; done < e.length;) {
+      VerifyChunk c;
+      c.entry = i;
+      c.offset = e.offset + done;
+      c.len = MIN(e.length - done, CKPT_INDEX_VERIFY_CHUNK);
+      c.checksum = 0;
+      c.readError = false;
+      chunks.push_back(c);
+      done += c.len;
+    }
+    total += e.length;
+  }
+
+  // Reading in the order of the file lets the kernel read ahead for every
+  // thread.
+  posix_fadvise(_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  VerifyJob job;
+  job.fd = _fd;
+  job.chunks = chunks.empty() ? NULL : &chunks[0];
+  job.numChunks = chunks.size();
+  job.next = 0;
+
+  nthreads = MAX(1, MIN(nthreads, CKPT_INDEX_MAX_THREADS));
+  nthreads = MIN((size_t)nthreads, MAX(chunks.size(), 1));
+  pthread_t threads[CKPT_INDEX_MAX_THREADS];
+  for (int i = 1; i < nthreads; i++) {
+    JASSERT(pthread_create(&threads[i], NULL, verifyThread, &job) == 0);
+  }
+  verifyThread(&job);
+  for (int i = 1; i < nthreads; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  // The chunks of an entry are consecutive and in order.
+  for (size_t c = 0; c < chunks.size();) {
+    size_t entry = chunks[c].entry;
+    uint32_t checksum = 0;
+    bool readError = false;
+    for (; c < chunks.size() && chunks[c].entry == entry; c++) {
+      checksum = crc32cCombine(checksum, chunks[c].checksum, chunks[c].len);
+      readError |= chunks[c].readError;
+    }
+    if (readError || checksum != _entries[entry].checksum) {
+      corrupt->push_back(entry);
+    }
+  }
+  return total;
+}
@@ -0,0 +1,153 @@
+/****************************************************************************
+ *   Copyright (C) 2006-2013 by Jason Ansel, Kapil Arya, and Gene Cooperman *
+ *   jansel@csail.mit.edu, kapil@ccs.neu.edu, gene@ccs.neu.edu              *
+ *                                                                          *
+ *  This file is part of DMTCP.                                             *
+ *                                                                          *
+ *  DMTCP is free software: you can redistribute it and/or                  *
+ *  modify it under the terms of the GNU Lesser General Public License as   *
+ *  published by the Free Software Foundation, either version 3 of the      *
+ *  License, or (at your option) any later version.                         *
+ *                                                                          *
+ *  DMTCP is distributed in the hope that it will be useful,                *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU Lesser General Public License for more details.                     *
+ *                                                                          *
+ *  You should have received a copy of the GNU Lesser General Public        *
+ *  License along with DMTCP:dmtcp/src.  If not, see                        *
+ *  <http://www.gnu.org/licenses/>.                                         *
+ ****************************************************************************/
+
+#ifndef CKPT_INDEX_H
+#define CKPT_INDEX_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "dmtcpalloc.h"
+#include "procmapsarea.h"
+
+/* Index of the memory areas of a checkpoint image.
+ *
+ * An uncompressed image ends with an index of its memory area records, so
+ * that a tool can find any of them without reading the image from the
+ * start.  It follows the record that ends the memory areas, where
+ * mtcp_restart stops reading:
+ *   CkptIndexEntry[numEntries]    one per memory area record, in order
+ *   names                         NUL-terminated names of the areas
+ *   CkptIndexFooter               the last bytes of the file
+ * Offsets are file offsets.  The checksum of an entry is the CRC32C of its
+ * record and of the data that follows the record in the image.
+ *
+ * Images written with compression, or streamed for live migration, have no
+ * index; nor do images written with DMTCP_CKPT_INDEX=0.
+ */
+
+#define CKPT_INDEX_MAGIC   "DMTCP_INDEX_V1\n"
+#define CKPT_INDEX_VERSION 1
+
+#define CKPT_INDEX_VERIFY_CHUNK (4 * 1024 * 1024)
+#define CKPT_INDEX_MAX_THREADS  64
+
+typedef struct CkptIndexEntry {
+  uint64_t addr;
+  uint64_t size;        // of the memory described by the record
+  uint64_t offset;      // of the record
+  uint64_t length;      // of the record and the data that follows it
+  int32_t prot;
+  int32_t flags;
+  uint32_t nameOffset;  // in the names
+  uint32_t checksum;
+  uint32_t runTypes;    // bit (1 << type) for each MtcpAreaRunType present
+  uint32_t reserved;
+} CkptIndexEntry;
+
+typedef struct CkptIndexFooter {
+  char magic[16];
+  uint32_t version;
+  uint32_t checksum;    // CRC32C of the entries and the names
+  uint64_t indexOffset;
+  uint64_t numEntries;
+  uint64_t namesLength;
+} CkptIndexFooter;
+
+#ifdef __cplusplus
+namespace dmtcp
+{
+namespace CkptIndex
+{
+// CRC32C (Castagnoli), with the SSE 4.2 instruction where available.
+// crc32c(crc32c(0, a, m), b, n) is the CRC32C of a followed by b.
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+
+// The CRC32C of a followed by b, from crc1 of a, and crc2 and len2 of b.
+uint32_t crc32cCombine(uint32_t crc1, uint32_t crc2, uint64_t len2);
+
+// Writer side, called by the checkpoint thread while writing an image whose
+// next byte goes to file offset startOffset.  addRecord() starts the entry
+// of a record about to be written.  addData() is given every byte written
+// after begin(), as it is submitted: by CkptSerializer::writeToImage(), or
+// by CkptIO::write() from its staging buffer.  No malloc is done after
+// begin(); the index is built in an mmap'ed arena that
+// mtcp_writememoryareas() must not save.  end() appends the index to the
+// image with writeToImage (CkptSerializer::writeToImage(), which is not
+// part of this library).
+void begin(uint64_t startOffset);
+bool isActive();
+bool isArenaArea(const ProcMapsArea &area);
+void addRecord(const MtcpAreaRecord *rec);
+void addData(const void *buf, size_t len);
+void end(int fd, void (*writeToImage)(int fd, const void *buf, size_t len));
+
+// Offset at which the index of the image starts, or the size of the image
+// if it has no index.  The memory areas end there.
+off_t dataEnd(int fd);
+
+// Reader side: random access to the memory areas of an indexed image.
+class Reader
+{
+  public:
+#ifdef JALIB_ALLOCATOR
+    static void *operator new(size_t nbytes, void *p) { return p; }
+
+    static void *operator new(size_t nbytes) { JALLOC_HELPER_NEW(nbytes); }
+
+    static void operator delete(void *p) { JALLOC_HELPER_DELETE(p); }
+#endif // ifdef JALIB_ALLOCATOR
+    Reader() : _fd(-1) {}
+    ~Reader();
+
+    // False if the file cannot be opened or has no (valid) index.
+    bool open(const string &path);
+
+    size_t numAreas() const { return _entries.size(); }
+    const CkptIndexEntry &area(size_t i) const { return _entries[i]; }
+    const char *areaName(size_t i) const;
+
+    // The entry whose memory contains addr, or -1.
+    ssize_t findArea(uint64_t addr) const;
+
+    // Copies the len bytes of memory at addr, as saved in the image.  False
+    // if some of them are not in the image itself: outside of all areas, or
+    // kept in the parent image, the page deduplication store, or the file
+    // that was mapped.
+    bool readMemory(uint64_t addr, void *buf, size_t len);
+
+    // Recomputes the checksum of an entry from the image.
+    bool verifyArea(size_t i);
+
+    // Recomputes the checksums of all entries with nthreads threads, each
+    // reading its own pieces of CKPT_INDEX_VERIFY_CHUNK bytes, so that a
+    // large area is checked in parallel too.  Returns the number of bytes
+    // read, and the entries whose checksum does not match in corrupt.
+    uint64_t verifyAll(int nthreads, vector<size_t> *corrupt);
+
+  private:
+    int _fd;
+    vector<CkptIndexEntry> _entries;
+    vector<char> _names;
+};
+}
+}
+#endif // ifdef __cplusplus
+#endif // ifndef CKPT_INDEX_H
@@ -0,0 +1,731 @@
+/****************************************************************************
+ *   Copyright (C) 2006-2013 by Jason Ansel, Kapil Arya, and Gene Cooperman *
+ *   jansel@csail.mit.edu, kapil@ccs.neu.edu, gene@ccs.neu.edu              *
+ *                                                                          *
+ *  This file is part of DMTCP.                                             *
+ *                                                                          *
+ *  DMTCP is free software: you can redistribute it and/or                  *
+ *  modify it under the terms of the GNU Lesser General Public License as   *
+ *  published by the Free Software Foundation, either version 3 of the      *
+ *  License, or (at your option) any later version.                         *
+ *                                                                          *
+ *  DMTCP is distributed in the hope that it will be useful,                *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU Lesser General Public License for more details.                     *
+ *                                                                          *
+ *  You should have received a copy of the GNU Lesser General Public        *
+ *  License along with DMTCP:dmtcp/src.  If not, see                        *
+ *  <http://www.gnu.org/licenses/>.                                         *
+ ****************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#if defined(__has_include)
+# if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#  include <linux/io_uring.h>
+#  define HAS_IO_URING
+# endif // if __has_include(<linux/io_uring.h>) && ...
+#endif // if defined(__has_include)
+#include "../jalib/jassert.h"
+#include "ckptindex.h"
+#include "ckptio.h"
+#include "constants.h"
+#include "rawsyscall.h"
+#include "syscallwrappers.h"
+#include "util.h"
+
+using namespace dmtcp;
+
+/* As for the compressor threads of ckptcompress.cpp, the I/O threads are
+ * created with a raw clone(), live entirely in the arena, and only issue
+ * system calls.  Having no TLS of their own, they would share errno with
+ * the thread that created them: all of their system calls go through
+ * raw_syscall(), which returns the error instead, and the code they run
+ * never reads errno.  The checkpoint thread can then rely on its errno
+ * while they run.
+ */
+#define WORKER_STACK_SIZE (64 * 1024)
+#define WORKER_CLONE_FLAGS                                    \
+  (CLONE_VM | CLONE_FS | CLONE_FILES | CLONE_SIGHAND | CLONE_THREAD | \
+  CLONE_SYSVSEM | CLONE_PARENT_SETTID | CLONE_CHILD_CLEARTID)
+
+// Alignment of the buffers, lengths and offsets of O_DIRECT writes.
+#define DIRECT_IO_ALIGN   4096
+
+// Minimum number of writes in flight with io_uring.
+#define URING_MIN_DEPTH   8
+
+#define SLOT_FREE         0
+#define SLOT_FULL         1
+#define SLOT_BUSY         2
+#define SLOT_DONE         3
+
+#define MAX_SLOTS         (2 * CKPT_IO_MAX_THREADS)
+
+typedef struct Slot {
+  volatile int state;
+  int error;
+  const char *data;
+  size_t len;
+  off_t offset;
+  char *buf;
+  struct iovec iov;
+} Slot;
+
+typedef struct Uring {
+  int fd;
+  char *sqRing;
+  size_t sqRingSize;
+  char *cqRing;
+  size_t cqRingSize;
+  char *sqes;
+  size_t sqesSize;
+} Uring;
+
+typedef struct Pool {
+  char *arena;
+  size_t arenaSize;
+  bool reading;
+  int fd;
+  int directFd;
+  int outFd;
+  bool useUring;
+  Uring uring;
+  int nthreads;
+  int nslots;
+  uint64_t numSubmitted;
+  uint64_t numRetired;
+  off_t offset;
+  Slot *cur;
+  volatile int event;
+  volatile int shutdown;
+  volatile pid_t tids[CKPT_IO_MAX_THREADS];
+  Slot slots[MAX_SLOTS];
+} Pool;
+
+static Pool pool;
+static bool streamActive = false;
+
+static void
+futexWait(volatile int *addr, int val)
+{
+  raw_futex_wait(addr, val);
+}
+
+static void
+futexWake(volatile int *addr)
+{
+  raw_futex_wake(addr);
+}
+
+static void
+notifyAll()
+{
+  __sync_fetch_and_add(&pool.event, 1);
+  futexWake(&pool.event);
+}
+
+// Returns 0, or the error of the first failed system call.  EINTR is
+// retried: the I/O threads block all signals, but the checkpoint thread
+// does not when it finishes a short io_uring write itself.
+static int
+transferAll(int fd, Slot *s)
+{
+  size_t done = 0;
+
+  while (done < s->len) {
+    long rc;
+    if (pool.reading) {
+      rc = raw_pread_pwrite(SYS_pread64, fd, s->buf + done, s->len - done,
+                            s->offset + done);
+    } else {
+      rc = raw_pread_pwrite(SYS_pwrite64, fd, s->data + done, s->len - done,
+                            s->offset + done);
+    }
+    if (rc == -EINTR) {
+      continue;
+    } else if (rc < 0) {
+      return -rc;
+    } else if (rc == 0) {
+      return EIO;
+    }
+    done += rc;
+  }
+  return 0;
+}
+
+static int
+processSlot(Slot *s)
+{
+  if (pool.directFd != -1) {
+    // Some filesystems accept O_DIRECT at open() but not at write().  The
+    // EINVAL is that of the pwrite() of this thread; see transferAll().
+    int error = transferAll(pool.directFd, s);
+    if (error != EINVAL) {
+      return error;
+    }
+  }
+  return transferAll(pool.fd, s);
+}
+
+#ifdef HAS_IO_URING
+
+/* The io_uring backend: instead of waking up I/O threads, submitSlot()
+ * queues a write to the kernel, and retireOldest() reaps the completions.
+ * The submission queue has one entry per slot, so it never overflows.
+ */
+#define URING_SQ(field) \
+  ((unsigned *)(pool.uring.sqRing + uringParams.sq_off.field))
+#define URING_CQ(field) \
+  ((unsigned *)(pool.uring.cqRing + uringParams.cq_off.field))
+
+static struct io_uring_params uringParams;
+
+static bool
+uringSetup(unsigned entries)
+{
+  Uring *u = &pool.uring;
+
+  memset(&uringParams, 0, sizeof(uringParams));
+  u->fd = _real_syscall(__NR_io_uring_setup, entries, &uringParams);
+  if (u->fd == -1) {
+    return false;
+  }
+
+  u->sqRingSize = uringParams.sq_off.array +
+                  uringParams.sq_entries * sizeof(unsigned);
+  u->cqRingSize = uringParams.cq_off.cqes +
+                  uringParams.cq_entries * sizeof(struct io_uring_cqe);
+  if (uringParams.features & IORING_FEAT_SINGLE_MMAP) {
+    u->sqRingSize = MAX(u->sqRingSize, u->cqRingSize);
+    u->cqRingSize = 0;
+  }
+  u->sqesSize = uringParams.sq_entries * sizeof(struct io_uring_sqe);
+
+  u->sqRing = (char *)_real_mmap(NULL, u->sqRingSize, PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_POPULATE, u->fd,
+                                 IORING_OFF_SQ_RING);
+  u->cqRing = u->sqRing;
+  if (u->sqRing != MAP_FAILED && u->cqRingSize > 0) {
+    u->cqRing = (char *)_real_mmap(NULL, u->cqRingSize,
+                                   PROT_READ | PROT_WRITE,
+                                   MAP_SHARED | MAP_POPULATE, u->fd,
+                                   IORING_OFF_CQ_RING);
+  }
+  u->sqes = (char *)_real_mmap(NULL, u->sqesSize, PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_POPULATE, u->fd,
+                               IORING_OFF_SQES);
+  return u->sqRing != MAP_FAILED && u->cqRing != MAP_FAILED &&
+         u->sqes != MAP_FAILED;
+}
+
+static void
+uringTeardown()
+{
+  Uring *u = &pool.uring;
+
+  if (u->sqes != NULL && u->sqes != MAP_FAILED) {
+    _real_munmap(u->sqes, u->sqesSize);
+  }
+  if (u->cqRingSize > 0 && u->cqRing != NULL && u->cqRing != MAP_FAILED) {
+    _real_munmap(u->cqRing, u->cqRingSize);
+  }
+  if (u->sqRing != NULL && u->sqRing != MAP_FAILED) {
+    _real_munmap(u->sqRing, u->sqRingSize);
+  }
+  if (u->fd != -1) {
+    _real_close(u->fd);
+  }
+  memset(u, 0, sizeof(*u));
+  u->fd = -1;
+}
+
+static int
+uringEnter(unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+  int rc;
+
+  do {
+    rc = _real_syscall(__NR_io_uring_enter, pool.uring.fd, toSubmit,
+                       minComplete, flags, NULL, 0);
+  } while (rc == -1 && errno == EINTR);
+  return rc;
+}
+
+static void
+uringSubmit(Slot *s)
+{
+  unsigned tail = *URING_SQ(tail);
+  unsigned idx = tail & *URING_SQ(ring_mask);
+  struct io_uring_sqe *sqe = (struct io_uring_sqe *)pool.uring.sqes + idx;
+
+  s->iov.iov_base = (void *)s->data;
+  s->iov.iov_len = s->len;
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_WRITEV;
+  sqe->fd = pool.directFd != -1 ? pool.directFd : pool.fd;
+  sqe->addr = (uintptr_t)&s->iov;
+  sqe->len = 1;
+  sqe->off = s->offset;
+  sqe->user_data = s - pool.slots;
+  URING_SQ(array)[idx] = idx;
+  __atomic_store_n(URING_SQ(tail), tail + 1, __ATOMIC_RELEASE);
+
+  JASSERT(uringEnter(1, 0, 0) == 1) (JASSERT_ERRNO)
+  .Text("Failed to submit checkpoint write to io_uring");
+}
+
+static void
+uringReap()
+{
+  struct io_uring_cqe *cqes =
+    (struct io_uring_cqe *)(pool.uring.cqRing + uringParams.cq_off.cqes);
+
+  JASSERT(uringEnter(0, 1, IORING_ENTER_GETEVENTS) != -1) (JASSERT_ERRNO);
+
+  unsigned head = *URING_CQ(head);
+  unsigned tail = __atomic_load_n(URING_CQ(tail), __ATOMIC_ACQUIRE);
+  for (; head != tail; head++) {
+    struct io_uring_cqe *cqe = &cqes[head & *URING_CQ(ring_mask)];
+    Slot *s = &pool.slots[cqe->user_data];
+    if (cqe->res >= 0 && (size_t)cqe->res < s->len) {
+      // Finish a short write synchronously.
+      s->data += cqe->res;
+      s->len -= cqe->res;
+      s->offset += cqe->res;
+      s->error = processSlot(s);
+    } else if (cqe->res == -EINVAL && pool.directFd != -1) {
+      s->error = transferAll(pool.fd, s);
+    } else {
+      s->error = cqe->res < 0 ? -cqe->res : 0;
+    }
+    s->state = SLOT_DONE;
+  }
+  __atomic_store_n(URING_CQ(head), head, __ATOMIC_RELEASE);
+}
+#endif // ifdef HAS_IO_URING
+
+static Slot *
+claimSlot()
+{
+  int first = pool.numRetired % pool.nslots;
+
+  for (int i = 0; i < pool.nslots; i++) {
+    Slot *s = &pool.slots[(first + i) % pool.nslots];
+    if (s->state == SLOT_FULL &&
+        __sync_bool_compare_and_swap(&s->state, SLOT_FULL, SLOT_BUSY)) {
+      return s;
+    }
+  }
+  return NULL;
+}
+
+static int
+workerMain(void *arg)
+{
+  while (1) {
+    int event = pool.event;
+    __sync_synchronize();
+    Slot *s = claimSlot();
+    if (s != NULL) {
+      s->error = processSlot(s);
+      __sync_synchronize();
+      s->state = SLOT_DONE;
+      notifyAll();
+    } else if (pool.shutdown) {
+      break;
+    } else {
+      futexWait(&pool.event, event);
+    }
+  }
+  return 0;
+}
+
+static void
+startPool(int fd, int nthreads, bool reading, bool useUring)
+{
+  if (nthreads < 1) {
+    nthreads = 1;
+  } else if (nthreads > CKPT_IO_MAX_THREADS) {
+    nthreads = CKPT_IO_MAX_THREADS;
+  }
+
+  memset(&pool, 0, sizeof(pool));
+  pool.fd = fd;
+  pool.directFd = -1;
+  pool.uring.fd = -1;
+  pool.reading = reading;
+  pool.nthreads = nthreads;
+  pool.nslots = 2 * nthreads;
+
+  if (useUring) {
+#ifdef HAS_IO_URING
+    pool.nslots = MAX(pool.nslots, URING_MIN_DEPTH);
+    pool.useUring = uringSetup(pool.nslots);
+    if (!pool.useUring) {
+      JNOTE("io_uring is not available; using I/O threads") (JASSERT_ERRNO);
+      uringTeardown();
+      pool.nslots = 2 * nthreads;
+    }
+#else // ifdef HAS_IO_URING
+    JNOTE("DMTCP was built without io_uring; using I/O threads");
+#endif // ifdef HAS_IO_URING
+  }
+  if (pool.useUring) {
+    pool.nthreads = 0;
+  }
+
+  // A shared anonymous mapping shows up as an area of its own in
+  // /proc/self/maps; see startPool() in ckptcompress.cpp.
+  pool.arenaSize = pool.nthreads * WORKER_STACK_SIZE +
+                   pool.nslots * CKPT_IO_BLOCK_SIZE;
+  pool.arena = (char *)_real_mmap(NULL, pool.arenaSize,
+                                  PROT_READ | PROT_WRITE,
+                                  MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE,
+                                  -1, 0);
+  JASSERT(pool.arena != MAP_FAILED) (pool.arenaSize) (JASSERT_ERRNO)
+  .Text("Failed to allocate checkpoint I/O buffers");
+
+  // The buffers are aligned for O_DIRECT.
+  char *buffers = pool.arena + pool.nthreads * WORKER_STACK_SIZE;
+  for (int i = 0; i < pool.nslots; i++) {
+    pool.slots[i].buf = buffers + i * CKPT_IO_BLOCK_SIZE;
+  }
+
+  // Workers inherit a fully blocked signal mask.
+  sigset_t allSignals, oldMask;
+  sigfillset(&allSignals);
+  _real_syscall(SYS_rt_sigprocmask, SIG_SETMASK, &allSignals, &oldMask,
+                _NSIG / 8);
+  for (int i = 0; i < pool.nthreads; i++) {
+    char *stack = pool.arena + (i + 1) * WORKER_STACK_SIZE;
+    pid_t tid = clone(workerMain, stack, WORKER_CLONE_FLAGS, NULL,
+                      &pool.tids[i], NULL, &pool.tids[i]);
+    JASSERT(tid > 0) (JASSERT_ERRNO).Text("Failed to create I/O thread");
+  }
+  _real_syscall(SYS_rt_sigprocmask, SIG_SETMASK, &oldMask, NULL, _NSIG / 8);
+}
+
+static void
+stopPool()
+{
+  pool.shutdown = 1;
+  notifyAll();
+
+  // The kernel clears each tid and does a FUTEX_WAKE when the thread exits.
+  for (int i = 0; i < pool.nthreads; i++) {
+    pid_t tid;
+    while ((tid = pool.tids[i]) != 0) {
+      futexWait(&pool.tids[i], tid);
+    }
+  }
+
+#ifdef HAS_IO_URING
+  if (pool.useUring) {
+    uringTeardown();
+  }
+#endif // ifdef HAS_IO_URING
+
+  JASSERT(_real_munmap(pool.arena, pool.arenaSize) == 0) (JASSERT_ERRNO);
+  pool.arena = NULL;
+  pool.arenaSize = 0;
+}
+
+/* Slots are reused in the order in which they were submitted.  When reading,
+ * this is also the order in which their blocks are passed on.
+ */
+static void
+retireOldest()
+{
+  Slot *s = &pool.slots[pool.numRetired % pool.nslots];
+
+#ifdef HAS_IO_URING
+  while (pool.useUring && s->state != SLOT_DONE) {
+    uringReap();
+  }
+#endif // ifdef HAS_IO_URING
+  while (s->state != SLOT_DONE) {
+    int event = pool.event;
+    __sync_synchronize();
+    if (s->state == SLOT_DONE) {
+      break;
+    }
+    futexWait(&pool.event, event);
+  }
+  __sync_synchronize();
+
+  if (pool.reading) {
+    JASSERT(s->error == 0) (s->offset) (s->len) (strerror(s->error))
+    .Text("Failed to read checkpoint image");
+    JASSERT(Util::writeAll(pool.outFd, s->buf, s->len) == (ssize_t)s->len)
+      (JASSERT_ERRNO);
+  } else {
+    JASSERT(s->error == 0) (s->offset) (s->len) (strerror(s->error))
+    .Text("Failed to write checkpoint image");
+  }
+
+  s->state = SLOT_FREE;
+  pool.numRetired++;
+}
+
+static void
+retireAll()
+{
+  while (pool.numRetired < pool.numSubmitted) {
+    retireOldest();
+  }
+}
+
+static Slot *
+acquireSlot()
+{
+  if (pool.numSubmitted - pool.numRetired == (uint64_t)pool.nslots) {
+    retireOldest();
+  }
+  Slot *s = &pool.slots[pool.numSubmitted % pool.nslots];
+  JASSERT(s->state == SLOT_FREE) (s->state);
+  s->error = 0;
+  s->data = s->buf;
+  s->len = 0;
+  s->offset = pool.offset;
+  return s;
+}
+
+static void
+submitSlot(Slot *s)
+{
+  pool.numSubmitted++;
+#ifdef HAS_IO_URING
+  if (pool.useUring) {
+    s->state = SLOT_BUSY;
+    uringSubmit(s);
+    return;
+  }
+#endif // ifdef HAS_IO_URING
+  __sync_synchronize();
+  s->state = SLOT_FULL;
+  notifyAll();
+}
+
+static void
+submitStaging()
+{
+  if (pool.cur != NULL && pool.cur->len > 0) {
+    submitSlot(pool.cur);
+    pool.cur = NULL;
+  }
+}
+
+/* A second descriptor of the image file, opened with O_DIRECT, is used for
+ * the memory areas.  All of their data then goes through the staging
+ * buffers, which are aligned and written in whole blocks; only the last one
+ * is padded, and the file is truncated back afterwards.  The DMTCP header
+ * was written through fd, and ends on a page boundary.
+ */
+static void
+openDirect(int fd)
+{
+  char path[64];
+
+  if (pool.offset % DIRECT_IO_ALIGN != 0) {
+    JNOTE("Image stream is not aligned; not using O_DIRECT") (pool.offset);
+    return;
+  }
+  snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+  pool.directFd = _real_open(path, O_WRONLY | O_DIRECT, 0);
+  if (pool.directFd == -1) {
+    JNOTE("Filesystem rejects O_DIRECT; writing through the page cache")
+      (JASSERT_ERRNO);
+  }
+}
+
+#define OUTPUT_DIRECT 0x1
+#define OUTPUT_URING  0x2
+
+static int
+outputFlags()
+{
+  const char *str = getenv(ENV_VAR_CKPT_OUTPUT);
+
+  if (str == NULL || *str == '\0' || strcmp(str, "write") == 0) {
+    return 0;
+  } else if (strcmp(str, "direct") == 0) {
+    return OUTPUT_DIRECT;
+  } else if (strcmp(str, "uring") == 0) {
+    return OUTPUT_URING;
+  } else if (strcmp(str, "uring-direct") == 0) {
+    return OUTPUT_URING | OUTPUT_DIRECT;
+  }
+  JWARNING(false) (ENV_VAR_CKPT_OUTPUT) (str)
+  .Text("Unknown checkpoint output backend; using write().");
+  return 0;
+}
+
+int
+CkptIO::numStreams()
+{
+  const char *str = getenv(ENV_VAR_PARALLEL_WRITE);
+
+  if (str == NULL || *str == '\0') {
+    return 0;
+  }
+
+  char *endptr;
+  long n = strtol(str, &endptr, 10);
+  if (*endptr != '\0' || n < 0) {
+    JWARNING(false) (ENV_VAR_PARALLEL_WRITE) (str)
+    .Text("Env var not defined as a non-negative number."
+          "  Checkpoint images will be written serially.");
+    return 0;
+  }
+  return n > CKPT_IO_MAX_THREADS ? CKPT_IO_MAX_THREADS : n;
+}
+
+bool
+CkptIO::isRequested()
+{
+  return numStreams() > 1 || outputFlags() != 0;
+}
+
+void
+CkptIO::beginStream(int fd, int nthreads)
+{
+  int flags = outputFlags();
+
+  JASSERT(!streamActive);
+
+  // mtcp_writememoryareas() closes its fd when done; keep our own.
+  int outFd = _real_dup(fd);
+  JASSERT(outFd != -1) (fd) (JASSERT_ERRNO);
+  off_t offset = lseek(outFd, 0, SEEK_CUR);
+  JASSERT(offset != -1) (JASSERT_ERRNO);
+
+  startPool(outFd, nthreads, false, flags & OUTPUT_URING);
+  pool.offset = offset;
+  if (flags & OUTPUT_DIRECT) {
+    openDirect(outFd);
+  }
+  streamActive = true;
+  JTRACE("Writing checkpoint image")
+    (pool.nthreads) (pool.useUring) (pool.directFd) (offset);
+}
+
+bool
+CkptIO::isActive()
+{
+  return streamActive;
+}
+
+void
+CkptIO::write(const void *buf, size_t len)
+{
+  const char *ptr = (const char *)buf;
+
+  JASSERT(streamActive);
+  while (len > 0) {
+    if (pool.cur == NULL) {
+      pool.cur = acquireSlot();
+    }
+
+    Slot *s = pool.cur;
+    size_t n = CKPT_IO_BLOCK_SIZE - s->len;
+    if (n > len) {
+      n = len;
+    }
+    memcpy(s->buf + s->len, ptr, n);
+
+    // The index sums up the staged copy: the bytes that reach the file.
+    CkptIndex::addData(s->buf + s->len, n);
+    s->len += n;
+    pool.offset += n;
+    ptr += n;
+    len -= n;
+
+    if (s->len == CKPT_IO_BLOCK_SIZE) {
+      submitStaging();
+    }
+  }
+}
+
+void
+CkptIO::endStream()
+{
+  off_t end = pool.offset;
+
+  JASSERT(streamActive);
+  if (pool.directFd != -1 && pool.cur != NULL) {
+    size_t len = pool.cur->len;
+    size_t padded = (len + DIRECT_IO_ALIGN - 1) & ~(DIRECT_IO_ALIGN - 1);
+    memset(pool.cur->buf + len, 0, padded - len);
+    pool.cur->len = padded;
+  }
+  submitStaging();
+  retireAll();
+  stopPool();
+
+  if (pool.directFd != -1) {
+    JASSERT(_real_close(pool.directFd) == 0) (JASSERT_ERRNO);
+    JASSERT(ftruncate(pool.fd, end) == 0) (end) (JASSERT_ERRNO);
+  }
+
+  // Leave the file offset at the end of the image, as write() would have.
+  JASSERT(lseek(pool.fd, end, SEEK_SET) == end) (JASSERT_ERRNO);
+  JASSERT(_real_close(pool.fd) == 0) (JASSERT_ERRNO);
+  streamActive = false;
+  JTRACE("Checkpoint image written") (pool.numSubmitted) (end);
+}
+
+static bool
+inMapping(VA addr, const char *start, size_t size)
+{
+  return start != NULL && addr >= start && addr < start + size;
+}
+
+bool
+CkptIO::isArenaArea(const ProcMapsArea &area)
+{
+  return streamActive &&
+         (inMapping(area.addr, pool.arena, pool.arenaSize) ||
+          inMapping(area.addr, pool.uring.sqRing, pool.uring.sqRingSize) ||
+          inMapping(area.addr, pool.uring.cqRing, pool.uring.cqRingSize) ||
+          inMapping(area.addr, pool.uring.sqes, pool.uring.sqesSize));
+}
+
+void
+CkptIO::readStream(int fd, int outFd, int nthreads)
+{
+  // mtcp_restart has no use for the index at the end of the image.
+  off_t end = CkptIndex::dataEnd(fd);
+  off_t offset = lseek(fd, 0, SEEK_CUR);
+
+  JASSERT(offset != -1) (JASSERT_ERRNO);
+
+  startPool(fd, nthreads, true, false);
+  pool.outFd = outFd;
+  pool.offset = offset;
+  while (pool.offset < end) {
+    Slot *s = acquireSlot();
+    s->len = end - pool.offset;
+    if (s->len > CKPT_IO_BLOCK_SIZE) {
+      s->len = CKPT_IO_BLOCK_SIZE;
+    }
+    pool.offset += s->len;
+    submitSlot(s);
+  }
+
+  retireAll();
+  stopPool();
+}
@@ -0,0 +1,85 @@
+/****************************************************************************
+ *   Copyright (C) 2006-2013 by Jason Ansel, Kapil Arya, and Gene Cooperman *
+ *   jansel@csail.mit.edu, kapil@ccs.neu.edu, gene@ccs.neu.edu              *
+ *                                                                          *
+ *  This file is part of DMTCP.                                             *
+ *                                                                          *
+ *  DMTCP is free software: you can redistribute it and/or                  *
+ *  modify it under the terms of the GNU Lesser General Public License as   *
+ *  published by the Free Software Foundation, either version 3 of the      *
+ *  License, or (at your option) any later version.                         *
+ *                                                                          *
+ *  DMTCP is distributed in the hope that it will be useful,                *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU Lesser General Public License for more details.                     *
+ *                                                                          *
+ *  You should have received a copy of the GNU Lesser General Public        *
+ *  License along with DMTCP:dmtcp/src.  If not, see                        *
+ *  <http://www.gnu.org/licenses/>.                                         *
+ ****************************************************************************/
+
+#ifndef CKPT_IO_H
+#define CKPT_IO_H
+
+#include "procmapsarea.h"
+
+/* Parallel writing and reading of uncompressed checkpoint images.
+ *
+ * The layout of an image is known to the checkpoint thread as it walks the
+ * memory areas: each area record is followed by the data of its runs.
+ * Instead of writing that stream with write(), the checkpoint thread hands
+ * it out in pieces of at most CKPT_IO_BLOCK_SIZE bytes, together with their
+ * offset in the file, to a pool of threads that write them concurrently
+ * with pwrite().  Everything is copied into staging buffers first, so
+ * whatever the checkpoint thread does to the memory of the process after
+ * handing it out (allocations, the deduplication and index buffers,
+ * madvise()) cannot show up in the file.  The resulting file is identical
+ * to one written serially.
+ *
+ * dmtcp_restart reads such an image back with as many threads, each
+ * pread()ing its own blocks, and feeds it to mtcp_restart in order.
+ *
+ * DMTCP_CKPT_OUTPUT selects how the blocks reach the file:
+ *   write         pwritev() from the worker threads (the default);
+ *   direct        the same, through a second descriptor opened with
+ *                 O_DIRECT, bypassing the page cache;
+ *   uring         the checkpoint thread queues the blocks on an io_uring
+ *                 instead of handing them to worker threads;
+ *   uring-direct  both.
+ * Whatever the kernel or the filesystem does not support falls back to the
+ * default, with a note.
+ */
+
+#define CKPT_IO_BLOCK_SIZE   (4 * 1024 * 1024)
+#define CKPT_IO_MAX_THREADS  64
+
+#ifdef __cplusplus
+namespace dmtcp
+{
+namespace CkptIO
+{
+// Number of writer threads requested through DMTCP_PARALLEL_WRITE, or 0 if
+// images are written serially.
+int numStreams();
+
+// True if images are written through this module: in parallel, or with an
+// output backend other than plain write().
+bool isRequested();
+
+// Writer side.  Called by the checkpoint thread with all user threads
+// suspended.  No malloc is done; all buffers and worker stacks live in a
+// single mmap'ed arena that mtcp_writememoryareas() must not save.
+void beginStream(int fd, int nthreads);
+bool isActive();
+void write(const void *buf, size_t len);
+void endStream();
+bool isArenaArea(const ProcMapsArea &area);
+
+// Reader side, used by dmtcp_restart: copy the rest of the image file fd to
+// outFd, reading it with nthreads threads.
+void readStream(int fd, int outFd, int nthreads);
+}
+}
+#endif // ifdef __cplusplus
+#endif // ifndef CKPT_IO_H
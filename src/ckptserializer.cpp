@@ -18,11 +18,18 @@
  *  License along with DMTCP.  If not, see <http://www.gnu.org/licenses/>.  *
  ****************************************************************************/
 
+#include <ctype.h>
+#include <errno.h>
 #include <limits.h> /* for LONG_MIN and LONG_MAX */
 #include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <time.h>
 #ifdef __aarch64__
 
 /* On aarch64, fork() is not implemented, in favor of clone().
@@ -38,11 +45,26 @@
 #else // ifdef __aarch64__
 # define _real_sys_fork() _real_syscall(SYS_fork)
 #endif // ifdef __aarch64__
+
+/* A fork whose child sends no signal when it exits: the SIGCHLD handler of
+ * the user is not involved, and plain wait() calls do not see the child.
+ * It is reaped with __WCLONE.
+ */
+#define _real_sys_fork_nosignal() \
+  _real_syscall(SYS_clone, 0, NULL, NULL, NULL, NULL)
 #include <fcntl.h>
 #include <signal.h>
 #include <unistd.h>
+#include "../jalib/jfilesystem.h"
+#include "../jalib/jsocket.h"
+#include "ckptcompress.h"
+#include "ckptdedup.h"
+#include "ckptincremental.h"
+#include "ckptindex.h"
+#include "ckptio.h"
 #include "ckptserializer.h"
 #include "constants.h"
+#include "coordinatorapi.h"
 #include "dmtcp.h"
 #include "protectedfds.h"
 #include "syscallwrappers.h"
@@ -62,8 +84,23 @@ using namespace dmtcp;
 #define FORKED_CKPT_PARENT 1
 #define FORKED_CKPT_CHILD  2
 
+// The writer reports to the coordinator every so many bytes.
+#define CKPT_WRITE_PROGRESS_INTERVAL (256 * 1024 * 1024)
+
+// Staged images are copied to the checkpoint directory in chunks this big.
+#define CKPT_DRAIN_BUF_SIZE          (4 * 1024 * 1024)
+#define CKPT_DRAIN_LOCK              ".dmtcp_drain.lock"
+
 static int forked_ckpt_status = -1;
+static pid_t ckpt_writer_pid = -1;
+static int ckpt_writer_sock = -1;
+static bool ckpt_write_async = false;
+static uint64_t ckpt_bytes_written = 0;
+static uint64_t ckpt_bytes_reported = 0;
 static pid_t ckpt_extcomp_child_pid = -1;
+static uint32_t migrate_stage = DMT_MIGRATE_NONE;
+static char migrate_target[PATH_MAX] = { 0 };
+static char migrate_cookie[DMTCP_MIGRATE_COOKIE_MAX + 2] = { 0 };
 static struct sigaction saved_sigchld_action;
 static int open_ckpt_to_write(int fd, int pipe_fds[2], char **extcomp_args);
 void mtcp_writememoryareas(int fd) __attribute__((weak));
@@ -218,9 +255,13 @@ open_ckpt_to_write_gz(int fd, int pipe_fds[2], char *gzip_path)
 static int
 perform_open_ckpt_image_fd(const char *tempCkptFilename,
                            bool *use_compression,
+                           bool *use_parallel_compression,
+                           bool *use_parallel_write,
                            int *fdCkptFileOnDisk)
 {
   *use_compression = false;  /* default value */
+  *use_parallel_compression = false;
+  *use_parallel_write = false;
 
   /* 1. Open fd to checkpoint image on disk */
   /* Create temp checkpoint file and write magic number to it */
@@ -230,12 +271,24 @@ perform_open_ckpt_image_fd(const char *tempCkptFilename,
   JASSERT(fd != -1) (tempCkptFilename) (JASSERT_ERRNO)
   .Text("Error creating file.");
 
-#ifdef FAST_RST_VIA_MMAP
-  return fd;
-#endif // ifdef FAST_RST_VIA_MMAP
+  /* 2. Built-in parallel compression takes precedence over an external
+   *    compressor; the image is compressed in-process by worker threads.
+   */
+  if (CkptCompress::numThreads() > 0) {
+    *use_parallel_compression = true;
+    return fd;
+  }
+
+  /* 2a. Parallel writing and the O_DIRECT/io_uring backends need a seekable,
+   *     uncompressed image; they are used instead of an external compressor.
+   */
+  if (CkptIO::isRequested()) {
+    *use_parallel_write = true;
+    return fd;
+  }
 
-  /* 2. Test if using GZIP/HBICT compression */
-  /* 2a. Test if using GZIP compression */
+  /* 3. Test if using GZIP/HBICT compression */
+  /* 3a. Test if using GZIP compression */
   int use_gzip_compression = 0;
   int use_deltacompression = 0;
   char *gzip_cmd = const_cast<char *>("gzip");
@@ -243,7 +296,7 @@ perform_open_ckpt_image_fd(const char *tempCkptFilename,
   use_gzip_compression = test_use_compression(const_cast<char *>("GZIP"),
                                               gzip_cmd, gzip_path, 1);
 
-  /* 2b. Test if using HBICT compression */
+  /* 3b. Test if using HBICT compression */
 #ifdef HBICT_DELTACOMP
   char *hbict_cmd = const_cast<char *>("hbict");
   char hbict_path[PATH_MAX];
@@ -253,25 +306,25 @@ perform_open_ckpt_image_fd(const char *tempCkptFilename,
                                               hbict_cmd, hbict_path, 1);
 #endif // ifdef HBICT_DELTACOMP
 
-  /* 3. We now have the information to pipe to gzip, or directly to fd.
+  /* 4. We now have the information to pipe to gzip, or directly to fd.
   *     We do it this way, so that gzip will be direct child of forked process
   *       when using forked checkpointing.
   */
 
   if (use_deltacompression || use_gzip_compression) { /* fork compr. process */
-    /* 3a. Set SIGCHLD to our own handler;
+    /* 4a. Set SIGCHLD to our own handler;
      *     User handling is restored after gzip finishes.
      */
     prepare_sigchld_handler();
 
-    /* 3b. Open pipe */
+    /* 4b. Open pipe */
     int pipe_fds[2];
     if (_real_pipe(pipe_fds) == -1) {
       JWARNING(false).Text("Error creating pipe. Compression won't be used.");
       use_gzip_compression = use_deltacompression = 0;
     }
 
-    /* 3c. Fork compressor child */
+    /* 4c. Fork compressor child */
     if (use_deltacompression) { /* fork a hbict process */
 #ifdef HBICT_DELTACOMP
       *use_compression = true;
@@ -296,6 +349,33 @@ perform_open_ckpt_image_fd(const char *tempCkptFilename,
   return fd;
 }
 
+/* Returns false if the writer of the last forked checkpoint is still running.
+ */
+static bool
+reap_ckpt_writer(bool block)
+{
+  if (ckpt_writer_pid == -1) {
+    return true;
+  }
+
+  pid_t ret = _real_waitpid(ckpt_writer_pid, NULL,
+                            __WCLONE | (block ? 0 : WNOHANG));
+  if (ret == 0) {
+    return false;
+  }
+
+  // ECHILD: somebody else did a wait(__WALL).
+  JWARNING(ret == ckpt_writer_pid || errno == ECHILD)
+    (ckpt_writer_pid) (JASSERT_ERRNO);
+  ckpt_writer_pid = -1;
+  return true;
+}
+
+/* With forked checkpointing, the image is written by a copy-on-write child
+ * while the process resumes right after fork().  The child is not waited
+ * for: it reports its progress and the completion of the image to the
+ * coordinator, which commits the checkpoint only then.
+ */
 static int
 test_and_prepare_for_forked_ckpt()
 {
@@ -303,38 +383,251 @@ test_and_prepare_for_forked_ckpt()
   return 1;
 #endif // ifdef TEST_FORKED_CHECKPOINTING
 
-  if (getenv(ENV_VAR_FORKED_CKPT) == NULL) {
+  ckpt_write_async = false;
+  if (migrate_stage == DMT_MIGRATE_FINAL) {
+    // The final migration image is written by this process, after the
+    // pre-copy image: it needs the soft-dirty bits of this process.
+    reap_ckpt_writer(true);
+    return 0;
+  }
+  if (getenv(ENV_VAR_FORKED_CKPT) == NULL &&
+      migrate_stage != DMT_MIGRATE_PRECOPY) {
     return 0;
   }
 
-  /* Set SIGCHLD to our own handler;
-   *     User handling is restored after forking child process.
-   */
-  prepare_sigchld_handler();
+  // The writer of the previous image may still be writing the same file.
+  if (!reap_ckpt_writer(false)) {
+    JNOTE("Waiting for the previous checkpoint image to be written")
+      (ckpt_writer_pid);
+    reap_ckpt_writer(true);
+  }
+
+  // Opened here, so that this process knows whether the coordinator will
+  // hear from the writer.
+  int sock = CoordinatorAPI::createCkptWriterSocket();
 
-  pid_t forked_cpid = _real_sys_fork();
+  if (migrate_stage == DMT_MIGRATE_PRECOPY) {
+    CkptIncremental::primeMigration();
+  }
+
+  pid_t forked_cpid = _real_sys_fork_nosignal();
   if (forked_cpid == -1) {
-    JWARNING(false)
+    JWARNING(false) (JASSERT_ERRNO)
     .Text("Failed to do forked checkpointing, trying normal checkpoint");
+    if (sock != -1) {
+      _real_close(sock);
+    }
     return FORKED_CKPT_FAILED;
   } else if (forked_cpid > 0) {
-    restore_sigchld_handler_and_wait_for_zombie(forked_cpid);
-    JTRACE("checkpoint complete\n");
+    ckpt_writer_pid = forked_cpid;
+    ckpt_write_async = sock != -1;
+    if (sock != -1) {
+      _real_close(sock);
+    }
+    JTRACE("checkpoint image is written by a child") (forked_cpid);
     return FORKED_CKPT_PARENT;
+  }
+
+  JTRACE("inside checkpoint writer process");
+  ckpt_writer_sock = sock;
+  ckpt_bytes_written = 0;
+  ckpt_bytes_reported = 0;
+  return FORKED_CKPT_CHILD;
+}
+
+static void
+report_ckpt_write_progress(size_t len)
+{
+  if (ckpt_writer_sock == -1) {
+    return;
+  }
+  ckpt_bytes_written += len;
+  if (ckpt_bytes_written - ckpt_bytes_reported >=
+      CKPT_WRITE_PROGRESS_INTERVAL) {
+    CoordinatorAPI::sendCkptWriteStatus(ckpt_writer_sock,
+                                        DMT_CKPT_WRITE_PROGRESS,
+                                        ckpt_bytes_written);
+    ckpt_bytes_reported = ckpt_bytes_written;
+  }
+}
+
+bool
+CkptSerializer::isAsyncCkpt()
+{
+  return ckpt_write_async;
+}
+
+bool
+CkptSerializer::isAsyncWritePending()
+{
+  return !reap_ckpt_writer(false);
+}
+
+/* Tiered checkpoint storage (DMTCP_CKPT_STAGING_DIR): the image is written
+ * to a fast node-local directory and the process resumes.  A drainer then
+ * copies it to the checkpoint directory and reports to the coordinator like
+ * the writer of a forked checkpoint, so that the checkpoint is committed,
+ * and the restart script written, only once every image is there.  The
+ * drainers of a node take turns through a lock file in the staging
+ * directory, each copying at most DMTCP_CKPT_DRAIN_RATE MB/s.
+ */
+static string
+staged_ckpt_filename(const string &ckptFilename)
+{
+  const char *stagingDir = getenv(ENV_VAR_CKPT_STAGING_DIR);
+
+  if (stagingDir == NULL || stagingDir[0] == '\0') {
+    return "";
+  }
+  JASSERT(mkdir(stagingDir, S_IRWXU) == 0 || errno == EEXIST)
+    (JASSERT_ERRNO) (stagingDir)
+  .Text("Error creating checkpoint staging directory");
+  return string(stagingDir) + "/" +
+         jalib::Filesystem::BaseName(ckptFilename);
+}
+
+/* Runs in the drainer, which must not allocate: the paths are built by the
+ * caller before the fork.  Returns 0 or an errno value.
+ */
+static int
+drain_ckpt_image(const char *stagedFilename,
+                 const char *lockFilename,
+                 const char *tempFilename,
+                 const char *ckptFilename)
+{
+  const char *rateStr = getenv(ENV_VAR_CKPT_DRAIN_RATE);
+  double bytesPerSec = rateStr != NULL ? atof(rateStr) * 1024 * 1024 : 0;
+  int err = 0;
+
+  int lockFd = _real_open(lockFilename, O_RDWR | O_CREAT, 0600);
+  if (lockFd != -1) {
+    while (flock(lockFd, LOCK_EX) == -1 && errno == EINTR) {}
+  }
+
+  int in = _real_open(stagedFilename, O_RDONLY, 0);
+  int out = _real_open(tempFilename, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  void *buf = _real_mmap(NULL, CKPT_DRAIN_BUF_SIZE, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (in == -1 || out == -1 || buf == MAP_FAILED) {
+    err = errno;
+  }
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  ckpt_bytes_written = 0;
+  ckpt_bytes_reported = 0;
+  uint64_t copied = 0;
+  while (err == 0) {
+    ssize_t rc = Util::readAll(in, buf, CKPT_DRAIN_BUF_SIZE);
+    if (rc <= 0) {
+      err = rc < 0 ? errno : 0;
+      break;
+    }
+    if (Util::writeAll(out, buf, rc) != rc) {
+      err = errno;
+      break;
+    }
+    copied += rc;
+    report_ckpt_write_progress(rc);
+
+    if (bytesPerSec > 0) {
+      // Sleep until the copy is back under the rate.
+      double due = copied / bytesPerSec;
+      struct timespec now;
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      double ahead = due - ((now.tv_sec - start.tv_sec) +
+                            (now.tv_nsec - start.tv_nsec) / 1e9);
+      if (ahead > 0) {
+        struct timespec delay;
+        delay.tv_sec = (time_t)ahead;
+        delay.tv_nsec = (long)((ahead - delay.tv_sec) * 1e9);
+        while (nanosleep(&delay, &delay) == -1 && errno == EINTR) {}
+      }
+    }
+  }
+
+  if (err == 0 && fsync(out) == -1) {
+    err = errno;
+  }
+  if (buf != MAP_FAILED) {
+    _real_munmap(buf, CKPT_DRAIN_BUF_SIZE);
+  }
+  if (in != -1) {
+    _real_close(in);
+  }
+  if (out != -1 && _real_close(out) == -1 && err == 0) {
+    err = errno;
+  }
+  if (err == 0 && rename(tempFilename, ckptFilename) == -1) {
+    err = errno;
+  }
+
+  if (err == 0) {
+    unlink(stagedFilename);
   } else {
-    pid_t grandchild_pid = _real_sys_fork();
-    JWARNING(grandchild_pid != -1)
-    .Text("WARNING: Forked checkpoint failed, no checkpoint available");
-    if (grandchild_pid > 0) {
-      // Use _exit() instead of exit() to avoid popping atexit() handlers
-      // registered by the parent process.
-      _exit(0); /* child exits */
+    // The staged image is kept: it is the only complete copy.
+    unlink(tempFilename);
+  }
+  JWARNING(err == 0) (stagedFilename) (ckptFilename) (strerror(err))
+  .Text("Failed to copy the staged checkpoint image");
+
+  if (lockFd != -1) {
+    _real_close(lockFd);
+  }
+  return err;
+}
+
+/* Copies the staged image to the checkpoint directory: in the forked
+ * checkpoint writer itself, or else in a drainer forked for it.
+ */
+static void
+drain_staged_image(const string &stagedFilename, const string &ckptFilename)
+{
+  string lockFilename = jalib::Filesystem::DirName(stagedFilename) +
+                        "/" CKPT_DRAIN_LOCK;
+  string tempFilename = ckptFilename + ".temp";
+
+  if (forked_ckpt_status == FORKED_CKPT_CHILD) {
+    int err = drain_ckpt_image(stagedFilename.c_str(), lockFilename.c_str(),
+                               tempFilename.c_str(), ckptFilename.c_str());
+    if (ckpt_writer_sock != -1) {
+      CoordinatorAPI::sendCkptWriteStatus(ckpt_writer_sock,
+                                          DMT_CKPT_WRITE_DONE,
+                                          ckpt_bytes_written,
+                                          err);
     }
+    _exit(0); /* writer exits */
+  }
 
-    /* grandchild continues; no need now to waitpid() on grandchild */
-    JTRACE("inside grandchild process");
+  int sock = CoordinatorAPI::createCkptWriterSocket();
+  pid_t cpid = _real_sys_fork_nosignal();
+  if (cpid == -1) {
+    JWARNING(false) (JASSERT_ERRNO)
+    .Text("Failed to fork the drainer, copying the staged image now");
+    if (sock != -1) {
+      _real_close(sock);
+    }
+    drain_ckpt_image(stagedFilename.c_str(), lockFilename.c_str(),
+                     tempFilename.c_str(), ckptFilename.c_str());
+    return;
+  } else if (cpid > 0) {
+    ckpt_writer_pid = cpid;
+    ckpt_write_async = sock != -1;
+    if (sock != -1) {
+      _real_close(sock);
+    }
+    JTRACE("staged checkpoint image is drained by a child") (cpid);
+    return;
   }
-  return FORKED_CKPT_CHILD;
+
+  ckpt_writer_sock = sock;
+  int err = drain_ckpt_image(stagedFilename.c_str(), lockFilename.c_str(),
+                             tempFilename.c_str(), ckptFilename.c_str());
+  if (sock != -1) {
+    CoordinatorAPI::sendCkptWriteStatus(sock, DMT_CKPT_WRITE_DONE,
+                                        ckpt_bytes_written, err);
+  }
+  _exit(0); /* drainer exits */
 }
 
 int
@@ -400,6 +693,123 @@ open_ckpt_to_write(int fd, int pipe_fds[2], char **extcomp_args)
   return fd;
 }
 
+void
+CkptSerializer::setMigration(uint32_t stage,
+                             const char *target,
+                             const char *cookie)
+{
+  migrate_stage = DMT_MIGRATE_NONE;
+  migrate_target[0] = '\0';
+  migrate_cookie[0] = '\0';
+  if (stage != DMT_MIGRATE_NONE) {
+    JASSERT(target != NULL && strlen(target) < sizeof(migrate_target))
+      (target);
+    JASSERT(cookie != NULL && strlen(cookie) <= DMTCP_MIGRATE_COOKIE_MAX);
+    strcpy(migrate_target, target);
+    snprintf(migrate_cookie, sizeof(migrate_cookie), "%s\n", cookie);
+    migrate_stage = stage;
+  }
+}
+
+bool
+CkptSerializer::isMigrationImage()
+{
+  return migrate_stage != DMT_MIGRATE_NONE;
+}
+
+uint32_t
+CkptSerializer::migrationStage()
+{
+  return migrate_stage;
+}
+
+// Returns a socket connected to migrate_target (HOST:PORT), or -1.
+static int
+open_migration_stream()
+{
+  const char *sep = strrchr(migrate_target, ':');
+
+  if (sep == NULL || sep == migrate_target || !isdigit(sep[1])) {
+    JWARNING(false) (migrate_target)
+    .Text("The migration target must be given as HOST:PORT");
+    errno = EINVAL;
+    return -1;
+  }
+
+  string host(migrate_target, sep - migrate_target);
+  return jalib::JClientSocket(host.c_str(), atoi(sep + 1)).sockfd();
+}
+
+/* The image of a live migration goes through a socket to dmtcp_restart,
+ * preceded by a tag for the round.  It is written in a form that the
+ * receiver can restore on its own: uncompressed, in one stream, and without
+ * references to the page deduplication store or to the mapped files.  The
+ * final image refers to the pre-copy image as its parent, under the name
+ * the receiver keeps it.
+ *
+ * If the target cannot be reached for the final image, this process exits
+ * all the same: returns false, and the image goes to the checkpoint
+ * directory instead, so that the computation can still be restarted.
+ */
+static bool
+write_migration_image(void *mtcpHdr, size_t mtcpHdrLen)
+{
+  const bool isFinal = migrate_stage == DMT_MIGRATE_FINAL;
+  const char *tag = isFinal ? DMTCP_MIGRATE_FINAL_TAG
+                            : DMTCP_MIGRATE_PRECOPY_TAG;
+  string ckptFilename = ProcessInfo::instance().getCkptFilename();
+  string parent;
+
+  int fd = open_migration_stream();
+  if (fd == -1 && isFinal) {
+    JWARNING(false) (migrate_target) (JASSERT_ERRNO) (ckptFilename)
+    .Text("Cannot connect to the migration target; writing the image to"
+          " the checkpoint directory instead");
+    migrate_stage = DMT_MIGRATE_NONE;
+    return false;
+  } else if (fd == -1) {
+    int err = errno;
+    JWARNING(false) (migrate_target) (JASSERT_ERRNO)
+    .Text("Cannot connect to the migration target; migration aborted");
+    if (forked_ckpt_status != FORKED_CKPT_CHILD) {
+      return true;
+    }
+    if (ckpt_writer_sock != -1) {
+      CoordinatorAPI::sendCkptWriteStatus(ckpt_writer_sock,
+                                          DMT_CKPT_WRITE_DONE, 0, err);
+    }
+    _exit(0);
+  }
+
+  if (isFinal) {
+    parent = jalib::Filesystem::BaseName(ckptFilename) +
+             DMTCP_MIGRATE_PRECOPY_SUFFIX;
+  }
+  CkptIncremental::prepareMigrationImage(parent);
+  CkptDedup::prepareImage(false);
+  ProcessInfo::instance().setNumWriteStreams(0);
+
+  JTRACE("Streaming migration image") (migrate_target) (isFinal);
+  JASSERT(Util::writeAll(fd, migrate_cookie, strlen(migrate_cookie)) ==
+          (ssize_t)strlen(migrate_cookie) &&
+          Util::writeAll(fd, tag, strlen(tag)) == (ssize_t)strlen(tag))
+    (migrate_target) (JASSERT_ERRNO);
+  CkptSerializer::writeDmtcpHeader(fd);
+  CkptSerializer::writeToImage(fd, mtcpHdr, mtcpHdrLen);
+  mtcp_writememoryareas(fd);
+  JASSERT(_real_close(fd) == 0) (migrate_target) (JASSERT_ERRNO);
+
+  if (forked_ckpt_status == FORKED_CKPT_CHILD) {
+    if (ckpt_writer_sock != -1) {
+      CoordinatorAPI::sendCkptWriteStatus(ckpt_writer_sock,
+                                          DMT_CKPT_WRITE_DONE,
+                                          ckpt_bytes_written);
+    }
+    _exit(0); /* writer exits */
+  }
+  return true;
+}
+
 void
 CkptSerializer::createCkptDir()
 {
@@ -419,11 +829,10 @@ void
 CkptSerializer::writeCkptImage(void *mtcpHdr, size_t mtcpHdrLen)
 {
   string ckptFilename = ProcessInfo::instance().getCkptFilename();
-  string tempCkptFilename = ckptFilename;
-
-  tempCkptFilename += ".temp";
+  string stagedFilename;
 
   JTRACE("Thread performing checkpoint.") (dmtcp_gettid());
+  Util::waitForLazyRestart();
   createCkptDir();
   forked_ckpt_status = test_and_prepare_for_forked_ckpt();
   if (forked_ckpt_status == FORKED_CKPT_PARENT) {
@@ -431,27 +840,92 @@ CkptSerializer::writeCkptImage(void *mtcpHdr, size_t mtcpHdrLen)
     return;
   }
 
+  // A final migration image that could not be sent is written below, as a
+  // full image: its pre-copy parent went to the migration target.
+  bool migrationFailed = false;
+  if (migrate_stage != DMT_MIGRATE_NONE) {
+    if (write_migration_image(mtcpHdr, mtcpHdrLen)) {
+      JTRACE("migration image complete");
+      return;
+    }
+    migrationFailed = true;
+  }
+
+  stagedFilename = staged_ckpt_filename(ckptFilename);
+  if (!stagedFilename.empty() && forked_ckpt_status != FORKED_CKPT_CHILD &&
+      !reap_ckpt_writer(false)) {
+    // The previous image may still be in the staging directory.
+    JNOTE("Waiting for the previous checkpoint image to be drained")
+      (ckpt_writer_pid);
+    reap_ckpt_writer(true);
+  }
+
+  string tempCkptFilename =
+    (stagedFilename.empty() ? ckptFilename : stagedFilename) + ".temp";
+
+  // Must precede writeDmtcpHeader(), which records the parent image and
+  // the page deduplication store.  A staged image is not incremental:
+  // its ancestors might be removed from the checkpoint directory before
+  // it gets there.
+  CkptIncremental::prepareImage(ckptFilename,
+                                forked_ckpt_status == FORKED_CKPT_CHILD ||
+                                !stagedFilename.empty() || migrationFailed);
+  CkptDedup::prepareImage();
+
   /* fd will either point to the ckpt file to write, or else the write end
    * of a pipe leading to a compression child process.
    */
   bool use_compression = false;
+  bool use_parallel_compression = false;
+  bool use_parallel_write = false;
   int fdCkptFileOnDisk = -1;
   int fd = -1;
 
   fd = perform_open_ckpt_image_fd(tempCkptFilename.c_str(), &use_compression,
+                                  &use_parallel_compression,
+                                  &use_parallel_write,
                                   &fdCkptFileOnDisk);
   JASSERT(fdCkptFileOnDisk >= 0);
   JASSERT(use_compression || fd == fdCkptFileOnDisk);
 
+  // Tells dmtcp_restart to read the image back with as many threads.
+  ProcessInfo::instance().setNumWriteStreams(use_parallel_write ?
+                                             CkptIO::numStreams() : 0);
+
   // The rest of this function is for compatibility with original definition.
   writeDmtcpHeader(fd);
 
+  // Only an uncompressed image is indexed: the offsets of its areas are
+  // those of the file.  The index counts all bytes written from here on,
+  // the MTCP header included.
+  const char *useIndex = getenv(ENV_VAR_CKPT_INDEX);
+  if (!use_compression && !use_parallel_compression &&
+      (useIndex == NULL || strcmp(useIndex, "0") != 0)) {
+    off_t offset = lseek(fdCkptFileOnDisk, 0, SEEK_CUR);
+    JASSERT(offset != -1) (JASSERT_ERRNO);
+    CkptIndex::begin(offset);
+  }
+
+  // The DMTCP header is left uncompressed so that dmtcp_restart can always
+  // read it; everything after it goes through the compressor threads.
+  if (use_parallel_compression) {
+    CkptCompress::beginStream(fd, CkptCompress::numThreads());
+  } else if (use_parallel_write) {
+    CkptIO::beginStream(fd, CkptIO::numStreams());
+  }
+
   // Write MTCP header
-  JASSERT(Util::writeAll(fd, mtcpHdr, mtcpHdrLen) == (ssize_t)mtcpHdrLen);
+  writeToImage(fd, mtcpHdr, mtcpHdrLen);
 
   JTRACE("MTCP is about to write checkpoint image.")(ckptFilename);
   mtcp_writememoryareas(fd);
 
+  if (use_parallel_compression) {
+    CkptCompress::endStream();
+  } else if (use_parallel_write) {
+    CkptIO::endStream();
+  }
+
   if (use_compression) {
     /* In perform_open_ckpt_image_fd(), we set SIGCHLD to our own handler.
      * Restore it now.
@@ -469,12 +943,31 @@ CkptSerializer::writeCkptImage(void *mtcpHdr, size_t mtcpHdrLen)
    * checkpoint file.  Uses rename() syscall, which doesn't change i-nodes.
    * So, gzip process can continue to write to file even after renaming.
    */
+  if (!stagedFilename.empty()) {
+    JASSERT(rename(tempCkptFilename.c_str(), stagedFilename.c_str()) == 0);
+    CkptIncremental::finishImage(ckptFilename);
+    drain_staged_image(stagedFilename, ckptFilename);
+    JTRACE("checkpoint image staged") (stagedFilename);
+    return;
+  }
+
   JASSERT(rename(tempCkptFilename.c_str(), ckptFilename.c_str()) == 0);
+  CkptIncremental::finishImage(ckptFilename);
 
   if (forked_ckpt_status == FORKED_CKPT_CHILD) {
+    if (ckpt_writer_sock != -1) {
+      struct stat st;
+      if (stat(ckptFilename.c_str(), &st) == 0) {
+        ckpt_bytes_written = st.st_size;
+      }
+      CoordinatorAPI::sendCkptWriteStatus(ckpt_writer_sock,
+                                          DMT_CKPT_WRITE_DONE,
+                                          ckpt_bytes_written);
+    }
+
     // Use _exit() instead of exit() to avoid popping atexit() handlers
     // registered by the parent process.
-    _exit(0); /* grandchild exits */
+    _exit(0); /* writer exits */
   }
 
   JTRACE("checkpoint complete");
@@ -497,3 +990,17 @@ CkptSerializer::writeDmtcpHeader(int fd)
   char buf[remaining];
   JASSERT(Util::writeAll(fd, buf, remaining) == remaining);
 }
+
+void
+CkptSerializer::writeToImage(int fd, const void *buf, size_t len)
+{
+  report_ckpt_write_progress(len);
+  if (CkptCompress::isActive()) {
+    CkptCompress::write(buf, len);
+  } else if (CkptIO::isActive()) {
+    CkptIO::write(buf, len);
+  } else {
+    JASSERT(Util::writeAll(fd, buf, len) == (ssize_t)len) (JASSERT_ERRNO);
+    CkptIndex::addData(buf, len);
+  }
+}
@@ -34,6 +34,22 @@ int openCkptFileToWrite(const string &path);
 void createCkptDir();
 void writeCkptImage(void *mtcpHdr, size_t mtcpHdrLen);
 void writeDmtcpHeader(int fd);
+void writeToImage(int fd, const void *buf, size_t len);
+
+// Forked checkpointing: true if the last image is written by a child that
+// reports to the coordinator, and whether that child is still running.
+bool isAsyncCkpt();
+bool isAsyncWritePending();
+
+// Live migration: the images of the next checkpoint are streamed to the
+// dmtcp_restart --migrate-listen at target (HOST:PORT), each preceded by
+// cookie, instead of being written to the checkpoint directory.  stage is a
+// DmtcpMigrateStage.
+// migrationStage() is DMT_MIGRATE_NONE after the final image fell back to
+// the checkpoint directory.
+void setMigration(uint32_t stage, const char *target, const char *cookie);
+bool isMigrationImage();
+uint32_t migrationStage();
 }
 }
 #endif // ifndef CKPT_SERIZLIZER_H
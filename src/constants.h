@@ -96,12 +96,34 @@
 #define ENV_VAR_EXPLICIT_SRUN       "DMTCP_EXPLICIT_SRUN"
 #define ENV_VAR_SKIP_WRITING_TEXT_SEGMENTS \
                                     "DMTCP_SKIP_WRITING_TEXT_SEGMENTS"
+#define ENV_VAR_SKIP_UNMODIFIED_FILE_PAGES \
+                                    "DMTCP_SKIP_UNMODIFIED_FILE_PAGES"
+
+// Keep in sync with plugin/ipc/file/fileconnection.h
+#define ENV_VAR_CKPT_FILES_COPY_THREADS \
+                                    "DMTCP_CKPT_FILES_COPY_THREADS"
+#define ENV_VAR_CKPT_FILES_DELTA    "DMTCP_CKPT_FILES_DELTA"
 
 #define ENV_VAR_COORD_LOGFILE       "DMTCP_COORD_LOG_FILENAME"
 
 // it is not yet safe to change these; these names are hard-wired in the code
 #define ENV_VAR_STDERR_PATH         "JALIB_STDERR_PATH"
 #define ENV_VAR_COMPRESSION         "DMTCP_GZIP"
+#define ENV_VAR_PARALLEL_COMPRESSION "DMTCP_PARALLEL_COMPRESSION"
+#define ENV_VAR_INCREMENTAL_CKPT    "DMTCP_INCREMENTAL_CKPT"
+#define ENV_VAR_DEDUP_DIR           "DMTCP_DEDUP_DIR"
+#define ENV_VAR_PARALLEL_WRITE      "DMTCP_PARALLEL_WRITE"
+#define ENV_VAR_CKPT_OUTPUT         "DMTCP_CKPT_OUTPUT"
+#define ENV_VAR_CKPT_INDEX          "DMTCP_CKPT_INDEX"
+#define ENV_VAR_CKPT_STAGING_DIR    "DMTCP_CKPT_STAGING_DIR"
+#define ENV_VAR_CKPT_DRAIN_RATE     "DMTCP_CKPT_DRAIN_RATE"
+#define ENV_VAR_BARRIER_RELAY       "DMTCP_BARRIER_RELAY"
+#define ENV_VAR_NODE_BARRIERS       "DMTCP_NODE_BARRIERS"
+#define ENV_VAR_LAZY_RESTART        "DMTCP_LAZY_RESTART"
+#define ENV_VAR_MMAP_RESTART        "DMTCP_MMAP_RESTART"
+#define ENV_VAR_RESTART_PREFETCH_THREADS "DMTCP_RESTART_PREFETCH_THREADS"
+#define ENV_VAR_MIGRATE_TO          "DMTCP_MIGRATE_TO"
+#define ENV_VAR_MIGRATE_COOKIE      "DMTCP_MIGRATE_COOKIE"
 #define ENV_VAR_ALLOC_PLUGIN        "DMTCP_ALLOC_PLUGIN"
 #define ENV_VAR_DL_PLUGIN           "DMTCP_DL_PLUGIN"
 #ifdef HBICT_DELTACOMP
@@ -140,6 +162,17 @@
   ENV_VAR_QUIET,                      \
   ENV_VAR_STDERR_PATH,                \
   ENV_VAR_COMPRESSION,                \
+  ENV_VAR_PARALLEL_COMPRESSION,       \
+  ENV_VAR_INCREMENTAL_CKPT,           \
+  ENV_VAR_DEDUP_DIR,                  \
+  ENV_VAR_PARALLEL_WRITE,             \
+  ENV_VAR_CKPT_OUTPUT,                \
+  ENV_VAR_CKPT_INDEX,                 \
+  ENV_VAR_CKPT_STAGING_DIR,           \
+  ENV_VAR_CKPT_DRAIN_RATE,            \
+  ENV_VAR_BARRIER_RELAY,              \
+  ENV_VAR_NODE_BARRIERS,              \
+  ENV_VAR_FORKED_CKPT,                \
   ENV_VAR_ALLOC_PLUGIN,               \
   ENV_VAR_DL_PLUGIN,                  \
   ENV_VAR_SIGCKPT,                    \
@@ -148,6 +181,9 @@
   ENV_VAR_DLSYM_OFFSET_M32,           \
   ENV_VAR_VIRTUAL_PID,                \
   ENV_VAR_SKIP_WRITING_TEXT_SEGMENTS, \
+  ENV_VAR_SKIP_UNMODIFIED_FILE_PAGES, \
+  ENV_VAR_CKPT_FILES_COPY_THREADS,    \
+  ENV_VAR_CKPT_FILES_DELTA,           \
   ENV_DELTACOMPRESSION
 
 #define DMTCP_RESTART_CMD       "dmtcp_restart"
@@ -157,6 +193,16 @@
 
 #define DMTCP_FILE_HEADER       "DMTCP_CHECKPOINT_IMAGE_v2.0\n"
 
+// A checkpoint image streamed to dmtcp_restart --migrate-listen is preceded
+// by the cookie of the receiver (DMTCP_MIGRATE_COOKIE) and a newline, and
+// then by one of these tags (of the same length).  A pre-copy image is kept
+// by the receiver as <ckpt image name>.precopy, the parent of the final
+// image.
+#define DMTCP_MIGRATE_PRECOPY_TAG    "DMTCP_MIGRATE_PRECOPY\n"
+#define DMTCP_MIGRATE_FINAL_TAG      "DMTCP_MIGRATE_FINAL__\n"
+#define DMTCP_MIGRATE_PRECOPY_SUFFIX ".precopy"
+#define DMTCP_MIGRATE_COOKIE_MAX     64
+
 // #define MIN_SIGNAL 1
 // #define MAX_SIGNAL 30
 
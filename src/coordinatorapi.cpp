@@ -24,6 +24,7 @@
 
 #include "coordinatorapi.h"
 #include <arpa/inet.h>
+#include <ctype.h>
 #include <fcntl.h>
 #include <netdb.h>
 #include <poll.h>
@@ -50,8 +51,15 @@ namespace dmtcp {
 namespace CoordinatorAPI {
 
 const int coordinatorSocket = PROTECTED_COORD_FD;
+const int barrierRelaySocket = PROTECTED_BARRIER_RELAY_FD;
 int nsSock = -1;
 
+// A connection to the barrier relay does not survive a restart: it is only
+// valid if it was opened after the last one.
+static bool barrierRelayConnected = false;
+static uint32_t barrierRelayNumRestarts = 0;
+static uint32_t nodeBarrierNumRestarts = 0;
+
 static bool _firstTime = true;
 static const char *_cachedHost = NULL;
 static int _cachedPort = 0;
@@ -275,7 +283,21 @@ connectAndSendUserCommand(char c,
       msg.theCheckpointInterval = jalib::StringToInt(interval);
     }
   }
+  // HOST:PORT and the cookie of the migration target, each NUL-terminated.
+  string target;
+  if (c == 'm') {
+    const char *to = getenv(ENV_VAR_MIGRATE_TO);
+    const char *cookie = getenv(ENV_VAR_MIGRATE_COOKIE);
+    if (to != NULL && cookie != NULL) {
+      target = string(to) + '\0' + cookie;
+      msg.extraBytes = target.length() + 1;
+    }
+  }
   JASSERT(Util::writeAll(coordFd, &msg, sizeof(msg)) == sizeof(msg));
+  if (msg.extraBytes > 0) {
+    JASSERT(Util::writeAll(coordFd, target.c_str(), msg.extraBytes) ==
+            (ssize_t)msg.extraBytes);
+  }
 
   // The coordinator will violently close our socket...
   if (c == 'q' || c == 'Q') {
@@ -351,13 +373,20 @@ sendMsgToCoordinatorRaw(int fd,
   if (noCoordinator()) {
     return;
   }
-  if (extraData != NULL) {
-    msg.extraBytes = len;
-  }
-  JASSERT(Util::writeAll(fd, &msg, sizeof(msg)) == sizeof(msg));
-  if (extraData != NULL) {
-    JASSERT(Util::writeAll(fd, extraData, len) == (ssize_t)len);
+  if (extraData == NULL) {
+    JASSERT(Util::writeAll(fd, &msg, sizeof(msg)) == sizeof(msg));
+    return;
   }
+
+  // One write, so that Nagle's algorithm does not hold back the extra data
+  // until the coordinator acknowledges the header.
+  msg.extraBytes = len;
+  char *buf = (char *)JALLOC_MALLOC(sizeof(msg) + len);
+  memcpy(buf, &msg, sizeof(msg));
+  memcpy(buf + sizeof(msg), extraData, len);
+  JASSERT(Util::writeAll(fd, buf, sizeof(msg) + len) ==
+          (ssize_t)(sizeof(msg) + len));
+  JALLOC_FREE(buf);
 }
 
 void
@@ -406,19 +435,121 @@ void recvMsgFromCoordinator(DmtcpMessage *msg, void **extraData)
   recvMsgFromCoordinatorRaw(coordinatorSocket, msg, extraData);
 }
 
+static bool
+isConnectedToBarrierRelay()
+{
+  return barrierRelayConnected &&
+         barrierRelayNumRestarts == ProcessInfo::instance().numRestarts();
+}
+
+static bool
+nodeBarriersEnabled()
+{
+  const char *nodeBarriers = getenv(ENV_VAR_NODE_BARRIERS);
+
+  return nodeBarriers != NULL && strcmp(nodeBarriers, "0") != 0 &&
+         !noCoordinator();
+}
+
+// Whether this process meets the other processes of its node before the
+// global barriers.  All of them have taken their slots by the time the
+// coordinator answers the suspend message, or releases the first barrier
+// after restart.
+static bool
+useNodeBarrier()
+{
+  return nodeBarriersEnabled() &&
+         SharedData::nodeBarrierSlot() >= 0 &&
+         SharedData::numNodeBarrierPeers() > 1 &&
+         (WorkerState::currentState() != WorkerState::RESTARTING ||
+          nodeBarrierNumRestarts == ProcessInfo::instance().numRestarts());
+}
+
+void
+connectToBarrierRelay()
+{
+  const char *relay = getenv(ENV_VAR_BARRIER_RELAY);
+
+  if (relay == NULL || relay[0] == '\0' || noCoordinator() ||
+      isConnectedToBarrierRelay()) {
+    return;
+  }
+
+  // Only the leader of the node reports to the relay.
+  if (nodeBarriersEnabled() && SharedData::nodeBarrierSlot() > 0) {
+    return;
+  }
+
+  const char *sep = strrchr(relay, ':');
+  int sock = -1;
+  if (sep != NULL && sep != relay && isdigit(sep[1])) {
+    string host(relay, sep - relay);
+    sock = jalib::JClientSocket(host.c_str(), atoi(sep + 1)).sockfd();
+  }
+  if (sock == -1) {
+    JWARNING(false) (relay) (JASSERT_ERRNO)
+    .Text("Cannot connect to the barrier relay; using the coordinator");
+    barrierRelayConnected = false;
+    return;
+  }
+
+  // This process counts for one member of the relay.
+  DmtcpMessage msg(DMT_BARRIER_RELAY);
+  msg.numPeers = 1;
+  sendMsgToCoordinatorRaw(sock, msg);
+  Util::changeFd(sock, barrierRelaySocket);
+  barrierRelayConnected = true;
+  barrierRelayNumRestarts = ProcessInfo::instance().numRestarts();
+}
+
+void
+disconnectFromBarrierRelay()
+{
+  if (isConnectedToBarrierRelay()) {
+    _real_close(barrierRelaySocket);
+  }
+  barrierRelayConnected = false;
+}
+
 void waitForBarrier(const string& barrierId)
 {
-  sendMsgToCoordinator(DmtcpMessage(DMT_OK));
+  // With node barriers, the leader reports the whole node in one message
+  // and the others wait for it to pass the release on.
+  bool atNode = useNodeBarrier();
+  if (atNode && SharedData::nodeBarrierSlot() > 0) {
+    JTRACE("waiting for the leader of the node") (barrierId);
+    if (!SharedData::waitForNodeLeader()) {
+      JTRACE("Received KILL message from coordinator, exiting");
+      _exit(0);
+    }
+    return;
+  }
+
+  connectToBarrierRelay();
+  int fd = isConnectedToBarrierRelay() ? barrierRelaySocket
+                                       : coordinatorSocket;
+
+  if (atNode) {
+    vector<DmtcpUniqueProcessId> ids;
+    SharedData::waitForNodePeers(&ids);
+    sendMsgToCoordinatorRaw(fd, DmtcpMessage(DMT_OK), &ids[0],
+                            ids.size() * sizeof(ids[0]));
+  } else {
+    sendMsgToCoordinatorRaw(fd, DmtcpMessage(DMT_OK));
+  }
 
   JTRACE("waiting for DMT_BARRIER_RELEASED message");
 
   char *extraData = NULL;
   DmtcpMessage msg;
-  recvMsgFromCoordinator(&msg, (void**)&extraData);
+  recvMsgFromCoordinatorRaw(fd, &msg, (void**)&extraData);
 
   msg.assertValid();
   if (msg.type == DMT_KILL_PEER) {
     JTRACE("Received KILL message from coordinator, exiting");
+    if (atNode) {
+      SharedData::releaseNodePeers(true);
+    }
     _exit(0);
   }
 
@@ -426,6 +557,11 @@ void waitForBarrier(const string& barrierId)
   JASSERT(extraData != NULL);
   JASSERT(barrierId == extraData) (barrierId) (extraData);
 
+  if (atNode) {
+    SharedData::releaseNodePeers(false);
+  }
+  nodeBarrierNumRestarts = ProcessInfo::instance().numRestarts();
+
   JALLOC_FREE(extraData);
 }
 
@@ -694,7 +830,7 @@ connectToCoordOnRestart(CoordinatorMode  mode,
 }
 
 void
-sendCkptFilename()
+sendCkptFilename(bool writePending, uint32_t migrateStage)
 {
   if (noCoordinator()) {
     return;
@@ -709,6 +845,8 @@ sendCkptFilename()
   } else {
     msg.type = DMT_CKPT_FILENAME;
   }
+  msg.ckptWritePending = writePending;
+  msg.migrateStage = migrateStage;
   // Tell coordinator type of remote shell command used ssh/rsh
   string shellType = "";
   const char *remoteShellType = getenv(ENV_VAR_REMOTE_SHELL_CMD);
@@ -728,6 +866,46 @@ sendCkptFilename()
   sendMsgToCoordinator(msg, buf, buflen);
 }
 
+int
+createCkptWriterSocket()
+{
+  if (noCoordinator()) {
+    return -1;
+  }
+
+  int sock = createNewSocketToCoordinator(COORD_ANY);
+  if (sock == -1) {
+    JWARNING(false) (JASSERT_ERRNO)
+    .Text("Cannot connect the checkpoint writer to the coordinator");
+    return -1;
+  }
+
+  // The coordinator ignores the writers of an abandoned checkpoint.
+  DmtcpMessage msg(DMT_CKPT_WRITER);
+  msg.compGroup = SharedData::getCompId();
+  if (Util::writeAll(sock, &msg, sizeof(msg)) != sizeof(msg)) {
+    _real_close(sock);
+    return -1;
+  }
+  return sock;
+}
+
+// Called while the memory areas are being written: no memory is allocated.
+void
+sendCkptWriteStatus(int sock,
+                    DmtcpMessageType type,
+                    uint64_t bytesWritten,
+                    int status)
+{
+  DmtcpMessage msg(type);
+
+  msg.ckptBytesWritten = bytesWritten;
+  msg.ckptWriteStatus = status;
+
+  // The image is written even if the coordinator went away.
+  Util::writeAll(sock, &msg, sizeof(msg));
+}
+
 int
 sendKeyValPairToCoordinator(const char *id,
                             const void *key,
@@ -71,6 +71,14 @@ void sendMsgToCoordinator(DmtcpMessage msg,
 void sendMsgToCoordinator(const DmtcpMessage &msg, const string &data);
 void recvMsgFromCoordinator(DmtcpMessage *msg, void **extraData = NULL);
 void waitForBarrier(const string &barrierId);
+
+// With DMTCP_BARRIER_RELAY, the global barriers of a checkpoint or restart
+// go through a barrier relay (dmtcp_coordinator --relay-to), which sends
+// one DMT_OK upstream for all of its members and fans out the releases.
+// The connection is opened for each checkpoint or restart and closed once
+// the process runs again.
+void connectToBarrierRelay();
+void disconnectFromBarrierRelay();
 char *connectAndSendUserCommand(char c,
                                 int *coordCmdStatus = NULL,
                                 int *numPeers = NULL,
@@ -80,7 +88,16 @@ char *connectAndSendUserCommand(char c,
 void updateCoordCkptDir(const char *dir);
 string getCoordCkptDir(void);
 
-void sendCkptFilename();
+void sendCkptFilename(bool writePending, uint32_t migrateStage);
+
+// Used with forked checkpointing.  The checkpointing process opens a
+// connection for the writer before forking it; the writer reports its
+// progress and the completion of the image on it.
+int createCkptWriterSocket();
+void sendCkptWriteStatus(int sock,
+                         DmtcpMessageType type,
+                         uint64_t bytesWritten,
+                         int status = 0);
 
 int sendKeyValPairToCoordinator(const char *id,
                                 const void *key,
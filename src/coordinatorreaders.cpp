@@ -0,0 +1,244 @@
+/****************************************************************************
+ *   Copyright (C) 2006-2013 by Jason Ansel, Kapil Arya, and Gene Cooperman *
+ *   jansel@csail.mit.edu, kapil@ccs.neu.edu, gene@ccs.neu.edu              *
+ *                                                                          *
+ *  This file is part of DMTCP.                                             *
+ *                                                                          *
+ *  DMTCP is free software: you can redistribute it and/or                  *
+ *  modify it under the terms of the GNU Lesser General Public License as   *
+ *  published by the Free Software Foundation, either version 3 of the      *
+ *  License, or (at your option) any later version.                         *
+ *                                                                          *
+ *  DMTCP is distributed in the hope that it will be useful,                *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU Lesser General Public License for more details.                     *
+ *                                                                          *
+ *  You should have received a copy of the GNU Lesser General Public        *
+ *  License along with DMTCP:dmtcp/src.  If not, see                        *
+ *  <http://www.gnu.org/licenses/>.                                         *
+ ****************************************************************************/
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include "../jalib/jassert.h"
+#include "coordinatorreaders.h"
+
+using namespace dmtcp;
+using namespace dmtcp::CoordinatorReaders;
+
+#define MAX_READER_EVENTS 64
+
+namespace
+{
+struct Watch {
+  int fd;
+  void *owner;
+  bool firstOnly;
+
+  // The message being read.  A slow sender leaves it partly read until
+  // the rest arrives; numRead counts the header, then the extra data.
+  Event event;
+  size_t numRead;
+};
+}
+
+static vector<int>readerEpollFds;
+static size_t nextReader = 0;
+static int eventFd = -1;
+static pthread_mutex_t eventsLock = PTHREAD_MUTEX_INITIALIZER;
+static vector<Event>pendingEvents;
+
+static void
+setBlocking(int fd, bool blocking)
+{
+  int flags = fcntl(fd, F_GETFL);
+
+  JASSERT(flags != -1) (fd) (JASSERT_ERRNO);
+  flags = blocking ? flags & ~O_NONBLOCK : flags | O_NONBLOCK;
+  JASSERT(fcntl(fd, F_SETFL, flags) != -1) (fd) (JASSERT_ERRNO);
+}
+
+static void
+queueEvent(const Event &event)
+{
+  pthread_mutex_lock(&eventsLock);
+  bool wasEmpty = pendingEvents.empty();
+  pendingEvents.push_back(event);
+  pthread_mutex_unlock(&eventsLock);
+
+  // One wakeup per batch: the event loop takes all pending events at once.
+  if (wasEmpty) {
+    uint64_t one = 1;
+    JASSERT(write(eventFd, &one, sizeof(one)) == sizeof(one)) (JASSERT_ERRNO);
+  }
+}
+
+static void
+resetMessage(Watch *w)
+{
+  w->event.connecting = w->firstOnly;
+  w->event.disconnected = false;
+  w->event.owner = w->owner;
+  w->event.extraData = NULL;
+  w->event.msg.poison();
+  w->numRead = 0;
+}
+
+static bool
+isMessageComplete(Watch *w)
+{
+  const DmtcpMessage &msg = w->event.msg;
+
+  // The event loop rejects an invalid message; its extra data is not read.
+  return w->numRead >= sizeof(msg) &&
+         (!msg.isValid() || w->numRead == sizeof(msg) + msg.extraBytes);
+}
+
+// Reads all that the socket has now.  Returns false once the connection
+// is closed or, with firstOnly, once the first message is read.
+static bool
+readMessages(int epfd, Watch *w)
+{
+  DmtcpMessage &msg = w->event.msg;
+
+  while (true) {
+    char *buf;
+    size_t len;
+    if (w->numRead < sizeof(msg)) {
+      buf = (char *)&msg + w->numRead;
+      len = sizeof(msg) - w->numRead;
+    } else {
+      size_t offset = w->numRead - sizeof(msg);
+      buf = w->event.extraData + offset;
+      len = msg.extraBytes - offset;
+    }
+
+    ssize_t ret = read(w->fd, buf, len);
+    if (ret == -1 && errno == EINTR) {
+      continue;
+    }
+    if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return true;
+    }
+    if (ret <= 0) {
+      // A partly read message is dropped with the connection.
+      JASSERT(epoll_ctl(epfd, EPOLL_CTL_DEL, w->fd, NULL) != -1)
+        (w->fd) (JASSERT_ERRNO);
+      delete[] w->event.extraData;
+      resetMessage(w);
+      w->event.disconnected = true;
+      queueEvent(w->event);
+      return false;
+    }
+
+    w->numRead += ret;
+    if (w->numRead == sizeof(msg) && msg.isValid() && msg.extraBytes > 0) {
+      w->event.extraData = new char[msg.extraBytes];
+    }
+    if (!isMessageComplete(w)) {
+      continue;
+    }
+
+    if (w->firstOnly) {
+      // The caller owns the socket from now on, and writes to it blocking.
+      JASSERT(epoll_ctl(epfd, EPOLL_CTL_DEL, w->fd, NULL) != -1)
+        (w->fd) (JASSERT_ERRNO);
+      setBlocking(w->fd, true);
+      queueEvent(w->event);
+      return false;
+    }
+    queueEvent(w->event);
+    resetMessage(w);
+  }
+}
+
+static void *
+readerThread(void *arg)
+{
+  int epfd = (int)(intptr_t)arg;
+  struct epoll_event events[MAX_READER_EVENTS];
+
+  while (true) {
+    int nfds = epoll_wait(epfd, events, MAX_READER_EVENTS, -1);
+    JASSERT(nfds != -1 || errno == EINTR) (JASSERT_ERRNO);
+
+    for (int n = 0; n < nfds; n++) {
+      Watch *w = (Watch *)events[n].data.ptr;
+
+      // A hangup still leaves the messages sent before it to be read.
+      if (!readMessages(epfd, w)) {
+        delete w;
+      }
+    }
+  }
+  return NULL;
+}
+
+int
+CoordinatorReaders::start(size_t numThreads)
+{
+  JASSERT(numThreads > 0);
+  eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  JASSERT(eventFd != -1) (JASSERT_ERRNO);
+
+  // Signals, SIGALRM for interval checkpoints in particular, are for the
+  // event loop.
+  sigset_t allSignals, oldMask;
+  sigfillset(&allSignals);
+  pthread_sigmask(SIG_BLOCK, &allSignals, &oldMask);
+
+  for (size_t i = 0; i < numThreads; i++) {
+    int epfd = epoll_create(MAX_READER_EVENTS);
+    JASSERT(epfd != -1) (JASSERT_ERRNO);
+    readerEpollFds.push_back(epfd);
+
+    pthread_t thread;
+    JASSERT(pthread_create(&thread, NULL, readerThread,
+                           (void *)(intptr_t)epfd) == 0);
+    pthread_detach(thread);
+  }
+  pthread_sigmask(SIG_SETMASK, &oldMask, NULL);
+  return eventFd;
+}
+
+void
+CoordinatorReaders::watch(int fd, void *owner, bool firstOnly)
+{
+  Watch *w = new Watch;
+
+  w->fd = fd;
+  w->owner = owner;
+  w->firstOnly = firstOnly;
+  resetMessage(w);
+
+  // A reader never waits on one socket: it reads what has arrived and
+  // keeps the rest of a message for the next time.
+  setBlocking(fd, false);
+
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.ptr = w;
+  int epfd = readerEpollFds[nextReader++ % readerEpollFds.size()];
+  JASSERT(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) != -1) (fd) (JASSERT_ERRNO);
+}
+
+void
+CoordinatorReaders::takeEvents(vector<Event> *events)
+{
+  uint64_t count;
+
+  // Drain the eventfd before taking the events, so that no wakeup is lost.
+  if (read(eventFd, &count, sizeof(count)) == -1) {
+    JASSERT(errno == EAGAIN) (JASSERT_ERRNO);
+  }
+
+  pthread_mutex_lock(&eventsLock);
+  events->swap(pendingEvents);
+  pthread_mutex_unlock(&eventsLock);
+}
@@ -0,0 +1,63 @@
+/****************************************************************************
+ *   Copyright (C) 2006-2013 by Jason Ansel, Kapil Arya, and Gene Cooperman *
+ *   jansel@csail.mit.edu, kapil@ccs.neu.edu, gene@ccs.neu.edu              *
+ *                                                                          *
+ *  This file is part of DMTCP.                                             *
+ *                                                                          *
+ *  DMTCP is free software: you can redistribute it and/or                  *
+ *  modify it under the terms of the GNU Lesser General Public License as   *
+ *  published by the Free Software Foundation, either version 3 of the      *
+ *  License, or (at your option) any later version.                         *
+ *                                                                          *
+ *  DMTCP is distributed in the hope that it will be useful,                *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU Lesser General Public License for more details.                     *
+ *                                                                          *
+ *  You should have received a copy of the GNU Lesser General Public        *
+ *  License along with DMTCP:dmtcp/src.  If not, see                        *
+ *  <http://www.gnu.org/licenses/>.                                         *
+ ****************************************************************************/
+
+#ifndef COORDINATORREADERS_H
+#define COORDINATORREADERS_H
+
+#include "dmtcpalloc.h"
+#include "dmtcpmessagetypes.h"
+
+/* The coordinator reads its sockets in a few reader threads, each with an
+ * epoll set of its own.  A reader takes whole messages off the sockets it
+ * owns and queues them for the event loop, which alone runs the protocol.
+ * The sockets are non-blocking, and a reader keeps the part of a message
+ * that has arrived until the rest follows, so a process that is slow to
+ * send a message holds up no one.  A connect storm at restart is read on
+ * all readers at once.
+ */
+namespace dmtcp
+{
+namespace CoordinatorReaders
+{
+struct Event {
+  // Set for the first message of a connection watched with firstOnly.
+  bool connecting;
+
+  // The socket was closed; no more events follow for this owner.
+  bool disconnected;
+
+  void *owner;
+  DmtcpMessage msg;
+  char *extraData;  // new[]'ed, or NULL
+};
+
+// Returns an eventfd that becomes readable when there are events.
+int start(size_t numThreads);
+
+// Reads messages from FD until it is closed; FD is made non-blocking.
+// With firstOnly, stops after the first message, and leaves FD to the
+// caller, blocking again.
+void watch(int fd, void *owner, bool firstOnly);
+
+void takeEvents(vector<Event> *events);
+}
+}
+#endif // ifndef COORDINATORREADERS_H
@@ -54,6 +54,13 @@ static const char *theUsage =
 // "    xc, -xc, --xcheckpoint : Checkpoint all nodes, kill all nodes when
 // done\n"
   "    -i, --interval <val>   Update ckpt interval to <val> seconds (0=never)\n"
+  "    -m, --migrate <host:port>\n"
+  "                           Stream the checkpoint images to the waiting\n"
+  "                           'dmtcp_restart --migrate-listen <host>:<port>',\n"
+  "                           then kill all nodes (live migration).  The\n"
+  "                           cookie printed by dmtcp_restart must be given\n"
+  "                           in the environment variable\n"
+  "                           DMTCP_MIGRATE_COOKIE.\n"
   "    -k, --kill             Kill all nodes\n"
   "    -q, --quit             Kill all nodes and quit\n"
   "\n"
@@ -68,6 +75,7 @@ int
 main(int argc, char **argv)
 {
   string interval = "";
+  string target = "";
   string request = "h";
 
   initializeJalib();
@@ -114,9 +122,17 @@ main(int argc, char **argv)
         fprintf(stderr, theUsage, "");
         return 1;
       } else if (*cmd == 's' || *cmd == 'i' || *cmd == 'c' || *cmd == 'b' ||
-                 *cmd == 'x' || *cmd == 'k' || *cmd == 'q' || *cmd == 'l') {
+                 *cmd == 'x' || *cmd == 'k' || *cmd == 'q' || *cmd == 'l' ||
+                 *cmd == 'm') {
         request = s;
-        if (*cmd == 'i') {
+        if (*cmd == 'm') {
+          if (argc == 1) {
+            fprintf(stderr, theUsage, "");
+            return 1;
+          }
+          target = argv[1];
+          shift;
+        } else if (*cmd == 'i') {
           if (isdigit(cmd[1])) { // if -i5, for example
             interval = cmd + 1;
           } else { // else -i 5
@@ -152,6 +168,17 @@ main(int argc, char **argv)
     CoordinatorAPI::connectAndSendUserCommand(*cmd, &coordCmdStatus);
     printf("Interval changed to %s\n", interval.c_str());
     break;
+  case 'm':
+    if (getenv(ENV_VAR_MIGRATE_COOKIE) == NULL ||
+        getenv(ENV_VAR_MIGRATE_COOKIE)[0] == '\0' ||
+        strlen(getenv(ENV_VAR_MIGRATE_COOKIE)) > DMTCP_MIGRATE_COOKIE_MAX) {
+      fprintf(stderr, "Set %s to the cookie printed by"
+              " dmtcp_restart --migrate-listen.\n", ENV_VAR_MIGRATE_COOKIE);
+      return 1;
+    }
+    setenv(ENV_VAR_MIGRATE_TO, target.c_str(), 1);
+    CoordinatorAPI::connectAndSendUserCommand(*cmd, &coordCmdStatus);
+    break;
   case 'b':
   case 'x':
 
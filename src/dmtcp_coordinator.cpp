@@ -60,11 +60,13 @@
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <netdb.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/stat.h>
-#include <sys/stat.h>
+#include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 #include <unistd.h>
 #include <algorithm>
@@ -73,6 +75,8 @@
 #include "../jalib/jconvert.h"
 #include "../jalib/jfilesystem.h"
 #include "../jalib/jtimer.h"
+#include "barrierrelay.h"
+#include "coordinatorreaders.h"
 #include "constants.h"
 #include "dmtcpmessagetypes.h"
 #include "lookup_service.h"
@@ -99,6 +103,8 @@ static const char *theHelpMessage =
   "  ? : Show this message\n"
   "\n";
 
+#define MAX_READER_THREADS 64
+
 static const char *theUsage =
   "Usage: dmtcp_coordinator [OPTIONS] [port]\n"
   "Coordinates checkpoints between multiple processes.\n\n"
@@ -124,6 +130,13 @@ static const char *theUsage =
   "      (default: 0, disabled)\n"
   "  --coord-logfile PATH (environment variable DMTCP_COORD_LOG_FILENAME\n"
   "              Coordinator will dump its logs to the given file\n"
+  "  --io-threads N\n"
+  "      Threads reading the connections of processes\n"
+  "      (default: number of CPUs, at most " STRINGIFY(MAX_READER_THREADS) ")\n"
+  "  --relay-to HOST:PORT\n"
+  "      Run as a barrier relay instead: aggregate the barriers of the\n"
+  "      processes started with --barrier-relay (or of other relays), and\n"
+  "      report them to the coordinator (or relay) at HOST:PORT\n"
   "  -q, --quiet \n"
   "      Skip startup msg; Skip NOTE msgs; if given twice, also skip WARNINGs\n"
   "  --help:\n"
@@ -147,6 +160,17 @@ static bool exitAfterCkpt = false;
 static bool exitAfterCkptOnce = false;
 static int blockUntilDoneRemote = -1;
 
+/* Live migration (dmtcp_command --migrate HOST:PORT) takes two checkpoints.
+ * The first one, DMT_MIGRATE_PRECOPY, streams complete images from forked
+ * writers while the computation resumes.  Once all of them are written, the
+ * second one, DMT_MIGRATE_FINAL, streams the pages modified since, and the
+ * processes exit.  Neither of them updates the restart script.  The
+ * workers send migrateCookie, given by dmtcp_command, ahead of each image.
+ */
+static DmtcpMigrateStage migrateStage = DMT_MIGRATE_NONE;
+static string migrateTarget;
+static string migrateCookie;
+
 static DmtcpCoordinator prog;
 
 /* The coordinator can receive a second checkpoint request while processing the
@@ -201,8 +225,13 @@ static string tmpDir;
 static string ckptDir;
 
 #define MAX_EVENTS 10000
+#define MAX_SEND_IOVECS 64
 struct epoll_event events[MAX_EVENTS];
 int epollFd;
+
+// Wakes up the event loop when the reader threads have messages.
+static int readersFd = -1;
+static size_t numReaderThreads = 0;
 static jalib::JSocket *listenSock = NULL;
 
 static void removeStaleSharedAreaFile();
@@ -213,6 +242,46 @@ static pid_t _nextVirtualPid = INITIAL_VIRTUAL_PID;
 static int theNextClientNumber = 1;
 vector<CoordClient *>clients;
 
+// Barrier relays report the processes behind them by identity.
+static vector<CoordClient *>barrierRelays;
+static map<UniquePid, CoordClient *>clientsByIdentity;
+static bool clientsByIdentityValid = false;
+
+// A relay may report a process again, e.g. after a member of its node
+// reconnected; each process is counted once per barrier.
+static void
+recordBarrierArrival(CoordClient *client)
+{
+  if (!client->atCurrentBarrier()) {
+    client->atCurrentBarrier(true);
+    workersAtCurrentBarrier++;
+  }
+}
+
+static void
+resetBarrierArrivals()
+{
+  for (size_t i = 0; i < clients.size(); i++) {
+    clients[i]->atCurrentBarrier(false);
+  }
+  workersAtCurrentBarrier = 0;
+}
+
+static CoordClient *
+findClient(const UniquePid &upid)
+{
+  if (!clientsByIdentityValid) {
+    clientsByIdentity.clear();
+    for (size_t i = 0; i < clients.size(); i++) {
+      clientsByIdentity[clients[i]->identity()] = clients[i];
+    }
+    clientsByIdentityValid = true;
+  }
+
+  map<UniquePid, CoordClient *>::iterator it = clientsByIdentity.find(upid);
+  return it == clientsByIdentity.end() ? NULL : it->second;
+}
+
 CoordClient::CoordClient(const jalib::JSocket &sock,
                          const struct sockaddr_storage *addr,
                          socklen_t len,
@@ -221,6 +290,16 @@ CoordClient::CoordClient(const jalib::JSocket &sock,
   : _sock(sock)
 {
   _isNSWorker = isNSWorker;
+  _isCkptWriter = hello_remote.type == DMT_CKPT_WRITER;
+  _ckptGeneration = hello_remote.compGroup.computationGeneration();
+  _ckptWriteDone = false;
+  _ckptWritePending = false;
+  _ckptBytesWritten = 0;
+  _isBarrierRelay = hello_remote.type == DMT_BARRIER_RELAY;
+  _barrierViaRelay = false;
+  _atCurrentBarrier = false;
+  _sendOffset = 0;
+  _pollingWritable = false;
   _realPid = hello_remote.realPid;
   _clientNumber = theNextClientNumber++;
   _identity = hello_remote.from;
@@ -229,18 +308,93 @@ CoordClient::CoordClient(const jalib::JSocket &sock,
   _ip = inet_ntoa(in->sin_addr);
 }
 
+CoordClient::~CoordClient()
+{
+  for (size_t i = 0; i < _sendQueue.size(); i++) {
+    _sendQueue[i]->unref();
+  }
+}
+
 void
-CoordClient::readProcessInfo(DmtcpMessage &msg)
+CoordClient::queueMessage(OutgoingMessage *msg)
 {
+  msg->ref();
+  _sendQueue.push_back(msg);
+}
+
+bool
+CoordClient::flushSendQueue(bool block)
+{
+  // Queued messages, barrier releases in particular, go out together.
+  while (!_sendQueue.empty()) {
+    struct iovec iov[MAX_SEND_IOVECS];
+    size_t n = 0;
+    for (; n < _sendQueue.size() && n < MAX_SEND_IOVECS; n++) {
+      size_t offset = n == 0 ? _sendOffset : 0;
+      iov[n].iov_base = (void *)(_sendQueue[n]->data() + offset);
+      iov[n].iov_len = _sendQueue[n]->size() - offset;
+    }
+
+    struct msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = iov;
+    mh.msg_iovlen = n;
+    ssize_t ret = sendmsg(_sock.sockfd(), &mh, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (ret == -1 && errno == EINTR) {
+      continue;
+    }
+    if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      if (!block) {
+        return false;
+      }
+
+      // The socket is non-blocking while its reader watches it.
+      struct pollfd pfd = { _sock.sockfd(), POLLOUT, 0 };
+      poll(&pfd, 1, -1);
+      continue;
+    }
+    if (ret == -1) {
+      // The event loop learns of the broken connection from epoll.
+      JTRACE("dropping messages to a broken connection")
+        (_identity) (_sendQueue.size()) (JASSERT_ERRNO);
+      for (size_t i = 0; i < _sendQueue.size(); i++) {
+        _sendQueue[i]->unref();
+      }
+      _sendQueue.clear();
+      _sendOffset = 0;
+      return true;
+    }
+
+    size_t done = 0;
+    size_t written = ret + _sendOffset;
+    while (done < n && written >= _sendQueue[done]->size()) {
+      written -= _sendQueue[done]->size();
+      _sendQueue[done]->unref();
+      done++;
+    }
+    _sendQueue.erase(_sendQueue.begin(), _sendQueue.begin() + done);
+    _sendOffset = written;
+  }
+  return true;
+}
+
+OutgoingMessage::OutgoingMessage(const DmtcpMessage &msg, const void *extraData)
+  : _buf(sizeof(msg) + msg.extraBytes),
+  _refs(1)
+{
+  memcpy(&_buf[0], &msg, sizeof(msg));
   if (msg.extraBytes > 0) {
-    char *extraData = new char[msg.extraBytes];
-    _sock.readAll(extraData, msg.extraBytes);
-    _hostname = extraData;
-    _progname = extraData + _hostname.length() + 1;
-    delete[] extraData;
+    memcpy(&_buf[sizeof(msg)], extraData, msg.extraBytes);
   }
 }
 
+void
+CoordClient::readProcessInfo(const char *extraData)
+{
+  _hostname = extraData;
+  _progname = extraData + _hostname.length() + 1;
+}
+
 pid_t
 DmtcpCoordinator::getNewVirtualPid()
 {
@@ -292,6 +446,29 @@ DmtcpCoordinator::handleUserCommand(char cmd, DmtcpMessage *reply /*= NULL*/)
       }
     }
     break;
+  case 'm': case 'M':
+    JTRACE("migrating...") (migrateTarget);
+    if (migrateTarget.empty() || migrateCookie.empty() ||
+        migrateCookie.length() > DMTCP_MIGRATE_COOKIE_MAX ||
+        migrateStage != DMT_MIGRATE_NONE) {
+      if (reply != NULL) {
+        reply->coordCmdStatus = CoordCmdStatus::ERROR_INVALID_COMMAND;
+      }
+      break;
+    }
+    migrateStage = DMT_MIGRATE_PRECOPY;
+    if (startCheckpoint()) {
+      JNOTE("Migrating the computation") (migrateTarget);
+      if (reply != NULL) {
+        reply->numPeers = getStatus().numPeers;
+      }
+    } else {
+      migrateStage = DMT_MIGRATE_NONE;
+      if (reply != NULL) {
+        reply->coordCmdStatus = CoordCmdStatus::ERROR_NOT_RUNNING_STATE;
+      }
+    }
+    break;
   case 'i': case 'I':
     JTRACE("setting checkpoint interval...");
     updateCheckpointInterval(theCheckpointInterval);
@@ -342,8 +519,12 @@ DmtcpCoordinator::handleUserCommand(char cmd, DmtcpMessage *reply /*= NULL*/)
     broadcastMessage(DMT_KILL_PEER);
     JASSERT_STDERR << "DMTCP coordinator exiting... (per request)\n";
     for (size_t i = 0; i < clients.size(); i++) {
+      clients[i]->flushSendQueue(true);
       clients[i]->sock().close();
     }
+    for (size_t i = 0; i < barrierRelays.size(); i++) {
+      barrierRelays[i]->flushSendQueue(true);
+    }
     listenSock->close();
     preExitCleanup();
     JTRACE("Exiting ...");
@@ -391,6 +572,14 @@ DmtcpCoordinator::printStatus(size_t numPeers, bool isRunning)
 {
   ostringstream o;
 
+  // The processes whose last barrier was reported by a relay.
+  size_t numPeersViaRelay = 0;
+  for (size_t i = 0; i < clients.size(); i++) {
+    if (clients[i]->barrierViaRelay()) {
+      numPeersViaRelay++;
+    }
+  }
+
   o << "Status..." << std::endl
     << "Host: " << coordHostname
     << " (" << inet_ntoa(localhostIPAddr) << ")" << std::endl
@@ -410,6 +599,7 @@ DmtcpCoordinator::printStatus(size_t numPeers, bool isRunning)
     // << std::endl
     << "Computation Id: " << compId << std::endl
     << "Checkpoint Dir: " << ckptDir << std::endl
+    << "PEERS_VIA_RELAY=" << numPeersViaRelay << std::endl
     << "NUM_PEERS=" << numPeers << std::endl
     << "RUNNING=" << (isRunning ? "yes" : "no") << std::endl;
   printf("%s", o.str().c_str());
@@ -444,6 +634,37 @@ DmtcpCoordinator::releaseBarrier(const string &barrier)
   broadcastMessage(DMT_BARRIER_RELEASED, barrier.length() + 1, barrier.c_str());
 }
 
+void
+DmtcpCoordinator::recordRelayedBarrier(CoordClient *sender,
+                                       const DmtcpMessage &msg,
+                                       const char *extraData)
+{
+  const DmtcpUniqueProcessId *ids = (const DmtcpUniqueProcessId *)extraData;
+  size_t numIds = msg.extraBytes / sizeof(*ids);
+  DmtcpUniqueProcessId from = msg.from.upid();
+
+  // A process may also use the coordinator itself as its relay.
+  if (numIds == 0) {
+    ids = &from;
+    numIds = 1;
+  }
+
+  for (size_t i = 0; i < numIds; i++) {
+    CoordClient *client = findClient(UniquePid(ids[i]));
+    if (client == NULL) {
+      JWARNING(false) (UniquePid(ids[i]))
+      .Text("Barrier relay reported an unknown process");
+      continue;
+    }
+    // The leader of a node waits for the release itself, and passes it on
+    // to the other processes of its node.
+    client->setState(msg.state);
+    client->barrierViaRelay(client != sender);
+    recordBarrierArrival(client);
+  }
+  updateMinimumState();
+}
+
 void
 DmtcpCoordinator::updateMinimumState()
 {
@@ -471,6 +692,11 @@ DmtcpCoordinator::updateMinimumState()
     }
   }
 
+  if (status.minimumState == WorkerState::RUNNING &&
+      migrateStage == DMT_MIGRATE_FINAL && !workersRunningAndSuspendMsgSent) {
+    startCheckpoint();
+  }
+
   if (status.minimumState == WorkerState::RESTARTING) {
     if (nextRestartBarrier < restartBarriers.size()) {
       JNOTE("Releasing next restart barrier")
@@ -486,7 +712,8 @@ DmtcpCoordinator::updateMinimumState()
 }
 
 void
-DmtcpCoordinator::recordCkptFilename(CoordClient *client, const char *extraData)
+DmtcpCoordinator::recordCkptFilename(CoordClient *client, const char *extraData,
+                                     bool inRestartScript)
 {
   client->setState(WorkerState::CHECKPOINTED);
   JASSERT(extraData != NULL)
@@ -503,7 +730,9 @@ DmtcpCoordinator::recordCkptFilename(CoordClient *client, const char *extraData)
   JTRACE("recording restart info") (ckptFilename) (hostname);
   JTRACE ( "recording restart info with shellType" )
     ( ckptFilename ) ( hostname ) (shellType);
-  if(shellType.empty())
+  if (!inRestartScript) {
+    // Streamed to the migration target.
+  } else if(shellType.empty())
     _restartFilenames[hostname].push_back ( ckptFilename );
   else if(shellType == "rsh")
     _rshCmdFileNames[hostname].push_back( ckptFilename );
@@ -516,6 +745,107 @@ DmtcpCoordinator::recordCkptFilename(CoordClient *client, const char *extraData)
   _numRestartFilenames++;
 
   if (_numRestartFilenames == _numCkptWorkers) {
+    size_t numPending = numPendingCkptWrites();
+    if (numPending > 0) {
+      JNOTE("Waiting for checkpoint images to be written") (numPending);
+      return;
+    }
+    completeCheckpoint();
+  }
+}
+
+// The writer may finish before its process sent its checkpoint filename;
+// the process is then already marked as done when the filename arrives.
+void
+DmtcpCoordinator::finishCkptWrite(CoordClient *writer, bool success)
+{
+  writer->ckptWriteDone(true);
+  if (writer->ckptGeneration() != compId.computationGeneration()) {
+    JNOTE("Ignoring the writer of an earlier checkpoint")
+      (writer->identity()) (writer->ckptGeneration());
+    return;
+  }
+
+  CoordClient *client = findClient(writer->identity());
+  if (client != NULL) {
+    client->ckptWriteDone(true);
+  }
+
+  if (success) {
+    JNOTE("Checkpoint image written")
+      (writer->identity()) (writer->ckptBytesWritten());
+  } else {
+    JWARNING(false) (writer->identity()) (writer->ckptBytesWritten())
+    .Text("Checkpoint writer failed; this checkpoint will not be committed");
+    _ckptWriteFailed = true;
+  }
+
+  if (_numCkptWorkers > 0 && _numRestartFilenames == _numCkptWorkers &&
+      numPendingCkptWrites() == 0) {
+    completeCheckpoint();
+  }
+}
+
+// A process that went away is no longer waited for.
+size_t
+DmtcpCoordinator::numPendingCkptWrites() const
+{
+  size_t n = 0;
+
+  for (size_t i = 0; i < clients.size(); i++) {
+    if (clients[i]->ckptWritePending() && !clients[i]->ckptWriteDone()) {
+      n++;
+    }
+  }
+  return n;
+}
+
+void
+DmtcpCoordinator::resetCkptWrites()
+{
+  for (size_t i = 0; i < clients.size(); i++) {
+    clients[i]->ckptWritePending(false);
+    clients[i]->ckptWriteDone(false);
+  }
+  _ckptWriteFailed = false;
+}
+
+void
+DmtcpCoordinator::completeCheckpoint()
+{
+  bool writeRestartScript = false;
+
+  if (_ckptWriteFailed && migrateStage != DMT_MIGRATE_NONE) {
+    JWARNING(false) (migrateTarget)
+    .Text("Migration aborted; the computation keeps running here");
+    migrateStage = DMT_MIGRATE_NONE;
+    migrateTarget.clear();
+    migrateCookie.clear();
+  } else if (_ckptWriteFailed) {
+    JWARNING(false)
+    .Text("Checkpoint failed; the restart script was not updated");
+  } else if (migrateStage == DMT_MIGRATE_PRECOPY) {
+    JNOTE("Pre-copy round of the migration complete") (migrateTarget);
+    migrateStage = DMT_MIGRATE_FINAL;
+  } else if (migrateStage == DMT_MIGRATE_FINAL && _numMigrationFallbacks > 0) {
+    // The processes have exited all the same; the restart script lists
+    // those that could not reach the target.
+    JWARNING(false) (migrateTarget) (_numMigrationFallbacks) (_numCkptWorkers)
+    .Text("Migration failed; final images written to the checkpoint dir");
+    migrateStage = DMT_MIGRATE_NONE;
+    migrateTarget.clear();
+    migrateCookie.clear();
+    writeRestartScript = true;
+  } else if (migrateStage == DMT_MIGRATE_FINAL) {
+    JNOTE("Migration complete") (migrateTarget);
+    migrateStage = DMT_MIGRATE_NONE;
+    migrateTarget.clear();
+    migrateCookie.clear();
+  } else {
+    writeRestartScript = true;
+  }
+
+  if (writeRestartScript) {
     const string restartScriptPath =
       RestartScript::writeScript(ckptDir,
                                  uniqueCkptFilenames,
@@ -528,62 +858,74 @@ DmtcpCoordinator::recordCkptFilename(CoordClient *client, const char *extraData)
                                  _sshCmdFileNames);
 
     JNOTE("Checkpoint complete. Wrote restart script") (restartScriptPath);
+  }
 
-    JTIMER_STOP(checkpoint);
-    resetCkptTimer();
+  JTIMER_STOP(checkpoint);
+  resetCkptTimer();
 
-    if (blockUntilDone) {
-      DmtcpMessage blockUntilDoneReply(DMT_USER_CMD_RESULT);
-      JNOTE("replying to dmtcp_command:  we're done");
+  if (blockUntilDone) {
+    DmtcpMessage blockUntilDoneReply(DMT_USER_CMD_RESULT);
+    JNOTE("replying to dmtcp_command:  we're done");
 
-      // These were set in DmtcpCoordinator::onConnect in this file
-      jalib::JSocket remote(blockUntilDoneRemote);
-      remote << blockUntilDoneReply;
-      remote.close();
-      blockUntilDone = false;
-      blockUntilDoneRemote = -1;
-    }
+    // These were set in DmtcpCoordinator::onConnect in this file
+    jalib::JSocket remote(blockUntilDoneRemote);
+    remote << blockUntilDoneReply;
+    remote.close();
+    blockUntilDone = false;
+    blockUntilDoneRemote = -1;
+  }
 
-    if (exitAfterCkpt || exitAfterCkptOnce) {
-      JNOTE("Checkpoint Done. Killing all peers.");
-      broadcastMessage(DMT_KILL_PEER);
-      exitAfterCkptOnce = false;
-    } else {
-      lookupService.reset();
-    }
-    _numRestartFilenames = 0;
-    _numCkptWorkers = 0;
+  if (exitAfterCkpt || exitAfterCkptOnce) {
+    JNOTE("Checkpoint Done. Killing all peers.");
+    broadcastMessage(DMT_KILL_PEER);
+    exitAfterCkptOnce = false;
+  } else {
+    lookupService.reset();
+  }
+  _numRestartFilenames = 0;
+  _numCkptWorkers = 0;
+  _numMigrationFallbacks = 0;
+  resetCkptWrites();
+
+  // All the workers have checkpointed so now it is safe to reset this flag.
+  workersRunningAndSuspendMsgSent = false;
 
-    // All the workers have checkpointed so now it is safe to reset this flag.
-    workersRunningAndSuspendMsgSent = false;
+  // Otherwise, the final round starts once the workers report RUNNING.
+  if (migrateStage == DMT_MIGRATE_FINAL) {
+    startCheckpoint();
   }
 }
 
 void
-DmtcpCoordinator::onData(CoordClient *client)
+DmtcpCoordinator::onData(CoordClient *client,
+                         DmtcpMessage &msg,
+                         char *extraData)
 {
-  DmtcpMessage msg;
-
   JASSERT(client != NULL);
 
-  client->sock() >> msg;
   msg.assertValid();
-  char *extraData = 0;
-  if (msg.extraBytes > 0) {
-    extraData = new char[msg.extraBytes];
-    client->sock().readAll(extraData, msg.extraBytes);
-  }
 
   switch (msg.type) {
   case DMT_OK:
   {
+    if (client->isBarrierRelay() || msg.extraBytes > 0) {
+      JTRACE("got DMT_OK message for several processes")
+        (msg.from) (msg.numPeers) (msg.state);
+      recordRelayedBarrier(client, msg, extraData);
+      break;
+    }
     JTRACE("got DMT_OK message") (client->state()) (msg.from) (msg.state);
     client->setState(msg.state);
-    workersAtCurrentBarrier++;
+    client->barrierViaRelay(false);
+    recordBarrierArrival(client);
     updateMinimumState();
     break;
   }
 
+  case DMT_BARRIER_RELAY:
+    // Whether a relay has members matters to the relays above it only.
+    break;
+
   case DMT_BARRIER_LIST:
   {
     JNOTE("got DMT_BARRIER_LIST message")
@@ -607,15 +949,33 @@ DmtcpCoordinator::onData(CoordClient *client)
 
   // Fall though
   case DMT_CKPT_FILENAME:
-    recordCkptFilename(client, extraData);
+    client->ckptWritePending(msg.ckptWritePending != 0);
+    if (migrateStage == DMT_MIGRATE_FINAL &&
+        msg.migrateStage == DMT_MIGRATE_NONE) {
+      _numMigrationFallbacks++;
+    }
+    recordCkptFilename(client, extraData,
+                       msg.migrateStage == DMT_MIGRATE_NONE);
+    break;
+
+  case DMT_CKPT_WRITE_PROGRESS:
+    client->ckptBytesWritten(msg.ckptBytesWritten);
+    JNOTE("Checkpoint image being written")
+      (msg.from) (msg.ckptBytesWritten);
+    break;
+
+  case DMT_CKPT_WRITE_DONE:
+    client->ckptBytesWritten(msg.ckptBytesWritten);
+    finishCkptWrite(client, msg.ckptWriteStatus == 0);
     break;
 
   case DMT_GET_CKPT_DIR:
   {
     DmtcpMessage reply(DMT_GET_CKPT_DIR_RESULT);
     reply.extraBytes = ckptDir.length() + 1;
-    client->sock() << reply;
-    client->sock().writeAll(ckptDir.c_str(), reply.extraBytes);
+    OutgoingMessage *out = new OutgoingMessage(reply, ckptDir.c_str());
+    sendMessage(client, out);
+    out->unref();
     break;
   }
   case DMT_UPDATE_CKPT_DIR:
@@ -639,23 +999,33 @@ DmtcpCoordinator::onData(CoordClient *client)
   case DMT_NAME_SERVICE_QUERY:
   {
     JTRACE("received NAME_SERVICE_QUERY msg") (client->identity());
-    lookupService.respondToQuery(client->sock(), msg,
-                                 (const void *)extraData);
+    DmtcpMessage reply;
+    const void *val = lookupService.replyToQuery(msg, extraData, &reply);
+    OutgoingMessage *out = new OutgoingMessage(reply, val);
+    sendMessage(client, out);
+    out->unref();
     break;
   }
 
   case DMT_NAME_SERVICE_GET_UNIQUE_ID:
   {
     JTRACE("received NAME_SERVICE_GET_UNIQUE_ID msg") (client->identity());
-    lookupService.respondToQuery(client->sock(), msg,
-                                 (const void *)extraData);
+    DmtcpMessage reply;
+    const void *val = lookupService.replyToQuery(msg, extraData, &reply);
+    OutgoingMessage *out = new OutgoingMessage(reply, val);
+    sendMessage(client, out);
+    out->unref();
     break;
   }
 
   case DMT_NAME_SERVICE_QUERY_ALL:
   {
     JTRACE("received NAME_SERVICE_QUERY_ALL msg") (client->identity());
-    lookupService.sendAllMappings(client->sock(), msg);
+    DmtcpMessage reply;
+    const void *val = lookupService.replyWithAllMappings(msg, &reply);
+    OutgoingMessage *out = new OutgoingMessage(reply, val);
+    sendMessage(client, out);
+    out->unref();
     break;
   }
 
@@ -665,6 +1035,7 @@ DmtcpCoordinator::onData(CoordClient *client)
       (client->hostname()) (client->progname()) (msg.from) (client->identity());
     client->identity(msg.from);
     client->realPid(msg.realPid);
+    clientsByIdentityValid = false;
     break;
   }
   case DMT_UPDATE_PROCESS_INFO_AFTER_INIT_OR_EXEC:
@@ -675,20 +1046,21 @@ DmtcpCoordinator::onData(CoordClient *client)
     client->setState(msg.state);
     client->progname(progname);
     client->identity(msg.from);
+    clientsByIdentityValid = false;
     break;
   }
 
   case DMT_NULL:
     JWARNING(false) (msg.type).Text(
       "unexpected message from worker. Closing connection");
-    onDisconnect(client);
+
+    // Its reader reports the disconnect.
+    shutdown(client->sock().sockfd(), SHUT_RDWR);
     break;
   default:
     JASSERT(false) (msg.from) (msg.type)
     .Text("unexpected message from worker");
   }
-
-  delete[] extraData;
 }
 
 static void
@@ -718,12 +1090,30 @@ DmtcpCoordinator::onDisconnect(CoordClient *client)
     delete client;
     return;
   }
+  if (client->isCkptWriter()) {
+    // Its reader delivered every message sent before the disconnect.
+    if (!client->ckptWriteDone()) {
+      finishCkptWrite(client, false);
+    }
+    client->sock().close();
+    delete client;
+    return;
+  }
+  if (client->isBarrierRelay()) {
+    barrierRelays.erase(std::find(barrierRelays.begin(), barrierRelays.end(),
+                                  client));
+    JNOTE("barrier relay disconnected") (client->identity());
+    client->sock().close();
+    delete client;
+    return;
+  }
   for (size_t i = 0; i < clients.size(); i++) {
     if (clients[i] == client) {
       clients.erase(clients.begin() + i);
       break;
     }
   }
+  clientsByIdentityValid = false;
   client->sock().close();
   JNOTE("client disconnected") (client->identity()) (client->progname());
   _virtualPidToClientMap.erase(client->virtualPid());
@@ -759,6 +1149,8 @@ DmtcpCoordinator::initializeComputation()
   // this is the first connection, do some initializations
   workersRunningAndSuspendMsgSent = false;
   killInProgress = false;
+  _ckptWriteFailed = false;
+  _numMigrationFallbacks = 0;
 
   // _nextVirtualPid = INITIAL_VIRTUAL_PID;
 
@@ -768,6 +1160,9 @@ DmtcpCoordinator::initializeComputation()
   numPeers = -1; // Drop number of peers to unknown
   blockUntilDone = false;
   exitAfterCkptOnce = false;
+  migrateStage = DMT_MIGRATE_NONE;
+  migrateTarget.clear();
+  migrateCookie.clear();
   workersAtCurrentBarrier = 0;
   nextCkptBarrier = nextRestartBarrier = 0;
 
@@ -778,67 +1173,83 @@ DmtcpCoordinator::initializeComputation()
 }
 
 void
-DmtcpCoordinator::onConnect()
+DmtcpCoordinator::acceptConnection()
 {
-  struct sockaddr_storage remoteAddr;
-  socklen_t remoteLen = sizeof(remoteAddr);
-  jalib::JSocket remote = listenSock->accept(&remoteAddr, &remoteLen);
+  PendingConnection *conn = new PendingConnection;
 
-  JTRACE("accepting new connection") (remote.sockfd()) (JASSERT_ERRNO);
+  conn->remoteLen = sizeof(conn->remoteAddr);
+  conn->sock = listenSock->accept(&conn->remoteAddr, &conn->remoteLen);
 
-  if (!remote.isValid()) {
-    remote.close();
+  JTRACE("accepting new connection") (conn->sock.sockfd()) (JASSERT_ERRNO);
+
+  if (!conn->sock.isValid()) {
+    conn->sock.close();
+    delete conn;
     return;
   }
 
-  DmtcpMessage hello_remote;
-  hello_remote.poison();
-  JTRACE("Reading from incoming connection...");
-  remote >> hello_remote;
-  if (!remote.isValid()) {
-    remote.close();
+  // A reader thread reads the hello; onConnect() takes it from there.
+  CoordinatorReaders::watch(conn->sock.sockfd(), conn, true);
+}
+
+void
+DmtcpCoordinator::onConnect(PendingConnection *conn,
+                            DmtcpMessage &hello_remote,
+                            char *extraData)
+{
+  jalib::JSocket remote = conn->sock;
+  struct sockaddr_storage remoteAddr = conn->remoteAddr;
+  socklen_t remoteLen = conn->remoteLen;
+
+  delete conn;
+
+  if (hello_remote.type == DMT_NAME_SERVICE_WORKER) {
+    CoordClient *client = new CoordClient(remote, &remoteAddr, remoteLen,
+                                          hello_remote);
+
+    addDataSocket(client);
     return;
   }
+  if (hello_remote.type == DMT_CKPT_WRITER) {
+    JTRACE("checkpoint writer connected") (hello_remote.from);
+    CoordClient *client = new CoordClient(remote, &remoteAddr, remoteLen,
+                                          hello_remote);
 
-  if (hello_remote.type == DMT_NAME_SERVICE_WORKER) {
+    addDataSocket(client);
+    return;
+  }
+  if (hello_remote.type == DMT_BARRIER_RELAY) {
+    JNOTE("barrier relay connected") (hello_remote.from) (remote.sockfd());
     CoordClient *client = new CoordClient(remote, &remoteAddr, remoteLen,
                                           hello_remote);
 
+    barrierRelays.push_back(client);
     addDataSocket(client);
     return;
   }
   if (hello_remote.type == DMT_NAME_SERVICE_QUERY) {
     JASSERT(hello_remote.extraBytes > 0) (hello_remote.extraBytes);
-    char *extraData = new char[hello_remote.extraBytes];
-    remote.readAll(extraData, hello_remote.extraBytes);
 
     JTRACE("received NAME_SERVICE_QUERY msg on running") (hello_remote.from);
     lookupService.respondToQuery(remote, hello_remote, extraData);
-    delete[] extraData;
     remote.close();
     return;
   }
   if (hello_remote.type == DMT_NAME_SERVICE_GET_UNIQUE_ID) {
     JASSERT(hello_remote.extraBytes > 0) (hello_remote.extraBytes);
-    char *extraData = new char[hello_remote.extraBytes];
-    remote.readAll(extraData, hello_remote.extraBytes);
 
     JTRACE("received NAME_SERVICE_GET_UNIQUE_ID msg on running")
           (hello_remote.from);
     lookupService.respondToQuery(remote, hello_remote, extraData);
-    delete[] extraData;
     remote.close();
     return;
   }
   if (hello_remote.type == DMT_REGISTER_NAME_SERVICE_DATA) {
     JASSERT(hello_remote.extraBytes > 0) (hello_remote.extraBytes);
-    char *extraData = new char[hello_remote.extraBytes];
-    remote.readAll(extraData, hello_remote.extraBytes);
 
     JTRACE("received REGISTER_NAME_SERVICE_DATA msg on running") (hello_remote.
                                                                   from);
     lookupService.registerData(hello_remote, (const void *)extraData);
-    delete[] extraData;
     remote.close();
     return;
   }
@@ -847,7 +1258,7 @@ DmtcpCoordinator::onConnect()
     // TODO(kapil): Update ckpt interval only if a valid one was supplied to
     // dmtcp_command.
     updateCheckpointInterval(hello_remote.theCheckpointInterval);
-    processDmtUserCmd(hello_remote, remote);
+    processDmtUserCmd(hello_remote, remote, extraData);
     return;
   }
 
@@ -871,7 +1282,7 @@ DmtcpCoordinator::onConnect()
                                         hello_remote);
 
   if (hello_remote.extraBytes > 0) {
-    client->readProcessInfo(hello_remote);
+    client->readProcessInfo(extraData);
   }
 
   if (hello_remote.type == DMT_RESTART_WORKER) {
@@ -900,6 +1311,7 @@ DmtcpCoordinator::onConnect()
   JNOTE("worker connected") (hello_remote.from) (client->progname());
 
   clients.push_back(client);
+  clientsByIdentityValid = false;
   addDataSocket(client);
 
   JTRACE("END") (clients.size());
@@ -907,7 +1319,8 @@ DmtcpCoordinator::onConnect()
 
 void
 DmtcpCoordinator::processDmtUserCmd(DmtcpMessage &hello_remote,
-                                    jalib::JSocket &remote)
+                                    jalib::JSocket &remote,
+                                    char *extraData)
 {
   // dmtcp_command doesn't handshake (it is antisocial)
   JTRACE("got user command from dmtcp_command")(hello_remote.coordCmd);
@@ -920,6 +1333,19 @@ DmtcpCoordinator::processDmtUserCmd(DmtcpMessage &hello_remote,
     // Reply will be done in DmtcpCoordinator::onData in this file.
     blockUntilDoneRemote = remote.sockfd();
     handleUserCommand(hello_remote.coordCmd, &reply);
+  } else if (hello_remote.coordCmd == 'm') {
+    // The extra data is HOST:PORT and the cookie, each NUL-terminated.
+    if (hello_remote.extraBytes > 0) {
+      extraData[hello_remote.extraBytes - 1] = '\0';
+      if (migrateStage == DMT_MIGRATE_NONE) {
+        migrateTarget = extraData;
+        size_t len = migrateTarget.length() + 1;
+        migrateCookie = len < hello_remote.extraBytes ? extraData + len : "";
+      }
+    }
+    handleUserCommand(hello_remote.coordCmd, &reply);
+    remote << reply;
+    remote.close();
   } else if (hello_remote.coordCmd == 'i') {
     // theDefaultCheckpointInterval = hello_remote.theCheckpointInterval;
     // theCheckpointInterval = theDefaultCheckpointInterval;
@@ -1125,6 +1551,8 @@ DmtcpCoordinator::startCheckpoint()
     time(&ckptTimeStamp);
     JTIMER_START(checkpoint);
     _numRestartFilenames = 0;
+    _numMigrationFallbacks = 0;
+    resetCkptWrites();
     _restartFilenames.clear();
     _rshCmdFileNames.clear();
     _sshCmdFileNames.clear();
@@ -1133,7 +1561,16 @@ DmtcpCoordinator::startCheckpoint()
       (s.numPeers) (compId.computationGeneration());
 
     // Pass number of connected peers to all clients
-    broadcastMessage(DMT_DO_SUSPEND);
+    if (migrateStage != DMT_MIGRATE_NONE) {
+      JNOTE("starting migration round") (migrateStage) (migrateTarget);
+      if (migrateStage == DMT_MIGRATE_FINAL) {
+        exitAfterCkptOnce = true;
+      }
+      string data = migrateTarget + '\0' + migrateCookie;
+      broadcastMessage(DMT_DO_SUSPEND, data.length() + 1, data.c_str());
+    } else {
+      broadcastMessage(DMT_DO_SUSPEND);
+    }
 
     // Suspend Message has been sent but the workers are still in running
     // state.  If the coordinator receives another checkpoint request from user
@@ -1160,20 +1597,34 @@ DmtcpCoordinator::broadcastMessage(DmtcpMessageType type,
   msg.compGroup = compId;
   msg.numPeers = clients.size();
   msg.exitAfterCkpt = exitAfterCkpt || exitAfterCkptOnce;
+  msg.migrateStage = migrateStage;
   msg.extraBytes = extraBytes;
 
   if (msg.type == DMT_KILL_PEER && clients.size() > 0) {
     killInProgress = true;
   }
 
+  // One copy for all the clients.  Header and extra data go out in a single
+  // write; otherwise Nagle's algorithm holds back the extra data until the
+  // header is acknowledged.
+  OutgoingMessage *out = new OutgoingMessage(msg, extraData);
+
   JTRACE("sending message")(type);
   for (size_t i = 0; i < clients.size(); i++) {
-    clients[i]->sock() << msg;
-    if (extraBytes > 0) {
-      clients[i]->sock().writeAll((const char *)extraData, extraBytes);
+    if (type == DMT_BARRIER_RELEASED && clients[i]->barrierViaRelay()) {
+      continue;
     }
+    sendMessage(clients[i], out);
   }
-  workersAtCurrentBarrier = 0;
+
+  // The relays forward these to the processes waiting on them.
+  if (type == DMT_BARRIER_RELEASED || type == DMT_KILL_PEER) {
+    for (size_t i = 0; i < barrierRelays.size(); i++) {
+      sendMessage(barrierRelays[i], out);
+    }
+  }
+  out->unref();
+  resetBarrierArrivals();
 }
 
 DmtcpCoordinator::ComputationStatus
@@ -1380,6 +1831,12 @@ DmtcpCoordinator::eventLoop(bool daemon)
   JASSERT(epoll_ctl(epollFd, EPOLL_CTL_ADD, listenSock->sockfd(), &ev) != -1)
     (JASSERT_ERRNO);
 
+  readersFd = CoordinatorReaders::start(numReaderThreads);
+  ev.events = EPOLLIN;
+  ev.data.ptr = &readersFd;
+  JASSERT(epoll_ctl(epollFd, EPOLL_CTL_ADD, readersFd, &ev) != -1)
+    (JASSERT_ERRNO);
+
   if (!daemon &&
 
       // epoll_ctl below fails if STDIN is pointing to /dev/null.
@@ -1412,57 +1869,98 @@ DmtcpCoordinator::eventLoop(bool daemon)
     // For example, any signal, including signal 0 or SIGWINCH can cause this.
     JASSERT(nfds != -1 || errno == EINTR) (JASSERT_ERRNO);
 
+    // Messages are handled after the other events of this round, which may
+    // refer to clients that disconnect in them.
+    bool haveMessages = false;
     for (int n = 0; n < nfds; ++n) {
       void *ptr = events[n].data.ptr;
-      if ((events[n].events & EPOLLHUP) ||
-#ifdef EPOLLRDHUP
-          (events[n].events & EPOLLRDHUP) ||
-#endif // ifdef EPOLLRDHUP
-          (events[n].events & EPOLLERR)) {
-        JASSERT(ptr != listenSock);
-        if (ptr == (void *)STDIN_FILENO) {
+      if (ptr == (void *)&readersFd) {
+        haveMessages = true;
+      } else if (ptr == (void *)listenSock) {
+        acceptConnection();
+      } else if (ptr == (void *)STDIN_FILENO) {
+        char buf[1];
+        int ret = 0;
+        if (events[n].events & EPOLLIN) {
+          ret = Util::readAll(STDIN_FD, buf, sizeof(buf));
+          JASSERT(ret != -1) (JASSERT_ERRNO);
+        }
+        if (ret > 0) {
+          handleUserCommand(buf[0]);
+        } else {
+          JNOTE("closing stdin");
           JASSERT(epoll_ctl(epollFd, EPOLL_CTL_DEL, STDIN_FILENO, &ev) != -1)
             (JASSERT_ERRNO);
           close(STDIN_FD);
-        } else {
-          onDisconnect((CoordClient *)ptr);
-        }
-      } else if (events[n].events & EPOLLIN) {
-        if (ptr == (void *)listenSock) {
-          onConnect();
-        } else if (ptr == (void *)STDIN_FILENO) {
-          char buf[1];
-          int ret = Util::readAll(STDIN_FD, buf, sizeof(buf));
-          JASSERT(ret != -1) (JASSERT_ERRNO);
-          if (ret > 0) {
-            handleUserCommand(buf[0]);
-          } else {
-            JNOTE("closing stdin");
-            JASSERT(epoll_ctl(epollFd, EPOLL_CTL_DEL, STDIN_FILENO, &ev) != -1)
-              (JASSERT_ERRNO);
-            close(STDIN_FD);
-          }
-        } else {
-          onData((CoordClient *)ptr);
         }
+      } else {
+        // Client sockets are here only while their send queue is not empty.
+        flushSendQueue((CoordClient *)ptr);
       }
     }
+
+    if (haveMessages) {
+      processReaderEvents();
+    }
+  }
+}
+
+void
+DmtcpCoordinator::processReaderEvents()
+{
+  vector<CoordinatorReaders::Event> readerEvents;
+
+  CoordinatorReaders::takeEvents(&readerEvents);
+  for (size_t i = 0; i < readerEvents.size(); i++) {
+    CoordinatorReaders::Event &e = readerEvents[i];
+    if (e.connecting && e.disconnected) {
+      PendingConnection *conn = (PendingConnection *)e.owner;
+      conn->sock.close();
+      delete conn;
+    } else if (e.connecting) {
+      onConnect((PendingConnection *)e.owner, e.msg, e.extraData);
+    } else if (e.disconnected) {
+      onDisconnect((CoordClient *)e.owner);
+    } else {
+      onData((CoordClient *)e.owner, e.msg, e.extraData);
+    }
+    delete[] e.extraData;
   }
 }
 
 void
 DmtcpCoordinator::addDataSocket(CoordClient *client)
 {
-  struct epoll_event ev;
+  CoordinatorReaders::watch(client->sock().sockfd(), client, false);
+}
 
-#ifdef EPOLLRDHUP
-  ev.events = EPOLLIN | EPOLLRDHUP;
-#else // ifdef EPOLLRDHUP
-  ev.events = EPOLLIN;
-#endif // ifdef EPOLLRDHUP
+// Writes what the socket takes now; the event loop writes the rest once
+// the socket is writable.
+void
+DmtcpCoordinator::sendMessage(CoordClient *client, OutgoingMessage *msg)
+{
+  client->queueMessage(msg);
+  if (!client->pollingWritable()) {
+    flushSendQueue(client);
+  }
+}
+
+void
+DmtcpCoordinator::flushSendQueue(CoordClient *client)
+{
+  bool empty = client->flushSendQueue();
+
+  if (empty == !client->pollingWritable()) {
+    return;
+  }
+
+  // Its reader thread has the socket for reading.
+  struct epoll_event ev;
+  ev.events = EPOLLOUT;
   ev.data.ptr = client;
-  JASSERT(epoll_ctl(epollFd, EPOLL_CTL_ADD, client->sock().sockfd(), &ev) != -1)
-    (JASSERT_ERRNO);
+  JASSERT(epoll_ctl(epollFd, empty ? EPOLL_CTL_DEL : EPOLL_CTL_ADD,
+                    client->sock().sockfd(), &ev) != -1) (JASSERT_ERRNO);
+  client->pollingWritable(!empty);
 }
 
 #define shift argc--; argv++
@@ -1488,6 +1986,7 @@ main(int argc, char **argv)
   bool quiet = false;
 
   char *tmpdir_arg = NULL;
+  string relayTo;
 
   /* NOTE: The convention is that user-specified explicit runtime arguments
    *       get a higher priority than env. vars. The logFilename variable will
@@ -1543,6 +2042,12 @@ main(int argc, char **argv)
     } else if (argc > 1 && s == "--port-file") {
       thePortFile = argv[1];
       shift; shift;
+    } else if (argc > 1 && s == "--relay-to") {
+      relayTo = argv[1];
+      shift; shift;
+    } else if (argc > 1 && s == "--io-threads") {
+      numReaderThreads = jalib::StringToInt(argv[1]);
+      shift; shift;
     } else if (argc > 1 && (s == "-c" || s == "--ckptdir")) {
       setenv(ENV_VAR_CHECKPOINT_DIR, argv[1], 1);
       shift; shift;
@@ -1703,10 +2208,20 @@ main(int argc, char **argv)
     // unblock SIGALRM because we are using alarm() for interval checkpointing
     sigdelset(&set, SIGALRM);
 
-    // sigprocmask is only per-thread; but the coordinator is single-threaded.
+    // sigprocmask is only per-thread; the reader threads, started later,
+    // block all signals.
     sigprocmask(SIG_BLOCK, &set, NULL);
   }
 
+  if (!relayTo.empty()) {
+    BarrierRelay::eventLoop(listenSock, relayTo);
+  }
+
+  if (numReaderThreads == 0) {
+    long numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+    numReaderThreads = numCpus > 0 ? numCpus : 1;
+  }
+  numReaderThreads = std::min(numReaderThreads, (size_t)MAX_READER_THREADS);
   prog.eventLoop(daemon);
   return 0;
 }
@@ -28,6 +28,28 @@
 
 namespace dmtcp
 {
+// A message with its extra data, ready to be written.  A broadcast shares
+// a single copy among the send queues of all the clients it goes to.
+class OutgoingMessage
+{
+  public:
+    OutgoingMessage(const DmtcpMessage &msg, const void *extraData);
+
+    const char *data() const { return &_buf[0]; }
+
+    size_t size() const { return _buf.size(); }
+
+    void ref() { _refs++; }
+
+    void unref() { if (--_refs == 0) { delete this; } }
+
+  private:
+    ~OutgoingMessage() {}
+
+    vector<char>_buf;
+    size_t _refs;
+};
+
 class CoordClient
 {
   public:
@@ -36,6 +58,7 @@ class CoordClient
                 socklen_t len,
                 DmtcpMessage &hello_remote,
                 int isNSWorker = 0);
+    ~CoordClient();
 
     jalib::JSocket &sock() { return _sock; }
 
@@ -69,7 +92,57 @@ class CoordClient
 
     int isNSWorker() { return _isNSWorker; }
 
-    void readProcessInfo(DmtcpMessage &msg);
+    // The connection of a process writing a forked checkpoint image.
+    bool isCkptWriter() const { return _isCkptWriter; }
+
+    // The checkpoint generation whose image the writer writes.
+    int ckptGeneration() const { return _ckptGeneration; }
+
+    // For a writer, whether it reported the end of the image.  For a
+    // process, whether the writer of its current image did.
+    bool ckptWriteDone() const { return _ckptWriteDone; }
+
+    void ckptWriteDone(bool done) { _ckptWriteDone = done; }
+
+    // The process sent its checkpoint filename while a forked writer was
+    // still writing the image.
+    bool ckptWritePending() const { return _ckptWritePending; }
+
+    void ckptWritePending(bool value) { _ckptWritePending = value; }
+
+    uint64_t ckptBytesWritten() const { return _ckptBytesWritten; }
+
+    void ckptBytesWritten(uint64_t n) { _ckptBytesWritten = n; }
+
+    // The connection of a barrier relay (dmtcp_coordinator --relay-to).
+    bool isBarrierRelay() const { return _isBarrierRelay; }
+
+    // The last DMT_OK of this process came through a barrier relay, which
+    // then forwards the release of the barrier.
+    bool barrierViaRelay() const { return _barrierViaRelay; }
+
+    void barrierViaRelay(bool value) { _barrierViaRelay = value; }
+
+    // The process was counted at the current barrier.
+    bool atCurrentBarrier() const { return _atCurrentBarrier; }
+
+    void atCurrentBarrier(bool value) { _atCurrentBarrier = value; }
+
+    void readProcessInfo(const char *extraData);
+
+    // Messages go through a send queue, so that a process that does not
+    // read its socket cannot stall the coordinator.  flushSendQueue()
+    // writes as much as the socket takes; it returns whether the queue is
+    // now empty.
+    void queueMessage(OutgoingMessage *msg);
+    bool flushSendQueue(bool block = false);
+
+    bool hasQueuedMessages() const { return !_sendQueue.empty(); }
+
+    // Whether the event loop waits for the socket to become writable.
+    bool pollingWritable() const { return _pollingWritable; }
+
+    void pollingWritable(bool value) { _pollingWritable = value; }
 
   private:
     UniquePid _identity;
@@ -82,6 +155,26 @@ class CoordClient
     pid_t _realPid;
     pid_t _virtualPid;
     int _isNSWorker;
+    bool _isCkptWriter;
+    int _ckptGeneration;
+    bool _ckptWriteDone;
+    bool _ckptWritePending;
+    uint64_t _ckptBytesWritten;
+    bool _isBarrierRelay;
+    bool _barrierViaRelay;
+    bool _atCurrentBarrier;
+    vector<OutgoingMessage *>_sendQueue;
+    size_t _sendOffset;
+    bool _pollingWritable;
+};
+
+// A connection whose first message has not been read yet.
+struct PendingConnection {
+  PendingConnection() : sock(-1), remoteLen(0) {}
+
+  jalib::JSocket sock;
+  struct sockaddr_storage remoteAddr;
+  socklen_t remoteLen;
 };
 
 class DmtcpCoordinator
@@ -94,12 +187,18 @@ class DmtcpCoordinator
       int numPeers;
     } ComputationStatus;
 
-    void onData(CoordClient *client);
-    void onConnect();
+    void onData(CoordClient *client, DmtcpMessage &msg, char *extraData);
+    void acceptConnection();
+    void onConnect(PendingConnection *conn,
+                   DmtcpMessage &hello_remote,
+                   char *extraData);
     void onDisconnect(CoordClient *client);
     void eventLoop(bool daemon);
+    void processReaderEvents();
 
     void addDataSocket(CoordClient *client);
+    void sendMessage(CoordClient *client, OutgoingMessage *msg);
+    void flushSendQueue(CoordClient *client);
     void updateCheckpointInterval(uint32_t timeout);
     void updateMinimumState();
     void initializeComputation();
@@ -107,14 +206,24 @@ class DmtcpCoordinator
                           size_t extraBytes = 0,
                           const void *extraData = NULL);
     void releaseBarrier(const string &barrier);
+    void recordRelayedBarrier(CoordClient *sender,
+                              const DmtcpMessage &msg,
+                              const char *extraData);
     bool startCheckpoint();
-    void recordCkptFilename(CoordClient *client, const char *barrierList);
+    void recordCkptFilename(CoordClient *client, const char *barrierList,
+                            bool inRestartScript);
+    void finishCkptWrite(CoordClient *client, bool success);
+    size_t numPendingCkptWrites() const;
+    void resetCkptWrites();
+    void completeCheckpoint();
 
     void handleUserCommand(char cmd, DmtcpMessage *reply = NULL);
     void printStatus(size_t numPeers, bool isRunning);
     string printList();
 
-    void processDmtUserCmd(DmtcpMessage &hello_remote, jalib::JSocket &remote);
+    void processDmtUserCmd(DmtcpMessage &hello_remote,
+                           jalib::JSocket &remote,
+                           char *extraData);
     bool validateNewWorkerProcess(DmtcpMessage &hello_remote,
                                   jalib::JSocket &remote,
                                   CoordClient *client,
@@ -139,6 +248,13 @@ class DmtcpCoordinator
     size_t _numCkptWorkers;
     size_t _numRestartFilenames;
 
+    // A writer of the current checkpoint failed.
+    bool _ckptWriteFailed;
+
+    // Workers that wrote their final migration image to the checkpoint
+    // directory, the target being out of reach.
+    size_t _numMigrationFallbacks;
+
     // Store whether rsh/ssh was used
     map< string, vector<string> > _rshCmdFileNames;
     map< string, vector<string> > _sshCmdFileNames;
@@ -0,0 +1,302 @@
+/****************************************************************************
+ *   Copyright (C) 2006-2010 by Jason Ansel, Kapil Arya, and Gene Cooperman *
+ *   jansel@csail.mit.edu, kapil@ccs.neu.edu, gene@ccs.neu.edu              *
+ *                                                                          *
+ *  This file is part of DMTCP.                                             *
+ *                                                                          *
+ *  DMTCP is free software: you can redistribute it and/or                  *
+ *  modify it under the terms of the GNU Lesser General Public License as   *
+ *  published by the Free Software Foundation, either version 3 of the      *
+ *  License, or (at your option) any later version.                         *
+ *                                                                          *
+ *  DMTCP is distributed in the hope that it will be useful,                *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU Lesser General Public License for more details.                     *
+ *                                                                          *
+ *  You should have received a copy of the GNU Lesser General Public        *
+ *  License along with DMTCP:dmtcp/src.  If not, see                        *
+ *  <http://www.gnu.org/licenses/>.                                         *
+ ****************************************************************************/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "ckptindex.h"
+#include "constants.h"
+#include "util.h"
+
+#define BINARY_NAME "dmtcp_image"
+
+// Granularity at which "diff" compares the memory of two areas.
+#define DIFF_CHUNK_SIZE (64 * MTCP_PAGE_SIZE)
+
+using namespace dmtcp;
+
+static const char *theUsage =
+  "Usage:  dmtcp_image COMMAND IMAGE [ARGS]\n"
+  "Inspect the memory areas of an uncompressed checkpoint image, through the\n"
+  "index at its end (see DMTCP_CKPT_INDEX).\n\n"
+  "Commands:\n"
+  "    list IMAGE             List the memory areas of IMAGE\n"
+  "    extract IMAGE ADDR LEN Write the LEN bytes of memory at ADDR, as saved\n"
+  "                           in IMAGE, to stdout\n"
+  "    diff IMAGE1 IMAGE2     List the areas and the ranges of pages that\n"
+  "                           differ between two images\n"
+  "    verify IMAGE           Check the checksum of every area of IMAGE\n"
+  "\n"
+  "Options:\n"
+  "  --help\n"
+  "              Print this message and exit.\n"
+  "  --version\n"
+  "              Print version information and exit.\n"
+  "\n"
+  "Pages that an image does not hold itself (kept in the parent image of an\n"
+  "incremental checkpoint, in the page deduplication store, or in the file\n"
+  "that was mapped) cannot be extracted or compared.\n"
+  "\n"
+  HELP_AND_CONTACT_INFO
+  "\n";
+
+static void
+openImage(CkptIndex::Reader *reader, const char *path)
+{
+  if (!reader->open(path)) {
+    fprintf(stderr, BINARY_NAME ": %s: not a checkpoint image with an index"
+            " (compressed images have none)\n", path);
+    exit(2);
+  }
+}
+
+static string
+describeArea(const CkptIndex::Reader &reader, size_t i)
+{
+  const CkptIndexEntry &e = reader.area(i);
+  static const char *runNames[] = { "data", "zero", "parent", "dedup", "file" };
+  string runs;
+  char buf[128];
+
+  for (size_t t = 0; t < sizeof(runNames) / sizeof(runNames[0]); t++) {
+    if (e.runTypes & (1U << t)) {
+      runs += runs.empty() ? "" : ",";
+      runs += runNames[t];
+    }
+  }
+  if (runs.empty()) {
+    runs = "-";
+  }
+  snprintf(buf, sizeof(buf), "%012llx-%012llx %c%c%c%c %-22s ",
+           (unsigned long long)e.addr, (unsigned long long)(e.addr + e.size),
+           (e.prot & PROT_READ) ? 'r' : '-',
+           (e.prot & PROT_WRITE) ? 'w' : '-',
+           (e.prot & PROT_EXEC) ? 'x' : '-',
+           (e.flags & MAP_SHARED) ? 's' : 'p',
+           runs.c_str());
+  return buf + string(reader.areaName(i));
+}
+
+static int
+listAreas(const char *path)
+{
+  CkptIndex::Reader reader;
+
+  openImage(&reader, path);
+  printf("%-25s %-4s %-22s %s\n", "ADDRESS", "PERM", "RUNS", "NAME");
+  for (size_t i = 0; i < reader.numAreas(); i++) {
+    printf("%s\n", describeArea(reader, i).c_str());
+  }
+  return 0;
+}
+
+static int
+extractMemory(const char *path, const char *addrArg, const char *lenArg)
+{
+  CkptIndex::Reader reader;
+  char *end;
+
+  openImage(&reader, path);
+  uint64_t addr = strtoull(addrArg, &end, 0);
+  if (*addrArg == '\0' || *end != '\0') {
+    fprintf(stderr, BINARY_NAME ": invalid address: %s\n", addrArg);
+    return 2;
+  }
+  uint64_t len = strtoull(lenArg, &end, 0);
+  if (*lenArg == '\0' || *end != '\0') {
+    fprintf(stderr, BINARY_NAME ": invalid length: %s\n", lenArg);
+    return 2;
+  }
+
+  vector<char> buf(MIN(len, DIFF_CHUNK_SIZE));
+  while (len > 0) {
+    size_t n = MIN(len, buf.size());
+    if (!reader.readMemory(addr, &buf[0], n)) {
+      fprintf(stderr, BINARY_NAME ": %s: memory at 0x%llx is not in the"
+              " image\n", path, (unsigned long long)addr);
+      return 1;
+    }
+    if (Util::writeAll(STDOUT_FILENO, &buf[0], n) != (ssize_t)n) {
+      perror(BINARY_NAME ": write");
+      return 2;
+    }
+    addr += n;
+    len -= n;
+  }
+  return 0;
+}
+
+static void
+printRange(const char *what, uint64_t start, uint64_t end)
+{
+  if (start < end) {
+    printf("  %s %012llx-%012llx\n", what,
+           (unsigned long long)start, (unsigned long long)end);
+  }
+}
+
+// Prints the ranges of pages of an area that differ between the images.
+static void
+diffArea(CkptIndex::Reader *r1, CkptIndex::Reader *r2,
+         uint64_t addr, uint64_t size)
+{
+  vector<char> buf1(DIFF_CHUNK_SIZE);
+  vector<char> buf2(DIFF_CHUNK_SIZE);
+  uint64_t changedStart = addr;
+  uint64_t changedEnd = addr;
+  uint64_t unknownStart = addr;
+  uint64_t unknownEnd = addr;
+
+  for (uint64_t end = addr + size; addr < end;) {
+    size_t n = MIN(end - addr, DIFF_CHUNK_SIZE);
+    size_t step = n;
+    bool unknown = false;
+    bool changed = false;
+
+    if (!r1->readMemory(addr, &buf1[0], n) ||
+        !r2->readMemory(addr, &buf2[0], n)) {
+      // Retry a page at a time, to narrow down the pages that are not in
+      // either image.
+      step = MTCP_PAGE_SIZE;
+      unknown = !r1->readMemory(addr, &buf1[0], step) ||
+                !r2->readMemory(addr, &buf2[0], step);
+      changed = !unknown && memcmp(&buf1[0], &buf2[0], step) != 0;
+    } else if (memcmp(&buf1[0], &buf2[0], n) != 0) {
+      step = MTCP_PAGE_SIZE;
+      for (size_t off = 0; off < n; off += step) {
+        if (memcmp(&buf1[off], &buf2[off], step) != 0) {
+          if (changedEnd != addr + off) {
+            printRange("changed", changedStart, changedEnd);
+            changedStart = addr + off;
+          }
+          changedEnd = addr + off + step;
+        }
+      }
+      step = n;
+    }
+
+    if (changed) {
+      if (changedEnd != addr) {
+        printRange("changed", changedStart, changedEnd);
+        changedStart = addr;
+      }
+      changedEnd = addr + step;
+    }
+    if (unknown) {
+      if (unknownEnd != addr) {
+        printRange("not in image", unknownStart, unknownEnd);
+        unknownStart = addr;
+      }
+      unknownEnd = addr + step;
+    }
+    addr += step;
+  }
+  printRange("changed", changedStart, changedEnd);
+  printRange("not in image", unknownStart, unknownEnd);
+}
+
+static bool
+sameArea(const CkptIndexEntry &e1, const CkptIndexEntry &e2)
+{
+  return e1.addr == e2.addr && e1.size == e2.size;
+}
+
+static int
+diffImages(const char *path1, const char *path2)
+{
+  CkptIndex::Reader r1;
+  CkptIndex::Reader r2;
+  int status = 0;
+
+  openImage(&r1, path1);
+  openImage(&r2, path2);
+
+  for (size_t i = 0; i < r1.numAreas(); i++) {
+    const CkptIndexEntry &e1 = r1.area(i);
+    ssize_t j = r2.findArea(e1.addr);
+    if (j == -1 || !sameArea(e1, r2.area(j))) {
+      printf("- %s\n", describeArea(r1, i).c_str());
+      status = 1;
+      continue;
+    }
+
+    // Same record and same data: nothing to compare.
+    const CkptIndexEntry &e2 = r2.area(j);
+    if (e1.length == e2.length && e1.checksum == e2.checksum) {
+      continue;
+    }
+    printf("M %s\n", describeArea(r1, i).c_str());
+    diffArea(&r1, &r2, e1.addr, e1.size);
+    status = 1;
+  }
+  for (size_t j = 0; j < r2.numAreas(); j++) {
+    ssize_t i = r1.findArea(r2.area(j).addr);
+    if (i == -1 || !sameArea(r1.area(i), r2.area(j))) {
+      printf("+ %s\n", describeArea(r2, j).c_str());
+      status = 1;
+    }
+  }
+  return status;
+}
+
+static int
+verifyImage(const char *path)
+{
+  CkptIndex::Reader reader;
+  vector<size_t> corrupt;
+
+  openImage(&reader, path);
+  reader.verifyAll(sysconf(_SC_NPROCESSORS_ONLN), &corrupt);
+  for (size_t i = 0; i < corrupt.size(); i++) {
+    printf("corrupt: %s\n", describeArea(reader, corrupt[i]).c_str());
+  }
+  printf("%s: %zu areas, %zu corrupt\n", path, reader.numAreas(),
+         corrupt.size());
+  return corrupt.empty() ? 0 : 1;
+}
+
+int
+main(int argc, char **argv)
+{
+  initializeJalib();
+
+  if (argc == 2 && strcmp(argv[1], "--version") == 0) {
+    printf("%s", DMTCP_VERSION_AND_COPYRIGHT_INFO);
+    return 0;
+  }
+  if (argc == 3 && strcmp(argv[1], "list") == 0) {
+    return listAreas(argv[2]);
+  } else if (argc == 5 && strcmp(argv[1], "extract") == 0) {
+    return extractMemory(argv[2], argv[3], argv[4]);
+  } else if (argc == 4 && strcmp(argv[1], "diff") == 0) {
+    return diffImages(argv[2], argv[3]);
+  } else if (argc == 3 && strcmp(argv[1], "verify") == 0) {
+    return verifyImage(argv[2]);
+  }
+
+  fprintf(argc == 2 && strcmp(argv[1], "--help") == 0 ? stdout : stderr,
+          "%s", theUsage);
+  return argc == 2 && strcmp(argv[1], "--help") == 0 ? 0 : 2;
+}
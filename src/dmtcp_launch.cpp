@@ -89,11 +89,62 @@ static const char *theUsage =
   "              if not set and no env var, use default value set in\n"
   "              dmtcp_coordinator or dmtcp_command.\n"
   "              Not allowed if --join-coordinator is specified\n"
+  "  --barrier-relay HOST:PORT (environment variable DMTCP_BARRIER_RELAY)\n"
+  "              Go through this barrier relay, usually the one of this\n"
+  "              node (dmtcp_coordinator --relay-to), for the barriers of\n"
+  "              checkpoint and restart (default: the coordinator)\n"
+  "  --node-barriers (environment variable DMTCP_NODE_BARRIERS=1)\n"
+  "              Processes on the same node meet in shared memory before\n"
+  "              each barrier, and one of them reports for all of them\n"
   "\n"
   "Checkpoint image generation:\n"
   "  --gzip, --no-gzip, (environment variable DMTCP_GZIP=[01])\n"
   "              Enable/disable compression of checkpoint images (default: 1)\n"
   "              WARNING: gzip adds seconds. Without gzip, ckpt is often < 1s\n"
+  "  --parallel-compression NUM_THREADS\n"
+  "              (environment variable DMTCP_PARALLEL_COMPRESSION)\n"
+  "              Compress checkpoint images in-process with NUM_THREADS\n"
+  "              threads instead of gzip; 0 disables it (default: 0)\n"
+  "  --parallel-write NUM_THREADS\n"
+  "              (environment variable DMTCP_PARALLEL_WRITE)\n"
+  "              Write uncompressed checkpoint images with NUM_THREADS\n"
+  "              threads instead of gzip, and read them back in parallel on\n"
+  "              restart.  Ignored with --parallel-compression.\n"
+  "              0 or 1 disables it (default: 0)\n"
+  "  --ckpt-output BACKEND\n"
+  "              (environment variable DMTCP_CKPT_OUTPUT)\n"
+  "              How uncompressed checkpoint images are written: write,\n"
+  "              direct (O_DIRECT), uring (io_uring) or uring-direct.\n"
+  "              Falls back to write if unsupported (default: write)\n"
+  "  --forked-ckpt\n"
+  "              (environment variable DMTCP_FORKED_CHECKPOINT)\n"
+  "              Resume right after fork() at checkpoint time; a child\n"
+  "              writes the image and reports to the coordinator, which\n"
+  "              commits the checkpoint once all images are written.\n"
+  "  --staging-dir PATH (environment variable DMTCP_CKPT_STAGING_DIR)\n"
+  "              Write the images to PATH, a fast node-local directory, and\n"
+  "              resume; they are then copied to the checkpoint directory in\n"
+  "              the background, and the checkpoint is committed once all\n"
+  "              of them are there (default: disabled)\n"
+  "  --drain-rate MB_PER_S (environment variable DMTCP_CKPT_DRAIN_RATE)\n"
+  "              Copy the images out of the staging directory at most this\n"
+  "              fast, per node; 0 is unlimited (default: 0)\n"
+  "  --incremental-ckpt NUM\n"
+  "              (environment variable DMTCP_INCREMENTAL_CKPT)\n"
+  "              Write only the pages modified since the previous checkpoint,\n"
+  "              with a full image after every NUM incremental ones.\n"
+  "              Requires soft-dirty page tracking in the kernel.\n"
+  "              0 disables it (default: 0)\n"
+  "  --dedup-dir PATH (environment variable DMTCP_DEDUP_DIR)\n"
+  "              Store the contents of file-backed and read-only memory\n"
+  "              once per node in PATH, shared by all processes, and refer\n"
+  "              to them from the checkpoint images (default: disabled)\n"
+  "  --skip-unmodified-file-pages\n"
+  "              (environment variable DMTCP_SKIP_UNMODIFIED_FILE_PAGES)\n"
+  "              Leave the pages of private file mappings that were never\n"
+  "              written to out of the checkpoint images; they are mapped\n"
+  "              from the files again on restart.  Restart fails if such a\n"
+  "              file has changed since the checkpoint.\n"
 #ifdef HBICT_DELTACOMP
   "  --hbict, --no-hbict, (environment variable DMTCP_HBICT=[01])\n"
   "              Enable/disable compression of checkpoint images (default: 1)\n"
@@ -267,6 +318,33 @@ processArgs(int *orig_argc,
     } else if (s == "--no-gzip") {
       setenv(ENV_VAR_COMPRESSION, "0", 1);
       shift;
+    } else if (argc > 1 && s == "--parallel-compression") {
+      setenv(ENV_VAR_PARALLEL_COMPRESSION, argv[1], 1);
+      shift; shift;
+    } else if (argc > 1 && s == "--incremental-ckpt") {
+      setenv(ENV_VAR_INCREMENTAL_CKPT, argv[1], 1);
+      shift; shift;
+    } else if (argc > 1 && s == "--dedup-dir") {
+      setenv(ENV_VAR_DEDUP_DIR, argv[1], 1);
+      shift; shift;
+    } else if (argc > 1 && s == "--staging-dir") {
+      setenv(ENV_VAR_CKPT_STAGING_DIR, argv[1], 1);
+      shift; shift;
+    } else if (argc > 1 && s == "--drain-rate") {
+      setenv(ENV_VAR_CKPT_DRAIN_RATE, argv[1], 1);
+      shift; shift;
+    } else if (argc > 1 && s == "--parallel-write") {
+      setenv(ENV_VAR_PARALLEL_WRITE, argv[1], 1);
+      shift; shift;
+    } else if (argc > 1 && s == "--ckpt-output") {
+      setenv(ENV_VAR_CKPT_OUTPUT, argv[1], 1);
+      shift; shift;
+    } else if (s == "--forked-ckpt") {
+      setenv(ENV_VAR_FORKED_CKPT, "1", 1);
+      shift;
+    } else if (s == "--skip-unmodified-file-pages") {
+      setenv(ENV_VAR_SKIP_UNMODIFIED_FILE_PAGES, "1", 1);
+      shift;
     }
 #ifdef HBICT_DELTACOMP
     else if (s == "--hbict") {
@@ -311,6 +389,12 @@ processArgs(int *orig_argc,
     } else if (argc > 1 && s == "--port-file") {
       thePortFile = argv[1];
       shift; shift;
+    } else if (argc > 1 && s == "--barrier-relay") {
+      setenv(ENV_VAR_BARRIER_RELAY, argv[1], 1);
+      shift; shift;
+    } else if (s == "--node-barriers") {
+      setenv(ENV_VAR_NODE_BARRIERS, "1", 1);
+      shift;
     } else if (argc > 1 && (s == "-c" || s == "--ckptdir")) {
       setenv(ENV_VAR_CHECKPOINT_DIR, argv[1], 1);
       shift; shift;
@@ -378,8 +462,9 @@ processArgs(int *orig_argc,
   }
 
 #ifdef FAST_RST_VIA_MMAP
-  // In case of fast restart, we shall not use gzip.
-  setenv(ENV_VAR_COMPRESSION, "0", 1);
+  // Built for fast restart:  unless asked otherwise, write uncompressed
+  // images, which mtcp_restart can map instead of reading.
+  setenv(ENV_VAR_COMPRESSION, "0", 0);
 #endif
 
 #if __aarch64__
@@ -441,11 +526,7 @@ main(int argc, char **argv)
 
 #ifdef FORKED_CHECKPOINTING
 
-  /* When this is robust, add --forked-checkpointing option on command-line,
-   * with #ifdef FORKED_CHECKPOINTING around the option, change default of
-   * configure.ac, dmtcp/configure.ac, to enable, and change them
-   * from enable-forked... to disable-...
-   */
+  // configure --enable-forked-checkpointing makes --forked-ckpt the default.
   setenv(ENV_VAR_FORKED_CKPT, "1", 1);
 #endif // ifdef FORKED_CHECKPOINTING
 
@@ -21,11 +21,13 @@
 
 #include <elf.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <sys/fcntl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <time.h>
 #include "config.h"
 #ifdef HAS_PR_SET_PTRACER
 #include <sys/prctl.h>
@@ -33,9 +35,16 @@
 
 #include "../jalib/jassert.h"
 #include "../jalib/jfilesystem.h"
+#include "../jalib/jsocket.h"
+#include "ckptcompress.h"
+#include "ckptdedup.h"
+#include "ckptincremental.h"
+#include "ckptindex.h"
+#include "ckptio.h"
 #include "constants.h"
 #include "coordinatorapi.h"
 #include "dmtcp_dlsym.h"
+#include "mtcp/mtcp_header.h"
 #include "processinfo.h"
 #include "shareddata.h"
 #include "uniquepid.h"
@@ -61,7 +70,9 @@ string tmpDir = "/DMTCP/Uninitialized/Tmp/Dir";
 // string has at least one format specifier with corresponding format argument.
 // Ubuntu 9.01 uses -Wformat=2 by default.
 static const char *theUsage =
-  "Usage: dmtcp_restart [OPTIONS] <ckpt1.dmtcp> [ckpt2.dmtcp...]\n\n"
+  "Usage: dmtcp_restart [OPTIONS] <ckpt1.dmtcp> [ckpt2.dmtcp...]\n"
+  "       dmtcp_restart [OPTIONS] --migrate-listen [HOST:]PORT\n"
+  "       dmtcp_restart --verify|--simulate <ckpt1.dmtcp> [ckpt2.dmtcp...]\n\n"
   "Restart processes from a checkpoint image.\n\n"
   "Connecting to the DMTCP Coordinator:\n"
   "  -h, --coord-host HOSTNAME (environment variable DMTCP_COORD_HOST)\n"
@@ -111,6 +122,43 @@ static const char *theUsage =
   "              Skip NOTE messages; if given twice, also skip WARNINGs\n"
   "  --coord-logfile PATH (environment variable DMTCP_COORD_LOG_FILENAME\n"
   "              Coordinator will dump its logs to the given file\n"
+  "  --lazy-restart (environment variable DMTCP_LAZY_RESTART=1)\n"
+  "              Resume the processes before their memory has been read:\n"
+  "              pages are loaded from the image on first access\n"
+  "              (userfaultfd), and in the background.  Needs an\n"
+  "              uncompressed image on a seekable file.\n"
+  "  --mmap-restart (environment variable DMTCP_MMAP_RESTART=1)\n"
+  "              Map the memory of the processes MAP_PRIVATE from an\n"
+  "              uncompressed image instead of reading it.  (This is the\n"
+  "              default if DMTCP was configured with --enable-fast-restart.)\n"
+  "  --prefetch-threads N (environment variable\n"
+  "              DMTCP_RESTART_PREFETCH_THREADS)\n"
+  "              Read the checkpoint images ahead into the page cache with\n"
+  "              N threads, and report the read bandwidth of each image.\n"
+  "              0 disables it.  (default: one thread per image, up to 16,\n"
+  "              if more than one image is restarted)\n"
+  "  --migrate-listen [HOST:]PORT\n"
+  "              Instead of reading checkpoint images, wait on TCP port\n"
+  "              PORT of the address HOST (default: 127.0.0.1) for the\n"
+  "              images streamed by 'dmtcp_command --migrate HOST:PORT', and\n"
+  "              restart the processes from them (live migration).  Only\n"
+  "              the streams preceded by the cookie in DMTCP_MIGRATE_COOKIE\n"
+  "              are accepted; if it is not set, a random cookie is printed,\n"
+  "              to be given to dmtcp_command in DMTCP_MIGRATE_COOKIE.  The\n"
+  "              images are received in --tmpdir, and the processes are\n"
+  "              restarted once all of them are complete and the\n"
+  "              coordinator has no processes left.  Images of another\n"
+  "              computation than the first one received are ignored.\n"
+  "  --verify\n"
+  "              Do not restart: check the checksum of every memory area of\n"
+  "              the images, with one thread per CPU.  Images without an\n"
+  "              index (compressed ones) are checked as with --simulate.\n"
+  "  --simulate\n"
+  "              Do not restart: read the images as a restart would\n"
+  "              (decompressing them, and merging incremental images with\n"
+  "              their parents), and check every memory area record,\n"
+  "              without mapping any memory.\n"
+  "              Both exit with a non-zero status if an image is damaged.\n"
   "  --help\n"
   "              Print this message and exit.\n"
   "  --version\n"
@@ -132,8 +180,21 @@ CoordinatorMode allowedModes = COORD_ANY;
 
 static void setEnvironFd();
 static void runMtcpRestart(int is32bitElf, int fd, ProcessInfo *pInfo);
+static bool isEnvFlagSet(const char *name);
 static int readCkptHeader(const string &path, ProcessInfo *pInfo);
+static int readCkptStreamHeader(int fd,
+                                const string &dir,
+                                ProcessInfo *pInfo);
+static void prefetch_ckpt_images();
+static bool verify_ckpt_image(const string &path, bool simulate);
+static void receive_migrated_processes(const string &listenAddr);
 static int openCkptFileToRead(const string &path);
+static int open_parallel_decompressor(int fd);
+static int open_parallel_reader(int fd, int nthreads);
+static int open_dedup_resolver(int fd, const ProcessInfo &pInfo);
+static int open_incremental_merger(const string &dir,
+                                   int fd,
+                                   const ProcessInfo &pInfo);
 
 class RestoreTarget
 {
@@ -145,6 +206,21 @@ class RestoreTarget
       .Text("checkpoint file missing");
 
       _fd = readCkptHeader(_path, &_pInfo);
+      checkImage();
+    }
+
+    // An image received by a live migration, next to the pre-copy image
+    // that is its parent.  The restarted process takes the --ckptdir, or
+    // else ckptDir, as its checkpoint directory.
+    RestoreTarget(const string &path, const string &ckptDir)
+      : _path(ckptDir + "/" + jalib::Filesystem::BaseName(path))
+    {
+      _fd = readCkptHeader(path, &_pInfo);
+      checkImage();
+    }
+
+    void checkImage()
+    {
       ptrdiff_t clock_gettime_offset =
                             dmtcp_dlsym_lib_fnc_offset("linux-vdso",
                                                        "__vdso_clock_gettime");
@@ -416,6 +492,15 @@ class RestoreTarget
     int _fd;
 };
 
+// True if the environment variable is set to "1".
+static bool
+isEnvFlagSet(const char *name)
+{
+  const char *value = getenv(name);
+
+  return value != NULL && strcmp(value, "1") == 0;
+}
+
 static void
 runMtcpRestart(int is32bitElf, int fd, ProcessInfo *pInfo)
 {
@@ -503,14 +588,31 @@ runMtcpRestart(int is32bitElf, int fd, ProcessInfo *pInfo)
     //     postRestartDebug() in the checkpoint image instead of postRestart().
   }
 
-  char *const newArgs[] = {
+  // Lazy and mmap restart need the image file itself, not a filter pipe.
+  bool seekable = lseek(fd, 0, SEEK_CUR) != -1;
+  bool lazy_restart = isEnvFlagSet(ENV_VAR_LAZY_RESTART);
+  bool mmap_restart = isEnvFlagSet(ENV_VAR_MMAP_RESTART);
+  JWARNING(seekable || !(lazy_restart || mmap_restart))
+    .Text("Lazy or mmap restart needs an uncompressed, seekable ckpt image;"
+          " reading memory instead.");
+
+  char *newArgs[] = {
     (char *)mtcprestart.c_str(),
     const_cast<char *>("--fd"), fdBuf,
     const_cast<char *>("--stderr-fd"), stderrFdBuf,
-    // This flag must be last, since it may become NULL
-    ( mtcp_restart_pause ? const_cast<char *>("--mtcp-restart-pause") : NULL ),
-    NULL
+    // These flags must be last, since they may become NULL
+    NULL, NULL, NULL, NULL
   };
+  int nextArg = 5;
+  if (lazy_restart && seekable) {
+    newArgs[nextArg++] = const_cast<char *>("--lazy");
+  }
+  if (mmap_restart && seekable) {
+    newArgs[nextArg++] = const_cast<char *>("--mmap");
+  }
+  if (mtcp_restart_pause) {
+    newArgs[nextArg++] = const_cast<char *>("--mtcp-restart-pause");
+  }
 
   execve(newArgs[0], newArgs, environ);
   JASSERT(false) (newArgs[0]) (newArgs[1]) (JASSERT_ERRNO)
@@ -519,10 +621,22 @@ runMtcpRestart(int is32bitElf, int fd, ProcessInfo *pInfo)
 
 // ************************ For reading checkpoint files *****************
 
+// All image files to be read, including the parents of incremental images.
+static vector<string> ckptImagePaths;
+
 int
 readCkptHeader(const string &path, ProcessInfo *pInfo)
 {
   int fd = openCkptFileToRead(path);
+  ckptImagePaths.push_back(path);
+  return readCkptStreamHeader(fd, jalib::Filesystem::DirName(path), pInfo);
+}
+
+// Reads the rest of the header of the image fd, past DMTCP_FILE_HEADER.  The
+// parent of an incremental image is looked up in dir.
+static int
+readCkptStreamHeader(int fd, const string &dir, ProcessInfo *pInfo)
+{
   const size_t len = strlen(DMTCP_FILE_HEADER);
 
   jalib::JBinarySerializeReaderRaw rdr("", fd);
@@ -535,9 +649,558 @@ readCkptHeader(const string &path, ProcessInfo *pInfo)
   ssize_t remaining = pagesize - (numRead % pagesize);
   char buf[remaining];
   JASSERT(Util::readAll(fd, buf, remaining) == remaining);
+
+  if (CkptCompress::isCompressedStream(fd)) {
+    fd = open_parallel_decompressor(fd);
+  } else if (pInfo->numWriteStreams() > 1 && lseek(fd, 0, SEEK_CUR) != -1 &&
+             !isEnvFlagSet(ENV_VAR_MMAP_RESTART) &&
+             !isEnvFlagSet(ENV_VAR_LAZY_RESTART)) {
+    // Otherwise, mtcp_restart maps or lazily loads the image file itself.
+    fd = open_parallel_reader(fd, pInfo->numWriteStreams());
+  }
+
+  // References into the page deduplication store are resolved first: the
+  // areas of an incremental image taken from its parent are never in it.
+  if (!pInfo->getDedupStoreDir().empty()) {
+    fd = open_dedup_resolver(fd, *pInfo);
+  }
+
+  if (!pInfo->getParentCkptFilename().empty()) {
+    fd = open_incremental_merger(dir, fd, *pInfo);
+  }
   return fd;
 }
 
+// An image written with DMTCP_DEDUP_DIR refers to chunks in the page
+// deduplication store.  A grandchild process replaces the references by the
+// chunks and feeds the complete image to mtcp_restart through a pipe.  If the
+// store was moved, DMTCP_DEDUP_DIR gives its new location.
+static int
+open_dedup_resolver(int fd, const ProcessInfo &pInfo)
+{
+  int fds[2];
+  pid_t cpid;
+  string storeDir = CkptDedup::storeDir();
+
+  if (storeDir.empty()) {
+    storeDir = pInfo.getDedupStoreDir();
+  }
+  JASSERT(jalib::Filesystem::FileExists(storeDir)) (storeDir)
+  .Text("Page deduplication store of the checkpoint image is missing");
+
+  JASSERT(pipe(fds) != -1) (JASSERT_ERRNO)
+  .Text("Cannot create pipe to read deduplicated ckpt file!");
+
+  cpid = fork();
+  JASSERT(cpid != -1)
+  .Text("ERROR: Cannot fork to read deduplicated ckpt file!");
+  if (cpid > 0) { /* parent process */
+    close(fd);
+    close(fds[1]);
+
+    // Wait for child process
+    JASSERT(waitpid(cpid, NULL, 0) == cpid);
+    return fds[0];
+  }
+
+  /* child process: fork a grandchild so that it never becomes a zombie. */
+  cpid = fork();
+  JASSERT(cpid != -1);
+  if (cpid > 0) {
+    _exit(0);
+  }
+
+  // Grandchild process
+  close(fds[0]);
+  CkptDedup::resolveStream(fd, fds[1], storeDir);
+  close(fds[1]);
+  close(fd);
+  _exit(0);
+}
+
+// An incremental image holds only the pages modified since its parent image.
+// A grandchild process merges it with the (recursively merged) stream of the
+// parent and feeds the complete image to mtcp_restart through a pipe.
+static int
+open_incremental_merger(const string &dir, int fd, const ProcessInfo &pInfo)
+{
+  int fds[2];
+  pid_t cpid;
+  string parentPath = pInfo.getParentCkptFilename();
+
+  if (parentPath[0] != '/') {
+    parentPath = dir + "/" + parentPath;
+  }
+
+  ProcessInfo parentInfo;
+  int parentFd = readCkptHeader(parentPath, &parentInfo);
+  JASSERT(parentInfo.upid() == pInfo.upid())
+    (parentPath) (parentInfo.upid()) (pInfo.upid())
+  .Text("Parent checkpoint image belongs to a different process");
+  JTRACE("Merging incremental checkpoint image") (parentPath);
+
+  JASSERT(pipe(fds) != -1) (JASSERT_ERRNO)
+  .Text("Cannot create pipe to merge incremental ckpt file!");
+
+  cpid = fork();
+  JASSERT(cpid != -1)
+  .Text("ERROR: Cannot fork to merge incremental ckpt file!");
+  if (cpid > 0) { /* parent process */
+    close(fd);
+    close(parentFd);
+    close(fds[1]);
+
+    // Wait for child process
+    JASSERT(waitpid(cpid, NULL, 0) == cpid);
+    return fds[0];
+  }
+
+  /* child process: fork a grandchild so that it never becomes a zombie. */
+  cpid = fork();
+  JASSERT(cpid != -1);
+  if (cpid > 0) {
+    _exit(0);
+  }
+
+  // Grandchild process
+  close(fds[0]);
+  CkptIncremental::mergeStream(fd, parentFd, fds[1]);
+  close(fds[1]);
+  close(parentFd);
+  close(fd);
+  _exit(0);
+}
+
+// The remainder of an image written with DMTCP_PARALLEL_COMPRESSION is
+// decompressed by a grandchild process and fed to mtcp_restart through a
+// pipe, in the same way as for gzip in open_ckpt_to_read() below.
+static int
+open_parallel_decompressor(int fd)
+{
+  int fds[2];
+  pid_t cpid;
+  int nthreads = CkptCompress::numThreads();
+
+  if (nthreads == 0) {
+    nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  }
+
+  JASSERT(pipe(fds) != -1) (JASSERT_ERRNO)
+  .Text("Cannot create pipe to decompress ckpt file!");
+
+  cpid = fork();
+  JASSERT(cpid != -1)
+  .Text("ERROR: Cannot fork to decompress ckpt file!");
+  if (cpid > 0) { /* parent process */
+    JTRACE("created child process to uncompress checkpoint file") (cpid);
+    close(fd);
+    close(fds[1]);
+
+    // Wait for child process
+    JASSERT(waitpid(cpid, NULL, 0) == cpid);
+    return fds[0];
+  }
+
+  /* child process: fork a grandchild so that it never becomes a zombie. */
+  cpid = fork();
+  JASSERT(cpid != -1);
+  if (cpid > 0) {
+    _exit(0);
+  }
+
+  // Grandchild process
+  close(fds[0]);
+  CkptCompress::decompressStream(fd, fds[1], nthreads);
+  close(fds[1]);
+  close(fd);
+  _exit(0);
+}
+
+// An image written with DMTCP_PARALLEL_WRITE is read back by a grandchild
+// process with as many threads, and fed to mtcp_restart through a pipe.
+static int
+open_parallel_reader(int fd, int nthreads)
+{
+  int fds[2];
+  pid_t cpid;
+
+  JASSERT(pipe(fds) != -1) (JASSERT_ERRNO)
+  .Text("Cannot create pipe to read ckpt file!");
+
+  cpid = fork();
+  JASSERT(cpid != -1)
+  .Text("ERROR: Cannot fork to read ckpt file!");
+  if (cpid > 0) { /* parent process */
+    close(fd);
+    close(fds[1]);
+
+    // Wait for child process
+    JASSERT(waitpid(cpid, NULL, 0) == cpid);
+    return fds[0];
+  }
+
+  /* child process: fork a grandchild so that it never becomes a zombie. */
+  cpid = fork();
+  JASSERT(cpid != -1);
+  if (cpid > 0) {
+    _exit(0);
+  }
+
+  // Grandchild process
+  close(fds[0]);
+  CkptIO::readStream(fd, fds[1], nthreads);
+  close(fds[1]);
+  close(fd);
+  _exit(0);
+}
+
+// Each process reads its own image only once the process tree has been
+// rebuilt up to it, and the images of a large computation would be read
+// one after another.  Instead, a grandchild process reads all of them into
+// the page cache at once, with a pool of threads taking whole images from
+// a shared queue, and reports the read bandwidth of each image.  Images
+// that do not fit into half of the available memory are left out: they
+// would only push the earlier ones out of the page cache before
+// mtcp_restart gets to them.
+#define PREFETCH_MAX_THREADS 16
+#define PREFETCH_BUF_SIZE    (1024 * 1024)
+
+struct PrefetchImage {
+  const char *path;
+  off_t bytes;
+  double seconds;
+  int error;
+};
+
+static PrefetchImage *prefetchImages;
+static size_t numPrefetchImages;
+static size_t nextPrefetchImage = 0;
+
+static size_t
+available_memory()
+{
+  size_t kbytes = 0;
+  char line[128];
+  FILE *fp = fopen("/proc/meminfo", "r");
+
+  while (fp != NULL && fgets(line, sizeof(line), fp) != NULL) {
+    if (sscanf(line, "MemAvailable: %zu kB", &kbytes) == 1) {
+      break;
+    }
+  }
+  if (fp != NULL) {
+    fclose(fp);
+  }
+  if (kbytes == 0) {  // Kernels before 3.14.
+    return (size_t)sysconf(_SC_AVPHYS_PAGES) * Util::pageSize();
+  }
+  return kbytes * 1024;
+}
+
+static void *
+prefetch_thread(void *arg)
+{
+  char *buf = (char *)arg;
+
+  while (1) {
+    size_t i = __sync_fetch_and_add(&nextPrefetchImage, 1);
+    if (i >= numPrefetchImages) {
+      break;
+    }
+
+    PrefetchImage *img = &prefetchImages[i];
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int fd = open(img->path, O_RDONLY);
+    if (fd == -1) {
+      img->error = errno;
+      continue;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    ssize_t rc;
+    while ((rc = read(fd, buf, PREFETCH_BUF_SIZE)) != 0) {
+      if (rc == -1 && errno != EINTR) {
+        img->error = errno;
+        break;
+      } else if (rc > 0) {
+        img->bytes += rc;
+      }
+    }
+    close(fd);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    img->seconds = (end.tv_sec - start.tv_sec) +
+                   (end.tv_nsec - start.tv_nsec) / 1e9;
+  }
+  return NULL;
+}
+
+static void
+prefetch_ckpt_images()
+{
+  const char *env = getenv(ENV_VAR_RESTART_PREFETCH_THREADS);
+  int nthreads;
+
+  if (env != NULL && env[0] != '\0') {
+    nthreads = atoi(env);
+  } else if (ckptImagePaths.size() > 1) {
+    nthreads = ckptImagePaths.size();
+  } else {
+    nthreads = 0;
+  }
+  if (nthreads <= 0) {
+    return;
+  }
+
+  pid_t cpid = fork();
+  JASSERT(cpid != -1)
+  .Text("ERROR: Cannot fork to prefetch ckpt files!");
+  if (cpid > 0) { /* parent process */
+    JASSERT(waitpid(cpid, NULL, 0) == cpid);
+    return;
+  }
+
+  /* child process: fork a grandchild so that it never becomes a zombie. */
+  cpid = fork();
+  JASSERT(cpid != -1);
+  if (cpid > 0) {
+    _exit(0);
+  }
+
+  // Grandchild process.  The streams of the images belong to mtcp_restart.
+  RestoreTargetMap::iterator it;
+  for (it = targets.begin(); it != targets.end(); it++) {
+    close(it->second->fd());
+  }
+
+  size_t budget = available_memory() / 2;
+  size_t total = 0;
+  prefetchImages = new PrefetchImage[ckptImagePaths.size()];
+  numPrefetchImages = 0;
+  for (size_t i = 0; i < ckptImagePaths.size(); i++) {
+    struct stat st;
+    const char *path = ckptImagePaths[i].c_str();
+    if (stat(path, &st) == -1 || !S_ISREG(st.st_mode)) {
+      continue;
+    }
+    if (total + st.st_size > budget) {
+      JNOTE("Not prefetching ckpt image: page cache is too small") (path)
+        (st.st_size) (budget);
+      continue;
+    }
+    total += st.st_size;
+    PrefetchImage *img = &prefetchImages[numPrefetchImages++];
+    memset(img, 0, sizeof(*img));
+    img->path = path;
+  }
+  if (numPrefetchImages == 0) {
+    _exit(0);
+  }
+
+  nthreads = MIN(nthreads, (int)numPrefetchImages);
+  nthreads = MIN(nthreads, PREFETCH_MAX_THREADS);
+  pthread_t threads[PREFETCH_MAX_THREADS];
+  char *bufs = new char[nthreads * PREFETCH_BUF_SIZE];
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < nthreads; i++) {
+    JASSERT(pthread_create(&threads[i], NULL, prefetch_thread,
+                           bufs + i * PREFETCH_BUF_SIZE) == 0);
+  }
+  for (int i = 0; i < nthreads; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  char rate[128];
+  for (size_t i = 0; i < numPrefetchImages; i++) {
+    PrefetchImage *img = &prefetchImages[i];
+    if (img->error != 0) {
+      JWARNING(false) (img->path) (strerror(img->error))
+      .Text("Failed to prefetch ckpt image");
+      continue;
+    }
+    snprintf(rate, sizeof(rate), "%.1f MB in %.2f s, %.1f MB/s",
+             img->bytes / 1e6, img->seconds,
+             img->bytes / 1e6 / MAX(img->seconds, 1e-6));
+    JNOTE("Prefetched ckpt image") (img->path) (rate);
+  }
+  double seconds = (end.tv_sec - start.tv_sec) +
+                   (end.tv_nsec - start.tv_nsec) / 1e9;
+  snprintf(rate, sizeof(rate), "%.1f MB in %.2f s, %.1f MB/s",
+           total / 1e6, seconds, total / 1e6 / MAX(seconds, 1e-6));
+  JNOTE("Prefetched all ckpt images") (numPrefetchImages) (nthreads) (rate);
+  _exit(0);
+}
+
+// --simulate reads an image through the same pipeline as a restart, but
+// parses the memory area records itself instead of mtcp_restart, and
+// discards their data.  When the stream is the image file itself, the
+// checksum of each record is also compared with the index of the image.
+static bool
+simulate_read(const string &path, CkptIndex::Reader *index)
+{
+  ProcessInfo pInfo;
+  int fd = readCkptHeader(path, &pInfo);
+  off_t offset = lseek(fd, 0, SEEK_CUR);
+  map<uint64_t, uint32_t> checksums;
+  string error;
+
+  if (offset != -1 && index != NULL) {
+    for (size_t i = 0; i < index->numAreas(); i++) {
+      checksums[index->area(i).offset] = index->area(i).checksum;
+    }
+  }
+
+  MtcpHeader mtcpHdr;
+  if (Util::readAll(fd, &mtcpHdr, sizeof(mtcpHdr)) != sizeof(mtcpHdr) ||
+      strncmp(mtcpHdr.signature, MTCP_SIGNATURE, MTCP_SIGNATURE_LEN) != 0) {
+    error = "no MTCP header";
+  }
+  offset = offset == -1 ? -1 : offset + sizeof(mtcpHdr);
+
+  MtcpAreaRecordBuf record;
+  MtcpAreaRecord *rec = &record.rec;
+  vector<char> buf(CKPT_INDEX_VERIFY_CHUNK);
+  size_t numAreas = 0;
+  size_t numChecked = 0;
+  uint64_t bytes = 0;
+  char msg[256];
+  while (error.empty()) {
+    if (Util::readAll(fd, rec, sizeof(*rec)) != sizeof(*rec)) {
+      error = "truncated image: no end of the memory areas";
+      break;
+    }
+    if (rec->magic != MTCP_AREA_MAGIC || rec->version != MTCP_AREA_VERSION ||
+        rec->recordLen < sizeof(*rec) || rec->recordLen > sizeof(record) ||
+        rec->numRuns > MTCP_AREA_MAX_RUNS || rec->nameLen >= FILENAMESIZE) {
+      snprintf(msg, sizeof(msg), "invalid memory area record after %zu areas",
+               numAreas);
+      error = msg;
+      break;
+    }
+    size_t rest = rec->recordLen - sizeof(*rec);
+    if (Util::readAll(fd, rec + 1, rest) != (ssize_t)rest) {
+      error = "truncated memory area record";
+      break;
+    }
+    if (rec->size == (uint64_t)-1) {
+      offset = offset == -1 ? -1 : offset + rec->recordLen;
+      break;
+    }
+
+    MtcpAreaRun *runs = mtcp_area_runs(rec);
+    uint64_t runsLen = 0;
+    uint64_t dataLen = 0;
+    for (size_t i = 0; i < rec->numRuns; i++) {
+      size_t len = MTCP_AREA_RUN_LEN(runs[i]);
+      int type = MTCP_AREA_RUN_TYPE(runs[i]);
+      runsLen += len;
+      if (type == MTCP_AREA_RUN_DATA) {
+        dataLen += len;
+      } else if (type == MTCP_AREA_RUN_DEDUP) {
+        dataLen += CKPT_DEDUP_REFS_SIZE(len);
+      } else if (type > MTCP_AREA_RUN_FILE) {
+        runsLen = (uint64_t)-1;
+        break;
+      }
+    }
+    const char *name = mtcp_area_name(rec);
+    if (rec->numRuns > 0 && runsLen != rec->size) {
+      snprintf(msg, sizeof(msg), "invalid runs in the memory area at 0x%llx"
+               " (%s)", (unsigned long long)rec->addr, name);
+      error = msg;
+      break;
+    }
+
+    uint32_t checksum = CkptIndex::crc32c(0, rec, rec->recordLen);
+    uint64_t done = 0;
+    while (done < dataLen) {
+      size_t n = MIN(dataLen - done, buf.size());
+      if (Util::readAll(fd, &buf[0], n) != (ssize_t)n) {
+        break;
+      }
+      checksum = CkptIndex::crc32c(checksum, &buf[0], n);
+      done += n;
+    }
+    if (done < dataLen) {
+      snprintf(msg, sizeof(msg), "truncated data of the memory area at 0x%llx"
+               " (%s)", (unsigned long long)rec->addr, name);
+      error = msg;
+      break;
+    }
+
+    map<uint64_t, uint32_t>::iterator it = checksums.find(offset);
+    if (it != checksums.end()) {
+      numChecked++;
+      if (it->second != checksum) {
+        snprintf(msg, sizeof(msg), "checksum mismatch in the memory area at"
+                 " 0x%llx (%s)", (unsigned long long)rec->addr, name);
+        error = msg;
+        break;
+      }
+    }
+    numAreas++;
+    bytes += rec->recordLen + dataLen;
+    offset = offset == -1 ? -1 : offset + rec->recordLen + dataLen;
+  }
+
+  if (error.empty()) {
+    char c;
+    if (offset != -1 ? offset != CkptIndex::dataEnd(fd)
+                     : Util::readAll(fd, &c, 1) != 0) {
+      error = "unexpected data after the end of the memory areas";
+    } else if (numChecked < checksums.size()) {
+      error = "memory areas of the index are missing from the image";
+    }
+  }
+  close(fd);
+
+  if (!error.empty()) {
+    printf("%s: DAMAGED: %s\n", path.c_str(), error.c_str());
+    return false;
+  }
+  printf("%s: OK: %zu areas, %.1f MB read%s\n", path.c_str(), numAreas,
+         bytes / 1e6, numChecked > 0 ? ", checksums match" : "");
+  return true;
+}
+
+// --verify checks an indexed image straight from the file, reading the
+// records of all areas concurrently; see CkptIndex::Reader::verifyAll().
+// Other images, and --simulate, are read with simulate_read().
+static bool
+verify_ckpt_image(const string &path, bool simulate)
+{
+  CkptIndex::Reader index;
+  bool indexed = index.open(path);
+
+  if (simulate || !indexed) {
+    if (!simulate) {
+      JNOTE("No index in ckpt image; reading it as a restart would") (path);
+    }
+    return simulate_read(path, indexed ? &index : NULL);
+  }
+
+  vector<size_t> corrupt;
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  uint64_t bytes = index.verifyAll(sysconf(_SC_NPROCESSORS_ONLN), &corrupt);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double seconds = (end.tv_sec - start.tv_sec) +
+                   (end.tv_nsec - start.tv_nsec) / 1e9;
+
+  for (size_t i = 0; i < corrupt.size(); i++) {
+    const CkptIndexEntry &e = index.area(corrupt[i]);
+    printf("%s: corrupt memory area %llx-%llx (%s)\n", path.c_str(),
+           (unsigned long long)e.addr, (unsigned long long)(e.addr + e.size),
+           index.areaName(corrupt[i]));
+  }
+  printf("%s: %s: %zu areas, %.1f MB in %.2f s, %.1f MB/s\n", path.c_str(),
+         corrupt.empty() ? "OK" : "DAMAGED", index.numAreas(), bytes / 1e6,
+         seconds, bytes / 1e6 / MAX(seconds, 1e-6));
+  return corrupt.empty();
+}
+
 static char
 first_char(const char *filename)
 {
@@ -690,6 +1353,253 @@ openCkptFileToRead(const string &path)
 
 // ************************ End of for reading checkpoint files *************
 
+// ************************ For live migration ******************************
+
+// Images received, in tmpDir; removed once the restore targets hold them.
+static vector<string> migrationSpoolFiles;
+static char migrationSpoolBuf[1024 * 1024];
+
+// A stalled sender must not hold up the others forever: the migration
+// sockets have a receive timeout, which Util::readAll() would retry.
+#define MIGRATE_RECV_TIMEOUT_SECONDS 60
+
+// Like Util::readAll(), but fails on the receive timeout.
+static ssize_t
+recv_all(int fd, void *buf, size_t count)
+{
+  size_t done = 0;
+
+  while (done < count) {
+    ssize_t rc = read(fd, (char *)buf + done, count - done);
+    if (rc == -1 && errno == EINTR) {
+      continue;
+    } else if (rc == -1) {
+      return -1;
+    } else if (rc == 0) {
+      break;
+    }
+    done += rc;
+  }
+  return done;
+}
+
+// Receives the image streamed on fd, after its tag, into tmpDir under the
+// name of the checkpoint image of its process followed by suffix: this is
+// how the final image of a process refers to its pre-copy image.  Returns
+// the path of the image, or "" if the stream broke, is not a checkpoint
+// image, or belongs to another computation than *compId (set by the first
+// image).
+static string
+spool_migration_image(int fd, const char *suffix, ProcessInfo *pInfo,
+                      UniquePid *compId)
+{
+  char tmpPath[PATH_MAX];
+  const size_t len = strlen(DMTCP_FILE_HEADER);
+  uint64_t bytes = 0;
+  ssize_t rc;
+
+  snprintf(tmpPath, sizeof(tmpPath), "%s/dmtcp_migrate.XXXXXX",
+           tmpDir.c_str());
+  int out = mkstemp(tmpPath);
+  JASSERT(out != -1) (tmpPath) (JASSERT_ERRNO);
+  while ((rc = recv_all(fd, migrationSpoolBuf,
+                        sizeof(migrationSpoolBuf))) > 0) {
+    JASSERT(Util::writeAll(out, migrationSpoolBuf, rc) == rc)
+      (tmpPath) (JASSERT_ERRNO);
+    bytes += rc;
+  }
+  close(fd);
+
+  char buf[len];
+  bool isImage = rc == 0 && pread(out, buf, len, 0) == (ssize_t)len &&
+                 memcmp(buf, DMTCP_FILE_HEADER, len) == 0;
+  if (isImage) {
+    JASSERT(lseek(out, len, SEEK_SET) == (off_t)len) (JASSERT_ERRNO);
+    jalib::JBinarySerializeReaderRaw rdr("", out);
+    pInfo->serialize(rdr);
+  }
+  close(out);
+
+  if (!isImage) {
+    JWARNING(false) (bytes)
+    .Text("Migration stream broken, or not a checkpoint image; ignored");
+    unlink(tmpPath);
+    return "";
+  }
+  if (*compId == UniquePid()) {
+    *compId = pInfo->compGroup();
+  } else if (pInfo->compGroup() != *compId) {
+    JWARNING(false) (pInfo->upid()) (pInfo->compGroup()) (*compId)
+    .Text("Migrated image of another computation; ignored");
+    unlink(tmpPath);
+    return "";
+  }
+
+  string path = tmpDir + "/" +
+                jalib::Filesystem::BaseName(pInfo->getCkptFilename()) + suffix;
+  JASSERT(rename(tmpPath, path.c_str()) == 0)
+    (tmpPath) (path) (JASSERT_ERRNO);
+  migrationSpoolFiles.push_back(path);
+  return path;
+}
+
+// Returns the cookie that the migration streams must begin with: that of
+// DMTCP_MIGRATE_COOKIE, or else a random one, which is printed.
+static string
+migration_cookie()
+{
+  const char *env = getenv(ENV_VAR_MIGRATE_COOKIE);
+
+  if (env != NULL && env[0] != '\0') {
+    JASSERT(strlen(env) <= DMTCP_MIGRATE_COOKIE_MAX) (ENV_VAR_MIGRATE_COOKIE)
+    .Text("Migration cookie too long");
+    return env;
+  }
+
+  unsigned char bytes[16];
+  char cookie[2 * sizeof(bytes) + 1];
+  int fd = open("/dev/urandom", O_RDONLY);
+  JASSERT(fd != -1 && Util::readAll(fd, bytes, sizeof(bytes)) ==
+          (ssize_t)sizeof(bytes)) (JASSERT_ERRNO);
+  close(fd);
+  for (size_t i = 0; i < sizeof(bytes); i++) {
+    sprintf(cookie + 2 * i, "%02x", bytes[i]);
+  }
+  printf("Migration cookie (give it to dmtcp_command in %s): %s\n",
+         ENV_VAR_MIGRATE_COOKIE, cookie);
+  fflush(stdout);
+  return cookie;
+}
+
+// Reads the cookie that a migration stream begins with, and compares it
+// with expected without returning early.
+static bool
+read_migration_cookie(int fd, const string &expected)
+{
+  char buf[DMTCP_MIGRATE_COOKIE_MAX + 1];
+  size_t len = expected.length() + 1;
+  unsigned char diff = 0;
+
+  if (recv_all(fd, buf, len) != (ssize_t)len) {
+    return false;
+  }
+  for (size_t i = 0; i < expected.length(); i++) {
+    diff |= buf[i] ^ expected[i];
+  }
+  return diff == 0 && buf[len - 1] == '\n';
+}
+
+// The workers of the migrated computation exit once their final images are
+// written.  Until the coordinator has seen all of them go, it would reject
+// the restarting processes.
+#define MIGRATE_COORD_WAIT_SECONDS 30
+
+static void
+wait_for_idle_coordinator()
+{
+  for (int i = 0; i < 10 * MIGRATE_COORD_WAIT_SECONDS; i++) {
+    int coordCmdStatus = CoordCmdStatus::NOERROR;
+    int numPeers = 0;
+    CoordinatorAPI::connectAndSendUserCommand('s', &coordCmdStatus,
+                                              &numPeers);
+    if (coordCmdStatus == CoordCmdStatus::ERROR_COORDINATOR_NOT_FOUND ||
+        (coordCmdStatus == CoordCmdStatus::NOERROR && numPeers == 0)) {
+      return;
+    }
+    usleep(100 * 1000);
+  }
+  JASSERT(false) (MIGRATE_COORD_WAIT_SECONDS) (tmpDir)
+  .Text("The coordinator still has processes of a computation; the"
+        " migrated images are left in the temporary directory");
+}
+
+/* Waits for the images of a live migration (dmtcp_command --migrate) on
+ * listenAddr, [HOST:]PORT, 127.0.0.1 by default.  A stream that does not
+ * begin with the cookie is dropped before anything is written to disk.
+ * All the images are received in tmpDir, and every final image is read
+ * back, merged with its pre-copy image, before any process is restarted:
+ * a migration that breaks off leaves the restart undone, and the images in
+ * tmpDir.  Returns once the restore targets of all the processes of the
+ * computation are set up.
+ */
+static void
+receive_migrated_processes(const string &listenAddr)
+{
+  size_t sep = listenAddr.rfind(':');
+  string host = sep == string::npos ? "127.0.0.1" : listenAddr.substr(0, sep);
+  int port = atoi(listenAddr.c_str() + (sep == string::npos ? 0 : sep + 1));
+  jalib::JServerSocket listener(jalib::JSockAddr(host.c_str()), port);
+  const string cookie = migration_cookie();
+  const size_t tagLen = strlen(DMTCP_MIGRATE_FINAL_TAG);
+  const struct timeval timeout = { MIGRATE_RECV_TIMEOUT_SECONDS, 0 };
+  map<UniquePid, string> finalImages;
+  UniquePid compId;
+  size_t numPeers = 0;
+
+  JASSERT(listener.isValid()) (listenAddr) (JASSERT_ERRNO)
+  .Text("Cannot listen for migrated processes");
+  JNOTE("Waiting for migrated processes") (host) (port);
+
+  while (numPeers == 0 || finalImages.size() < numPeers) {
+    int fd = listener.accept().sockfd();
+    JASSERT(fd != -1) (JASSERT_ERRNO);
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    if (!read_migration_cookie(fd, cookie)) {
+      JWARNING(false).Text("Migration stream without the cookie; ignored");
+      close(fd);
+      continue;
+    }
+
+    char tag[tagLen];
+    bool isPrecopy = false;
+    if (recv_all(fd, tag, tagLen) != (ssize_t)tagLen ||
+        (!(isPrecopy = memcmp(tag, DMTCP_MIGRATE_PRECOPY_TAG, tagLen) == 0) &&
+         memcmp(tag, DMTCP_MIGRATE_FINAL_TAG, tagLen) != 0)) {
+      JWARNING(false).Text("Not a migration stream; ignored");
+      close(fd);
+      continue;
+    }
+
+    ProcessInfo pInfo;
+    string path = spool_migration_image(fd, isPrecopy ?
+                                        DMTCP_MIGRATE_PRECOPY_SUFFIX : "",
+                                        &pInfo, &compId);
+    if (path.empty()) {
+      continue;
+    }
+    if (isPrecopy) {
+      JNOTE("Received pre-copy image") (pInfo.upid()) (pInfo.procname());
+      continue;
+    }
+    finalImages[pInfo.upid()] = path;
+    numPeers = pInfo.numPeers();
+    JNOTE("Received final image")
+      (pInfo.upid()) (pInfo.procname()) (finalImages.size()) (numPeers);
+  }
+  listener.close();
+
+  map<UniquePid, string>::iterator it;
+  for (it = finalImages.begin(); it != finalImages.end(); it++) {
+    JASSERT(simulate_read(it->second, NULL)) (it->second)
+    .Text("Incomplete migration image; no process was restarted");
+  }
+
+  wait_for_idle_coordinator();
+  for (it = finalImages.begin(); it != finalImages.end(); it++) {
+    RestoreTarget *t = new RestoreTarget(it->second,
+                                         jalib::Filesystem::GetCWD());
+    targets[t->upid()] = t;
+  }
+
+  // The restore targets hold the images open.
+  for (size_t i = 0; i < migrationSpoolFiles.size(); i++) {
+    unlink(migrationSpoolFiles[i].c_str());
+  }
+}
+
+// ************************ End of for live migration ***********************
+
 
 static void
 setEnvironFd()
@@ -745,12 +1655,18 @@ main(int argc, char **argv)
 {
   char *tmpdir_arg = NULL;
   char *ckptdir_arg = NULL;
+  const char *migrate_listen = NULL;
+  bool verify = false;
+  bool simulate = false;
 
   initializeJalib();
 
   if (!getenv(ENV_VAR_QUIET)) {
     setenv(ENV_VAR_QUIET, "0", 0);
   }
+#ifdef FAST_RST_VIA_MMAP
+  setenv(ENV_VAR_MMAP_RESTART, "1", 0);
+#endif // ifdef FAST_RST_VIA_MMAP
 
   if (getenv(ENV_VAR_DISABLE_STRICT_CHECKING)) {
     noStrictChecking = true;
@@ -768,7 +1684,7 @@ main(int argc, char **argv)
 
   // process args
   shift;
-  while (true) {
+  while (argc > 0 || migrate_listen == NULL) {
     string s = argc > 0 ? argv[0] : "--help";
     if (s == "--help" && argc == 1) {
       printf("%s", theUsage);
@@ -794,6 +1710,24 @@ main(int argc, char **argv)
     } else if (s == "--coord-logfile") {
       setenv(ENV_VAR_COORD_LOGFILE, argv[1], 1);
       shift; shift;
+    } else if (s == "--lazy-restart") {
+      setenv(ENV_VAR_LAZY_RESTART, "1", 1);
+      shift;
+    } else if (s == "--mmap-restart") {
+      setenv(ENV_VAR_MMAP_RESTART, "1", 1);
+      shift;
+    } else if (argc > 1 && s == "--prefetch-threads") {
+      setenv(ENV_VAR_RESTART_PREFETCH_THREADS, argv[1], 1);
+      shift; shift;
+    } else if (s == "--verify") {
+      verify = true;
+      shift;
+    } else if (s == "--simulate") {
+      simulate = true;
+      shift;
+    } else if (argc > 1 && s == "--migrate-listen") {
+      migrate_listen = argv[1];
+      shift; shift;
     } else if (argv[0][0] == '-' && argv[0][1] == 'i' &&
                isdigit(argv[0][2])) { // else if -i5, for example
       setenv(ENV_VAR_CKPT_INTR, argv[0] + 2, 1);
@@ -870,7 +1804,16 @@ main(int argc, char **argv)
 
   JTRACE("New dmtcp_restart process; _argc_ ckpt images") (argc);
 
+  if (migrate_listen != NULL) {
+    if (argc > 0 || verify || simulate) {
+      printf("Invalid Argument\n%s", theUsage);
+      return DMTCP_FAIL_RC;
+    }
+    receive_migrated_processes(migrate_listen);
+  }
+
   bool doAbort = false;
+  int numDamaged = 0;
   for (; argc > 0; shift) {
     string restorename(argv[0]);
     struct stat buf;
@@ -902,10 +1845,23 @@ main(int argc, char **argv)
       exit(DMTCP_FAIL_RC);
     }
 
+    if (verify || simulate) {
+      numDamaged += verify_ckpt_image(restorename, simulate) ? 0 : 1;
+      continue;
+    }
+
     JTRACE("Will restart ckpt image") (argv[0]);
     RestoreTarget *t = new RestoreTarget(argv[0]);
     targets[t->upid()] = t;
   }
+  if (verify || simulate) {
+    return numDamaged > 0 ? DMTCP_FAIL_RC : 0;
+  }
+
+  // The migrated images were just read back, and are already unlinked.
+  if (migrate_listen == NULL) {
+    prefetch_ckpt_images();
+  }
 
   // Prepare list of independent process tree roots
   RestoreTargetMap::iterator i;
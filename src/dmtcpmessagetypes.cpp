@@ -41,6 +41,10 @@ DmtcpMessage::DmtcpMessage(DmtcpMessageType t /*= DMT_NULL*/)
   , coordTimeStamp(0)
   , theCheckpointInterval(DMTCPMESSAGE_SAME_CKPT_INTERVAL)
   , exitAfterCkpt(0)
+  , ckptWritePending(0)
+  , ckptBytesWritten(0)
+  , ckptWriteStatus(0)
+  , migrateStage(DMT_MIGRATE_NONE)
 {
   // struct sockaddr_storage _addr;
   // socklen_t _addrlen;
@@ -131,6 +135,11 @@ dmtcp::operator<<(dmtcp::ostream &o, const DmtcpMessageType &s)
 
     OSHIFTPRINTF(DMT_OK)
 
+    OSHIFTPRINTF(DMT_CKPT_WRITER)
+    OSHIFTPRINTF(DMT_CKPT_WRITE_PROGRESS)
+    OSHIFTPRINTF(DMT_CKPT_WRITE_DONE)
+    OSHIFTPRINTF(DMT_BARRIER_RELAY)
+
   default:
     JASSERT(false) (s).Text("Invalid Message Type");
 
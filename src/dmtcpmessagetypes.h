@@ -77,6 +77,15 @@ enum DmtcpMessageType {
 
   DMT_OK,                    // slave telling coordinator it is done (response
                              // to DMT_DO_*)  this means slave reached barrier
+
+  DMT_CKPT_WRITER,           // on connect established by the process that
+                             // writes a forked checkpoint image
+  DMT_CKPT_WRITE_PROGRESS,   // ckpt writer -> coordinator: bytes written
+  DMT_CKPT_WRITE_DONE,       // ckpt writer -> coordinator: image complete
+  DMT_BARRIER_RELAY,         // on connect established with a barrier relay
+                             // or the coordinator by a process or a relay
+                             // whose global barriers go through the relay;
+                             // later, a relay -> upstream: number of members
 };
 
 namespace CoordCmdStatus
@@ -91,6 +100,16 @@ enum  ErrorCodes {
 
 ostream&operator<<(ostream &o, const DmtcpMessageType &s);
 
+// Rounds of a live migration (dmtcp_command --migrate), as sent with
+// DMT_DO_SUSPEND.  The pre-copy image is streamed by a forked writer while
+// the computation keeps running; the final image holds only the pages
+// modified since, and the processes exit once it is written.
+enum DmtcpMigrateStage {
+  DMT_MIGRATE_NONE = 0,
+  DMT_MIGRATE_PRECOPY,
+  DMT_MIGRATE_FINAL
+};
+
 #define DMTCPMESSAGE_NUM_PARAMS         2
 #define DMTCPMESSAGE_SAME_CKPT_INTERVAL (~0u) /* default value */
 
@@ -127,7 +146,16 @@ struct DmtcpMessage {
   uint32_t uniqueIdOffset;
 
   uint32_t exitAfterCkpt;
-  uint32_t padding;
+  uint32_t ckptWritePending;  // DMT_CKPT_FILENAME: image is still being
+                              // written by a forked writer
+
+  uint64_t ckptBytesWritten;  // DMT_CKPT_WRITE_{PROGRESS,DONE}
+  int32_t ckptWriteStatus;    // DMT_CKPT_WRITE_DONE: 0 or errno
+  uint32_t migrateStage;      // DMT_DO_SUSPEND: a DmtcpMigrateStage; the
+                              // extra data is the HOST:PORT to stream to
+                              // and the cookie, each NUL-terminated.
+                              // DMT_CKPT_FILENAME: DMT_MIGRATE_NONE if the
+                              // image went to the checkpoint directory
 
   DmtcpMessage(DmtcpMessageType t = DMT_NULL);
   void assertValid() const;
@@ -21,6 +21,7 @@
 
 #include <stdlib.h>
 
+#include "ckptserializer.h"
 #include "coordinatorapi.h"
 #include "dmtcp.h"
 #include "dmtcpworker.h"
@@ -125,6 +126,12 @@ dmtcp_get_local_status(int *nCheckpoints, int *nRestarts)
   return DMTCP_IS_PRESENT;
 }
 
+EXTERNC int
+dmtcp_is_ckpt_write_pending()
+{
+  return CkptSerializer::isAsyncWritePending();
+}
+
 EXTERNC int
 dmtcp_disable_ckpt()
 {
@@ -27,6 +27,7 @@
 #include "../jalib/jconvert.h"
 #include "../jalib/jfilesystem.h"
 #include "../jalib/jsocket.h"
+#include "ckptserializer.h"
 #include "coordinatorapi.h"
 #include "pluginmanager.h"
 #include "processinfo.h"
@@ -449,7 +450,8 @@ DmtcpWorker::waitForSuspendMessage()
   JTRACE("waiting for SUSPEND message");
 
   DmtcpMessage msg;
-  CoordinatorAPI::recvMsgFromCoordinator(&msg);
+  void *extraData = NULL;
+  CoordinatorAPI::recvMsgFromCoordinator(&msg, &extraData);
 
   if (exitInProgress()) {
     ThreadSync::destroyDmtcpWorkerLockUnlock();
@@ -471,6 +473,20 @@ DmtcpWorker::waitForSuspendMessage()
     (SharedData::getCompId()) (msg.compGroup);
 
   _exitAfterCkpt = msg.exitAfterCkpt;
+
+  // For a live migration, the extra data is where to stream the image to,
+  // and the cookie to send ahead of it, each NUL-terminated.
+  const char *target = (const char *)extraData;
+  const char *cookie = NULL;
+  if (target != NULL && msg.extraBytes > 0 &&
+      target[msg.extraBytes - 1] == '\0' &&
+      strlen(target) + 1 < msg.extraBytes) {
+    cookie = target + strlen(target) + 1;
+  }
+  CkptSerializer::setMigration(msg.migrateStage, target, cookie);
+  if (extraData != NULL) {
+    JALLOC_HELPER_FREE(extraData);
+  }
 }
 
 void
@@ -480,6 +496,10 @@ DmtcpWorker::acknowledgeSuspendMsg()
     return;
   }
 
+  // Joined before the coordinator hears from this process, so that the
+  // relay expects it from the first barrier on.
+  CoordinatorAPI::connectToBarrierRelay();
+
   JTRACE("Waiting for DMT_DO_CHECKPOINT message");
   CoordinatorAPI::sendMsgToCoordinator(DmtcpMessage(DMT_OK));
 
@@ -545,7 +565,8 @@ void
 DmtcpWorker::postCheckpoint()
 {
   WorkerState::setCurrentState(WorkerState::CHECKPOINTED);
-  CoordinatorAPI::sendCkptFilename();
+  CoordinatorAPI::sendCkptFilename(CkptSerializer::isAsyncCkpt(),
+                                   CkptSerializer::migrationStage());
 
   if (_exitAfterCkpt) {
     JTRACE("Asked to exit after checkpoint. Exiting!");
@@ -553,6 +574,7 @@ DmtcpWorker::postCheckpoint()
   }
 
   PluginManager::processResumeBarriers();
+  CoordinatorAPI::disconnectFromBarrierRelay();
 #ifdef TIMING
   PluginManager::logCkptResumeBarrierOverhead();
 #endif
@@ -569,6 +591,7 @@ DmtcpWorker::postRestart(double ckptReadTime)
   WorkerState::setCurrentState(WorkerState::RESTARTING);
 
   PluginManager::processRestartBarriers();
+  CoordinatorAPI::disconnectFromBarrierRelay();
 #ifdef TIMING
   PluginManager::logRestartBarrierOverhead(ckptReadTime);
 #endif
@@ -23,69 +23,182 @@
 #include "../jalib/jassert.h"
 #include "../jalib/jsocket.h"
 
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define MIN_TABLE_SLOTS  16
+
 using namespace dmtcp;
 
+// FNV-1a; the keys are mostly a few ints.
+static uint64_t
+hashKey(const void *key, size_t len)
+{
+  const unsigned char *p = (const unsigned char *)key;
+  uint64_t hash = 14695981039346656037ULL;
+
+  for (size_t i = 0; i < len; i++) {
+    hash ^= p[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+static bool
+keyEquals(KeyValue *kv, const void *key, size_t keyLen, uint64_t hash)
+{
+  return kv->hash == hash && kv->keyLen == keyLen &&
+         memcmp(kv->key(), key, keyLen) == 0;
+}
+
+void *
+KeyValueArena::allocate(size_t len)
+{
+  len = (len + 7) & ~(size_t)7;
+  if (len > _left) {
+    size_t chunkSize = len > ARENA_CHUNK_SIZE ? len : ARENA_CHUNK_SIZE;
+    _next = (char *)JALLOC_HELPER_MALLOC(chunkSize);
+    _left = chunkSize;
+    _chunks.push_back(_next);
+  }
+  void *p = _next;
+  _next += len;
+  _left -= len;
+  return p;
+}
+
 void
-LookupService::reset()
+KeyValueArena::reset()
+{
+  for (size_t i = 0; i < _chunks.size(); i++) {
+    JALLOC_HELPER_FREE(_chunks[i]);
+  }
+  _chunks.clear();
+  _next = NULL;
+  _left = 0;
+}
+
+KeyValue *
+KeyValueTable::find(const void *key, size_t keyLen, uint64_t hash)
 {
-  MapIterator i;
-
-  for (i = _maps.begin(); i != _maps.end(); i++) {
-    KeyValueMap &kvmap = i->second;
-    KeyValueMap::iterator it;
-    for (it = kvmap.begin(); it != kvmap.end(); it++) {
-      KeyValue *k = (KeyValue *)&(it->first);
-      KeyValue *v = it->second;
-      k->destroy();
-      v->destroy();
-      delete v;
+  if (_slots.empty()) {
+    return NULL;
+  }
+  size_t mask = _slots.size() - 1;
+  for (size_t i = hash & mask; _slots[i] != 0; i = (i + 1) & mask) {
+    KeyValue *kv = _entries[_slots[i] - 1];
+    if (keyEquals(kv, key, keyLen, hash)) {
+      return kv;
     }
-    kvmap.clear();
   }
-  _maps.clear();
-  _lastUniqueIds.clear();
-  _offsets.clear();
+  return NULL;
 }
 
 void
-LookupService::addKeyValue(string id,
-                           const void *key,
+KeyValueTable::insert(KeyValue *kv)
+{
+  // At most half full.
+  if ((_entries.size() + 1) * 2 > _slots.size()) {
+    grow();
+  }
+  size_t mask = _slots.size() - 1;
+  size_t i = kv->hash & mask;
+  for (; _slots[i] != 0; i = (i + 1) & mask) {
+    uint32_t &index = _slots[i];
+    if (keyEquals(_entries[index - 1], kv->key(), kv->keyLen, kv->hash)) {
+      JTRACE("Duplicate key");
+      _entries[index - 1] = kv;
+      return;
+    }
+  }
+  _entries.push_back(kv);
+  _slots[i] = _entries.size();
+}
+
+void
+KeyValueTable::grow()
+{
+  size_t numSlots = _slots.empty() ? MIN_TABLE_SLOTS : _slots.size() * 2;
+
+  _slots.assign(numSlots, 0);
+  size_t mask = numSlots - 1;
+  for (size_t e = 0; e < _entries.size(); e++) {
+    size_t i = _entries[e]->hash & mask;
+    while (_slots[i] != 0) {
+      i = (i + 1) & mask;
+    }
+    _slots[i] = e + 1;
+  }
+}
+
+void
+LookupService::reset()
+{
+  _tables.clear();
+  _lastTable = NULL;
+  _lastNsid[0] = '\0';
+  _arena.reset();
+}
+
+KeyValueTable &
+LookupService::table(const char *id)
+{
+  const size_t maxLen = sizeof(_lastNsid) - 1;
+
+  if (_lastTable == NULL || strncmp(_lastNsid, id, maxLen) != 0) {
+    strncpy(_lastNsid, id, maxLen);
+    _lastNsid[maxLen] = '\0';
+    _lastTable = &_tables[_lastNsid];
+  }
+  return *_lastTable;
+}
+
+KeyValue *
+LookupService::newKeyValue(const void *key,
                            size_t keyLen,
+                           uint64_t hash,
                            const void *val,
                            size_t valLen)
 {
-  KeyValueMap &kvmap = _maps[id];
+  KeyValue *kv =
+    (KeyValue *)_arena.allocate(sizeof(KeyValue) + keyLen + valLen);
 
-  KeyValue k(key, keyLen);
-  KeyValue *v = new KeyValue(val, valLen);
+  kv->hash = hash;
+  kv->keyLen = keyLen;
+  kv->valLen = valLen;
+  memcpy(kv->key(), key, keyLen);
+  memcpy(kv->val(), val, valLen);
+  return kv;
+}
 
-  if (kvmap.find(k) != kvmap.end()) {
-    JTRACE("Duplicate key");
-  }
-  kvmap[k] = v;
+void
+LookupService::addKeyValue(const char *id,
+                           const void *key,
+                           size_t keyLen,
+                           const void *val,
+                           size_t valLen)
+{
+  uint64_t hash = hashKey(key, keyLen);
+
+  table(id).insert(newKeyValue(key, keyLen, hash, val, valLen));
 }
 
 void
-LookupService::query(string id,
+LookupService::query(const char *id,
                      const void *key,
                      size_t keyLen,
                      void **val,
                      size_t *valLen)
 {
-  KeyValueMap &kvmap = _maps[id];
-  KeyValue k(key, keyLen);
+  KeyValue *kv = table(id).find(key, keyLen, hashKey(key, keyLen));
 
-  if (kvmap.find(k) == kvmap.end()) {
+  if (kv == NULL) {
     JTRACE("Lookup Failed, Key not found.");
     *val = NULL;
     *valLen = 0;
     return;
   }
 
-  KeyValue *v = kvmap[k];
-  *valLen = v->len();
-  *val = new char[v->len()];
-  memcpy(*val, v->data(), *valLen);
+  *val = kv->val();
+  *valLen = kv->valLen;
 }
 
 void
@@ -101,106 +214,120 @@ LookupService::registerData(const DmtcpMessage &msg, const void *data)
   addKeyValue(msg.nsid, key, keyLen, val, valLen);
 }
 
+// Writes the reply and its value with one write.
+void
+LookupService::sendReply(jalib::JSocket &remote,
+                         const DmtcpMessage &reply,
+                         const void *val)
+{
+  _replyBuf.resize(sizeof(reply) + reply.extraBytes);
+  memcpy(&_replyBuf[0], &reply, sizeof(reply));
+  if (reply.extraBytes > 0) {
+    memcpy(&_replyBuf[sizeof(reply)], val, reply.extraBytes);
+  }
+  remote.writeAll(&_replyBuf[0], _replyBuf.size());
+}
+
 void
 LookupService::respondToQuery(jalib::JSocket &remote,
                               const DmtcpMessage &msg,
                               const void *key)
+{
+  DmtcpMessage reply;
+  const void *val = replyToQuery(msg, key, &reply);
+
+  sendReply(remote, reply, val);
+}
+
+const void *
+LookupService::replyToQuery(const DmtcpMessage &msg,
+                            const void *key,
+                            DmtcpMessage *reply)
 {
   JASSERT(msg.keyLen > 0 && msg.keyLen == msg.extraBytes)
     (msg.keyLen) (msg.extraBytes);
   void *val = NULL;
   size_t valLen = 0;
-  DmtcpMessage reply;
 
   if (msg.type == DMT_NAME_SERVICE_GET_UNIQUE_ID) {
-    reply.type = DMT_NAME_SERVICE_GET_UNIQUE_ID_RESPONSE;
+    reply->type = DMT_NAME_SERVICE_GET_UNIQUE_ID_RESPONSE;
     getUniqueId(msg.nsid, key, msg.keyLen, &val,
                 msg.uniqueIdOffset, msg.valLen);
     valLen = msg.valLen;
   } else {
-    reply.type = DMT_NAME_SERVICE_QUERY_RESPONSE;
+    reply->type = DMT_NAME_SERVICE_QUERY_RESPONSE;
     query(msg.nsid, key, msg.keyLen, &val, &valLen);
   }
 
-  reply.keyLen = 0;
-  reply.valLen = valLen;
-  reply.extraBytes = reply.valLen;
-
-  remote << reply;
-  if (valLen > 0) {
-    remote.writeAll((char *)val, valLen);
-  }
-  delete[] (char *)val;
+  reply->keyLen = 0;
+  reply->valLen = valLen;
+  reply->extraBytes = valLen;
+  return val;
 }
 
 void
 LookupService::getUniqueId(const char *id,    // DB name
                            const void *key,   // Key: can be hostid, pid, etc.
                            size_t key_len,    // Length of the key
-                           void **val,        // Result
+                           void **val,        // Result, in the arena
                            uint32_t offset,   // Difference in two unique ids
                            size_t val_len)    // Expected value length
 {
-  KeyValueMap &kvmap = _maps[id];
-  KeyValue k(key, key_len);
+  KeyValueTable &kvtable = table(id);
+  uint64_t hash = hashKey(key, key_len);
+  KeyValue *kv = kvtable.find(key, key_len, hash);
 
   // if key does not exist in the key-value map, add it
-  if (kvmap.find(k) == kvmap.end()) {
-    if (_lastUniqueIds.find(id) == _lastUniqueIds.end()) {
-      _lastUniqueIds[id] = 1;
-      _offsets[id] = offset;
+  if (kv == NULL) {
+    if (kvtable.lastUniqueId == 0) {
+      kvtable.lastUniqueId = 1;
+      kvtable.uniqueIdOffset = offset;
     }
     JTRACE("Assigning a new unique id to client request")
-       (id) (_lastUniqueIds[id]);
-    KeyValue *v = new KeyValue(&_lastUniqueIds[id], val_len);
-    _lastUniqueIds[id] += _offsets[id];
-    kvmap[k] = v;
+      (id) (kvtable.lastUniqueId);
+    JASSERT(val_len <= sizeof(kvtable.lastUniqueId)) (val_len);
+    kv = newKeyValue(key, key_len, hash, &kvtable.lastUniqueId, val_len);
+    kvtable.lastUniqueId += kvtable.uniqueIdOffset;
+    kvtable.insert(kv);
   }
 
-  KeyValue *v = kvmap[k];
-  JASSERT(v->len() == val_len);
-  *val = new char[v->len()];
-  memcpy(*val, v->data(), val_len);
+  JASSERT(kv->valLen == val_len);
+  *val = kv->val();
 }
 
-void
-LookupService::sendAllMappings(jalib::JSocket &remote,
-                               const DmtcpMessage &msg)
+const void *
+LookupService::replyWithAllMappings(const DmtcpMessage &msg,
+                                    DmtcpMessage *reply)
 {
-  void *val = NULL;
+  KeyValueTable &kvtable = table(msg.nsid);
   size_t valLen = 0;
-  ostringstream o;
 
-  DmtcpMessage reply(DMT_NAME_SERVICE_QUERY_ALL_RESPONSE);
-
-  map<KeyValue, KeyValue *>::iterator i;
-  KeyValueMap &kvmap = _maps[msg.nsid];
-
-  for (i = kvmap.begin(); i != kvmap.end(); i++) {
-    KeyValue *k = (KeyValue *)&(i->first);
-    KeyValue *v = i->second;
-    size_t len;
-
-    // insert the key length and key
-    len = k->len();
-    o.write((const char*)(&len), sizeof(len));
-    o.write((const char*)k->data(), len);
-    // insert the value length and value
-    len = v->len();
-    o.write((const char*)(&len), sizeof(len));
-    o.write((const char*)v->data(), len);
+  for (size_t i = 0; i < kvtable.size(); i++) {
+    KeyValue *kv = kvtable.entry(i);
+    valLen += 2 * sizeof(size_t) + kv->keyLen + kv->valLen;
   }
 
-  reply.keyLen = 0;
-  valLen = o.tellp();
-  reply.valLen = valLen;
-  reply.extraBytes = reply.valLen;
-  val = new char[reply.extraBytes];
-  memcpy(val, o.str().c_str(), reply.extraBytes);
+  reply->type = DMT_NAME_SERVICE_QUERY_ALL_RESPONSE;
+  reply->keyLen = 0;
+  reply->valLen = valLen;
+  reply->extraBytes = valLen;
+  if (valLen == 0) {
+    return NULL;
+  }
+  _replyBuf.resize(valLen);
 
-  remote << reply;
-  if (valLen > 0) {
-    remote.writeAll((char *)val, valLen);
+  // Key length and key, then value length and value, for each entry.
+  char *p = &_replyBuf[0];
+  for (size_t i = 0; i < kvtable.size(); i++) {
+    KeyValue *kv = kvtable.entry(i);
+    size_t len = kv->keyLen;
+    memcpy(p, &len, sizeof(len));
+    memcpy(p + sizeof(len), kv->key(), len);
+    p += sizeof(len) + len;
+    len = kv->valLen;
+    memcpy(p, &len, sizeof(len));
+    memcpy(p + sizeof(len), kv->val(), len);
+    p += sizeof(len) + len;
   }
-  delete[] (char *)val;
+  return &_replyBuf[0];
 }
@@ -24,60 +24,72 @@
 
 #include <string.h>
 #include <map>
+#include <vector>
 #include "../jalib/jsocket.h"
 #include "dmtcpmessagetypes.h"
 
 namespace dmtcp
 {
-class KeyValue
+// Bump allocator for the keys and values of the name service.  Nothing is
+// freed on its own; reset() drops everything at once.
+class KeyValueArena
 {
   public:
-    KeyValue(const void *data, const size_t len)
-    {
-      _data = JALLOC_HELPER_MALLOC(len);
-      _len = len;
-      memcpy(_data, data, len);
-    }
-
-    ~KeyValue() {}
-
-    void destroy()
-    {
-      JASSERT(_data != NULL);
-      JALLOC_HELPER_FREE(_data);
-    }
-
-    void *data() { return _data; }
-
-    size_t len() { return _len; }
-
-    bool operator<(const KeyValue &that) const
-    {
-      if (_len == that._len) {
-        return memcmp(_data, that._data, _len) < 0;
-      }
-      return _len < that._len;
-    }
-
-    bool operator==(const KeyValue &that) const
-    {
-      return _len == that._len && memcmp(_data, that._data, _len) == 0;
-    }
-
-    bool operator!=(const KeyValue &that) const
-    {
-      return !operator==(that);
-    }
+    KeyValueArena() : _chunks(), _next(NULL), _left(0) {}
+
+    ~KeyValueArena() { reset(); }
+
+    void *allocate(size_t len);
+    void reset();
+
+  private:
+    vector<char *>_chunks;
+    char *_next;
+    size_t _left;
+};
+
+// A key and its value, back to back in the arena.
+struct KeyValue {
+  uint64_t hash;
+  uint32_t keyLen;
+  uint32_t valLen;
+
+  char *key() { return (char *)(this + 1); }
+
+  char *val() { return key() + keyLen; }
+};
+
+// One namespace: an open-addressing hash table (linear probing) of the
+// entries, which are kept in the order they were first inserted.
+class KeyValueTable
+{
+  public:
+    KeyValueTable()
+      : lastUniqueId(0), uniqueIdOffset(0), _slots(), _entries() {}
+
+    KeyValue *find(const void *key, size_t keyLen, uint64_t hash);
+    void insert(KeyValue *kv);
+
+    size_t size() { return _entries.size(); }
+
+    KeyValue *entry(size_t i) { return _entries[i]; }
+
+    // For getUniqueId(); lastUniqueId is 0 until the first id is handed out.
+    uint64_t lastUniqueId;
+    uint64_t uniqueIdOffset;
 
   private:
-    void *_data;
-    size_t _len;
+    void grow();
+
+    // Index + 1 into _entries; 0 for an empty slot.
+    vector<uint32_t>_slots;
+    vector<KeyValue *>_entries;
 };
 
 class LookupService
 {
   public:
-    LookupService() {}
+    LookupService() : _lastTable(NULL) { _lastNsid[0] = '\0'; }
 
     ~LookupService() { reset(); }
 
@@ -86,34 +98,60 @@ class LookupService
     void respondToQuery(jalib::JSocket &remote,
                         const DmtcpMessage &msg,
                         const void *data);
+
+    // These fill in *reply and return its extra data, reply->extraBytes
+    // long; it is valid until the next call or reset().
+    const void *replyToQuery(const DmtcpMessage &msg,
+                             const void *data,
+                             DmtcpMessage *reply);
+    const void *replyWithAllMappings(const DmtcpMessage &msg,
+                                     DmtcpMessage *reply);
+
     void getUniqueId(const char *id,    // DB name
                      const void *key,   // Key: can be hostid, pid, etc.
                      size_t key_len,  // Length of the key
-                     void **val,        // Result
+                     void **val,        // Result, in the arena
                      uint32_t offset,   // Difference in two unique ids
                      size_t val_len); // Expected value length
 
-    void sendAllMappings(jalib::JSocket &remote,
-                         const DmtcpMessage &msg);
-
   private:
-    typedef map<KeyValue, KeyValue *>KeyValueMap;
-    typedef map<string, KeyValueMap>::iterator MapIterator;
-    void addKeyValue(string id,
+    // src/bench/lookups.cpp
+    friend class LookupServiceBench;
+
+    void addKeyValue(const char *id,
                      const void *key,
                      size_t keyLen,
                      const void *val,
                      size_t valLen);
-    void query(string id,
+
+    // Sets *val to the value in the arena, valid until the next reset(), or
+    // to NULL if there is none.
+    void query(const char *id,
                const void *key,
                size_t keyLen,
                void **val,
                size_t *valLen);
 
+    KeyValueTable &table(const char *id);
+    KeyValue *newKeyValue(const void *key,
+                          size_t keyLen,
+                          uint64_t hash,
+                          const void *val,
+                          size_t valLen);
+    void sendReply(jalib::JSocket &remote,
+                   const DmtcpMessage &reply,
+                   const void *val);
+
   private:
-    map<string, KeyValueMap>_maps;
-    map<string, uint64_t>_lastUniqueIds;
-    map<string, uint64_t>_offsets;
+    KeyValueArena _arena;
+    map<string, KeyValueTable>_tables;
+
+    // Queries come in bursts for one namespace.
+    KeyValueTable *_lastTable;
+    char _lastNsid[sizeof(((DmtcpMessage *)0)->nsid) + 1];
+
+    // Reused for the replies.
+    vector<char>_replyBuf;
 };
 }
 #endif // ifndef LOOKUP_SERVICE_H
@@ -37,8 +37,12 @@ typedef struct _ThreadTLSInfo {
   struct user_desc gdtentrytls[1];
 } ThreadTLSInfo;
 
-#define MTCP_SIGNATURE     "MTCP_HEADER_v2.2\n"
+#define MTCP_SIGNATURE     "MTCP_HEADER_v2.3\n"
 #define MTCP_SIGNATURE_LEN 32
+
+/* Bits of MtcpHeader.image_flags */
+#define MTCP_IMAGE_PAGE_ALIGNED 0x1  // The data of each area record starts
+                                     // at a page-aligned offset in the image.
 typedef union _MtcpHeader {
   struct {
     char signature[MTCP_SIGNATURE_LEN];
@@ -55,6 +59,7 @@ typedef union _MtcpHeader {
     int tls_pid_offset;
     int tls_tid_offset;
     MYINFO_GS_T myinfo_gs;
+    int image_flags;
   };
 
   char _padding[4096];
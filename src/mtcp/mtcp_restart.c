@@ -52,6 +52,7 @@
 #include <unistd.h>
 #include <unistd.h>
 
+#include "../ckptdedup.h"
 #include "../membarrier.h"
 #include "config.h"
 #include "mtcp_check_vdso.ic"
@@ -59,8 +60,29 @@
 #include "mtcp_sys.h"
 #include "mtcp_util.ic"
 #include "procmapsarea.h"
+#include "protectedfds.h"
 #include "tlsutil.h"
 
+/* Lazy restart needs userfaultfd with the non-cooperative events (Linux 4.11).
+ * pread64 takes a split offset on 32-bit targets, so keep it to 64-bit ones.
+ */
+#if (defined(__x86_64__) || defined(__aarch64__)) && \
+  defined(__NR_userfaultfd) && defined(__has_include)
+# if __has_include(<linux/userfaultfd.h>)
+#  include <linux/userfaultfd.h>
+#  include <poll.h>
+#  include <sys/ioctl.h>
+#  ifdef UFFD_FEATURE_EVENT_UNMAP
+#   define HAS_LAZY_RESTART
+#  endif
+# endif
+#endif
+
+/* fadvise64 also takes a split offset on 32-bit targets. */
+#if (defined(__x86_64__) || defined(__aarch64__)) && defined(__NR_fadvise64)
+# define HAS_READAHEAD
+#endif
+
 /* The use of NO_OPTIMIZE is deprecated and will be removed, since we
  * compile mtcp_restart.c with the -O0 flag already.
  */
@@ -71,9 +93,7 @@
 #endif /* ifdef __clang__ */
 
 void mtcp_check_vdso(char **environ);
-#ifdef FAST_RST_VIA_MMAP
-static void mmapfile(int fd, void *buf, size_t size, int prot, int flags);
-#endif
+static int mmapfile(int fd, void *buf, size_t size, int prot, int flags);
 
 #define BINARY_NAME     "mtcp_restart"
 #define BINARY_NAME_M32 "mtcp_restart-32"
@@ -87,6 +107,36 @@ static void mmapfile(int fd, void *buf, size_t size, int prot, int flags);
 typedef void (*fnptr_t)();
 #define STACKSIZE 4 * 1024 * 1024
 
+/* Lazy restart (dmtcp_restart --lazy-restart):  large anonymous areas are
+ * mapped empty and registered with a userfaultfd instead of being read.  For
+ * each data run we send a LazyRun to a page server that was forked off before
+ * the restore; it fills pages from the image as the application faults on
+ * them, and prefetches the rest in the background.
+ */
+typedef struct LazyRestoreInfo {
+  int uffd;    /* -1 if restoring eagerly */
+  int runsfd;  /* write end of the pipe to the page server */
+} LazyRestoreInfo;
+
+typedef struct LazyRun {
+  VA addr;
+  uint64_t len;
+  uint64_t offset;  /* offset of the data in the ckpt image */
+} LazyRun;
+
+#define LAZY_MIN_AREA_SIZE  (1024 * 1024)
+#define LAZY_FAULT_CHUNK    (64 * 1024)
+#define LAZY_PREFETCH_CHUNK (1024 * 1024)
+
+/* Readahead:  when the image is read straight from a file, we keep the kernel
+ * reading up to READAHEAD_WINDOW bytes ahead of us, so that the storage keeps
+ * streaming while we map and mprotect the areas.  The kernel caps a single
+ * POSIX_FADV_WILLNEED at the readahead window of the device, so the advice is
+ * given in steps of READAHEAD_STEP.
+ */
+#define READAHEAD_WINDOW (32 * 1024 * 1024)
+#define READAHEAD_STEP   (128 * 1024)
+
 // static long long tempstack[STACKSIZE];
 typedef struct RestoreInfo {
   int fd;
@@ -122,12 +172,20 @@ typedef struct RestoreInfo {
 #endif
   MYINFO_GS_T myinfo_gs;
   int mtcp_restart_pause;  // Used by env. var. DMTCP_RESTART_PAUSE0
+  LazyRestoreInfo lazy;
+  int mmap_image;  /* Map the data of anonymous areas from the image. */
+  off_t readahead_end;  /* -1 if not reading ahead */
 } RestoreInfo;
 static RestoreInfo rinfo;
 
 /* Internal routines */
-static void readmemoryareas(int fd);
-static int read_one_memory_area(int fd);
+static void readmemoryareas(RestoreInfo *rinfo);
+static int read_one_memory_area(RestoreInfo *rinfo);
+static int read_area_record(int fd, MtcpAreaRecordBuf *record, Area *area);
+static int file_is_unchanged(int fd, const MtcpAreaRecord *rec);
+static void readahead_start(RestoreInfo *rinfo);
+static void readahead_advance(RestoreInfo *rinfo);
+static void read_data_run(RestoreInfo *rinfo, void *addr, size_t len);
 #if 0
 static void adjust_for_smaller_file_size(Area *area, int fd);
 #endif /* if 0 */
@@ -144,6 +202,13 @@ void restore_libc(ThreadTLSInfo *tlsInfo,
                   int tls_tid_offset,
                   MYINFO_GS_T myinfo_gs);
 static void unmap_memory_areas_and_restore_vdso(RestoreInfo *rinfo);
+static void lazy_restart_setup(RestoreInfo *rinfo);
+#ifdef HAS_LAZY_RESTART
+static int lazy_map_area(int fd, LazyRestoreInfo *lazy, Area *area,
+                         MtcpAreaRun *runs, size_t numRuns);
+static void lazy_page_server(int uffd, int imagefd, int runsfd, int donefd,
+                             pid_t app);
+#endif
 
 
 #define MB                 1024 * 1024
@@ -206,6 +271,8 @@ main(int argc, char *argv[], char **environ)
   MtcpHeader mtcpHdr;
   int mtcp_sys_errno;
   int simulate = 0;
+  int lazy = 0;
+  int mmap_image = 0;
 
   if (argc == 1) {
     MTCP_PRINTF("***ERROR: This program should not be used directly.\n");
@@ -260,6 +327,12 @@ main(int argc, char *argv[], char **environ)
     } else if (mtcp_strcmp(argv[0], "--mtcp-restart-pause") == 0) {
       rinfo.mtcp_restart_pause = 1; /* true */
       shift;
+    } else if (mtcp_strcmp(argv[0], "--lazy") == 0) {
+      lazy = 1;
+      shift;
+    } else if (mtcp_strcmp(argv[0], "--mmap") == 0) {
+      mmap_image = 1;
+      shift;
     } else if (mtcp_strcmp(argv[0], "--simulate") == 0) {
       simulate = 1;
       shift;
@@ -334,6 +407,19 @@ main(int argc, char *argv[], char **environ)
   rinfo.tls_pid_offset = mtcpHdr.tls_pid_offset;
   rinfo.tls_tid_offset = mtcpHdr.tls_tid_offset;
   rinfo.myinfo_gs = mtcpHdr.myinfo_gs;
+  rinfo.lazy.uffd = -1;
+  rinfo.lazy.runsfd = -1;
+
+  /* The image can be mapped if the writer page-aligned the area data and we
+   * read it straight from the file.
+   */
+  rinfo.mmap_image = mmap_image &&
+                     (mtcpHdr.image_flags & MTCP_IMAGE_PAGE_ALIGNED) &&
+                     mtcp_sys_lseek(rinfo.fd, 0, SEEK_CUR) != -1;
+  if (lazy) {
+    lazy_restart_setup(&rinfo);
+  }
+  readahead_start(&rinfo);
 
   restore_brk(rinfo.saved_brk, rinfo.restore_addr,
               rinfo.restore_addr + rinfo.restore_size);
@@ -570,23 +656,30 @@ mtcp_simulateread(int fd, MtcpHeader *mtcpHdr)
   mtcp_printf("**** vdso: %p..%p\n", mtcpHdr->vdsoStart, mtcpHdr->vdsoEnd);
   mtcp_printf("**** vvar: %p..%p\n", mtcpHdr->vvarStart, mtcpHdr->vvarEnd);
 
+  MtcpAreaRecordBuf record;
   Area area;
   mtcp_printf("\n**** Listing ckpt image area:\n");
-  while (1) {
-    mtcp_readfile(fd, &area, sizeof area);
-    if (area.size == -1) {
-      break;
+  while (read_area_record(fd, &record, &area) != -1) {
+    MtcpAreaRun *runs = mtcp_area_runs(&record.rec);
+    size_t len = 0;
+    size_t i;
+
+    for (i = 0; i < record.rec.numRuns; i++) {
+      if (MTCP_AREA_RUN_TYPE(runs[i]) == MTCP_AREA_RUN_DATA) {
+        len += MTCP_AREA_RUN_LEN(runs[i]);
+      } else if (MTCP_AREA_RUN_TYPE(runs[i]) == MTCP_AREA_RUN_DEDUP) {
+        len += CKPT_DEDUP_REFS_SIZE(MTCP_AREA_RUN_LEN(runs[i]));
+      }
     }
-    if ((area.properties & DMTCP_ZERO_PAGE) == 0 &&
-        (area.properties & DMTCP_SKIP_WRITING_TEXT_SEGMENTS) == 0) {
-      void *addr = mtcp_sys_mmap(0, area.size, PROT_WRITE | PROT_READ,
+    if (len > 0) {
+      void *addr = mtcp_sys_mmap(0, len, PROT_WRITE | PROT_READ,
                                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
       if (addr == MAP_FAILED) {
         MTCP_PRINTF("***Error: mmap failed; errno: %d\n", mtcp_sys_errno);
         mtcp_abort();
       }
-      mtcp_readfile(fd, addr, area.size);
-      if (mtcp_sys_munmap(addr, area.size) == -1) {
+      mtcp_readfile(fd, addr, len);
+      if (mtcp_sys_munmap(addr, len) == -1) {
         MTCP_PRINTF("***Error: munmap failed; errno: %d\n", mtcp_sys_errno);
         mtcp_abort();
       }
@@ -672,10 +765,18 @@ restorememoryareas(RestoreInfo *rinfo_ptr)
 
   /* Restore memory areas */
   DPRINTF("restoring memory areas\n");
-  readmemoryareas(restore_info.fd);
+  readmemoryareas(&restore_info);
 
   /* Everything restored, close file and finish up */
 
+  if (restore_info.lazy.uffd != -1) {
+    /* From now on the page server holds the only reference to the
+     * userfaultfd; it exits (and unregisters the areas) once all pages are in.
+     */
+    mtcp_sys_close(restore_info.lazy.runsfd);
+    mtcp_sys_close(restore_info.lazy.uffd);
+  }
+
   DPRINTF("close cpfd %d\n", restore_info.fd);
   mtcp_sys_close(restore_info.fd);
   double readTime = 0.0;
@@ -936,10 +1037,10 @@ unmap_memory_areas_and_restore_vdso(RestoreInfo *rinfo)
  *
  **************************************************************************/
 static void
-readmemoryareas(int fd)
+readmemoryareas(RestoreInfo *rinfo)
 {
   while (1) {
-    if (read_one_memory_area(fd) == -1) {
+    if (read_one_memory_area(rinfo) == -1) {
       break; /* error */
     }
   }
@@ -953,22 +1054,197 @@ readmemoryareas(int fd)
 #endif /* if defined(__arm__) || defined(__aarch64__) */
 }
 
+/* Start reading ahead, unless the data is mapped or lazily loaded from the
+ * image instead, or the image does not come from a file.
+ */
+NO_OPTIMIZE
+static void
+readahead_start(RestoreInfo *rinfo)
+{
+  rinfo->readahead_end = -1;
+#ifdef HAS_READAHEAD
+  int mtcp_sys_errno;
+  off_t pos;
+
+  if (rinfo->mmap_image || rinfo->lazy.uffd != -1) {
+    return;
+  }
+  pos = mtcp_sys_lseek(rinfo->fd, 0, SEEK_CUR);
+  if (pos == -1 ||
+      mtcp_sys_fadvise64(rinfo->fd, 0, 0, POSIX_FADV_SEQUENTIAL) != 0) {
+    return;
+  }
+  rinfo->readahead_end = pos;
+  readahead_advance(rinfo);
+#endif /* ifdef HAS_READAHEAD */
+}
+
+/* Once we are past the first half of the window, slide it forward. */
+NO_OPTIMIZE
+static void
+readahead_advance(RestoreInfo *rinfo)
+{
+#ifdef HAS_READAHEAD
+  int mtcp_sys_errno;
+  off_t pos, end;
+
+  if (rinfo->readahead_end == -1) {
+    return;
+  }
+  pos = mtcp_sys_lseek(rinfo->fd, 0, SEEK_CUR);
+  if (rinfo->readahead_end - pos >= READAHEAD_WINDOW / 2) {
+    return;
+  }
+  end = pos + READAHEAD_WINDOW;
+  if (rinfo->readahead_end < pos) {
+    rinfo->readahead_end = pos;
+  }
+  while (rinfo->readahead_end < end) {
+    if (mtcp_sys_fadvise64(rinfo->fd, rinfo->readahead_end, READAHEAD_STEP,
+                           POSIX_FADV_WILLNEED) != 0) {
+      rinfo->readahead_end = -1;
+      return;
+    }
+    rinfo->readahead_end += READAHEAD_STEP;
+  }
+#endif /* ifdef HAS_READAHEAD */
+}
+
+/* Read the data of a run, in pieces of half the readahead window. */
+NO_OPTIMIZE
+static void
+read_data_run(RestoreInfo *rinfo, void *addr, size_t len)
+{
+  while (len > 0) {
+    size_t n = len;
+    if (rinfo->readahead_end != -1 && n > READAHEAD_WINDOW / 2) {
+      n = READAHEAD_WINDOW / 2;
+    }
+    mtcp_readfile(rinfo->fd, addr, n);
+    readahead_advance(rinfo);
+    addr = (char *)addr + n;
+    len -= n;
+  }
+}
+
+/* Read the next memory area record of the image, and the description of the
+ * area into *area.  Returns -1 at the end of the memory areas.
+ */
 NO_OPTIMIZE
 static int
-read_one_memory_area(int fd)
+read_area_record(int fd, MtcpAreaRecordBuf *record, Area *area)
 {
   int mtcp_sys_errno;
+  MtcpAreaRecord *rec = &record->rec;
+
+  mtcp_readfile(fd, rec, sizeof *rec);
+  if (rec->magic != MTCP_AREA_MAGIC || rec->version != MTCP_AREA_VERSION ||
+      rec->recordLen < sizeof *rec || rec->recordLen > sizeof *record ||
+      rec->numRuns > MTCP_AREA_MAX_RUNS || rec->nameLen >= FILENAMESIZE) {
+    MTCP_PRINTF("***Error: invalid memory area record in ckpt image.\n");
+    mtcp_abort();
+  }
+  if (rec->recordLen > sizeof *rec) {
+    mtcp_readfile(fd, rec + 1, rec->recordLen - sizeof *rec);
+  }
+  if (rec->size == (uint64_t)-1) {
+    return -1;
+  }
+
+  area->addr = (VA)rec->addr;
+  area->size = rec->size;
+  area->endAddr = area->addr + area->size;
+  area->offset = rec->offset;
+  area->prot = rec->prot;
+  area->flags = rec->flags;
+  area->devmajor = rec->devmajor;
+  area->devminor = rec->devminor;
+  area->inodenum = rec->inodenum;
+  area->properties = rec->properties;
+  mtcp_memcpy(area->name, mtcp_area_name(rec), rec->nameLen + 1);
+  return 0;
+}
+
+/* True if the file open on fd is the one whose stat() the record holds,
+ * with the same size and modification time: the unmodified pages of its
+ * FILE runs are then still those of the file.
+ */
+NO_OPTIMIZE
+static int
+file_is_unchanged(int fd, const MtcpAreaRecord *rec)
+{
+  int mtcp_sys_errno;
+  struct mtcp_stat st;
+
+  if (mtcp_sys_fstat(fd, &st) == -1) {
+    return 0;
+  }
+  return (uint64_t)st.st_dev == rec->fileDev &&
+         (uint64_t)st.st_ino == rec->fileInode &&
+         (uint64_t)st.st_size == rec->fileSize &&
+         (uint64_t)st.st_mtim.tv_sec == rec->fileMtimeSec &&
+         (uint64_t)st.st_mtim.tv_nsec == rec->fileMtimeNsec;
+}
+
+NO_OPTIMIZE
+static int
+read_one_memory_area(RestoreInfo *rinfo)
+{
+  int mtcp_sys_errno;
+  int fd = rinfo->fd;
+  LazyRestoreInfo *lazy = &rinfo->lazy;
+  int use_mmap;
   int imagefd;
   void *mmappedat;
   int try_skipping_existing_segment = 0;
+  MtcpAreaRecordBuf record;
+  MtcpAreaRun *runs;
+  size_t numRuns;
+  size_t dataSize = 0;
+  int allZero = 1;
+  int fromFile = 0;
+  size_t i;
 
   /* Read header of memory area into area; mtcp_readfile() will read header */
   Area area;
 
-  mtcp_readfile(fd, &area, sizeof area);
-  if (area.size == -1) {
+  if (read_area_record(fd, &record, &area) == -1) {
     return -1;
   }
+  readahead_advance(rinfo);
+
+  runs = mtcp_area_runs(&record.rec);
+  numRuns = record.rec.numRuns;
+  for (i = 0; i < numRuns; i++) {
+    switch (MTCP_AREA_RUN_TYPE(runs[i])) {
+    case MTCP_AREA_RUN_DATA:
+      dataSize += MTCP_AREA_RUN_LEN(runs[i]);
+      allZero = 0;
+      break;
+
+    case MTCP_AREA_RUN_ZERO:
+      break;
+
+    case MTCP_AREA_RUN_FILE:
+      fromFile = 1;
+      allZero = 0;
+      break;
+
+    case MTCP_AREA_RUN_PARENT:
+      MTCP_PRINTF("***Error: incremental checkpoint image; the pages at %p\n"
+                  "    are in its parent image.  Restart with dmtcp_restart.\n",
+                  area.addr);
+      mtcp_abort();
+
+    default:
+      MTCP_PRINTF("***Error: the pages at %p are in a page deduplication\n"
+                  "    store.  Restart with dmtcp_restart.\n", area.addr);
+      mtcp_abort();
+    }
+  }
+  if (numRuns == 0) {
+    allZero = 0;  /* Text segment, restored from its file. */
+  }
 
   if (area.name[0] && mtcp_strstr(area.name, "[heap]")
       && mtcp_sys_brk(NULL) != area.addr + area.size) {
@@ -987,7 +1263,7 @@ read_one_memory_area(int fd)
   /* Now mmap the data of the area into memory. */
 
   /* CASE MAPPED AS ZERO PAGE: */
-  if ((area.properties & DMTCP_ZERO_PAGE) != 0) {
+  if (allZero) {
     DPRINTF("restoring non-rwx anonymous area, %p bytes at %p\n",
             area.size, area.addr);
     mmappedat = mtcp_sys_mmap(area.addr, area.size,
@@ -1001,18 +1277,20 @@ read_one_memory_area(int fd)
     }
   }
 
-#ifdef FAST_RST_VIA_MMAP
-    /* CASE MAP_ANONYMOUS with FAST_RST enabled
-     * We only want to do this in the MAP_ANONYMOUS case, since we don't want
-     *   any writes to RAM to be reflected back into the underlying file.
-     * Note that in order to map from a file (ckpt image), we must turn off
-     *   anonymous (~MAP_ANONYMOUS).  It's okay, since the fd
-     *   should have been opened with read permission, only.
-     */
-    else if (area.flags & MAP_ANONYMOUS) {
-      mmapfile (fd, area.addr, area.size, area.prot,
-                area.flags & ~MAP_ANONYMOUS);
-    }
+
+#ifdef HAS_LAZY_RESTART
+  /* CASE LAZY RESTART:
+   * Large private anonymous areas are left empty; the page server fills them
+   * in on demand.  Anything lazy_map_area() declines is restored eagerly.
+   */
+  else if (lazy->uffd != -1 && (area.flags & MAP_ANONYMOUS) &&
+           area.name[0] != '/' && (area.prot & PROT_WRITE) &&
+           (area.properties & DMTCP_SKIP_WRITING_TEXT_SEGMENTS) == 0 &&
+           area.size >= LAZY_MIN_AREA_SIZE && dataSize > 0 &&
+           lazy_map_area(fd, lazy, &area, runs, numRuns) == 0) {
+    DPRINTF("lazily restoring anonymous area, %p bytes at %p\n",
+            area.size, area.addr);
+  }
 #endif
 
   /* CASE MAP_ANONYMOUS (usually implies MAP_PRIVATE):
@@ -1033,11 +1311,12 @@ read_one_memory_area(int fd)
       if (imagefd >= 0) {
         /* If the current file size is smaller than the original, we map the region
          * as private anonymous. Note that with this we lose the name of the region
-         * but most applications may not care.
+         * but most applications may not care.  (A partial last page is
+         * fine; only whole pages past the end of the file are not.)
          */
         off_t curr_size = mtcp_sys_lseek(imagefd, 0, SEEK_END);
         MTCP_ASSERT(curr_size != -1);
-        if (curr_size < area.offset + area.size) {
+        if (curr_size + MTCP_PAGE_SIZE <= area.offset + area.size) {
           mtcp_sys_close(imagefd);
           imagefd = -1;
           area.offset = 0;
@@ -1046,6 +1325,18 @@ read_one_memory_area(int fd)
         }
       }
     }
+    if (fromFile && imagefd < 0) {
+      MTCP_PRINTF("***Error: %s is missing or shorter than at checkpoint\n"
+                  "    time; its unmodified pages at %p are not in the image.\n",
+                  area.name, area.addr);
+      mtcp_abort();
+    }
+    if (fromFile && !file_is_unchanged(imagefd, &record.rec)) {
+      MTCP_PRINTF("***Error: %s has changed since checkpoint time;\n"
+                  "    its unmodified pages at %p are not in the image.\n",
+                  area.name, area.addr);
+      mtcp_abort();
+    }
 
     if (area.flags & MAP_ANONYMOUS) {
       DPRINTF("restoring anonymous area, %p  bytes at %p\n",
@@ -1102,14 +1393,40 @@ read_one_memory_area(int fd)
 
     if (try_skipping_existing_segment) {
       // This fails on teracluster.  Presumably extra symbols cause overflow.
-      mtcp_skipfile(fd, area.size);
+      if (dataSize > 0) {
+        mtcp_skipfile(fd, dataSize);
+      }
     } else if ((area.properties & DMTCP_SKIP_WRITING_TEXT_SEGMENTS) == 0) {
-      /* This mmapfile after prev. mmap is okay; use same args again.
-       *  Posix says prev. map will be munmapped.
+      /* With --mmap, the data runs of plain anonymous areas are mapped
+       * MAP_PRIVATE from the image instead of being read, where the image
+       * layout allows it.  The mmap() replaces that part of the area.
        */
-
-      /* ANALYZE THE CONDITION FOR DOING mmapfile MORE CAREFULLY. */
-      mtcp_readfile(fd, area.addr, area.size);
+      VA addr = area.addr;
+      use_mmap = rinfo->mmap_image && (area.flags & MAP_ANONYMOUS) &&
+                 area.name[0] == '\0';
+      for (i = 0; i < numRuns; i++) {
+        size_t len = MTCP_AREA_RUN_LEN(runs[i]);
+        if (MTCP_AREA_RUN_TYPE(runs[i]) == MTCP_AREA_RUN_DATA) {
+          if (!use_mmap ||
+              mmapfile(fd, addr, len, area.prot | PROT_WRITE,
+                       MAP_PRIVATE | MAP_FIXED) == -1) {
+            read_data_run(rinfo, addr, len);
+          }
+        } else if (MTCP_AREA_RUN_TYPE(runs[i]) == MTCP_AREA_RUN_FILE) {
+          /* Mapped from the file above. */
+        } else if (!(area.flags & MAP_ANONYMOUS)) {
+          /* Zero pages of an area that was mapped from its file. */
+          mmappedat = mtcp_sys_mmap(addr, len, area.prot | PROT_WRITE,
+                                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED,
+                                    -1, 0);
+          if (mmappedat != addr) {
+            MTCP_PRINTF("error %d mapping %p bytes at %p\n",
+                        mtcp_sys_errno, len, addr);
+            mtcp_abort();
+          }
+        }
+        addr += len;
+      }
       if (!(area.prot & PROT_WRITE)) {
         if (mtcp_sys_mprotect(area.addr, area.size, area.prot) < 0) {
           MTCP_PRINTF("error %d write-protecting %p bytes at %p\n",
@@ -1129,6 +1446,723 @@ read_one_memory_area(int fd)
   return 0;
 }
 
+/* Set up a lazy restart:  create the userfaultfd and fork the page server.
+ * The server is double-forked so that it is not a child of the restored
+ * process.  The restored process gets the read end of a pipe at
+ * PROTECTED_LAZY_RESTART_FD, which reads EOF once the server is done.
+ * On any failure, rinfo->lazy.uffd stays -1 and we restore eagerly.
+ */
+NO_OPTIMIZE
+static void
+lazy_restart_setup(RestoreInfo *rinfo)
+{
+  int mtcp_sys_errno;
+
+#ifdef HAS_LAZY_RESTART
+  struct uffdio_api api;
+  int runsPipe[2];
+  int donePipe[2];
+  int uffd;
+  int status = -1;
+  pid_t app = mtcp_sys_getpid();
+  pid_t pid;
+
+  if (mtcp_sys_lseek(rinfo->fd, 0, SEEK_CUR) == -1) {
+    MTCP_PRINTF("ckpt image is not seekable; restoring eagerly.\n");
+    return;
+  }
+  uffd = mtcp_sys_userfaultfd(O_CLOEXEC | O_NONBLOCK);
+  if (uffd == -1) {
+    MTCP_PRINTF("userfaultfd() failed (errno %d); restoring eagerly.\n"
+                "    (See also: sysctl vm.unprivileged_userfaultfd)\n",
+                mtcp_sys_errno);
+    return;
+  }
+  api.api = UFFD_API;
+  api.features = UFFD_FEATURE_EVENT_REMAP | UFFD_FEATURE_EVENT_REMOVE |
+                 UFFD_FEATURE_EVENT_UNMAP;
+  api.ioctls = 0;
+  if (mtcp_sys_ioctl(uffd, UFFDIO_API, &api) == -1) {
+    MTCP_PRINTF("UFFDIO_API failed (errno %d); restoring eagerly.\n",
+                mtcp_sys_errno);
+    mtcp_sys_close(uffd);
+    return;
+  }
+  if (mtcp_sys_pipe(runsPipe) == -1) {
+    mtcp_sys_close(uffd);
+    return;
+  }
+  if (mtcp_sys_pipe(donePipe) == -1) {
+    mtcp_sys_close(runsPipe[0]);
+    mtcp_sys_close(runsPipe[1]);
+    mtcp_sys_close(uffd);
+    return;
+  }
+
+  pid = mtcp_sys_fork();
+  if (pid == 0) {
+    pid = mtcp_sys_fork();
+    if (pid == 0) {
+      mtcp_sys_close(runsPipe[1]);
+      mtcp_sys_close(donePipe[0]);
+      lazy_page_server(uffd, rinfo->fd, runsPipe[0], donePipe[1], app);
+    }
+    mtcp_sys_exit(pid == -1);
+  }
+  if (pid != -1) {
+    mtcp_sys_wait4(pid, &status, 0, NULL);
+  }
+  mtcp_sys_close(runsPipe[0]);
+  mtcp_sys_close(donePipe[1]);
+  if (status != 0 ||
+      mtcp_sys_dup2(donePipe[0], PROTECTED_LAZY_RESTART_FD) !=
+      PROTECTED_LAZY_RESTART_FD) {
+    /* A server that did start sees EOF on an empty table and exits. */
+    MTCP_PRINTF("could not start the page server; restoring eagerly.\n");
+    mtcp_sys_close(runsPipe[1]);
+    mtcp_sys_close(donePipe[0]);
+    mtcp_sys_close(uffd);
+    return;
+  }
+  mtcp_sys_close(donePipe[0]);
+  rinfo->lazy.uffd = uffd;
+  rinfo->lazy.runsfd = runsPipe[1];
+#else // ifdef HAS_LAZY_RESTART
+  MTCP_PRINTF("lazy restart is not supported on this platform;"
+              " restoring eagerly.\n");
+#endif // ifdef HAS_LAZY_RESTART
+}
+
+#ifdef HAS_LAZY_RESTART
+
+/* Map an area empty, register it with the userfaultfd, and hand its data
+ * runs to the page server while skipping over the data in the image.
+ * Returns -1, without consuming any data, if the area cannot be registered.
+ */
+NO_OPTIMIZE
+static int
+lazy_map_area(int fd, LazyRestoreInfo *lazy, Area *area, MtcpAreaRun *runs,
+              size_t numRuns)
+{
+  int mtcp_sys_errno;
+  struct uffdio_register reg;
+  LazyRun run;
+  VA addr = area->addr;
+  off_t offset;
+  size_t i;
+
+  if (mtcp_sys_mmap(area->addr, area->size, area->prot,
+                    area->flags | MAP_FIXED, -1, 0) != area->addr) {
+    return -1;
+  }
+  reg.range.start = (uint64_t)(unsigned long)area->addr;
+  reg.range.len = area->size;
+  reg.mode = UFFDIO_REGISTER_MODE_MISSING;
+  reg.ioctls = 0;
+  if (mtcp_sys_ioctl(lazy->uffd, UFFDIO_REGISTER, &reg) == -1) {
+    DPRINTF("UFFDIO_REGISTER failed (errno %d) for %p bytes at %p\n",
+            mtcp_sys_errno, area->size, area->addr);
+    return -1;
+  }
+
+  offset = mtcp_sys_lseek(fd, 0, SEEK_CUR);
+  for (i = 0; i < numRuns; i++) {
+    size_t len = MTCP_AREA_RUN_LEN(runs[i]);
+    if (MTCP_AREA_RUN_TYPE(runs[i]) == MTCP_AREA_RUN_DATA) {
+      run.addr = addr;
+      run.len = len;
+      run.offset = offset;
+      if (mtcp_write_all(lazy->runsfd, &run, sizeof run) != sizeof run) {
+        MTCP_PRINTF("***Error: lost the lazy-restart page server.\n");
+        mtcp_abort();
+      }
+      offset += len;
+    }
+    addr += len;
+  }
+  if (mtcp_sys_lseek(fd, offset, SEEK_SET) != offset) {
+    MTCP_PRINTF("error %d seeking in ckpt image\n", mtcp_sys_errno);
+    mtcp_abort();
+  }
+  return 0;
+}
+
+/* The page server.  It runs in a copy of mtcp_restart (forked before the
+ * restore), so unlike the code above it may use globals and never runs from
+ * the relocated text.  Its state is a table of the data runs not yet loaded,
+ * sorted by address, with a byte per page recording which pages are in.
+ * A fault is served from the run covering it, in LAZY_FAULT_CHUNK pieces;
+ * pages outside every run are zero.  When idle, the server walks the table
+ * and loads the rest in LAZY_PREFETCH_CHUNK pieces.
+ */
+typedef struct LazyEntry {
+  VA addr;
+  size_t len;
+  off_t offset;
+  size_t page;  /* index of the entry's first page in LazyServer.loaded */
+} LazyEntry;
+
+typedef struct LazyServer {
+  int uffd;
+  int imagefd;
+  int runsfd;   /* -1 once the restoring process has sent every run */
+  pid_t app;
+  LazyEntry *entries;
+  size_t count;
+  size_t capacity;
+  char *loaded;
+  size_t loadedSize;
+  size_t totalPages;
+  size_t pending;  /* pages neither loaded nor dropped */
+  size_t cursor;   /* prefetch position: entries[cursor], page cursorPage */
+  size_t cursorPage;
+  VA *deferred;    /* faults to retry after the pending events are read */
+  size_t numDeferred;
+  size_t deferredCapacity;
+  char *buf;
+} LazyServer;
+
+static LazyServer lazysrv;
+
+NO_OPTIMIZE
+static void
+lazy_fatal(void)
+{
+  int mtcp_sys_errno;
+
+  /* Exiting would let the kernel zero-fill the missing pages. */
+  mtcp_sys_kill(lazysrv.app, SIGKILL);
+  mtcp_sys_exit(1);
+}
+
+NO_OPTIMIZE
+static void *
+lazy_grow(void *old, size_t oldSize, size_t newSize)
+{
+  int mtcp_sys_errno;
+  void *addr;
+
+  if (old == NULL) {
+    addr = mtcp_sys_mmap(NULL, newSize, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  } else {
+    addr = mtcp_sys_mremap(old, oldSize, newSize, MREMAP_MAYMOVE, NULL);
+  }
+  if (addr == MAP_FAILED) {
+    MTCP_PRINTF("***Error: page server out of memory: errno %d\n",
+                mtcp_sys_errno);
+    lazy_fatal();
+  }
+  return addr;
+}
+
+/* Index of the entry covering addr, or -1. */
+static ssize_t
+lazy_find(VA addr)
+{
+  ssize_t lo = 0;
+  ssize_t hi = (ssize_t)lazysrv.count - 1;
+
+  while (lo <= hi) {
+    ssize_t mid = lo + (hi - lo) / 2;
+    LazyEntry *e = &lazysrv.entries[mid];
+    if (addr < e->addr) {
+      hi = mid - 1;
+    } else if (addr >= e->addr + e->len) {
+      lo = mid + 1;
+    } else {
+      return mid;
+    }
+  }
+  return -1;
+}
+
+static void
+lazy_insert(LazyEntry *e)
+{
+  size_t i;
+
+  if (lazysrv.count == lazysrv.capacity) {
+    size_t capacity = lazysrv.capacity ? 2 * lazysrv.capacity : 4096;
+    lazysrv.entries = lazy_grow(lazysrv.entries,
+                                lazysrv.capacity * sizeof(LazyEntry),
+                                capacity * sizeof(LazyEntry));
+    lazysrv.capacity = capacity;
+  }
+  /* Runs arrive in address order, so this is normally an append. */
+  for (i = lazysrv.count; i > 0 && lazysrv.entries[i - 1].addr > e->addr;
+       i--) {
+    lazysrv.entries[i] = lazysrv.entries[i - 1];
+  }
+  lazysrv.entries[i] = *e;
+  lazysrv.count++;
+  if (i <= lazysrv.cursor) {
+    lazysrv.cursor = lazysrv.cursorPage = 0;
+  }
+}
+
+static void
+lazy_mark_loaded(LazyEntry *e, size_t first, size_t npages)
+{
+  size_t i;
+
+  for (i = first; i < first + npages; i++) {
+    if (!lazysrv.loaded[e->page + i]) {
+      lazysrv.loaded[e->page + i] = 1;
+      lazysrv.pending--;
+    }
+  }
+}
+
+/* Read more LazyRun records from the restoring process. */
+NO_OPTIMIZE
+static void
+lazy_read_runs(void)
+{
+  int mtcp_sys_errno;
+  LazyRun runs[128];
+  ssize_t rc;
+  size_t i;
+
+  rc = mtcp_sys_read(lazysrv.runsfd, runs, sizeof runs);
+  if (rc == -1 && (mtcp_sys_errno == EINTR || mtcp_sys_errno == EAGAIN)) {
+    return;
+  }
+  if (rc > 0 && rc % sizeof(LazyRun) != 0) {
+    size_t rest = sizeof(LazyRun) - rc % sizeof(LazyRun);
+    if (mtcp_read_all(lazysrv.runsfd, (char *)runs + rc, rest) != rest) {
+      rc = -1;
+    } else {
+      rc += rest;
+    }
+  }
+  if (rc <= 0) {
+    mtcp_sys_close(lazysrv.runsfd);
+    lazysrv.runsfd = -1;
+    return;
+  }
+
+  for (i = 0; i < rc / sizeof(LazyRun); i++) {
+    LazyEntry e;
+    size_t npages = runs[i].len / MTCP_PAGE_SIZE;
+    size_t needed = lazysrv.totalPages + npages;
+
+    if (needed > lazysrv.loadedSize) {
+      size_t size = lazysrv.loadedSize ? lazysrv.loadedSize : 64 * 1024;
+      while (size < needed) {
+        size *= 2;
+      }
+      lazysrv.loaded = lazy_grow(lazysrv.loaded, lazysrv.loadedSize, size);
+      lazysrv.loadedSize = size;
+    }
+    e.addr = runs[i].addr;
+    e.len = runs[i].len;
+    e.offset = runs[i].offset;
+    e.page = lazysrv.totalPages;
+    lazysrv.totalPages += npages;
+    lazysrv.pending += npages;
+    lazy_insert(&e);
+  }
+}
+
+/* Make sure no entry straddles addr. */
+static void
+lazy_split(VA addr)
+{
+  ssize_t i = lazy_find(addr);
+
+  if (i != -1 && lazysrv.entries[i].addr < addr) {
+    LazyEntry tail = lazysrv.entries[i];
+    size_t headLen = addr - tail.addr;
+
+    lazysrv.entries[i].len = headLen;
+    tail.addr += headLen;
+    tail.len -= headLen;
+    tail.offset += headLen;
+    tail.page += headLen / MTCP_PAGE_SIZE;
+    lazy_insert(&tail);
+  }
+}
+
+/* The application discarded or unmapped [start, end):  never load it. */
+static void
+lazy_drop(VA start, VA end)
+{
+  size_t i, j;
+
+  lazy_split(start);
+  lazy_split(end);
+  for (i = j = 0; i < lazysrv.count; i++) {
+    LazyEntry *e = &lazysrv.entries[i];
+    if (e->addr >= start && e->addr + e->len <= end) {
+      lazy_mark_loaded(e, 0, e->len / MTCP_PAGE_SIZE);
+    } else {
+      lazysrv.entries[j++] = *e;
+    }
+  }
+  if (j != lazysrv.count) {
+    lazysrv.count = j;
+    lazysrv.cursor = lazysrv.cursorPage = 0;
+  }
+}
+
+/* The application mremap()ed [from, from + len) to 'to'. */
+static void
+lazy_remap(VA from, VA to, size_t len)
+{
+  size_t i, j;
+
+  lazy_drop(to, to + len);
+  lazy_split(from);
+  lazy_split(from + len);
+  for (i = 0; i < lazysrv.count; i++) {
+    LazyEntry *e = &lazysrv.entries[i];
+    if (e->addr >= from && e->addr + e->len <= from + len) {
+      e->addr = to + (e->addr - from);
+    }
+  }
+  for (i = 1; i < lazysrv.count; i++) {
+    LazyEntry e = lazysrv.entries[i];
+    for (j = i; j > 0 && lazysrv.entries[j - 1].addr > e.addr; j--) {
+      lazysrv.entries[j] = lazysrv.entries[j - 1];
+    }
+    lazysrv.entries[j] = e;
+  }
+  lazysrv.cursor = lazysrv.cursorPage = 0;
+}
+
+/* Copy npages pages of entry e, starting at page first, into the
+ * application.  Returns -1 if the copy must wait until the pending events
+ * have been read.
+ */
+NO_OPTIMIZE
+static int
+lazy_copy(LazyEntry *e, size_t first, size_t npages)
+{
+  int mtcp_sys_errno;
+  struct uffdio_copy copy;
+  size_t len = npages * MTCP_PAGE_SIZE;
+  off_t offset = e->offset + first * MTCP_PAGE_SIZE;
+  size_t done = 0;
+  size_t copied;
+
+  while (done < len) {
+    ssize_t rc = mtcp_sys_pread(lazysrv.imagefd, lazysrv.buf + done,
+                                len - done, offset + done);
+    if (rc == -1 && mtcp_sys_errno == EINTR) {
+      continue;
+    }
+    if (rc <= 0) {
+      MTCP_PRINTF("***Error: reading ckpt image at offset %p: errno %d\n",
+                  (void *)(offset + done), mtcp_sys_errno);
+      lazy_fatal();
+    }
+    done += rc;
+  }
+
+  copy.dst = (uint64_t)(unsigned long)(e->addr + first * MTCP_PAGE_SIZE);
+  copy.src = (uint64_t)(unsigned long)lazysrv.buf;
+  copy.len = len;
+  copy.mode = 0;
+  copy.copy = 0;
+  if (mtcp_sys_ioctl(lazysrv.uffd, UFFDIO_COPY, &copy) == 0) {
+    lazy_mark_loaded(e, first, npages);
+    return 0;
+  }
+
+  copied = copy.copy > 0 ? copy.copy / MTCP_PAGE_SIZE : 0;
+  lazy_mark_loaded(e, first, copied);
+  switch (mtcp_sys_errno) {
+  case EAGAIN:
+    return -1;
+
+  case EEXIST:  /* Already present: skip that page. */
+    lazy_mark_loaded(e, first + copied, 1);
+    return 0;
+
+  case ENOENT:  /* Unmapped, and we have not seen the event yet. */
+    lazy_mark_loaded(e, first + copied, npages - copied);
+    return 0;
+
+  case ESRCH:   /* The application is gone. */
+    mtcp_sys_exit(0);
+
+  default:
+    MTCP_PRINTF("***Error: UFFDIO_COPY to %p failed: errno %d\n",
+                (void *)(unsigned long)copy.dst, mtcp_sys_errno);
+    lazy_fatal();
+  }
+  return 0;
+}
+
+/* Resolve a fault on a page that has no data to load. */
+NO_OPTIMIZE
+static int
+lazy_zero_page(VA addr)
+{
+  int mtcp_sys_errno;
+  struct uffdio_zeropage zero;
+  struct uffdio_range range;
+
+  zero.range.start = (uint64_t)(unsigned long)addr;
+  zero.range.len = MTCP_PAGE_SIZE;
+  zero.mode = 0;
+  if (mtcp_sys_ioctl(lazysrv.uffd, UFFDIO_ZEROPAGE, &zero) == -1) {
+    if (mtcp_sys_errno == EAGAIN) {
+      return -1;
+    } else if (mtcp_sys_errno == EEXIST) {
+      /* Loaded while the fault was queued; the faulting thread still waits. */
+      range = zero.range;
+      mtcp_sys_ioctl(lazysrv.uffd, UFFDIO_WAKE, &range);
+    } else if (mtcp_sys_errno == ESRCH) {
+      mtcp_sys_exit(0);
+    }
+  }
+  return 0;
+}
+
+/* Resolve a fault at addr.  Returns -1 if it must be retried. */
+NO_OPTIMIZE
+static int
+lazy_handle_fault(VA addr)
+{
+  const size_t chunkPages = LAZY_FAULT_CHUNK / MTCP_PAGE_SIZE;
+  LazyEntry *e;
+  ssize_t i;
+  size_t p, first, last;
+
+  addr = (VA)((unsigned long)addr & MTCP_PAGE_MASK);
+  while ((i = lazy_find(addr)) == -1 && lazysrv.runsfd != -1) {
+    lazy_read_runs();
+  }
+  if (i == -1) {
+    return lazy_zero_page(addr);
+  }
+  e = &lazysrv.entries[i];
+  p = (addr - e->addr) / MTCP_PAGE_SIZE;
+  if (lazysrv.loaded[e->page + p]) {
+    return lazy_zero_page(addr);
+  }
+
+  first = p - p % chunkPages;
+  last = first + chunkPages;
+  if (last > e->len / MTCP_PAGE_SIZE) {
+    last = e->len / MTCP_PAGE_SIZE;
+  }
+  while (!lazysrv.loaded[e->page + p]) {
+    size_t s = p;
+    size_t t = p + 1;
+    while (s > first && !lazysrv.loaded[e->page + s - 1]) {
+      s--;
+    }
+    while (t < last && !lazysrv.loaded[e->page + t]) {
+      t++;
+    }
+    if (lazy_copy(e, s, t - s) == -1) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static void
+lazy_defer_fault(VA addr)
+{
+  if (lazysrv.numDeferred == lazysrv.deferredCapacity) {
+    size_t capacity = lazysrv.deferredCapacity ?
+                      2 * lazysrv.deferredCapacity : 512;
+    lazysrv.deferred = lazy_grow(lazysrv.deferred,
+                                 lazysrv.deferredCapacity * sizeof(VA),
+                                 capacity * sizeof(VA));
+    lazysrv.deferredCapacity = capacity;
+  }
+  lazysrv.deferred[lazysrv.numDeferred++] = addr;
+}
+
+static void
+lazy_retry_deferred(void)
+{
+  size_t n = lazysrv.numDeferred;
+  size_t i, j;
+
+  for (i = j = 0; i < n; i++) {
+    if (lazy_handle_fault(lazysrv.deferred[i]) == -1) {
+      lazysrv.deferred[j++] = lazysrv.deferred[i];
+    }
+  }
+  lazysrv.numDeferred = j;
+}
+
+NO_OPTIMIZE
+static void
+lazy_read_events(void)
+{
+  int mtcp_sys_errno;
+  struct uffd_msg msgs[16];
+  ssize_t rc;
+  size_t i;
+
+  rc = mtcp_sys_read(lazysrv.uffd, msgs, sizeof msgs);
+  if (rc == -1) {
+    if (mtcp_sys_errno != EAGAIN && mtcp_sys_errno != EINTR) {
+      MTCP_PRINTF("***Error: reading userfaultfd: errno %d\n", mtcp_sys_errno);
+      lazy_fatal();
+    }
+    return;
+  }
+  for (i = 0; i < rc / sizeof(struct uffd_msg); i++) {
+    struct uffd_msg *msg = &msgs[i];
+    switch (msg->event) {
+    case UFFD_EVENT_PAGEFAULT:
+    {
+      VA addr = (VA)(unsigned long)msg->arg.pagefault.address;
+      if (lazy_handle_fault(addr) == -1) {
+        lazy_defer_fault(addr);
+      }
+      break;
+    }
+
+    case UFFD_EVENT_REMOVE:
+    case UFFD_EVENT_UNMAP:
+      lazy_drop((VA)(unsigned long)msg->arg.remove.start,
+                (VA)(unsigned long)msg->arg.remove.end);
+      break;
+
+    case UFFD_EVENT_REMAP:
+      lazy_remap((VA)(unsigned long)msg->arg.remap.from,
+                 (VA)(unsigned long)msg->arg.remap.to,
+                 msg->arg.remap.len);
+      break;
+    }
+  }
+}
+
+/* Load the next LAZY_PREFETCH_CHUNK of pages that are not yet in. */
+static void
+lazy_prefetch(void)
+{
+  const size_t chunkPages = LAZY_PREFETCH_CHUNK / MTCP_PAGE_SIZE;
+  size_t i;
+
+  while (lazysrv.cursor < lazysrv.count) {
+    LazyEntry *e = &lazysrv.entries[lazysrv.cursor];
+    size_t npages = e->len / MTCP_PAGE_SIZE;
+    size_t p = lazysrv.cursorPage;
+    size_t n = 0;
+
+    while (p < npages && lazysrv.loaded[e->page + p]) {
+      p++;
+    }
+    while (p + n < npages && n < chunkPages &&
+           !lazysrv.loaded[e->page + p + n]) {
+      n++;
+    }
+    if (n == 0) {
+      lazysrv.cursor++;
+      lazysrv.cursorPage = 0;
+      continue;
+    }
+    lazysrv.cursorPage = p;
+    lazy_copy(e, p, n);
+    return;
+  }
+
+  /* Reached the end of the table; recount in case entries moved behind the
+   * cursor, and start over.
+   */
+  lazysrv.pending = 0;
+  for (i = 0; i < lazysrv.count; i++) {
+    LazyEntry *e = &lazysrv.entries[i];
+    size_t p;
+    for (p = 0; p < e->len / MTCP_PAGE_SIZE; p++) {
+      lazysrv.pending += !lazysrv.loaded[e->page + p];
+    }
+  }
+  lazysrv.cursor = lazysrv.cursorPage = 0;
+}
+
+NO_OPTIMIZE
+static void
+lazy_page_server(int uffd, int imagefd, int runsfd, int donefd, pid_t app)
+{
+  int mtcp_sys_errno;
+  unsigned long allSignals = ~0UL;
+  int maxfd = PROTECTED_FD_END;
+  int fd;
+
+  /* Keep out of the application's session and signals:  if we die early,
+   * the pages we have not loaded yet would read as zero.
+   */
+  mtcp_sys_setsid();
+  mtcp_sys_rt_sigprocmask(SIG_SETMASK, &allSignals, NULL, sizeof allSignals);
+
+  /* Do not hold on to the application's sockets, pipes, and files. */
+  maxfd = uffd > maxfd ? uffd : maxfd;
+  maxfd = imagefd > maxfd ? imagefd : maxfd;
+  maxfd = runsfd > maxfd ? runsfd : maxfd;
+  maxfd = donefd > maxfd ? donefd : maxfd;
+  for (fd = 0; fd <= maxfd; fd++) {
+    if (fd != 2 && fd != uffd && fd != imagefd && fd != runsfd &&
+        fd != donefd) {
+      mtcp_sys_close(fd);
+    }
+  }
+#ifdef __NR_close_range
+  mtcp_sys_close_range(maxfd + 1, ~0U, 0);
+#endif
+
+  mtcp_memset(&lazysrv, 0, sizeof lazysrv);
+  lazysrv.uffd = uffd;
+  lazysrv.imagefd = imagefd;
+  lazysrv.runsfd = runsfd;
+  lazysrv.app = app;
+  lazysrv.buf = lazy_grow(NULL, 0, LAZY_PREFETCH_CHUNK);
+
+  while (1) {
+    struct pollfd fds[2];
+    struct timespec noWait = { 0, 0 };
+    int busy;
+    int rc;
+
+    lazy_retry_deferred();
+    busy = lazysrv.pending > 0 || lazysrv.numDeferred > 0;
+    if (!busy && lazysrv.runsfd == -1) {
+      break;
+    }
+    fds[0].fd = uffd;
+    fds[0].events = POLLIN;
+    fds[0].revents = 0;
+    fds[1].fd = lazysrv.runsfd;
+    fds[1].events = POLLIN;
+    fds[1].revents = 0;
+    rc = mtcp_sys_ppoll(fds, 2, busy ? &noWait : NULL, NULL, 0);
+    if (rc == -1) {
+      if (mtcp_sys_errno == EINTR) {
+        continue;
+      }
+      MTCP_PRINTF("***Error: ppoll: errno %d\n", mtcp_sys_errno);
+      lazy_fatal();
+    }
+    if (fds[1].revents) {
+      lazy_read_runs();
+    }
+    if (fds[0].revents & POLLIN) {
+      lazy_read_events();
+    } else if (fds[0].revents & (POLLERR | POLLHUP)) {
+      break;
+    } else if (rc == 0 && lazysrv.pending > 0) {
+      lazy_prefetch();
+    }
+  }
+
+  /* Closing donefd (on exit) wakes up Util::waitForLazyRestart().  Closing
+   * the userfaultfd unregisters the areas; any page not in a data run is
+   * zero-filled by the kernel from here on.
+   */
+  mtcp_sys_exit(0);
+}
+#endif // ifdef HAS_LAZY_RESTART
+
 #if 0
 
 // See note above.
@@ -1365,29 +2399,34 @@ __intel_security_check_cookie(void)
   mtcp_abort();
 }
 
-#ifdef FAST_RST_VIA_MMAP
-static void mmapfile(int fd, void *buf, size_t size, int prot, int flags)
+/* Map size bytes of the image at its current offset to buf, and move past
+ * them, as mtcp_readfile() would.  Returns -1, without moving, if the image
+ * cannot be mapped there (not page-aligned, not a regular file, ...).
+ */
+NO_OPTIMIZE
+static int
+mmapfile(int fd, void *buf, size_t size, int prot, int flags)
 {
   int mtcp_sys_errno;
+  off_t offset = mtcp_sys_lseek(fd, 0, SEEK_CUR);
   void *addr;
-  int rc;
 
-  /* Use mmap for this portion of checkpoint image. */
-  addr = mtcp_sys_mmap(buf, size, prot, flags,
-                       fd, mtcp_sys_lseek(fd, 0, SEEK_CUR));
+  if (offset == -1 || (offset & MTCP_PAGE_OFFSET_MASK) != 0) {
+    return -1;
+  }
+  addr = mtcp_sys_mmap(buf, size, prot, flags, fd, offset);
   if (addr != buf) {
-    if (addr == MAP_FAILED) {
-      MTCP_PRINTF("error %d reading checkpoint file\n", mtcp_sys_errno);
-    } else {
+    if (addr != MAP_FAILED) {
       MTCP_PRINTF("Requested address %p, but got address %p\n", buf, addr);
+      mtcp_abort();
     }
-    mtcp_abort();
+    DPRINTF("error %d mapping ckpt image at offset %p\n",
+            mtcp_sys_errno, (void *)offset);
+    return -1;
   }
-  /* Now update fd so as to work the same way as readfile() */
-  rc = mtcp_sys_lseek(fd, size, SEEK_CUR);
-  if (rc == -1) {
+  if (mtcp_sys_lseek(fd, offset + size, SEEK_SET) == -1) {
     MTCP_PRINTF("mtcp_sys_lseek failed with errno %d\n", mtcp_sys_errno);
     mtcp_abort();
   }
+  return 0;
 }
-#endif
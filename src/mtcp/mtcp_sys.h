@@ -236,6 +236,17 @@ struct linux_dirent {
 # define mtcp_sys_write(args ...) mtcp_inline_syscall(write, 3, args)
 # define mtcp_sys_lseek(args ...) mtcp_inline_syscall(lseek, 3, args)
 
+/* The kernel fills in a struct stat as glibc defines it on 64-bit
+ * architectures, and a struct stat64 on 32-bit ones.
+ */
+# if defined(__i386__) || defined(__arm__)
+#  define mtcp_stat                stat64
+#  define mtcp_sys_fstat(args ...) mtcp_inline_syscall(fstat64, 2, args)
+# else // if defined(__i386__) || defined(__arm__)
+#  define mtcp_stat                stat
+#  define mtcp_sys_fstat(args ...) mtcp_inline_syscall(fstat, 2, args)
+# endif // if defined(__i386__) || defined(__arm__)
+
 /*
  * As of glibc-2.18, open() has been replaced by openat(). glibc converts
  * calls to open() to openat(), but NOT for Aarch64
@@ -379,6 +390,28 @@ struct linux_dirent {
 #  define mtcp_sys_getdents64(args ...) mtcp_inline_syscall(getdents64, 3, args)
 # endif // ifdef __NR_getdents64
 
+// Used by the lazy-restart page server in mtcp_restart.c.
+# define mtcp_sys_ioctl(args ...)   mtcp_inline_syscall(ioctl, 3, args)
+# define mtcp_sys_pread(args ...)   mtcp_inline_syscall(pread64, 4, args)
+# define mtcp_sys_ppoll(args ...)   mtcp_inline_syscall(ppoll, 5, args)
+# define mtcp_sys_setsid(args ...)  mtcp_inline_syscall(setsid, 0)
+# define mtcp_sys_kill(args ...)    mtcp_inline_syscall(kill, 2, args)
+# define mtcp_sys_rt_sigprocmask(args ...) \
+  mtcp_inline_syscall(rt_sigprocmask, 4, args)
+# ifdef __NR_userfaultfd
+#  define mtcp_sys_userfaultfd(args ...) \
+  mtcp_inline_syscall(userfaultfd, 1, args)
+# endif // ifdef __NR_userfaultfd
+# ifdef __NR_close_range
+#  define mtcp_sys_close_range(args ...) \
+  mtcp_inline_syscall(close_range, 3, args)
+# endif // ifdef __NR_close_range
+
+# ifdef __NR_fadvise64
+#  define mtcp_sys_fadvise64(args ...) \
+  mtcp_inline_syscall(fadvise64, 4, args)
+# endif // ifdef __NR_fadvise64
+
 # define mtcp_sys_fcntl2(args ...)      mtcp_inline_syscall(fcntl, 2, args)
 # define mtcp_sys_fcntl3(args ...)      mtcp_inline_syscall(fcntl, 3, args)
 # if defined(__aarch64__)
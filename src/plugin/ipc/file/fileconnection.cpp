@@ -21,11 +21,18 @@
 
 #include <arpa/inet.h>
 #include <fcntl.h>
+#include <linux/fs.h>
+#include <linux/futex.h>
 #include <linux/limits.h>
+#include <linux/magic.h>
+#include <sched.h>
 #include <sys/file.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/select.h>
+#include <sys/syscall.h>
 #include <sys/un.h>
+#include <sys/vfs.h>
 #include <termios.h>
 #include <time.h>
 #include <unistd.h>
@@ -49,6 +56,405 @@ using namespace dmtcp;
 static void writeFileFromFd(int fd, int destFd);
 static bool areFilesEqual(int fd, int destFd, size_t size);
 
+/* Checkpointed copies of files are made by copier threads created with a raw
+ * clone(), for the same reasons as the compressor threads in the core
+ * library: they must not show up in the ThreadList or be known to
+ * libpthread.  They only issue system calls through rawSyscall, which is
+ * resolved by the checkpoint thread beforehand, and touch no memory other
+ * than the queue of copies and their own stack and buffer.
+ */
+#define COPY_BUF_PAGES        1024
+#define COPY_MAX_THREADS      16
+#define COPY_DEFAULT_THREADS  4
+#define COPY_CHUNK            (64 * 1024 * 1024)
+#define COPIER_STACK_SIZE     (64 * 1024)
+#define COPIER_CLONE_FLAGS                                     \
+  (CLONE_VM | CLONE_FS | CLONE_FILES | CLONE_SIGHAND | CLONE_THREAD | \
+  CLONE_SYSVSEM | CLONE_PARENT_SETTID | CLONE_CHILD_CLEARTID)
+
+/* With DMTCP_CKPT_FILES_DELTA, the copy of a file is only saved in full
+ * (the base copy) every so often.  In between, only the blocks that differ
+ * from the base copy are saved, to <saved file>.delta:
+ *   FileDeltaHeader, the changed blocks, the manifest (their block numbers).
+ * Each delta is against the base copy, so restart never needs more than two
+ * files.  The base copy is shared by hard links between checkpoints, and is
+ * never modified in place.
+ */
+#define FILE_DELTA_MAGIC      "DMTCP_FDELTA_V1\n"
+#define FILE_DELTA_SUFFIX     ".delta"
+#define FILE_DELTA_BLOCK_SIZE (64 * 1024)
+#define FILE_DELTA_MIN_SIZE   (1024 * 1024)
+
+typedef struct FileDeltaHeader {
+  char magic[16];
+  uint64_t fileSize;
+  uint64_t baseSize;
+  uint64_t blockSize;
+  uint64_t numBlocks;
+  uint64_t manifestOffset;
+} FileDeltaHeader;
+
+enum FileCopyMode {
+  COPY_FULL,
+  COPY_DELTA
+};
+
+typedef struct FileCopy {
+  FileConnection *con;
+  int mode;
+  int srcFd;
+  int destFd;
+  int closeSrc;
+  int error;
+  struct stat st;
+  struct timespec start;
+
+  // COPY_FULL: the hashes of the blocks of the new base copy, if wanted.
+  uint64_t *hashes;
+  size_t maxHashes;
+  ssize_t numHashes;
+
+  // COPY_DELTA: the base copy, and the blocks that differ from it.
+  const uint64_t *baseHashes;
+  size_t numBaseHashes;
+  uint64_t baseSize;
+  uint64_t *changed;
+  size_t numChanged;
+} FileCopy;
+
+static vector<FileCopy> fileCopies;
+static volatile int copyNext = 0;
+static size_t copyBufSize = 0;
+static __typeof__(&syscall) rawSyscall = NULL;
+
+static bool
+timespecEqual(const struct timespec &a, const struct timespec &b)
+{
+  return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+static bool
+timespecLess(const struct timespec &a, const struct timespec &b)
+{
+  return a.tv_sec < b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_nsec < b.tv_nsec);
+}
+
+static bool
+sameSavedFile(const struct stat &a, const struct stat &b)
+{
+  return a.st_dev == b.st_dev && a.st_ino == b.st_ino &&
+         a.st_size == b.st_size && timespecEqual(a.st_mtim, b.st_mtim);
+}
+
+static inline uint64_t
+rotl64(uint64_t x, int r)
+{
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t
+fmix64(uint64_t k)
+{
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdULL;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ULL;
+  k ^= k >> 33;
+  return k;
+}
+
+// MurmurHash3 (x64, 128 bits) of a block, seeded with its length.
+static void
+hashBlock(const char *data, size_t len, uint64_t *hash)
+{
+  const uint8_t *p = (const uint8_t *)data;
+  const size_t nblocks = len / 16;
+  const uint64_t c1 = 0x87c37b91114253d5ULL;
+  const uint64_t c2 = 0x4cf5ad432745937fULL;
+  uint64_t h1 = len;
+  uint64_t h2 = len;
+  uint64_t k1, k2;
+
+  for (size_t i = 0; i < nblocks; i++) {
+    memcpy(&k1, p + i * 16, sizeof(k1));
+    memcpy(&k2, p + i * 16 + 8, sizeof(k2));
+
+    k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+    h1 = rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+    k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+    h2 = rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+  }
+
+  const uint8_t *tail = p + nblocks * 16;
+  k1 = k2 = 0;
+  for (size_t i = len & 15; i > 8; i--) {
+    k2 ^= (uint64_t)tail[i - 1] << ((i - 9) * 8);
+  }
+  for (size_t i = MIN(len & 15, 8); i > 0; i--) {
+    k1 ^= (uint64_t)tail[i - 1] << ((i - 1) * 8);
+  }
+  k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+  k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+
+  h1 ^= len; h2 ^= len;
+  h1 += h2; h2 += h1;
+  h1 = fmix64(h1); h2 = fmix64(h2);
+  h1 += h2; h2 += h1;
+
+  hash[0] = h1;
+  hash[1] = h2;
+}
+
+/* Reads up to len bytes at offset.  Returns the number of bytes read (less
+ * than len only at the end of the file), or -errno.  errno lives in the TLS
+ * of the checkpoint thread, which the copier threads share; a race there can
+ * only change the reported error.
+ */
+static ssize_t
+preadAll(int fd, char *buf, size_t len, off_t offset)
+{
+  size_t done = 0;
+
+  while (done < len) {
+    long rc = rawSyscall(SYS_pread64, fd, buf + done, len - done,
+                         offset + done);
+    if (rc == -1 && errno == EINTR) {
+      continue;
+    } else if (rc == -1) {
+      return errno != 0 ? -errno : -EIO;
+    } else if (rc == 0) {
+      break;
+    }
+    done += rc;
+  }
+  return done;
+}
+
+// Returns 0, or the errno of the failed system call.
+static int
+pwriteAll(int fd, const char *buf, size_t len, off_t offset)
+{
+  size_t done = 0;
+
+  while (done < len) {
+    long rc = rawSyscall(SYS_pwrite64, fd, buf + done, len - done,
+                         offset + done);
+    if (rc == -1 && errno == EINTR) {
+      continue;
+    } else if (rc <= 0) {
+      return rc == -1 && errno != 0 ? errno : EIO;
+    }
+    done += rc;
+  }
+  return 0;
+}
+
+/* Copies all of fd to destFd, both from offset 0 and without moving their
+ * file offsets.  A reflink is tried first, then copy_file_range(), which
+ * lets the filesystem (or the NFS server) do the copy, and finally a plain
+ * read/write loop through buf.  Returns 0, or the errno of the failed system
+ * call.
+ */
+static int
+copyFileData(int fd, int destFd, char *buf, size_t bufSize)
+{
+  long rc;
+
+  // Synchronize memory buffer with data in filesystem
+  // On some Linux kernels, the shared-memory test will fail without this.
+  rawSyscall(SYS_fsync, fd);
+
+#ifdef FICLONE
+  if (rawSyscall(SYS_ioctl, destFd, FICLONE, fd) == 0) {
+    return 0;
+  }
+#endif // ifdef FICLONE
+
+  loff_t inOff = 0;
+#ifdef SYS_copy_file_range
+  loff_t outOff = 0;
+  while (1) {
+    rc = rawSyscall(SYS_copy_file_range, fd, &inOff, destFd, &outOff,
+                    COPY_CHUNK, 0);
+    if (rc == -1 && errno == EINTR) {
+      continue;
+    } else if (rc > 0) {
+      continue;
+    } else if (inOff > 0) {
+      // Some special files report a size of zero to copy_file_range().
+      return rc == 0 ? 0 : (errno != 0 ? errno : EIO);
+    }
+    // Unsupported between these two files; fall back to read/write.
+    break;
+  }
+#endif // ifdef SYS_copy_file_range
+
+  while (1) {
+    rc = preadAll(fd, buf, bufSize, inOff);
+    if (rc < 0) {
+      return -rc;
+    } else if (rc == 0) {
+      return 0;
+    }
+    int error = pwriteAll(destFd, buf, rc, inOff);
+    if (error != 0) {
+      return error;
+    }
+    inOff += rc;
+  }
+}
+
+/* Hashes the blocks of a new base copy.  numHashes is left at -1 if the copy
+ * has more blocks than were expected, and so cannot be used as a base.
+ */
+static int
+hashBaseCopy(FileCopy *c, char *buf, size_t bufSize)
+{
+  off_t offset = 0;
+
+  c->numHashes = 0;
+  while (1) {
+    ssize_t rc = preadAll(c->destFd, buf, bufSize, offset);
+    if (rc < 0) {
+      return -rc;
+    }
+    for (ssize_t pos = 0; pos < rc; pos += FILE_DELTA_BLOCK_SIZE) {
+      if ((size_t)c->numHashes == c->maxHashes) {
+        c->numHashes = -1;
+        return 0;
+      }
+      hashBlock(buf + pos, MIN(FILE_DELTA_BLOCK_SIZE, rc - pos),
+                c->hashes + 2 * c->numHashes);
+      c->numHashes++;
+    }
+    if ((size_t)rc < bufSize) {
+      return 0;
+    }
+    offset += rc;
+  }
+}
+
+// Saves the blocks of the file that differ from the base copy.
+static int
+writeFileDelta(FileCopy *c, char *buf, size_t bufSize)
+{
+  FileDeltaHeader hdr;
+  uint64_t limit = c->st.st_size;
+  uint64_t offset = 0;
+  uint64_t dataOffset = sizeof(hdr);
+  int error;
+
+  rawSyscall(SYS_fsync, c->srcFd);
+
+  c->numChanged = 0;
+  while (offset < limit) {
+    size_t len = MIN(bufSize, limit - offset);
+    ssize_t rc = preadAll(c->srcFd, buf, len, offset);
+    if (rc < 0) {
+      return -rc;
+    }
+    for (ssize_t pos = 0; pos < rc; pos += FILE_DELTA_BLOCK_SIZE) {
+      size_t blockLen = MIN(FILE_DELTA_BLOCK_SIZE, rc - pos);
+      uint64_t block = (offset + pos) / FILE_DELTA_BLOCK_SIZE;
+      uint64_t hash[2];
+      hashBlock(buf + pos, blockLen, hash);
+      if (block < c->numBaseHashes &&
+          hash[0] == c->baseHashes[2 * block] &&
+          hash[1] == c->baseHashes[2 * block + 1]) {
+        continue;
+      }
+      if ((error = pwriteAll(c->destFd, buf + pos, blockLen, dataOffset))) {
+        return error;
+      }
+      dataOffset += blockLen;
+      c->changed[c->numChanged++] = block;
+    }
+    offset += rc;
+    if ((size_t)rc < len) {
+      break;
+    }
+  }
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, FILE_DELTA_MAGIC, sizeof(hdr.magic));
+  hdr.fileSize = offset;
+  hdr.baseSize = c->baseSize;
+  hdr.blockSize = FILE_DELTA_BLOCK_SIZE;
+  hdr.numBlocks = c->numChanged;
+  hdr.manifestOffset = dataOffset;
+  if ((error = pwriteAll(c->destFd, (const char *)c->changed,
+                         c->numChanged * sizeof(uint64_t), dataOffset))) {
+    return error;
+  }
+  return pwriteAll(c->destFd, (const char *)&hdr, sizeof(hdr), 0);
+}
+
+static void
+copyFiles(char *buf, size_t bufSize)
+{
+  int n = fileCopies.size();
+  FileCopy *copies = &fileCopies[0];
+
+  while (1) {
+    int i = __sync_fetch_and_add(&copyNext, 1);
+    if (i >= n) {
+      break;
+    }
+    FileCopy *c = &copies[i];
+    if (c->mode == COPY_DELTA) {
+      c->error = writeFileDelta(c, buf, bufSize);
+    } else {
+      c->error = copyFileData(c->srcFd, c->destFd, buf, bufSize);
+      if (c->error == 0 && c->hashes != NULL) {
+        c->error = hashBaseCopy(c, buf, bufSize);
+      }
+    }
+  }
+}
+
+static size_t
+numDeltaBlocks(off_t size)
+{
+  return (size + FILE_DELTA_BLOCK_SIZE - 1) / FILE_DELTA_BLOCK_SIZE;
+}
+
+static bool
+deltaEnabled(const struct stat &st)
+{
+  const char *str = getenv(ENV_VAR_CKPT_FILES_DELTA);
+
+  return str != NULL && atoi(str) != 0 && S_ISREG(st.st_mode) &&
+         st.st_size >= FILE_DELTA_MIN_SIZE;
+}
+
+// The copy buffer sits right above the stack of each copier.
+static int
+copierMain(void *arg)
+{
+  copyFiles((char *)arg, copyBufSize);
+  return 0;
+}
+
+static int
+numCopierThreads(size_t numCopies)
+{
+  int nthreads = COPY_DEFAULT_THREADS;
+  const char *str = getenv(ENV_VAR_CKPT_FILES_COPY_THREADS);
+
+  if (str != NULL) {
+    nthreads = atoi(str);
+  }
+  if (nthreads < 1) {
+    nthreads = 1;
+  } else if (nthreads > COPY_MAX_THREADS) {
+    nthreads = COPY_MAX_THREADS;
+  }
+  if ((size_t)nthreads > numCopies) {
+    nthreads = numCopies;
+  }
+  return nthreads;
+}
+
 static bool
 _isVimApp()
 {
@@ -218,24 +624,7 @@ FileConnection::preCkpt()
       _savedFilePath = getSavedFilePath(_path);
       JASSERT(Util::createDirectoryTree(_savedFilePath)) (_savedFilePath)
       .Text("Unable to create directory in File Path");
-
-      int destFd = _real_open(
-          _savedFilePath.c_str(), O_CREAT | O_WRONLY | O_TRUNC,
-          S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
-      JASSERT(destFd != -1) (JASSERT_ERRNO) (_path) (_savedFilePath);
-
-      JTRACE("Saving checkpointed copy of the file") (_path) (_savedFilePath);
-      if (_fcntlFlags & O_WRONLY) {
-        // If the file is opened() in write-only mode. Open it in readonly mode
-        // to create the ckpt copy.
-        int tmpfd = _real_open(_path.c_str(), O_RDONLY, 0);
-        JASSERT(tmpfd != -1);
-        writeFileFromFd(tmpfd, destFd);
-        _real_close(tmpfd);
-      } else {
-        writeFileFromFd(_fds[0], destFd);
-      }
-      _real_close(destFd);
+      queueSavedCopy();
     } else {
       JTRACE("Not checkpointing this file") (_path);
       _ckpted_file = false;
@@ -254,6 +643,339 @@ FileConnection::preCkpt()
   }
 }
 
+/* The checkpointed copy is not made right away: preCkpt() only queues it, and
+ * FileConnList::preCkpt() then calls copyQueuedFiles() to make all the queued
+ * copies concurrently.  A copy is skipped altogether if the file has not
+ * changed since the copy made by the previous checkpoint.
+ */
+void
+FileConnection::queueSavedCopy()
+{
+  FileCopy copy;
+
+  memset(&copy, 0, sizeof(copy));
+
+  // Taken before the file is looked at; see isSavedCopyCurrent().
+  clock_gettime(CLOCK_REALTIME_COARSE, &copy.start);
+
+  copy.con = this;
+  copy.srcFd = _fds[0];
+  if (_fcntlFlags & O_WRONLY) {
+    // If the file is opened() in write-only mode. Open it in readonly mode
+    // to create the ckpt copy.
+    copy.srcFd = _real_open(_path.c_str(), O_RDONLY, 0);
+    JASSERT(copy.srcFd != -1) (JASSERT_ERRNO) (_path);
+    copy.closeSrc = true;
+  }
+  JASSERT(fstat(copy.srcFd, &copy.st) == 0) (JASSERT_ERRNO) (_path);
+
+  if (isSavedCopyCurrent(copy.srcFd, copy.st)) {
+    JTRACE("File unchanged since last checkpoint; reusing its copy")
+      (_path) (_savedFilePath);
+    if (copy.closeSrc) {
+      _real_close(copy.srcFd);
+    }
+    return;
+  }
+
+  // Saved files may be linked from an older checkpoint; never truncate them.
+  string deltaPath = _savedFilePath + FILE_DELTA_SUFFIX;
+  unlink(deltaPath.c_str());
+
+  if (canSaveDelta(copy.st)) {
+    copy.mode = COPY_DELTA;
+    copy.destFd = _real_open(deltaPath.c_str(), O_CREAT | O_WRONLY | O_TRUNC,
+                             S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
+    JASSERT(copy.destFd != -1) (JASSERT_ERRNO) (_path) (deltaPath);
+    copy.baseHashes = &_blockHashes[0];
+    copy.numBaseHashes = _blockHashes.size() / 2;
+    copy.baseSize = _lastSavedStat.st_size;
+    copy.changed = (uint64_t *)JALLOC_HELPER_MALLOC(
+        numDeltaBlocks(copy.st.st_size) * sizeof(uint64_t));
+    JTRACE("Saving changed blocks of the file") (_path) (deltaPath);
+  } else {
+    copy.mode = COPY_FULL;
+    _lastSavedPath.clear();
+    _blockHashes.clear();
+    unlink(_savedFilePath.c_str());
+    copy.destFd = _real_open(
+        _savedFilePath.c_str(), O_CREAT | O_RDWR | O_TRUNC,
+        S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
+    JASSERT(copy.destFd != -1) (JASSERT_ERRNO) (_path) (_savedFilePath);
+    if (deltaEnabled(copy.st)) {
+      copy.maxHashes = numDeltaBlocks(copy.st.st_size);
+      _blockHashes.resize(2 * copy.maxHashes);
+      copy.hashes = &_blockHashes[0];
+    }
+    JTRACE("Saving checkpointed copy of the file") (_path) (_savedFilePath);
+  }
+  fileCopies.push_back(copy);
+}
+
+/* The copy made by the previous checkpoint is still valid if neither the
+ * file nor the copy has been touched since.  A write always moves the ctime
+ * of the file forward to at least the (coarse-grained) time at which it
+ * happened; so if the ctime of the file was already older than the start of
+ * the previous copy, and it is unchanged now, nothing was written since the
+ * copy was started.  tmpfs does not update the timestamps for stores through
+ * shared mappings, so files there are always copied.
+ */
+bool
+FileConnection::isSavedCopyCurrent(int fd, const struct stat &st)
+{
+  struct statfs fs;
+  struct stat saved;
+
+  if (_lastSavedPath.empty() || _type != FILE_REGULAR) {
+    return false;
+  }
+  bool hasDelta = _lastDeltaStat.st_ino != 0;
+
+  if (fstatfs(fd, &fs) != 0 || fs.f_type == TMPFS_MAGIC) {
+    return false;
+  }
+
+  if (st.st_dev != _lastFileStat.st_dev ||
+      st.st_ino != _lastFileStat.st_ino ||
+      st.st_size != _lastFileStat.st_size ||
+      !timespecEqual(st.st_mtim, _lastFileStat.st_mtim) ||
+      !timespecEqual(st.st_ctim, _lastFileStat.st_ctim) ||
+      !timespecLess(_lastFileStat.st_ctim, _lastCopyStart)) {
+    return false;
+  }
+
+  if (!isBaseCopyIntact()) {
+    return false;
+  }
+
+  string lastDeltaPath = _lastSavedPath + FILE_DELTA_SUFFIX;
+  if (hasDelta && (stat(lastDeltaPath.c_str(), &saved) != 0 ||
+                   !sameSavedFile(saved, _lastDeltaStat))) {
+    return false;
+  }
+
+  return moveSavedCopy(hasDelta);
+}
+
+/* A delta is saved against the base copy made by an earlier checkpoint of
+ * the same file, until the delta grows to half the size of the base.
+ */
+bool
+FileConnection::canSaveDelta(const struct stat &st)
+{
+  if (!deltaEnabled(st) || _lastSavedPath.empty() || _blockHashes.empty()) {
+    return false;
+  }
+
+  if (st.st_dev != _lastFileStat.st_dev ||
+      st.st_ino != _lastFileStat.st_ino ||
+      _lastDeltaStat.st_size > _lastSavedStat.st_size / 2) {
+    return false;
+  }
+
+  return isBaseCopyIntact() && moveSavedCopy(false);
+}
+
+bool
+FileConnection::isBaseCopyIntact()
+{
+  struct stat saved;
+
+  return stat(_lastSavedPath.c_str(), &saved) == 0 &&
+         sameSavedFile(saved, _lastSavedStat);
+}
+
+// The checkpoint image may have a different name this time.
+bool
+FileConnection::moveSavedCopy(bool withDelta)
+{
+  if (_lastSavedPath == _savedFilePath) {
+    return true;
+  }
+
+  string lastDeltaPath = _lastSavedPath + FILE_DELTA_SUFFIX;
+  string deltaPath = _savedFilePath + FILE_DELTA_SUFFIX;
+  unlink(_savedFilePath.c_str());
+  unlink(deltaPath.c_str());
+  if (link(_lastSavedPath.c_str(), _savedFilePath.c_str()) != 0 ||
+      (withDelta && link(lastDeltaPath.c_str(), deltaPath.c_str()) != 0)) {
+    return false;
+  }
+  _lastSavedPath = _savedFilePath;
+  return true;
+}
+
+/* Rebuilds the file as it was at checkpoint time from its base copy and its
+ * delta, if it has one.  The result is written to a temporary file, which
+ * stands in for the saved copy until refill().
+ */
+void
+FileConnection::rebuildSavedCopy()
+{
+  FileDeltaHeader hdr;
+  struct stat st;
+
+  string deltaPath = _savedFilePath + FILE_DELTA_SUFFIX;
+  int deltaFd = _real_open(deltaPath.c_str(), O_RDONLY, 0);
+  if (deltaFd == -1) {
+    return;
+  }
+
+  JASSERT(Util::readAll(deltaFd, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+          memcmp(hdr.magic, FILE_DELTA_MAGIC, sizeof(hdr.magic)) == 0 &&
+          hdr.blockSize == FILE_DELTA_BLOCK_SIZE) (deltaPath)
+  .Text("Invalid delta of checkpointed file");
+
+  int baseFd = _real_open(_savedFilePath.c_str(), O_RDONLY, 0);
+  JASSERT(baseFd != -1) (_savedFilePath) (JASSERT_ERRNO);
+  JASSERT(fstat(baseFd, &st) == 0 && (uint64_t)st.st_size == hdr.baseSize)
+    (_savedFilePath) (st.st_size) (hdr.baseSize)
+  .Text("Checkpointed copy of file does not match its delta");
+
+  ostringstream os;
+  os << dmtcp_get_tmpdir() << "/" << jalib::Filesystem::BaseName(_savedFilePath)
+     << "." << getpid() << ".rebuilt";
+  string rebuiltPath = os.str();
+  int fd = _real_open(rebuiltPath.c_str(), O_CREAT | O_RDWR | O_TRUNC,
+                      S_IRUSR | S_IWUSR);
+  JASSERT(fd != -1) (rebuiltPath) (JASSERT_ERRNO);
+
+  writeFileFromFd(baseFd, fd);
+  _real_close(baseFd);
+
+  if (hdr.numBlocks > 0) {
+    size_t manifestSize = hdr.numBlocks * sizeof(uint64_t);
+    vector<uint64_t> manifest(hdr.numBlocks);
+    char *buf = (char *)JALLOC_HELPER_MALLOC(FILE_DELTA_BLOCK_SIZE);
+    JASSERT(preadAll(deltaFd, (char *)&manifest[0], manifestSize,
+                     hdr.manifestOffset) == (ssize_t)manifestSize)
+      (deltaPath).Text("Truncated delta of checkpointed file");
+
+    uint64_t dataOffset = sizeof(hdr);
+    for (size_t i = 0; i < manifest.size(); i++) {
+      uint64_t offset = manifest[i] * FILE_DELTA_BLOCK_SIZE;
+      JASSERT(offset < hdr.fileSize) (deltaPath) (manifest[i]);
+      size_t len = MIN(FILE_DELTA_BLOCK_SIZE, hdr.fileSize - offset);
+      JASSERT(preadAll(deltaFd, buf, len, dataOffset) == (ssize_t)len)
+        (deltaPath).Text("Truncated delta of checkpointed file");
+      int error = pwriteAll(fd, buf, len, offset);
+      JASSERT(error == 0) (rebuiltPath) (strerror(error));
+      dataOffset += len;
+    }
+    JALLOC_HELPER_FREE(buf);
+  }
+  JASSERT(ftruncate(fd, hdr.fileSize) == 0) (rebuiltPath) (JASSERT_ERRNO);
+  _real_close(fd);
+  _real_close(deltaFd);
+
+  JTRACE("Rebuilt checkpointed copy of file from its delta")
+    (_savedFilePath) (rebuiltPath) (hdr.numBlocks);
+  _savedFilePath = rebuiltPath;
+  _rebuiltSavedCopy = true;
+}
+
+// Forgets the checkpointed copy made by the last checkpoint, so that the
+// next checkpoint saves the file in full.
+void
+FileConnection::resetSavedCopyState()
+{
+  _lastSavedPath.clear();
+  _blockHashes.clear();
+  memset(&_lastCopyStart, 0, sizeof(_lastCopyStart));
+  memset(&_lastFileStat, 0, sizeof(_lastFileStat));
+  memset(&_lastSavedStat, 0, sizeof(_lastSavedStat));
+  memset(&_lastDeltaStat, 0, sizeof(_lastDeltaStat));
+  _rebuiltSavedCopy = false;
+}
+
+void
+FileConnection::copyQueuedFiles()
+{
+  if (fileCopies.empty()) {
+    return;
+  }
+
+  rawSyscall = _real_syscall;
+  copyNext = 0;
+
+  int nthreads = numCopierThreads(fileCopies.size());
+  long page_size = sysconf(_SC_PAGESIZE);
+  copyBufSize = COPY_BUF_PAGES * page_size;
+
+  if (nthreads == 1) {
+    char *buf = (char *)JALLOC_HELPER_MALLOC(copyBufSize);
+    copyFiles(buf, copyBufSize);
+    JALLOC_HELPER_FREE(buf);
+  } else {
+    size_t perThread = COPIER_STACK_SIZE + copyBufSize;
+    size_t arenaSize = nthreads * perThread;
+    char *arena = (char *)_real_mmap(NULL, arenaSize, PROT_READ | PROT_WRITE,
+                                     MAP_PRIVATE | MAP_ANONYMOUS |
+                                     MAP_NORESERVE, -1, 0);
+    JASSERT(arena != MAP_FAILED) (arenaSize) (JASSERT_ERRNO)
+    .Text("Failed to allocate buffers for copying files");
+
+    volatile pid_t tids[COPY_MAX_THREADS];
+
+    // Copiers inherit a fully blocked signal mask.
+    sigset_t allSignals, oldMask;
+    sigfillset(&allSignals);
+    rawSyscall(SYS_rt_sigprocmask, SIG_SETMASK, &allSignals, &oldMask,
+               _NSIG / 8);
+    for (int i = 0; i < nthreads; i++) {
+      char *stack = arena + i * perThread;
+      tids[i] = 0;
+      pid_t tid = clone(copierMain, stack + COPIER_STACK_SIZE,
+                        COPIER_CLONE_FLAGS, stack + COPIER_STACK_SIZE,
+                        &tids[i], NULL, &tids[i]);
+      JASSERT(tid > 0) (JASSERT_ERRNO).Text("Failed to create copier thread");
+    }
+    rawSyscall(SYS_rt_sigprocmask, SIG_SETMASK, &oldMask, NULL, _NSIG / 8);
+
+    // The kernel clears each tid and does a FUTEX_WAKE when the thread exits.
+    for (int i = 0; i < nthreads; i++) {
+      pid_t tid;
+      while ((tid = tids[i]) != 0) {
+        rawSyscall(SYS_futex, &tids[i], FUTEX_WAIT, tid, NULL, NULL, 0);
+      }
+    }
+    JASSERT(_real_munmap(arena, arenaSize) == 0) (JASSERT_ERRNO);
+  }
+
+  for (size_t i = 0; i < fileCopies.size(); i++) {
+    FileCopy &copy = fileCopies[i];
+    FileConnection *con = copy.con;
+    JASSERT(copy.error == 0) (con->_path) (con->_savedFilePath)
+      (strerror(copy.error)).Text("Failed to save checkpointed copy of file");
+
+    if (copy.mode == COPY_DELTA) {
+      JASSERT(fstat(copy.destFd, &con->_lastDeltaStat) == 0) (JASSERT_ERRNO);
+      JALLOC_HELPER_FREE(copy.changed);
+      JTRACE("Saved changed blocks of file")
+        (con->_path) (copy.numChanged) (copy.numBaseHashes);
+    } else {
+      JASSERT(fstat(copy.destFd, &con->_lastSavedStat) == 0) (JASSERT_ERRNO);
+      memset(&con->_lastDeltaStat, 0, sizeof(con->_lastDeltaStat));
+      if (copy.numHashes > 0) {
+        con->_blockHashes.resize(2 * copy.numHashes);
+      } else {
+        con->_blockHashes.clear();
+      }
+    }
+    con->_lastSavedPath = con->_savedFilePath;
+    con->_lastFileStat = copy.st;
+    con->_lastCopyStart = copy.start;
+
+    _real_close(copy.destFd);
+    if (copy.closeSrc) {
+      _real_close(copy.srcFd);
+    }
+  }
+  JTRACE("Saved checkpointed copies of files")
+    (fileCopies.size()) (nthreads);
+  fileCopies.clear();
+}
+
 /* Given an open file-descriptor for a saved file, saves a copy
  * of its existing copy, and replaces the existing copy with the
  * saved file.
@@ -333,6 +1055,11 @@ FileConnection::refill(bool isRestart)
     _real_close(savedFd);
   }
 
+  if (_rebuiltSavedCopy) {
+    unlink(_savedFilePath.c_str());
+    _rebuiltSavedCopy = false;
+  }
+
   if (!_ckpted_file) {
     int tempfd;
     if (_type == FILE_DELETED &&
@@ -451,6 +1178,9 @@ FileConnection::postRestart()
 
   JASSERT(_fds.size() > 0);
 
+  // The file may have been restored from its checkpointed copy.
+  resetSavedCopyState();
+
   if (dmtcp_get_new_file_path) {
     refreshPath();
   }
@@ -463,6 +1193,7 @@ FileConnection::postRestart()
   JTRACE("Restoring File Connection") (id()) (_path);
   JASSERT(jalib::Filesystem::FileExists(_savedFilePath))
     (_savedFilePath) (_path).Text("Unable to find checkpointed copy of file");
+  rebuildSavedCopy();
 
   if (_type == FILE_BATCH_QUEUE) {
     JASSERT(dmtcp_bq_restore_file);
@@ -580,29 +1311,13 @@ static void
 writeFileFromFd(int fd, int destFd)
 {
   long page_size = sysconf(_SC_PAGESIZE);
-  const size_t bufSize = 1024 * page_size;
+  const size_t bufSize = COPY_BUF_PAGES * page_size;
   char *buf = (char *)JALLOC_HELPER_MALLOC(bufSize);
 
-  // Synchronize memory buffer with data in filesystem
-  // On some Linux kernels, the shared-memory test will fail without this.
-  fsync(fd);
-
-  off_t offset = _real_lseek(fd, 0, SEEK_CUR);
-  JASSERT(_real_lseek(fd, 0, SEEK_SET) == 0) (fd) (JASSERT_ERRNO);
-  JASSERT(_real_lseek(destFd, 0, SEEK_SET) == 0) (destFd) (JASSERT_ERRNO);
-
-  int readBytes, writtenBytes;
-  while (1) {
-    readBytes = Util::readAll(fd, buf, bufSize);
-    JASSERT(readBytes != -1) (JASSERT_ERRNO).Text("Read Failed");
-    if (readBytes == 0) {
-      break;
-    }
-    writtenBytes = Util::writeAll(destFd, buf, readBytes);
-    JASSERT(writtenBytes != -1) (JASSERT_ERRNO).Text("Write failed.");
-  }
+  rawSyscall = _real_syscall;
+  int error = copyFileData(fd, destFd, buf, bufSize);
   JALLOC_HELPER_FREE(buf);
-  JASSERT(_real_lseek(fd, offset, SEEK_SET) != -1);
+  JASSERT(error == 0) (fd) (destFd) (strerror(error)).Text("Copy failed");
 }
 
 string
@@ -32,6 +32,7 @@
 # include <sys/stat.h>
 # include <sys/types.h>
 # include <sys/types.h>
+# include <time.h>
 # include <unistd.h>
 
 # include "jbuffer.h"
@@ -40,6 +41,10 @@
 
 # include "connection.h"
 
+// Keep in sync with dmtcp/src/constants.h
+# define ENV_VAR_CKPT_FILES_COPY_THREADS "DMTCP_CKPT_FILES_COPY_THREADS"
+# define ENV_VAR_CKPT_FILES_DELTA        "DMTCP_CKPT_FILES_DELTA"
+
 namespace dmtcp
 {
 class StdioConnection : public Connection
@@ -83,7 +88,7 @@ class FileConnection : public Connection
       FILE_BATCH_QUEUE
     };
 
-    FileConnection() {}
+    FileConnection() { resetSavedCopyState(); }
 
     FileConnection(const string &path,
                    int flags,
@@ -92,7 +97,12 @@ class FileConnection : public Connection
       : Connection(type)
       , _path(path)
       , _fileAlreadyExists(false)
-    { }
+    {
+      resetSavedCopyState();
+    }
+
+    // Makes the checkpointed copies queued by preCkpt().
+    static void copyQueuedFiles();
 
     virtual void doLocking();
     virtual void drain();
@@ -125,6 +135,13 @@ class FileConnection : public Connection
     void calculateRelativePath();
     string getSavedFilePath(const string &path);
     void overwriteFileWithBackup(int savedFd);
+    void queueSavedCopy();
+    bool isSavedCopyCurrent(int fd, const struct stat &st);
+    bool canSaveDelta(const struct stat &st);
+    bool isBaseCopyIntact();
+    bool moveSavedCopy(bool withDelta);
+    void rebuildSavedCopy();
+    void resetSavedCopyState();
 
     string _path;
     string _savedFilePath;
@@ -143,6 +160,19 @@ class FileConnection : public Connection
     uint64_t _st_dev;
     uint64_t _st_ino;
     int64_t _st_size;
+
+    // The checkpointed copy made by the last checkpoint (if any), and the
+    // state of the file when that copy was started.  Not serialized.
+    // With DMTCP_CKPT_FILES_DELTA, _lastSavedPath is the base copy, and
+    // _blockHashes are the hashes of its blocks.  _lastDeltaStat.st_ino is 0
+    // if the last checkpoint saved the file in full.
+    string _lastSavedPath;
+    struct timespec _lastCopyStart;
+    struct stat _lastFileStat;
+    struct stat _lastSavedStat;
+    struct stat _lastDeltaStat;
+    vector<uint64_t> _blockHashes;
+    int32_t _rebuiltSavedCopy;
 };
 
 class FifoConnection : public Connection
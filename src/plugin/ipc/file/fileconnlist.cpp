@@ -147,12 +147,14 @@ FileConnList::drain()
 
 /*
  * This function is called after preCkpt() for all the FileConnection
- * objects and writes out information about the open files saved by DMTCP.
+ * objects.  It makes the checkpointed copies of files that they queued and
+ * writes out information about the open files saved by DMTCP.
  */
 void
 FileConnList::preCkpt()
 {
   ConnectionList::preCkpt();
+  FileConnection::copyQueuedFiles();
 
   string fdInfoFile = dmtcp_get_ckpt_files_subdir();
   fdInfoFile += "/fd-info.txt";
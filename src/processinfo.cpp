@@ -137,6 +137,7 @@ ProcessInfo::ProcessInfo()
   _isRootOfProcessTree = false;
   _noCoordinator = false;
   _generation = 0;
+  _numWriteStreams = 0;
 
   // _generation, above, is per-process.
   // This contrasts with DmtcpUniqueProcessId:_computation_generation, which is
@@ -775,7 +776,8 @@ ProcessInfo::serialize(jalib::JBinarySerializer &o)
   o & _compGroup & _numPeers & _noCoordinator & _argvSize & _envSize;
   o & _restoreBufAddr & _savedHeapStart & _savedBrk;
   o & _vdsoStart & _vdsoEnd & _vvarStart & _vvarEnd;
-  o & _ckptDir & _ckptFileName & _ckptFilesSubDir;
+  o & _ckptDir & _ckptFileName & _ckptFilesSubDir & _parentCkptFileName;
+  o & _dedupStoreDir & _numWriteStreams;
 
   JTRACE("Serialized process information")
     (_sid) (_ppid) (_gid) (_fgid) (_isRootOfProcessTree)
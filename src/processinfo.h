@@ -156,6 +156,18 @@ class ProcessInfo
 
     string getCkptDir() const { return _ckptDir; }
 
+    string getParentCkptFilename() const { return _parentCkptFileName; }
+
+    void setParentCkptFilename(const string &f) { _parentCkptFileName = f; }
+
+    string getDedupStoreDir() const { return _dedupStoreDir; }
+
+    void setDedupStoreDir(const string &dir) { _dedupStoreDir = dir; }
+
+    uint32_t numWriteStreams() const { return _numWriteStreams; }
+
+    void setNumWriteStreams(uint32_t n) { _numWriteStreams = n; }
+
     void setCkptDir(const char *);
     void setCkptFilename(const char *);
     void updateCkptDirFileSubdir(string newCkptDir = "");
@@ -181,6 +193,7 @@ class ProcessInfo
     uint32_t _generation;
     uint32_t _numCheckpoints;
     uint32_t _numRestarts;
+    uint32_t _numWriteStreams;
 
     uint32_t _numPeers;
     uint32_t _noCoordinator;
@@ -197,6 +210,8 @@ class ProcessInfo
     string _ckptDir;
     string _ckptFileName;
     string _ckptFilesSubDir;
+    string _parentCkptFileName;
+    string _dedupStoreDir;
 
     UniquePid _upid;
     UniquePid _uppid;
@@ -0,0 +1,132 @@
+/****************************************************************************
+ *   Copyright (C) 2006-2013 by Jason Ansel, Kapil Arya, and Gene Cooperman *
+ *   jansel@csail.mit.edu, kapil@ccs.neu.edu, gene@ccs.neu.edu              *
+ *                                                                          *
+ *  This file is part of DMTCP.                                             *
+ *                                                                          *
+ *  DMTCP is free software: you can redistribute it and/or                  *
+ *  modify it under the terms of the GNU Lesser General Public License as   *
+ *  published by the Free Software Foundation, either version 3 of the      *
+ *  License, or (at your option) any later version.                         *
+ *                                                                          *
+ *  DMTCP is distributed in the hope that it will be useful,                *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ *  GNU Lesser General Public License for more details.                     *
+ *                                                                          *
+ *  You should have received a copy of the GNU Lesser General Public        *
+ *  License along with DMTCP:dmtcp/src.  If not, see                        *
+ *  <http://www.gnu.org/licenses/>.                                         *
+ ****************************************************************************/
+
+#ifndef RAW_SYSCALL_H
+#define RAW_SYSCALL_H
+
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+
+/* System calls for the threads that ckptcompress.cpp and ckptio.cpp create
+ * with a raw clone().  Such a thread has no TLS of its own: it runs with
+ * the thread pointer of the checkpoint thread, and syscall() would store
+ * its errors into the errno of the checkpoint thread, under the feet of
+ * whatever that thread is doing meanwhile.  These return -errno instead,
+ * as the kernel does, and never touch errno.
+ */
+static inline long
+raw_syscall(long n, long a1 = 0, long a2 = 0, long a3 = 0, long a4 = 0,
+            long a5 = 0, long a6 = 0)
+{
+#if defined(__x86_64__)
+  register long r10 asm ("r10") = a4;
+  register long r8 asm ("r8") = a5;
+  register long r9 asm ("r9") = a6;
+  long ret;
+
+  asm volatile ("syscall"
+                : "=a" (ret)
+                : "0" (n), "D" (a1), "S" (a2), "d" (a3), "r" (r10), "r" (r8),
+                "r" (r9)
+                : "rcx", "r11", "memory");
+  return ret;
+#elif defined(__i386__)
+  // %ebx may hold the GOT pointer and %ebp the frame pointer.
+  long args[3] = { n, a1, a6 };
+  long ret;
+
+  asm volatile ("pushl %%ebp\n\t"
+                "pushl %%ebx\n\t"
+                "movl 4(%%eax), %%ebx\n\t"
+                "movl 8(%%eax), %%ebp\n\t"
+                "movl 0(%%eax), %%eax\n\t"
+                "int $0x80\n\t"
+                "popl %%ebx\n\t"
+                "popl %%ebp"
+                : "=a" (ret)
+                : "0" (args), "c" (a2), "d" (a3), "S" (a4), "D" (a5)
+                : "memory");
+  return ret;
+#elif defined(__aarch64__)
+  register long x8 asm ("x8") = n;
+  register long x0 asm ("x0") = a1;
+  register long x1 asm ("x1") = a2;
+  register long x2 asm ("x2") = a3;
+  register long x3 asm ("x3") = a4;
+  register long x4 asm ("x4") = a5;
+  register long x5 asm ("x5") = a6;
+
+  asm volatile ("svc 0"
+                : "+r" (x0)
+                : "r" (x8), "r" (x1), "r" (x2), "r" (x3), "r" (x4), "r" (x5)
+                : "memory");
+  return x0;
+#elif defined(__arm__)
+  // %r7 may be the frame pointer in Thumb code.
+  register long r0 asm ("r0") = a1;
+  register long r1 asm ("r1") = a2;
+  register long r2 asm ("r2") = a3;
+  register long r3 asm ("r3") = a4;
+  register long r4 asm ("r4") = a5;
+  register long r5 asm ("r5") = a6;
+
+  asm volatile ("mov ip, r7\n\t"
+                "mov r7, %[n]\n\t"
+                "svc 0\n\t"
+                "mov r7, ip"
+                : "+r" (r0)
+                : [n] "r" (n), "r" (r1), "r" (r2), "r" (r3), "r" (r4),
+                "r" (r5)
+                : "ip", "memory");
+  return r0;
+#else // if defined(__x86_64__)
+# error "raw_syscall() is not implemented for this architecture"
+#endif // if defined(__x86_64__)
+}
+
+// The 64-bit offset takes two registers on 32-bit architectures, starting
+// with an even one on ARM EABI.
+static inline long
+raw_pread_pwrite(long n, int fd, const void *buf, size_t len, uint64_t off)
+{
+#if defined(__x86_64__) || defined(__aarch64__)
+  return raw_syscall(n, fd, (long)buf, len, off);
+#elif defined(__arm__)
+  return raw_syscall(n, fd, (long)buf, len, 0, (long)off, (long)(off >> 32));
+#else // if defined(__x86_64__) || defined(__aarch64__)
+  return raw_syscall(n, fd, (long)buf, len, (long)off, (long)(off >> 32));
+#endif // if defined(__x86_64__) || defined(__aarch64__)
+}
+
+static inline void
+raw_futex_wait(volatile int *addr, int val)
+{
+  raw_syscall(SYS_futex, (long)addr, FUTEX_WAIT, val);
+}
+
+static inline void
+raw_futex_wake(volatile int *addr)
+{
+  raw_syscall(SYS_futex, (long)addr, FUTEX_WAKE, INT_MAX);
+}
+#endif // ifndef RAW_SYSCALL_H
@@ -20,12 +20,15 @@
  ****************************************************************************/
 
 #include <fcntl.h>
+#include <limits.h>
 #include <stdlib.h>
+#include <string.h>
 #include <syscall.h>
 #include <sys/ipc.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <linux/futex.h>
+#include <algorithm>
 
 #include "../jalib/jassert.h"
 #include "../jalib/jconvert.h"
@@ -44,6 +47,7 @@
 using namespace dmtcp;
 static struct SharedData::Header *sharedDataHeader = NULL;
 static uint32_t nextVirtualPtyId = (uint32_t)-1;
+static int barrierSlot = -1;
 
 #if defined(__x86_64__) || defined(__aarch64__)
 static const SharedData::DMTCP_ARCH_MODE archMode = SharedData::DMTCP_ARCH_32;
@@ -221,6 +225,9 @@ SharedData::resetBarrierInfo()
   sharedDataHeader->barrierInfo.numCkptPeers = 0;
   sharedDataHeader->barrierInfo.numIn = 0;
   sharedDataHeader->barrierInfo.curRound = 0;
+  sharedDataHeader->barrierInfo.nodeNumIn = 0;
+  sharedDataHeader->barrierInfo.nodeRound = 0;
+  sharedDataHeader->barrierInfo.nodeKilled = 0;
 }
 
 // Here we reset some counters that are used by IPC plugin for local
@@ -239,7 +246,13 @@ void
 SharedData::initializeBarrier()
 {
   Util::lockFile(PROTECTED_SHM_FD);
-  sharedDataHeader->barrierInfo.numCkptPeers++;
+  uint64_t slot = sharedDataHeader->barrierInfo.numCkptPeers++;
+  if (slot < MAX_NODE_BARRIER_PEERS) {
+    sharedDataHeader->nodeBarrierPeers[slot] = UniquePid::ThisProcess().upid();
+    barrierSlot = slot;
+  } else {
+    barrierSlot = -1;
+  }
 
   if (sharedDataHeader->archMode != DMTCP_ARCH_MIXED) {
     pthread_barrierattr_t barrierAttr;
@@ -303,6 +316,77 @@ SharedData::waitForBarrier(const string &barrierId)
   }
 }
 
+// Processes of the node that meet at the global barriers before their
+// leader, the process in slot 0, reports them all to the coordinator.  The
+// slots are handed out in prepareForCkpt() and postRestart().
+int
+SharedData::nodeBarrierSlot()
+{
+  return barrierSlot;
+}
+
+size_t
+SharedData::numNodeBarrierPeers()
+{
+  return std::min(sharedDataHeader->barrierInfo.numCkptPeers,
+                  (uint64_t)MAX_NODE_BARRIER_PEERS);
+}
+
+// Returns false if the leader was told to exit instead.
+bool
+SharedData::waitForNodeLeader()
+{
+  uint32_t round = sharedDataHeader->barrierInfo.nodeRound;
+
+  RMB;
+  uint32_t numIn =
+    __sync_add_and_fetch(&sharedDataHeader->barrierInfo.nodeNumIn, 1);
+  if (numIn == numNodeBarrierPeers() - 1) {
+    _real_syscall(SYS_futex, &sharedDataHeader->barrierInfo.nodeNumIn,
+                  FUTEX_WAKE, 1, NULL, NULL, 0);
+  }
+
+  while (*(volatile uint32_t *)&sharedDataHeader->barrierInfo.nodeRound ==
+         round) {
+    if (_real_syscall(SYS_futex, &sharedDataHeader->barrierInfo.nodeRound,
+                      FUTEX_WAIT, round, NULL, NULL, 0) != 0) {
+      JASSERT(errno == EAGAIN || errno == EINTR) (JASSERT_ERRNO);
+    }
+  }
+  RMB;
+  return sharedDataHeader->barrierInfo.nodeKilled == 0;
+}
+
+void
+SharedData::waitForNodePeers(vector<DmtcpUniqueProcessId> *ids)
+{
+  size_t numPeers = numNodeBarrierPeers();
+  uint32_t numIn;
+
+  while ((numIn = *(volatile uint32_t *)
+                    &sharedDataHeader->barrierInfo.nodeNumIn) < numPeers - 1) {
+    if (_real_syscall(SYS_futex, &sharedDataHeader->barrierInfo.nodeNumIn,
+                      FUTEX_WAIT, numIn, NULL, NULL, 0) != 0) {
+      JASSERT(errno == EAGAIN || errno == EINTR) (JASSERT_ERRNO);
+    }
+  }
+  RMB;
+  ids->resize(numPeers);
+  memcpy(&(*ids)[0], sharedDataHeader->nodeBarrierPeers,
+         numPeers * sizeof((*ids)[0]));
+}
+
+void
+SharedData::releaseNodePeers(bool kill)
+{
+  sharedDataHeader->barrierInfo.nodeNumIn = 0;
+  sharedDataHeader->barrierInfo.nodeKilled = kill;
+  WMB;
+  __sync_add_and_fetch(&sharedDataHeader->barrierInfo.nodeRound, 1);
+  _real_syscall(SYS_futex, &sharedDataHeader->barrierInfo.nodeRound,
+                FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
 string
 SharedData::coordHost()
 {
@@ -799,7 +883,7 @@ SharedData::getCkptLeaderForFile(dev_t devnum, ino_t inode, void *id)
   JASSERT(id != NULL);
   if (sharedDataHeader->numInodeConnIdMaps > 0) {
     for (int i = sharedDataHeader->numInodeConnIdMaps - 1; i >= 0; i--) {
-      InodeConnIdMap &map = sharedDataHeader->inodeConnIdMap[i];
+      InodeConnIdMap map = sharedDataHeader->inodeConnIdMap[i];
       if (map.devnum == devnum && map.inode == inode) {
         memcpy(id, map.id, sizeof(map.id));
         return true;
@@ -321,6 +321,7 @@ prepareMtcpHeader(MtcpHeader *mtcpHdr)
   mtcpHdr->tls_pid_offset = TLSInfo_GetPidOffset();
   mtcpHdr->tls_tid_offset = TLSInfo_GetTidOffset();
   mtcpHdr->myinfo_gs = myinfo_gs;
+  mtcpHdr->image_flags = MTCP_IMAGE_PAGE_ALIGNED;
 }
 
 /*************************************************************************
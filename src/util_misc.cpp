@@ -23,6 +23,11 @@
 #include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
+#if defined(__x86_64__)
+# include <immintrin.h>
+#elif defined(__aarch64__)
+# include <arm_neon.h>
+#endif // if defined(__x86_64__)
 #include "../jalib/jassert.h"
 #include "../jalib/jfilesystem.h"
 #include "dmtcp.h"
@@ -567,6 +572,24 @@ skipeol:
   return 0;    /* NOTREACHED : stop compiler warning */
 }
 
+// Reads the next memory area record of a checkpoint image.
+void
+Util::readAreaRecord(int fd, MtcpAreaRecordBuf *buf)
+{
+  MtcpAreaRecord *rec = &buf->rec;
+
+  JASSERT(readAll(fd, rec, sizeof(*rec)) == (ssize_t)sizeof(*rec))
+    (JASSERT_ERRNO).Text("Truncated checkpoint image");
+  JASSERT(rec->magic == MTCP_AREA_MAGIC && rec->version == MTCP_AREA_VERSION)
+    (rec->magic) (rec->version).Text("Invalid memory area record");
+  JASSERT(rec->recordLen >= sizeof(*rec) && rec->recordLen <= sizeof(*buf) &&
+          rec->numRuns <= MTCP_AREA_MAX_RUNS) (rec->recordLen) (rec->numRuns);
+
+  ssize_t len = rec->recordLen - sizeof(*rec);
+  JASSERT(readAll(fd, rec + 1, len) == len) (JASSERT_ERRNO)
+  .Text("Truncated checkpoint image");
+}
+
 int
 Util::memProtToOpenFlags(int prot)
 {
@@ -627,6 +650,28 @@ Util::isValidFd(int fd)
   return _real_fcntl(fd, F_GETFL, 0) != -1;
 }
 
+// After a lazy restart (dmtcp_restart --lazy-restart), a page server fills
+// in the restored memory in the background, and closes the other end of
+// PROTECTED_LAZY_RESTART_FD when it is done.  Anything that needs every page
+// of the address space in place must wait for it first:  a forked child does
+// not inherit the on-demand loading, and the checkpoint writer would take
+// pages that were never loaded for zero pages.
+void
+Util::waitForLazyRestart()
+{
+  char buf[64];
+  ssize_t rc;
+
+  if (!isValidFd(PROTECTED_LAZY_RESTART_FD)) {
+    return;
+  }
+  JTRACE("Waiting for the lazy restart to finish loading memory");
+  do {
+    rc = _real_read(PROTECTED_LAZY_RESTART_FD, buf, sizeof buf);
+  } while (rc > 0 || (rc == -1 && errno == EINTR));
+  _real_close(PROTECTED_LAZY_RESTART_FD);
+}
+
 bool
 Util::isPseudoTty(const string &path)
 {
@@ -656,29 +701,167 @@ Util::pageMask()
   return page_mask;
 }
 
-/* This function detects if the given pages are zero pages or not. There is
- * scope of improving this function using some optimizations.
- *
- * TODO: One can use /proc/self/pagemap to detect if the page is backed by a
- * shared zero page.
+/* Zero-page scanning kernels.  Checkpointing calls areZeroPages() on every
+ * page of every anonymous area, so on large sparse heaps the scan is bound
+ * by memory bandwidth.  The widest vector unit of the CPU is picked at the
+ * first call; every kernel stops at the first non-zero block.
  */
-bool
-Util::areZeroPages(void *addr, size_t numPages)
+typedef bool (*ZeroScanFn)(const char *buf, size_t len);
+
+static bool
+areZeroBytesScalar(const char *buf, size_t len)
 {
-  static size_t page_size = pageSize();
-  long long *buf = (long long *)addr;
+  const long long *p = (const long long *)buf;
+  size_t end = len / sizeof(*p);
   size_t i;
-  size_t end = numPages * page_size / sizeof(*buf);
-  long long res = 0;
 
   for (i = 0; i + 7 < end; i += 8) {
-    res = buf[i + 0] | buf[i + 1] | buf[i + 2] | buf[i + 3] |
-      buf[i + 4] | buf[i + 5] | buf[i + 6] | buf[i + 7];
-    if (res != 0) {
-      break;
+    if ((p[i + 0] | p[i + 1] | p[i + 2] | p[i + 3] |
+         p[i + 4] | p[i + 5] | p[i + 6] | p[i + 7]) != 0) {
+      return false;
+    }
+  }
+  for (i *= sizeof(*p); i < len; i++) {
+    if (buf[i] != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2")))
+static bool
+areZeroBytesAVX2(const char *buf, size_t len)
+{
+  size_t i;
+
+  for (i = 0; i + 128 <= len; i += 128) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(buf + i));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(buf + i + 32));
+    __m256i c = _mm256_loadu_si256((const __m256i *)(buf + i + 64));
+    __m256i d = _mm256_loadu_si256((const __m256i *)(buf + i + 96));
+    __m256i x = _mm256_or_si256(_mm256_or_si256(a, b),
+                                _mm256_or_si256(c, d));
+    if (!_mm256_testz_si256(x, x)) {
+      return false;
     }
   }
-  return res == 0;
+  return areZeroBytesScalar(buf + i, len - i);
+}
+
+__attribute__((target("avx512f")))
+static bool
+areZeroBytesAVX512(const char *buf, size_t len)
+{
+  size_t i;
+
+  for (i = 0; i + 256 <= len; i += 256) {
+    __m512i a = _mm512_loadu_si512((const void *)(buf + i));
+    __m512i b = _mm512_loadu_si512((const void *)(buf + i + 64));
+    __m512i c = _mm512_loadu_si512((const void *)(buf + i + 128));
+    __m512i d = _mm512_loadu_si512((const void *)(buf + i + 192));
+    __m512i x = _mm512_or_si512(_mm512_or_si512(a, b),
+                                _mm512_or_si512(c, d));
+    if (_mm512_test_epi64_mask(x, x) != 0) {
+      return false;
+    }
+  }
+  return areZeroBytesScalar(buf + i, len - i);
+}
+#endif // if defined(__x86_64__)
+
+#if defined(__aarch64__)
+static bool
+areZeroBytesNEON(const char *buf, size_t len)
+{
+  size_t i;
+
+  for (i = 0; i + 64 <= len; i += 64) {
+    uint8x16_t a = vld1q_u8((const uint8_t *)(buf + i));
+    uint8x16_t b = vld1q_u8((const uint8_t *)(buf + i + 16));
+    uint8x16_t c = vld1q_u8((const uint8_t *)(buf + i + 32));
+    uint8x16_t d = vld1q_u8((const uint8_t *)(buf + i + 48));
+    uint8x16_t x = vorrq_u8(vorrq_u8(a, b), vorrq_u8(c, d));
+    if (vmaxvq_u8(x) != 0) {
+      return false;
+    }
+  }
+  return areZeroBytesScalar(buf + i, len - i);
+}
+#endif // if defined(__aarch64__)
+
+static const struct {
+  const char *name;
+  ZeroScanFn fn;
+} zeroScanKernels[] = {
+  // Best first.
+#if defined(__x86_64__)
+  { "avx512", areZeroBytesAVX512 },
+  { "avx2", areZeroBytesAVX2 },
+#endif // if defined(__x86_64__)
+#if defined(__aarch64__)
+  { "neon", areZeroBytesNEON },
+#endif // if defined(__aarch64__)
+  { "scalar", areZeroBytesScalar },
+};
+
+static ZeroScanFn zeroScanFn = NULL;
+static const char *zeroScanName = NULL;
+
+static bool
+zeroScanKernelSupported(const char *name)
+{
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (strcmp(name, "avx512") == 0) {
+    return __builtin_cpu_supports("avx512f");
+  }
+  if (strcmp(name, "avx2") == 0) {
+    return __builtin_cpu_supports("avx2");
+  }
+#endif // if defined(__x86_64__)
+  return true;
+}
+
+bool
+Util::setZeroPagesKernel(const char *name)
+{
+  for (size_t i = 0; i < sizeof(zeroScanKernels) / sizeof(zeroScanKernels[0]);
+       i++) {
+    if ((name == NULL || strcmp(name, zeroScanKernels[i].name) == 0) &&
+        zeroScanKernelSupported(zeroScanKernels[i].name)) {
+      zeroScanName = zeroScanKernels[i].name;
+      zeroScanFn = zeroScanKernels[i].fn;
+      return true;
+    }
+  }
+  return false;
+}
+
+const char *
+Util::zeroPagesKernel()
+{
+  if (zeroScanFn == NULL) {
+    setZeroPagesKernel(NULL);
+  }
+  return zeroScanName;
+}
+
+/* This function detects if the given pages are zero pages or not, by
+ * reading them.  Pages that are not present at all are found through
+ * /proc/self/pagemap beforehand, without touching them; see
+ * mtcp_get_absent_page_range() in writeckpt.cpp.
+ */
+bool
+Util::areZeroPages(void *addr, size_t numPages)
+{
+  static size_t page_size = pageSize();
+
+  if (zeroScanFn == NULL) {
+    setZeroPagesKernel(NULL);
+  }
+  return zeroScanFn((const char *)addr, numPages * page_size);
 }
 
 /* Caller must allocate exec_path of size at least MTCP_MAX_PATH */
@@ -30,6 +30,12 @@
 #include <sys/resource.h>
 #include <sys/stat.h>
 #include "jassert.h"
+#include "ckptcompress.h"
+#include "ckptdedup.h"
+#include "ckptincremental.h"
+#include "ckptindex.h"
+#include "ckptio.h"
+#include "ckptserializer.h"
 #include "constants.h"
 #include "dmtcp.h"
 #include "processinfo.h"
@@ -55,6 +61,12 @@ using namespace dmtcp;
 EXTERNC int dmtcp_infiniband_enabled(void) __attribute__((weak));
 
 static bool skipWritingTextSegments = false;
+static bool skipUnmodifiedFilePages = false;
+static int pagemapFd = -1;
+
+// Number of bytes written since the first memory area.  The headers before
+// it fill whole pages, so this has the alignment of the offset in the image.
+static uint64_t imageOffset = 0;
 
 // FIXME:  Why do we create two global variable here?  They should at least
 // be static (file-private), and preferably local to a function.
@@ -74,9 +86,20 @@ vector<ProcMapsArea> *nscdAreas = NULL;
 /* Internal routines */
 
 // static void sync_shared_mem(void);
-static void writememoryarea(int fd, Area *area, int stack_was_seen);
+static void write_area_record(int fd,
+                              const Area *area,
+                              const MtcpAreaRun *runs,
+                              size_t numRuns,
+                              const struct stat *fileStat = NULL);
+static void writememoryarea(int fd,
+                            Area *area,
+                            int stack_was_seen,
+                            bool allow_incremental,
+                            bool use_pagemap,
+                            const struct stat *fileStat);
 
 static void remap_nscd_areas(const vector<ProcMapsArea> &areas);
+static bool file_backs_area(const Area *area, struct stat *st);
 
 /*****************************************************************************
  *
@@ -99,6 +122,10 @@ mtcp_writememoryareas(int fd)
   if (getenv(ENV_VAR_SKIP_WRITING_TEXT_SEGMENTS) != NULL) {
     skipWritingTextSegments = true;
   }
+  if (getenv(ENV_VAR_SKIP_UNMODIFIED_FILE_PAGES) != NULL) {
+    skipUnmodifiedFilePages = true;
+  }
+  imageOffset = 0;
 
   JTRACE("Performing checkpoint.");
 
@@ -145,6 +172,20 @@ mtcp_writememoryareas(int fd)
     delete procSelfMaps;
   }
 
+  /* For an incremental image, record the pages unchanged since the parent
+   * image, and re-arm the soft-dirty tracking for the next image.
+   */
+  CkptIncremental::snapshotDirtyPages();
+
+  /* Pages that were never touched need not be read to find out that they
+   * are zero pages.
+   */
+  pagemapFd = _real_open("/proc/self/pagemap", O_RDONLY);
+  if (pagemapFd == -1) {
+    JTRACE("Cannot open /proc/self/pagemap; scanning all pages")
+      (JASSERT_ERRNO);
+  }
+
   /* Finally comes the memory contents */
   procSelfMaps = new ProcSelfMaps();
   while (procSelfMaps->getNextArea(&area)) {
@@ -161,6 +202,13 @@ mtcp_writememoryareas(int fd)
       continue;
     } else if (SharedData::isSharedDataRegion(area.addr)) {
       continue;
+    } else if (CkptCompress::isArenaArea(area) || CkptIO::isArenaArea(area) ||
+               CkptIndex::isArenaArea(area)) {
+      // Buffers and stacks of the compressor and I/O threads, and the index
+      // of the image.
+      continue;
+    } else if (CkptIncremental::isSnapshotArea(area)) {
+      continue;
     }
 
     /* Original comment:  Skip anything in kernel address space ---
@@ -227,6 +275,18 @@ mtcp_writememoryareas(int fd)
       continue;
     }
 
+    // Pages of shared areas may change without setting our soft-dirty bits.
+    bool allow_incremental = (area.flags & MAP_SHARED) == 0;
+
+    // Only in private anonymous areas do the pages that are absent from the
+    // page tables read as zeroes.  The flags and name are those of
+    // /proc/self/maps, before the rewriting below.
+    bool use_pagemap = (area.flags & MAP_PRIVATE) != 0 &&
+                       (area.name[0] == '\0' ||
+                        strcmp(area.name, "[heap]") == 0 ||
+                        strcmp(area.name, "[stack]") == 0 ||
+                        Util::strStartsWith(area.name, "[stack:"));
+
     if (Util::strStartsWith(area.name, DEV_ZERO_DELETED_STR) ||
         Util::strStartsWith(area.name, DEV_NULL_DELETED_STR)) {
       /* If the process has an area labeled as "/dev/zero (deleted)", we mark
@@ -249,14 +309,22 @@ mtcp_writememoryareas(int fd)
       area.name[0] = '\0';
     } else if (Util::isNscdArea(area)) {
       /* Special Case Handling: nscd is enabled*/
+      MtcpAreaRun run = MTCP_AREA_RUN(MTCP_AREA_RUN_ZERO, area.size);
       area.prot = PROT_READ | PROT_WRITE;
-      area.properties |= DMTCP_ZERO_PAGE;
       area.flags = MAP_PRIVATE | MAP_ANONYMOUS;
-      Util::writeAll(fd, &area, sizeof(area));
+      write_area_record(fd, &area, &run, 1);
       continue;
     } else if (Util::isIBShmArea(area)) {
       // TODO: Don't checkpoint infiniband shared area for now.
       continue;
+    } else if (Util::strEndsWith(area.name, CKPT_FILE_SUFFIX) ||
+               Util::strEndsWith(area.name,
+                                 CKPT_FILE_SUFFIX DELETED_FILE_SUFFIX)) {
+      /* Mapped from the previous image by mtcp_restart --mmap; the pages
+       * are ordinary private memory.  Pages not yet read in are not zero,
+       * so use_pagemap stays false.
+       */
+      area.name[0] = '\0';
     } else if (Util::strEndsWith(area.name, DELETED_FILE_SUFFIX)) {
       /* Deleted File */
     } else if (area.name[0] == '/' && strstr(&area.name[1], "/") != NULL) {
@@ -277,6 +345,15 @@ mtcp_writememoryareas(int fd)
       area.flags |= MAP_ANONYMOUS;
     }
 
+    // The pages of a private file mapping that were never written to are
+    // still those of the file, unless the file was deleted or truncated.
+    struct stat fileStat;
+    bool use_file = skipUnmodifiedFilePages &&
+                    !CkptSerializer::isMigrationImage() &&
+                    (area.flags & MAP_PRIVATE) != 0 && area.name[0] == '/' &&
+                    !Util::strEndsWith(area.name, DELETED_FILE_SUFFIX) &&
+                    file_backs_area(&area, &fileStat);
+
     /* Only write this image if it is not CS_RESTOREIMAGE.
      * Skip any mapping for this image - it got saved as CS_RESTOREIMAGE
      * at the beginning.
@@ -287,24 +364,44 @@ mtcp_writememoryareas(int fd)
     }
 
     // the whole thing comes after the restore image
-    writememoryarea(fd, &area, stack_was_seen);
+    writememoryarea(fd, &area, stack_was_seen, allow_incremental,
+                    use_pagemap, use_file ? &fileStat : NULL);
   }
 
   // Release the memory.
   delete procSelfMaps;
   procSelfMaps = NULL;
+  CkptIncremental::releaseDirtyPages();
+  if (pagemapFd != -1) {
+    _real_close(pagemapFd);
+    pagemapFd = -1;
+  }
 
   /* It's now safe to do this, since we're done using writememoryarea() */
   remap_nscd_areas(*nscdAreas);
 
+  memset(&area, 0, sizeof(area));
   area.addr = NULL; // End of data
   area.size = -1; // End of data
-  Util::writeAll(fd, &area, sizeof(area));
+  write_area_record(fd, &area, NULL, 0);
+  CkptIndex::end(fd, CkptSerializer::writeToImage);
 
   /* That's all folks */
   JASSERT(_real_close(fd) == 0);
 }
 
+// True if the file at the path of the area is the one that was mapped, and
+// still has data in every page of the area; reading a page past its end
+// would raise SIGBUS.  Its stat() goes in the records of the area, for
+// mtcp_restart to check that the file did not change since.
+static bool
+file_backs_area(const Area *area, struct stat *st)
+{
+  return stat(area->name, st) == 0 && S_ISREG(st->st_mode) &&
+         (uint64_t)st->st_ino == (uint64_t)area->inodenum &&
+         st->st_size + MTCP_PAGE_SIZE > area->offset + (off_t)area->size;
+}
+
 static void
 remap_nscd_areas(const vector<ProcMapsArea> &areas)
 {
@@ -317,51 +414,302 @@ remap_nscd_areas(const vector<ProcMapsArea> &areas)
   }
 }
 
-/* This function returns a range of zero or non-zero pages. If the first page
- * is non-zero, it searches for all contiguous non-zero pages and returns them.
- * If the first page is all-zero, it searches for contiguous zero pages and
- * returns them.
+/* Size of the units in which areas are scanned for zero pages. */
+#define ZERO_SCAN_SIZE (64 * 1024)
+
+/* Number of /proc/self/pagemap entries read at once (16 MB of memory). */
+#define PAGEMAP_ENTRIES_PER_IO 4096
+
+/* No memory may be allocated while the memory areas are being written. */
+static MtcpAreaRecordBuf areaRecord;
+static MtcpAreaRun areaRuns[MTCP_AREA_MAX_RUNS];
+static uint64_t pagemapEntries[PAGEMAP_ENTRIES_PER_IO];
+
+/* Write the record of the area, or of a part of it, with the given runs.
+ * The data of the runs must follow.
  */
 static void
-mtcp_get_next_page_range(Area *area, size_t *size, int *is_zero)
+write_area_record(int fd,
+                  const Area *area,
+                  const MtcpAreaRun *runs,
+                  size_t numRuns,
+                  const struct stat *fileStat)
 {
-  char *pg;
-  char *prevAddr;
-  size_t count = 0;
-  const size_t one_MB = (1024 * 1024);
-
-  if (area->size < one_MB) {
-    *size = area->size;
-    *is_zero = 0;
-    return;
+  MtcpAreaRecord *rec = &areaRecord.rec;
+  size_t nameLen = strlen(area->name);
+
+  JASSERT(numRuns <= MTCP_AREA_MAX_RUNS && nameLen < FILENAMESIZE);
+  memset(rec, 0, sizeof(*rec));
+  rec->magic = MTCP_AREA_MAGIC;
+  rec->version = MTCP_AREA_VERSION;
+  rec->nameLen = nameLen;
+  rec->numRuns = numRuns;
+  rec->addr = (uint64_t)area->addr;
+  rec->size = area->size;
+  rec->offset = area->offset;
+  rec->prot = area->prot;
+  rec->flags = area->flags;
+  rec->devmajor = area->devmajor;
+  rec->devminor = area->devminor;
+  rec->inodenum = area->inodenum;
+  rec->properties = area->properties;
+  if (fileStat != NULL) {
+    rec->fileDev = fileStat->st_dev;
+    rec->fileInode = fileStat->st_ino;
+    rec->fileSize = fileStat->st_size;
+    rec->fileMtimeSec = fileStat->st_mtim.tv_sec;
+    rec->fileMtimeNsec = fileStat->st_mtim.tv_nsec;
   }
-  *size = one_MB;
-  *is_zero = Util::areZeroPages(area->addr, one_MB / MTCP_PAGE_SIZE);
-  prevAddr = area->addr;
-  for (pg = area->addr + one_MB;
-       pg < area->addr + area->size;
-       pg += one_MB) {
-    size_t minsize = MIN(one_MB, (size_t)(area->addr + area->size - pg));
-    if (*is_zero != Util::areZeroPages(pg, minsize / MTCP_PAGE_SIZE)) {
+
+  char *name = mtcp_area_name(rec);
+  memset(name, 0, MTCP_AREA_NAME_SPACE(nameLen));
+  memcpy(name, area->name, nameLen);
+  memcpy(mtcp_area_runs(rec), runs, numRuns * sizeof(*runs));
+  size_t len = (char *)(mtcp_area_runs(rec) + numRuns) - (char *)rec;
+
+  // Pad the record so that the data of its runs starts at a page-aligned
+  // offset, where mtcp_restart --mmap can map it (MTCP_IMAGE_PAGE_ALIGNED).
+  for (size_t i = 0; i < numRuns; i++) {
+    if (MTCP_AREA_RUN_TYPE(runs[i]) == MTCP_AREA_RUN_DATA) {
+      size_t pad = (MTCP_PAGE_SIZE - (imageOffset + len) % MTCP_PAGE_SIZE) %
+                   MTCP_PAGE_SIZE;
+      memset((char *)rec + len, 0, pad);
+      len += pad;
       break;
     }
-    *size += minsize;
-    if (*is_zero && ++count % 10 == 0) { // madvise every 10MB
-      if (madvise(prevAddr, area->addr + *size - prevAddr,
-                  MADV_DONTNEED) == -1) {
-        JNOTE("error doing madvise(..., MADV_DONTNEED)")
-          (JASSERT_ERRNO) ((void *)area->addr) ((int)*size);
-        prevAddr = pg;
+  }
+  rec->recordLen = len;
+
+  CkptIndex::addRecord(rec);
+  CkptSerializer::writeToImage(fd, rec, rec->recordLen);
+  imageOffset += rec->recordLen;
+}
+
+/* This function returns the length of a range of pages at addr, of at most
+ * len bytes, that are all absent from /proc/self/pagemap (neither present nor
+ * swapped out), or that are all backed by memory.  In a private anonymous
+ * area, absent pages were never touched (or were discarded) and read as
+ * zeroes.  Without pagemap, all pages are taken to be backed by memory.
+ */
+static size_t
+mtcp_get_absent_page_range(VA addr, size_t len, int *is_absent)
+{
+  size_t numPages = len / MTCP_PAGE_SIZE;
+  size_t i = 0;
+
+  *is_absent = 0;
+  while (pagemapFd != -1 && i < numPages) {
+    size_t count = MIN(numPages - i, PAGEMAP_ENTRIES_PER_IO);
+    off_t offset = ((uintptr_t)addr / MTCP_PAGE_SIZE + i) * sizeof(uint64_t);
+    ssize_t rc = pread(pagemapFd, pagemapEntries, count * sizeof(uint64_t),
+                       offset);
+    if (rc != (ssize_t)(count * sizeof(uint64_t))) {
+      JTRACE("Failed to read /proc/self/pagemap; scanning all pages")
+        (JASSERT_ERRNO) (rc);
+      _real_close(pagemapFd);
+      pagemapFd = -1;
+      return i > 0 ? i * MTCP_PAGE_SIZE : len;
+    }
+    for (size_t j = 0; j < count; j++, i++) {
+      int absent = (pagemapEntries[j] & (PM_PRESENT | PM_SWAP)) == 0;
+      if (i == 0) {
+        *is_absent = absent;
+      } else if (absent != *is_absent) {
+        return i * MTCP_PAGE_SIZE;
       }
     }
   }
+  return len;
 }
 
+/* This function returns the length of a range of pages at addr, of at most
+ * len bytes, of a private file mapping that are all still the pages of the
+ * file (absent, or present in the page cache), or that are all private
+ * copies (written to, or swapped out).  Without pagemap, all pages are taken
+ * to be private copies.
+ */
+static size_t
+mtcp_get_file_page_range(VA addr, size_t len, int *is_file)
+{
+  size_t numPages = len / MTCP_PAGE_SIZE;
+  size_t i = 0;
+
+  *is_file = 0;
+  while (pagemapFd != -1 && i < numPages) {
+    size_t count = MIN(numPages - i, PAGEMAP_ENTRIES_PER_IO);
+    off_t offset = ((uintptr_t)addr / MTCP_PAGE_SIZE + i) * sizeof(uint64_t);
+    ssize_t rc = pread(pagemapFd, pagemapEntries, count * sizeof(uint64_t),
+                       offset);
+    if (rc != (ssize_t)(count * sizeof(uint64_t))) {
+      JTRACE("Failed to read /proc/self/pagemap; writing all pages")
+        (JASSERT_ERRNO) (rc);
+      _real_close(pagemapFd);
+      pagemapFd = -1;
+      return i > 0 ? i * MTCP_PAGE_SIZE : len;
+    }
+    for (size_t j = 0; j < count; j++, i++) {
+      uint64_t e = pagemapEntries[j];
+      int file = (e & PM_SWAP) == 0 &&
+                 ((e & PM_PRESENT) == 0 || (e & PM_FILE) != 0);
+      if (i == 0) {
+        *is_file = file;
+      } else if (file != *is_file) {
+        return i * MTCP_PAGE_SIZE;
+      }
+    }
+  }
+  return len;
+}
+
+/* This function returns the length of a range of zero or non-zero pages at
+ * addr, of at most len bytes. Ranges of absent pages are zero without being
+ * read. Otherwise, if the first ZERO_SCAN_SIZE bytes are non-zero, it
+ * searches for all contiguous non-zero pages. If they are all-zero, it
+ * searches for contiguous zero pages.
+ */
+static size_t
+mtcp_get_next_page_range(VA addr, size_t len, bool use_pagemap, int *is_zero)
+{
+  if (use_pagemap) {
+    len = mtcp_get_absent_page_range(addr, len, is_zero);
+    if (*is_zero) {
+      return len;
+    }
+  }
+
+  size_t size = MIN(len, ZERO_SCAN_SIZE);
+
+  *is_zero = Util::areZeroPages(addr, size / MTCP_PAGE_SIZE);
+  while (size < len) {
+    size_t n = MIN(len - size, ZERO_SCAN_SIZE);
+    if (*is_zero != Util::areZeroPages(addr + size, n / MTCP_PAGE_SIZE)) {
+      break;
+    }
+    size += n;
+  }
+  return size;
+}
+
+/* Write the area as one or more records, each with a list of runs.
+ *   allow_incremental: pages unchanged since the parent image become PARENT
+ *                      runs;
+ *   detect_zero:       zero pages become ZERO runs;
+ *   use_pagemap:       absent pages are zero pages (private anonymous
+ *                      areas only); the pages of ZERO runs are then also
+ *                      given back with MADV_DONTNEED, as they read back as
+ *                      zeroes only in such areas;
+ *   allow_dedup:       other pages go to the page deduplication store;
+ *   fileStat:          if not NULL, pages never written to become FILE
+ *                      runs (private file mappings only); fileStat is the
+ *                      stat() of the file that was mapped.
+ * A DEDUP run always ends its record, since the references to its chunks
+ * are only valid until the next call to CkptDedup::storeChunks().
+ */
 static void
-mtcp_write_non_rwx_and_anonymous_pages(int fd, Area *orig_area)
+write_area_runs(int fd,
+                Area *orig_area,
+                bool allow_incremental,
+                bool detect_zero,
+                bool use_pagemap,
+                bool allow_dedup,
+                const struct stat *fileStat)
 {
-  Area area = *orig_area;
+  VA addr = orig_area->addr;
+  VA endAddr = orig_area->addr + orig_area->size;
+
+  while (addr < endAddr) {
+    const CkptDedupRef *refs = NULL;
+    size_t numRuns = 0;
+    bool has_file = false;
+    Area a = *orig_area;
+    a.addr = addr;
+    a.offset = orig_area->offset + (addr - orig_area->addr);
+
+    while (addr < endAddr && numRuns < MTCP_AREA_MAX_RUNS && refs == NULL) {
+      size_t len = endAddr - addr;
+      bool in_parent = false;
+      int is_file = 0;
+      int is_zero = 0;
+      int type;
+
+      if (allow_incremental) {
+        len = CkptIncremental::pageRun(addr, len, &in_parent);
+      }
+      if (fileStat != NULL) {
+        len = mtcp_get_file_page_range(addr, len, &is_file);
+      }
+      if (in_parent) {
+        type = MTCP_AREA_RUN_PARENT;
+      } else if (is_file) {
+        type = MTCP_AREA_RUN_FILE;
+        has_file = true;
+      } else {
+        if (detect_zero) {
+          len = mtcp_get_next_page_range(addr, len, use_pagemap, &is_zero);
+        }
+        size_t stored = 0;
+        if (!is_zero && allow_dedup) {
+          stored = CkptDedup::storeChunks(addr, len, &refs);
+
+          // Once the store is not usable, the rest is written as usual.
+          allow_dedup = stored > 0;
+        }
+
+        if (is_zero) {
+          type = MTCP_AREA_RUN_ZERO;
+        } else if (stored > 0) {
+          type = MTCP_AREA_RUN_DEDUP;
+          len = stored;
+        } else {
+          type = MTCP_AREA_RUN_DATA;
+        }
+      }
 
+      if (numRuns > 0 && MTCP_AREA_RUN_TYPE(areaRuns[numRuns - 1]) == type &&
+          type != MTCP_AREA_RUN_DEDUP) {
+        areaRuns[numRuns - 1] += len;
+      } else {
+        areaRuns[numRuns++] = MTCP_AREA_RUN(type, len);
+      }
+      addr += len;
+    }
+
+    a.size = addr - a.addr;
+    a.endAddr = addr;
+    write_area_record(fd, &a, areaRuns, numRuns, has_file ? fileStat : NULL);
+
+    VA runAddr = a.addr;
+    for (size_t i = 0; i < numRuns; i++) {
+      size_t len = MTCP_AREA_RUN_LEN(areaRuns[i]);
+      switch (MTCP_AREA_RUN_TYPE(areaRuns[i])) {
+      case MTCP_AREA_RUN_DATA:
+        CkptSerializer::writeToImage(fd, runAddr, len);
+        imageOffset += len;
+        break;
+
+      case MTCP_AREA_RUN_ZERO:
+        if (use_pagemap && madvise(runAddr, len, MADV_DONTNEED) == -1) {
+          JNOTE("error doing madvise(..., MADV_DONTNEED)")
+            (JASSERT_ERRNO) ((void *)runAddr) (len);
+        }
+        break;
+
+      case MTCP_AREA_RUN_DEDUP:
+        CkptSerializer::writeToImage(fd, refs, CKPT_DEDUP_REFS_SIZE(len));
+        imageOffset += CKPT_DEDUP_REFS_SIZE(len);
+        break;
+      }
+      runAddr += len;
+    }
+  }
+}
+
+static void
+mtcp_write_non_rwx_and_anonymous_pages(int fd,
+                                       Area *orig_area,
+                                       bool allow_incremental,
+                                       bool use_pagemap)
+{
   /* Now give read permission to the anonymous/[heap]/[stack]/[stack:XXX] pages
    * that do not have read permission. We should remove the permission
    * as soon as we are done writing the area to the checkpoint image
@@ -377,7 +725,13 @@ mtcp_write_non_rwx_and_anonymous_pages(int fd, Area *orig_area)
   JASSERT(orig_area->name[0] == '\0' || (strcmp(orig_area->name,
                                                 "[heap]") == 0) ||
           (strcmp(orig_area->name, "[stack]") == 0) ||
-          (Util::strStartsWith(area.name, "[stack:XXX]")));
+          (Util::strStartsWith(orig_area->name, "[stack:XXX]")));
+
+  // Read-only tables are likely to be the same in all processes.
+  bool allow_dedup = (orig_area->prot & PROT_READ) != 0 &&
+                     (orig_area->prot & PROT_WRITE) == 0;
+  bool detect_zero =
+    !(dmtcp_infiniband_enabled && dmtcp_infiniband_enabled());
 
   if ((orig_area->prot & PROT_READ) == 0) {
     JASSERT(mprotect(orig_area->addr, orig_area->size,
@@ -386,32 +740,8 @@ mtcp_write_non_rwx_and_anonymous_pages(int fd, Area *orig_area)
     .Text("error adding PROT_READ to mem region");
   }
 
-  while (area.size > 0) {
-    size_t size;
-    int is_zero;
-    Area a = area;
-    if (dmtcp_infiniband_enabled && dmtcp_infiniband_enabled()) {
-      size = area.size;
-      is_zero = 0;
-    } else {
-      mtcp_get_next_page_range(&a, &size, &is_zero);
-    }
-
-    a.properties = is_zero ? DMTCP_ZERO_PAGE : 0;
-    a.size = size;
-
-    Util::writeAll(fd, &a, sizeof(a));
-    if (!is_zero) {
-      Util::writeAll(fd, a.addr, a.size);
-    } else {
-      if (madvise(a.addr, a.size, MADV_DONTNEED) == -1) {
-        JNOTE("error doing madvise(..., MADV_DONTNEED)")
-          (JASSERT_ERRNO) (a.addr) ((int)a.size);
-      }
-    }
-    area.addr += size;
-    area.size -= size;
-  }
+  write_area_runs(fd, orig_area, allow_incremental, detect_zero, use_pagemap,
+                  allow_dedup, NULL);
 
   /* Now remove the PROT_READ from the area if it didn't have it originally
   */
@@ -423,7 +753,12 @@ mtcp_write_non_rwx_and_anonymous_pages(int fd, Area *orig_area)
 }
 
 static void
-writememoryarea(int fd, Area *area, int stack_was_seen)
+writememoryarea(int fd,
+                Area *area,
+                int stack_was_seen,
+                bool allow_incremental,
+                bool use_pagemap,
+                const struct stat *fileStat)
 {
   void *addr = area->addr;
 
@@ -460,7 +795,8 @@ writememoryarea(int fd, Area *area, int stack_was_seen)
      * Currently, we detect zero pages in non-rwx mapping and anonymous
      * mappings only
      */
-    mtcp_write_non_rwx_and_anonymous_pages(fd, area);
+    mtcp_write_non_rwx_and_anonymous_pages(fd, area, allow_incremental,
+                                           use_pagemap);
   } else {
     /* Anonymous sections need to have their data copied to the file,
      *   as there is no file that contains their data
@@ -471,11 +807,10 @@ writememoryarea(int fd, Area *area, int stack_was_seen)
 
     if (skipWritingTextSegments && (area->prot & PROT_EXEC)) {
       area->properties |= DMTCP_SKIP_WRITING_TEXT_SEGMENTS;
-      Util::writeAll(fd, area, sizeof(*area));
+      write_area_record(fd, area, NULL, 0);
       JTRACE("Skipping over text segments") (area->name) ((void *)area->addr);
     } else {
-      Util::writeAll(fd, area, sizeof(*area));
-      Util::writeAll(fd, area->addr, area->size);
+      write_area_runs(fd, area, false, false, false, true, fileStat);
     }
   }
 }
@@ -375,6 +375,9 @@ def WAITFOR(test, msg):
     left-=1
     sleep(INTERVAL)
 
+#the other KEY=VALUE lines of the last status of the coordinator
+statusFields = {}
+
 #extract (NUM_PEERS, RUNNING) from coordinator
 def getStatus():
   coordinatorCmd('s')
@@ -398,6 +401,11 @@ def getStatus():
         peers = int(m.group(1))
         continue
 
+      m = re.match('([A-Z_]+)=(\S*)$', line)
+      if m != None and m.group(1) != 'RUNNING':
+        statusFields[m.group(1)] = m.group(2)
+        continue
+
       m = re.search('RUNNING=(\w+)', line)
       if m != None:
         running = m.group(1)
@@ -444,7 +452,9 @@ def getNumCkptFiles(dir):
 
 # Test a given list of commands to see if they checkpoint
 # runTest() sets up a keyboard interrupt handler, and then calls this function.
-def runTestRaw(name, numProcs, cmds):
+# afterCkpt() and afterRestart(), if given, check the effects of the feature
+# under test once the processes have checkpointed or restarted.
+def runTestRaw(name, numProcs, cmds, afterCkpt=None, afterRestart=None):
   #the expected/correct running status
 #  if USE_M32:
 #    def forall(fnc, lst):
@@ -531,6 +541,9 @@ def runTestRaw(name, numProcs, cmds):
       CHECK(doesStatusSatisfy(getStatus(), status),
             "error: processes checkpointed, but died upon resume")
 
+    if afterCkpt:
+      afterCkpt()
+
   def testRestart():
     #build restart command
     cmd=BIN+"dmtcp_restart --quiet"
@@ -546,6 +559,8 @@ def runTestRaw(name, numProcs, cmds):
       sleep(S*SLOW)
       CHECK(doesStatusSatisfy(getStatus(), status),
             "error:  processes restarted and then died")
+    if afterRestart:
+      afterRestart()
     if HBICT_DELTACOMP == "no":
       clearCkptDir()
 
@@ -652,10 +667,10 @@ def getProcessChildren(pid):
     return [int(pid) for pid in stdout.split()]
 
 # If the user types ^C, then kill all child processes.
-def runTest(name, numProcs, cmds):
+def runTest(name, numProcs, cmds, afterCkpt=None, afterRestart=None):
   for i in range(2):
     try:
-      runTestRaw(name, numProcs, cmds)
+      runTestRaw(name, numProcs, cmds, afterCkpt, afterRestart)
       break;
     except KeyboardInterrupt:
       for pid in getProcessChildren(os.getpid()):
@@ -912,6 +927,277 @@ os.environ['DMTCP_GZIP'] = "1"
 runTest("gzip",          1, ["./test/dmtcp1"])
 os.environ['DMTCP_GZIP'] = GZIP
 
+os.environ['DMTCP_PARALLEL_COMPRESSION'] = "4"
+runTest("parallel-compression", 1, ["./test/dmtcp1"])
+del os.environ['DMTCP_PARALLEL_COMPRESSION']
+
+os.environ['DMTCP_INCREMENTAL_CKPT'] = "3"
+runTest("incremental-ckpt", 1, ["./test/dmtcp1"])
+del os.environ['DMTCP_INCREMENTAL_CKPT']
+
+os.environ['DMTCP_DEDUP_DIR'] = os.path.abspath(ckptDir) + "/dedup"
+runTest("dedup", 2, ["./test/dmtcp1", "./test/dmtcp1"])
+del os.environ['DMTCP_DEDUP_DIR']
+
+os.environ['DMTCP_PARALLEL_WRITE'] = "4"
+runTest("parallel-write", 1, ["./test/dmtcp1"])
+# The checkpoint thread changes the heap while it is being written.
+runTest("parallel-write-heap", 1, ["./test/heap-churn"])
+del os.environ['DMTCP_PARALLEL_WRITE']
+
+os.environ['DMTCP_CKPT_OUTPUT'] = "uring-direct"
+runTest("ckpt-output", 1, ["./test/dmtcp1"])
+del os.environ['DMTCP_CKPT_OUTPUT']
+
+os.environ['DMTCP_FORKED_CHECKPOINT'] = "1"
+runTest("forked-ckpt", 1, ["./test/dmtcp1"])
+del os.environ['DMTCP_FORKED_CHECKPOINT']
+
+# The images are drained from the staging directory into ckptDir; the
+# drainers leave their lock file behind.
+stagingDir = os.path.abspath(ckptDir) + "/staging"
+
+def checkImagesDrained():
+  def staged():
+    return filter(lambda f: f.startswith("ckpt_"), os.listdir(stagingDir))
+  CHECK(os.path.exists(stagingDir + "/.dmtcp_drain.lock"),
+        "images were not drained from the staging directory")
+  WAITFOR(lambda: staged() == [],
+          lambda: "images left in the staging directory: " + str(staged()))
+
+os.environ['DMTCP_CKPT_STAGING_DIR'] = stagingDir
+runTest("staging-dir", 2, ["./test/dmtcp1", "./test/dmtcp1"],
+        afterCkpt=checkImagesDrained)
+os.environ['DMTCP_FORKED_CHECKPOINT'] = "1"
+runTest("staging-dir-forked", 1, ["./test/dmtcp1"],
+        afterCkpt=checkImagesDrained)
+del os.environ['DMTCP_FORKED_CHECKPOINT']
+del os.environ['DMTCP_CKPT_STAGING_DIR']
+
+# Live migration to a dmtcp_restart on this host: the launched process exits,
+# and the one restarted from the streamed images takes its place, without
+# any image in the checkpoint directory.  Both ends get the cookie through
+# DMTCP_MIGRATE_COOKIE.
+def runMigrationTest(name, cmd):
+  printFixed(name,15)
+  if not shouldRunTest(name):
+    print "SKIPPED"
+    return
+  procs = []
+  try:
+    stats[1]+=1
+    CHECK(getStatus()==(0, False), "coordinator initial state")
+    target = "127.0.0.1:" + str(randint(10001,20000))
+    procs.append(runCmd(BIN+"dmtcp_launch "+cmd))
+    WAITFOR(lambda: getStatus()==(1, True),
+            lambda: "user program startup error")
+    sleep(S*SLOW)
+    os.environ['DMTCP_MIGRATE_COOKIE'] = "%x" % randint(1, 2**64)
+    procs.append(runCmd(BIN+"dmtcp_restart --quiet --ckptdir "+ckptDir+
+                        " --migrate-listen "+target))
+    sleep(S*SLOW)
+    CHECK(subprocess.call([BIN+"dmtcp_command", "--migrate", target],
+                          stdout=devnullFd, stderr=devnullFd) == 0,
+          "dmtcp_command --migrate failed")
+    WAITFOR(lambda: procs[0].poll() != None and getStatus()==(1, True),
+            lambda: "migration error, running=%d" % getStatus()[1])
+    CHECK(getNumCkptFiles(ckptDir) == 0,
+          "checkpoint images written by a migration")
+    printFixed("PASSED")
+    coordinatorCmd('k')
+    WAITFOR(lambda: getStatus()==(0, False),
+            lambda: "coordinator kill command failed")
+    print
+    stats[0]+=1
+  except CheckFailed, e:
+    print "FAILED"
+    printFixed("",15)
+    print "root-pids:", map(lambda x: x.pid, procs), "msg:", e.value
+    coordinatorCmd('k')
+    WAITFOR(lambda: getStatus()==(0, False),
+            lambda: "coordinator kill command failed")
+  if 'DMTCP_MIGRATE_COOKIE' in os.environ:
+    del os.environ['DMTCP_MIGRATE_COOKIE']
+  for x in procs:
+    if x.poll() == None:
+      os.kill(x.pid, signal.SIGKILL)
+    x.wait()
+  clearCkptDir()
+
+runMigrationTest("migrate", "./test/dmtcp1")
+
+# The barriers of both processes go through a relay, and then through the
+# relay chained to it.
+def checkPeersViaRelay(n):
+  def check():
+    getStatus()
+    CHECK(statusFields.get('PEERS_VIA_RELAY') == str(n),
+          "%d processes expected to reach the barriers through a relay, "
+          "%s found" % (n, statusFields.get('PEERS_VIA_RELAY')))
+  return check
+
+relayPort = int(os.environ['DMTCP_COORD_PORT']) + 1
+relay = runCmd(BIN+"dmtcp_coordinator -q --coord-port %d --relay-to localhost:%s"
+               % (relayPort, os.environ['DMTCP_COORD_PORT']))
+relay2 = runCmd(BIN+"dmtcp_coordinator -q --coord-port %d --relay-to localhost:%d"
+                % (relayPort + 1, relayPort))
+os.environ['DMTCP_BARRIER_RELAY'] = "localhost:" + str(relayPort)
+runTest("barrier-relay", 2, ["./test/dmtcp1", "./test/dmtcp1"],
+        afterCkpt=checkPeersViaRelay(2))
+os.environ['DMTCP_BARRIER_RELAY'] = "localhost:" + str(relayPort + 1)
+runTest("barrier-relay-chain", 2, ["./test/dmtcp1", "./test/dmtcp1"],
+        afterCkpt=checkPeersViaRelay(2))
+os.environ['DMTCP_NODE_BARRIERS'] = "1"
+runTest("node-barriers-relay", 3,
+        ["./test/dmtcp1", "./test/dmtcp1", "./test/dmtcp1"],
+        afterCkpt=checkPeersViaRelay(3))
+del os.environ['DMTCP_BARRIER_RELAY']
+# The leader of the node reports the other two processes.
+runTest("node-barriers", 3,
+        ["./test/dmtcp1", "./test/dmtcp1", "./test/dmtcp1"],
+        afterCkpt=checkPeersViaRelay(2))
+del os.environ['DMTCP_NODE_BARRIERS']
+relay2.kill()
+relay.kill()
+relay2.wait()
+relay.wait()
+
+# Lazy and mmap restart, and the index checked by --verify, need an
+# uncompressed image.
+os.environ['DMTCP_GZIP'] = "0"
+os.environ['DMTCP_LAZY_RESTART'] = "1"
+runTest("lazy-restart", 1, ["./test/dmtcp1"])
+del os.environ['DMTCP_LAZY_RESTART']
+os.environ['DMTCP_MMAP_RESTART'] = "1"
+runTest("mmap-restart", 1, ["./test/dmtcp1"])
+del os.environ['DMTCP_MMAP_RESTART']
+
+# dmtcp_image and dmtcp_restart --verify accept the images just written,
+# whose index is checked against their areas, and --verify rejects a
+# truncated copy and a copy with one byte flipped; the copies are kept out
+# of the top level of ckptDir, whose images are restarted.
+def restartCheckRc(option, image):
+  return subprocess.call([BIN+"dmtcp_restart", option, image],
+                         stdout=devnullFd, stderr=devnullFd)
+
+def checkVerifyImages():
+  images = [f for f in os.listdir(ckptDir) if f.endswith(".dmtcp")]
+  CHECK(len(images) > 0, "no checkpoint images found")
+  for image in images:
+    path = os.path.join(ckptDir, image)
+    for cmd in ["list", "verify"]:
+      CHECK(subprocess.call([BIN+"dmtcp_image", cmd, path],
+                            stdout=devnullFd, stderr=devnullFd) == 0,
+            "dmtcp_image %s fails on the image %s" % (cmd, image))
+    CHECK(restartCheckRc("--verify", path) == 0,
+          "dmtcp_restart --verify rejects the image " + image)
+  image = os.path.join(ckptDir, images[0])
+  CHECK(restartCheckRc("--simulate", image) == 0,
+        "dmtcp_restart --simulate rejects the image " + images[0])
+
+  damagedDir = os.path.join(ckptDir, "damaged")
+  os.mkdir(damagedDir)
+  data = open(image, "rb").read()
+  truncated = os.path.join(damagedDir, "truncated.dmtcp")
+  open(truncated, "wb").write(data[:len(data)/2])
+  flipped = os.path.join(damagedDir, "flipped.dmtcp")
+  middle = len(data)/2
+  open(flipped, "wb").write(data[:middle] + chr(ord(data[middle]) ^ 0xff) +
+                            data[middle+1:])
+  CHECK(restartCheckRc("--verify", truncated) != 0,
+        "dmtcp_restart --verify accepts a truncated image")
+  CHECK(restartCheckRc("--verify", flipped) != 0,
+        "dmtcp_restart --verify accepts an image with a byte flipped")
+  os.remove(truncated)
+  os.remove(flipped)
+  os.rmdir(damagedDir)
+
+runTest("verify-image", 1, ["./test/dmtcp1"], afterCkpt=checkVerifyImages)
+# The image goes through the staging buffers of the writer threads.
+os.environ['DMTCP_PARALLEL_WRITE'] = "4"
+runTest("verify-image-parallel-write", 1, ["./test/heap-churn"],
+        afterCkpt=checkVerifyImages)
+del os.environ['DMTCP_PARALLEL_WRITE']
+os.environ['DMTCP_GZIP'] = GZIP
+
+# Images are prefetched by default only if there are several of them.
+os.environ['DMTCP_RESTART_PREFETCH_THREADS'] = "2"
+runTest("prefetch-restart", 1, ["./test/dmtcp1"])
+del os.environ['DMTCP_RESTART_PREFETCH_THREADS']
+
+os.environ['DMTCP_SKIP_UNMODIFIED_FILE_PAGES'] = "1"
+runTest("skip-file-pages", 1, ["./test/dmtcp1"])
+del os.environ['DMTCP_SKIP_UNMODIFIED_FILE_PAGES']
+
+# Checkpointed copies of files are made concurrently by default.  The copy
+# of a file that did not change since the previous checkpoint is reused;
+# files on tmpfs are always copied.
+fileUnchangedPath = os.path.abspath("dmtcp-autotest-file-unchanged.%d"
+                                    % os.getpid())
+f = open(fileUnchangedPath, "wb")
+f.write(os.urandom(1024*1024))
+f.close()
+fileUnchangedOnTmpfs = subprocess.Popen(["stat", "-f", "-c", "%T",
+                                         fileUnchangedPath],
+                                        stdout=subprocess.PIPE
+                                       ).communicate()[0].strip() == "tmpfs"
+
+def checkpointUnchangedFile():
+  prefix = os.path.basename(fileUnchangedPath) + "_"
+  copies = [os.path.join(root, f) for root, dirs, files in os.walk(ckptDir)
+                                  for f in files if f.startswith(prefix)]
+  CHECK(len(copies) == 1, "%d checkpointed copies of the file" % len(copies))
+  CHECK(open(copies[0], "rb").read() == open(fileUnchangedPath, "rb").read(),
+        "checkpointed copy differs from the file")
+  before = os.stat(copies[0])
+  sleep(S*SLOW)
+  CHECK(subprocess.call([BIN+"dmtcp_command", "--bcheckpoint"],
+                        stdout=devnullFd, stderr=devnullFd) == 0,
+        "second checkpoint failed")
+  after = os.stat(copies[0])
+  CHECK(fileUnchangedOnTmpfs or
+        (after.st_ino == before.st_ino and after.st_mtime == before.st_mtime),
+        "unchanged file was copied again")
+
+os.environ['DMTCP_CKPT_FILES_COPY_THREADS'] = "1"
+runTest("file2-serial-copy", 1, ["./test/file2"])
+os.environ['DMTCP_CKPT_OPEN_FILES'] = "1"
+runTest("file-unchanged", 1, ["./test/file-unchanged " + fileUnchangedPath],
+        afterCkpt=checkpointUnchangedFile)
+del os.environ['DMTCP_CKPT_OPEN_FILES']
+del os.environ['DMTCP_CKPT_FILES_COPY_THREADS']
+os.remove(fileUnchangedPath)
+
+# The file is checkpointed twice before each restart: the second checkpoint
+# saves a delta of the changed blocks, and the restart rebuilds the file
+# from the first copy and the delta.
+fileDeltaPath = os.path.abspath("dmtcp-autotest-file-delta.%d" % os.getpid())
+
+def checkpointFileDelta():
+  sleep(S*SLOW)
+  CHECK(subprocess.call([BIN+"dmtcp_command", "--bcheckpoint"],
+                        stdout=devnullFd, stderr=devnullFd) == 0,
+        "second checkpoint failed")
+  deltas = [f for root, dirs, files in os.walk(ckptDir)
+              for f in files if f.endswith(".delta")]
+  CHECK(len(deltas) == 1, "%d deltas of the file found" % len(deltas))
+
+def checkFileRestored():
+  # The program aborts if the restored file differs from its copy in memory.
+  sleep(S*SLOW)
+  CHECK(getStatus() == (1, True), "restored file has the wrong contents")
+
+os.environ['DMTCP_CKPT_OPEN_FILES'] = "1"
+os.environ['DMTCP_CKPT_FILES_DELTA'] = "1"
+os.environ['DMTCP_ALLOW_OVERWRITE_WITH_CKPTED_FILES'] = "1"
+runTest("file-delta", 1, ["./test/file-delta " + fileDeltaPath],
+        afterCkpt=checkpointFileDelta, afterRestart=checkFileRestored)
+del os.environ['DMTCP_ALLOW_OVERWRITE_WITH_CKPTED_FILES']
+del os.environ['DMTCP_CKPT_FILES_DELTA']
+del os.environ['DMTCP_CKPT_OPEN_FILES']
+if os.path.exists(fileDeltaPath):
+  os.remove(fileDeltaPath)
+
 if HAS_READLINE == "yes":
   runTest("readline",    1,  ["./test/readline"])
 
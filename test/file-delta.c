@@ -0,0 +1,74 @@
+/* Keeps rewriting a few blocks of a 4 MB file, and checks the whole file
+ * against a copy in memory after each write.  Run with
+ * DMTCP_CKPT_OPEN_FILES and DMTCP_CKPT_FILES_DELTA, a checkpoint after the
+ * first one saves only the changed blocks of the file; a restart that
+ * overwrites the file with its checkpointed copy must then rebuild it from
+ * the first copy and that delta.
+ *
+ * Usage: file-delta FILE
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BLOCK_SIZE     (64 * 1024)
+#define NUM_BLOCKS     64
+#define CHANGED_BLOCKS 16
+#define FILE_SIZE      (BLOCK_SIZE * NUM_BLOCKS)
+
+static char expected[FILE_SIZE];
+static char actual[FILE_SIZE];
+
+int
+main(int argc, char *argv[])
+{
+  long count = 0;
+  int fd;
+
+  if (argc != 2) {
+    fprintf(stderr, "Usage: %s FILE\n", argv[0]);
+    return 1;
+  }
+
+  fd = open(argv[1], O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (fd == -1) {
+    perror("open");
+    return 1;
+  }
+  memset(expected, 'a', sizeof(expected));
+  if (pwrite(fd, expected, sizeof(expected), 0) != sizeof(expected)) {
+    perror("pwrite");
+    return 1;
+  }
+
+  while (1) {
+    // A quarter of the file at most changes between two checkpoints.
+    int block = (count * 7) % CHANGED_BLOCKS;
+    char *p = expected + block * BLOCK_SIZE;
+
+    memset(p, 'b' + count % 24, BLOCK_SIZE);
+    if (pwrite(fd, p, BLOCK_SIZE, block * BLOCK_SIZE) != BLOCK_SIZE) {
+      perror("pwrite");
+      abort();
+    }
+
+    if (pread(fd, actual, sizeof(actual), 0) != sizeof(actual)) {
+      perror("pread");
+      abort();
+    }
+    if (memcmp(actual, expected, sizeof(actual)) != 0) {
+      fprintf(stderr, "%s does not have the expected contents\n", argv[1]);
+      abort();
+    }
+
+    if (++count % 10 == 0) {
+      printf("%ld ", count);
+      fflush(stdout);
+    }
+    usleep(100000);
+  }
+  return 0;
+}
@@ -0,0 +1,52 @@
+/* Keeps a file open for reading and checks every 100 ms that it still
+ * starts with what it started with.  Run with DMTCP_CKPT_OPEN_FILES, the
+ * checkpointed copy of the file made by one checkpoint is reused by the
+ * next one, as the file does not change.
+ *
+ * Usage: file-unchanged FILE
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+int
+main(int argc, char *argv[])
+{
+  char first[4096];
+  char buf[4096];
+  ssize_t len;
+  long count = 0;
+  int fd;
+
+  if (argc != 2) {
+    fprintf(stderr, "Usage: %s FILE\n", argv[0]);
+    return 1;
+  }
+
+  fd = open(argv[1], O_RDONLY);
+  if (fd == -1) {
+    perror("open");
+    return 1;
+  }
+  len = pread(fd, first, sizeof(first), 0);
+  if (len <= 0) {
+    fprintf(stderr, "%s is empty\n", argv[1]);
+    return 1;
+  }
+
+  while (1) {
+    if (pread(fd, buf, len, 0) != len || memcmp(buf, first, len) != 0) {
+      fprintf(stderr, "%s changed\n", argv[1]);
+      abort();
+    }
+    if (++count % 10 == 0) {
+      printf("%ld ", count);
+      fflush(stdout);
+    }
+    usleep(100000);
+  }
+  return 0;
+}
@@ -0,0 +1,103 @@
+/* Compile with:  gcc THIS_FILE -lpthread */
+
+/* Several threads keep freeing and reallocating blocks of up to 1 MB, and
+ * check the contents of each block before freeing it.  All threads, the
+ * checkpoint thread of DMTCP included, share a single malloc arena on the
+ * heap, so anything the checkpoint thread allocates or frees while the
+ * image is being written changes pages of the heap that were already
+ * handed to the writer.
+ */
+
+#include <malloc.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define NUM_THREADS       4
+#define BLOCKS_PER_THREAD 16
+#define MAX_BLOCK_WORDS   (1024 * 1024 / sizeof(long))
+
+typedef struct Block {
+  size_t numWords;
+  long seed;
+  long words[];
+} Block;
+
+static Block *
+newBlock(unsigned int *rand_state)
+{
+  size_t numWords = 1 + rand_r(rand_state) % MAX_BLOCK_WORDS;
+  Block *b = malloc(sizeof(Block) + numWords * sizeof(long));
+  size_t i;
+
+  if (b == NULL) {
+    perror("malloc");
+    exit(1);
+  }
+  b->numWords = numWords;
+  b->seed = rand_r(rand_state);
+  for (i = 0; i < numWords; i++) {
+    b->words[i] = b->seed + i;
+  }
+  return b;
+}
+
+static void
+checkBlock(Block *b)
+{
+  size_t i;
+
+  for (i = 0; i < b->numWords; i++) {
+    if (b->words[i] != b->seed + (long)i) {
+      fprintf(stderr, "block %p: word %zu is %ld, expected %ld\n",
+              (void *)b, i, b->words[i], b->seed + (long)i);
+      abort();
+    }
+  }
+}
+
+static void *
+threadMain(void *arg)
+{
+  unsigned int rand_state = (unsigned int)(long)arg;
+  Block *blocks[BLOCKS_PER_THREAD];
+  long count = 0;
+  int i;
+
+  for (i = 0; i < BLOCKS_PER_THREAD; i++) {
+    blocks[i] = newBlock(&rand_state);
+  }
+  while (1) {
+    i = rand_r(&rand_state) % BLOCKS_PER_THREAD;
+    checkBlock(blocks[i]);
+    free(blocks[i]);
+    blocks[i] = newBlock(&rand_state);
+    if (++count % 1000 == 0) {
+      printf("thread %ld: %ld\n", (long)arg, count);
+      fflush(stdout);
+    }
+  }
+  return NULL;
+}
+
+int
+main()
+{
+  pthread_t threads[NUM_THREADS];
+  long i;
+
+  // One arena, and no block is given its own mmap().
+  mallopt(M_ARENA_MAX, 1);
+  mallopt(M_MMAP_THRESHOLD, 4 * 1024 * 1024);
+
+  for (i = 1; i < NUM_THREADS; i++) {
+    if (pthread_create(&threads[i], NULL, threadMain, (void *)i) != 0) {
+      perror("pthread_create");
+      return 1;
+    }
+  }
+  threadMain((void *)0);
+  return 0;
+}